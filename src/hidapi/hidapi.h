@@ -42,11 +42,30 @@
 #define HID_API_EXPORT_CALL HID_API_EXPORT HID_API_CALL /**< API export and call macro*/
 //#define HID_API_EXPORT_CALL
 
+/** Maximum size of a HID report descriptor, as defined by the
+    hidraw interface (HID_MAX_DESCRIPTOR_SIZE). */
+#define HID_API_MAX_REPORT_DESCRIPTOR_SIZE 4096
+
+/** Flag for hid_enumerate_ex(): leave the serial number, manufacturer and
+    product strings and the usage out of the returned records. Use
+    hid_enumerate_fill_strings() to fetch them for a single record. */
+#define HID_ENUMERATE_NO_STRINGS 0x1
+
+/** Flag for hid_enumerate_ex(): on the Linux hidraw backend, scan
+    /sys/class/hidraw directly instead of going through libudev. The
+    device node is assumed to be /dev/<hidraw name>. Ignored by the
+    other backends. */
+#define HID_ENUMERATE_SYSFS 0x2
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 		struct hid_device_;
 		typedef struct hid_device_ hid_device; /**< opaque hidapi structure */
+		struct hid_context_;
+		typedef struct hid_context_ hid_context; /**< opaque hidapi context */
+		struct hid_wake_event_;
+		typedef struct hid_wake_event_ hid_wake_event; /**< opaque event which ends a hid_wait_any_event() */
 
 		/** hidapi info structure */
 		struct hid_device_info {
@@ -81,6 +100,76 @@ extern "C" {
 			struct hid_device_info *next;
 		};
 
+		/** Number of buckets of the latency histograms of struct
+		    #hid_device_stats. */
+		#define HID_STATS_LATENCY_BUCKETS 32
+
+		/** Runtime statistics of an open device, see
+		    hid_get_device_stats(). */
+		struct hid_device_stats {
+			/** Input reports returned by the read functions */
+			unsigned long long reports_read;
+			/** Bytes of the Input reports returned */
+			unsigned long long bytes_read;
+			/** Output reports written with hid_write() */
+			unsigned long long reports_written;
+			/** Bytes of the Output reports written */
+			unsigned long long bytes_written;
+			/** Input reports dropped because the queue was full */
+			unsigned long long reports_dropped;
+			/** Timed or blocking reads which returned no report */
+			unsigned long long read_timeouts;
+			/** Reads which failed */
+			unsigned long long read_errors;
+			/** Writes which failed */
+			unsigned long long write_errors;
+			/** The longest the Input report queue has been */
+			unsigned long long queue_high_water;
+			/** Input reports not delivered because they did not
+			    change, see hid_set_change_filter() */
+			unsigned long long reports_suppressed;
+			/** Time from the arrival of an Input report to its
+			    delivery to the reader. Bucket i counts the times
+			    of 2^i to 2^(i+1) - 1 nanoseconds, bucket 0 also
+			    counts 0 and the last bucket everything longer. */
+			unsigned long long read_latency[HID_STATS_LATENCY_BUCKETS];
+			/** Time from the submission of an Output report to
+			    its completion, bucketed as read_latency. */
+			unsigned long long write_latency[HID_STATS_LATENCY_BUCKETS];
+		};
+
+		/** Bus types for hid_enumeration_filter::bus_type. The
+		    values are those of linux/input.h. */
+		#define HID_BUS_ANY       0x00
+		#define HID_BUS_USB       0x03
+		#define HID_BUS_BLUETOOTH 0x05
+
+		/** Criteria for hid_enumerate_filter(). Zero values (and -1
+		    for the interface number, NULL for the serial number)
+		    match anything, so a zeroed filter with interface_number
+		    set to -1 returns every device. */
+		struct hid_enumeration_filter {
+			/** Vendor ID, or 0 for any */
+			unsigned short vendor_id;
+			/** Product ID, or 0 for any */
+			unsigned short product_id;
+			/** USB interface number, or -1 for any */
+			int interface_number;
+			/** Usage Page, or 0 for any. Only applied where the
+			    backend can read the usage, see
+			    hid_enumerate_filter(). */
+			unsigned short usage_page;
+			/** Usage, or 0 for any */
+			unsigned short usage;
+			/** One of the HID_BUS_* values */
+			int bus_type;
+			/** UTF-8 fnmatch() pattern the serial number must
+			    match, or NULL for any */
+			const char *serial_number;
+			/** A combination of the HID_ENUMERATE_* flags */
+			unsigned int flags;
+		};
+
 
 		/** @brief Initialize the HIDAPI library.
 
@@ -90,6 +179,13 @@ extern "C" {
 			needed.  This function should be called at the beginning of
 			execution however, if there is a chance of HIDAPI handles
 			being opened by different threads simultaneously.
+
+			The library is reference counted: every successful call
+			takes a reference which is dropped by hid_exit(), and the
+			library is only finalized when the last one is dropped. An
+			automatic initialization takes a reference only if there
+			is none, so a single hid_exit() still finalizes a library
+			which was never initialized explicitly.
 			
 			@ingroup API
 
@@ -100,9 +196,11 @@ extern "C" {
 
 		/** @brief Finalize the HIDAPI library.
 
-			This function frees all of the static data associated with
-			HIDAPI. It should be called at the end of execution to avoid
-			memory leaks.
+			This function drops a reference taken by hid_init(). Once
+			the last one has gone all of the static data associated
+			with HIDAPI is freed. It should be called at the end of
+			execution to avoid memory leaks. Devices opened through
+			the shared context must be closed first.
 
 			@ingroup API
 
@@ -144,6 +242,99 @@ extern "C" {
 		*/
 		void  HID_API_EXPORT HID_API_CALL hid_free_enumeration(struct hid_device_info *devs);
 
+		/** @brief Enumerate the HID Devices, with options.
+
+			This function works like hid_enumerate(), but takes a set
+			of flags which control how much work is done per device.
+
+			With #HID_ENUMERATE_NO_STRINGS only the information which
+			can be read without opening the devices is returned: the
+			path, VID/PID, release number and interface number. On
+			libusb this avoids opening every HID device and issuing
+			several control transfers per string. The string fields
+			of the returned records are NULL.
+
+			@ingroup API
+			@param vendor_id The Vendor ID (VID) of the types of device
+				to open.
+			@param product_id The Product ID (PID) of the types of
+				device to open.
+			@param flags A combination of the HID_ENUMERATE_* flags, or 0.
+
+		    @returns
+		    	This function returns a pointer to a linked list of type
+		    	struct #hid_device_info, or NULL in the case of failure.
+		    	Free this linked list by calling hid_free_enumeration().
+		*/
+		struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate_ex(unsigned short vendor_id, unsigned short product_id, unsigned int flags);
+
+		/** @brief Fetch the strings and usage of one enumerated device.
+
+			Fills in the serial number, manufacturer and product
+			strings, and the usage where the platform supports it, of
+			a record returned by hid_enumerate_ex() with
+			#HID_ENUMERATE_NO_STRINGS. Only fields which are still NULL
+			are filled in. The device is located by its path.
+
+			@ingroup API
+			@param info The record to fill in. Only the path needs to be
+				set.
+
+		    @returns
+		    	This function returns 0 on success and -1 if the device
+		    	could not be found or opened.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_enumerate_fill_strings(struct hid_device_info *info);
+
+		/** @brief Enumerate the HID Devices matching a filter.
+
+			The criteria of the filter are checked by the backend as
+			early as it can, so that devices which do not match are
+			dropped before their strings are converted, their
+			descriptors are read or they are opened. The libusb
+			backend only opens a device to check the serial number
+			pattern once everything else matches.
+
+			The usage criteria need the report descriptor. The hidraw
+			backend reads it from sysfs, the libusb backend only
+			applies them when built with INVASIVE_GET_USAGE and
+			ignores them otherwise.
+
+			@ingroup API
+			@param filter The criteria to match.
+
+		    @returns
+		    	This function returns a pointer to a linked list of type
+		    	struct #hid_device_info, or NULL in the case of failure
+		    	or if no device matches. Free this linked list by calling
+		    	hid_free_enumeration().
+		*/
+		struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate_filter(const struct hid_enumeration_filter *filter);
+
+		/** @brief Get the physical location of a device.
+
+			Writes a string which identifies where the device with
+			the given path is plugged in, for example the chain of
+			USB ports it hangs off. The string stays the same for a
+			device which is unplugged and plugged back into the same
+			port, even if its path changes. The device is not opened.
+
+			On Linux this is the sysfs path of the USB interface of
+			the device. Devices on other buses get the sysfs path of
+			their HID device, which may change when they reconnect.
+
+			@ingroup API
+			@param path The path of the device, as returned in
+				hid_device_info.
+			@param buf A buffer to put the location into.
+			@param buf_size The size of the buffer in bytes.
+
+			@returns
+				This function returns the length of the location on
+				success and -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_get_location(const char *path, char *buf, size_t buf_size);
+
 		/** @brief Open a HID device using a Vendor ID (VID), Product ID
 			(PID) and optionally a serial number.
 
@@ -177,6 +368,103 @@ extern "C" {
 		*/
 		HID_API_EXPORT hid_device * HID_API_CALL hid_open_path(const char *path);
 
+		/** @brief Create a private HIDAPI context.
+
+			Devices enumerated and opened through a private context
+			do not share any backend state with the rest of the
+			process. On libusb the context owns its own
+			libusb_context, so its devices run their event handling
+			independently of those of the shared context and of other
+			private contexts. On hidraw there is no such state and a
+			context behaves like the shared one.
+
+			A private context does not need hid_init(), and is not
+			affected by hid_exit().
+
+			@ingroup API
+
+			@returns
+				This function returns a new context, or NULL on
+				failure. Free it with hid_context_free().
+		*/
+		HID_API_EXPORT hid_context * HID_API_CALL hid_context_new(void);
+
+		/** @brief Free a private HIDAPI context.
+
+			Every device opened through the context must have been
+			closed first.
+
+			@ingroup API
+			@param ctx The context, as returned by hid_context_new().
+		*/
+		void HID_API_EXPORT HID_API_CALL hid_context_free(hid_context *ctx);
+
+		/** @brief Enumerate the HID Devices matching a filter through a context.
+
+			Works like hid_enumerate_filter(), using the context @p
+			ctx, or the shared context if @p ctx is NULL.
+
+			@ingroup API
+			@param ctx The context, or NULL.
+			@param filter The criteria to match.
+
+		    @returns
+		    	This function returns a pointer to a linked list of type
+		    	struct #hid_device_info, or NULL in the case of failure
+		    	or if no device matches. Free this linked list by calling
+		    	hid_free_enumeration().
+		*/
+		struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate_context(hid_context *ctx, const struct hid_enumeration_filter *filter);
+
+		/** @brief Fetch the strings and usage of one enumerated device through a context.
+
+			Works like hid_enumerate_fill_strings(), using the
+			context @p ctx, or the shared context if @p ctx is NULL.
+
+			@ingroup API
+			@param ctx The context, or NULL.
+			@param info The record to fill in.
+
+		    @returns
+		    	This function returns 0 on success and -1 if the device
+		    	could not be found or opened.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_enumerate_fill_strings_context(hid_context *ctx, struct hid_device_info *info);
+
+		/** @brief Open a HID device using a Vendor ID (VID), Product ID
+			(PID) and optionally a serial number, through a context.
+
+			Works like hid_open(), using the context @p ctx, or the
+			shared context if @p ctx is NULL.
+
+			@ingroup API
+			@param ctx The context, or NULL.
+			@param vendor_id The Vendor ID (VID) of the device to open.
+			@param product_id The Product ID (PID) of the device to open.
+			@param serial_number The Serial Number of the device to open
+				               (Optionally NULL).
+
+			@returns
+				This function returns a pointer to a #hid_device object on
+				success or NULL on failure.
+		*/
+		HID_API_EXPORT hid_device * HID_API_CALL hid_open_context(hid_context *ctx, unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number);
+
+		/** @brief Open a HID device by its path name, through a context.
+
+			Works like hid_open_path(), using the context @p ctx, or
+			the shared context if @p ctx is NULL.
+
+			@ingroup API
+			@param ctx The context, or NULL.
+		    @param path The path name of the device to open
+
+			@returns
+				This function returns a pointer to a #hid_device object on
+				success or NULL on failure.
+		*/
+		HID_API_EXPORT hid_device * HID_API_CALL hid_open_path_context(hid_context *ctx, const char *path);
+
 		/** @brief Write an Output report to a HID device.
 
 			The first byte of @p data[] must contain the Report ID. For
@@ -246,6 +534,165 @@ extern "C" {
 		*/
 		int  HID_API_EXPORT HID_API_CALL hid_read(hid_device *device, unsigned char *data, size_t length);
 
+		/** @brief Read an Input report from a HID device, with the
+			time it arrived.
+
+			Works like hid_read(), and also returns the time at which
+			the report was received, in nanoseconds of the
+			CLOCK_MONOTONIC clock. On libusb the time is taken when
+			the transfer completes. hidraw does not record it, so the
+			time is taken when the report is read from the kernel,
+			which is only close to its arrival if the device is read
+			promptly.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param data A buffer to put the read data into.
+			@param length The number of bytes to read.
+			@param timestamp Set to the arrival time of the report, if
+				one was read. May be NULL.
+
+			@returns
+				The same as hid_read().
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_read_timestamped(hid_device *device, unsigned char *data, size_t length, unsigned long long *timestamp);
+
+		/** @brief Read an Input report from a HID device with timeout,
+			with the time it arrived.
+
+			Works like hid_read_timeout(). See hid_read_timestamped()
+			for the timestamp.
+
+			@ingroup API
+			@param dev A device handle returned from hid_open().
+			@param data A buffer to put the read data into.
+			@param length The number of bytes to read.
+			@param milliseconds timeout in milliseconds or -1 for
+				blocking wait.
+			@param timestamp Set to the arrival time of the report, if
+				one was read. May be NULL.
+
+			@returns
+				The same as hid_read_timeout().
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_read_timeout_timestamped(hid_device *dev, unsigned char *data, size_t length, int milliseconds, unsigned long long *timestamp);
+
+		/** @brief Wait until any of several HID devices has an Input
+			report to read.
+
+			Waits, for at most @p milliseconds, until at least one of
+			the devices has a report queued or has failed, for example
+			because it was unplugged, and marks every such device in
+			@p ready. A following hid_read() on a marked device does
+			not block. On hidraw all the devices are polled with a
+			single poll() call, on libusb the caller sleeps on one
+			condition which the read threads of all devices signal.
+
+			@ingroup API
+			@param devs The devices to wait on.
+			@param num_devs The number of devices in @p devs.
+			@param ready An array of @p num_devs flags, set to 1 for
+				each device which is ready and 0 for the others.
+			@param milliseconds timeout in milliseconds, 0 to only
+				check, or -1 for blocking wait.
+
+			@returns
+				This function returns the number of ready devices, 0
+				if the timeout expired and -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_wait_any(hid_device **devs, size_t num_devs, int *ready, int milliseconds);
+
+		/** @brief Create an event to end a hid_wait_any_event() early.
+
+			The event lets something other than a HID device, such as
+			another thread which receives data of its own, wake a
+			thread waiting on devices.
+
+			@ingroup API
+
+			@returns
+				This function returns a new event, or NULL on failure.
+				Free it with hid_wake_event_free().
+		*/
+		HID_API_EXPORT hid_wake_event * HID_API_CALL hid_wake_event_new(void);
+
+		/** @brief Free an event created by hid_wake_event_new().
+
+			No thread may be waiting on the event.
+
+			@ingroup API
+			@param event The event, or NULL.
+		*/
+		void HID_API_EXPORT HID_API_CALL hid_wake_event_free(hid_wake_event *event);
+
+		/** @brief Signal an event.
+
+			The event stays signalled until a hid_wait_any_event() on
+			it returns, so a signal sent before the wait starts is not
+			lost. May be called from any thread.
+
+			@ingroup API
+			@param event The event.
+		*/
+		void HID_API_EXPORT HID_API_CALL hid_wake_event_signal(hid_wake_event *event);
+
+		/** @brief Wait until any of several HID devices has an Input
+			report to read, or an event is signalled.
+
+			Works like hid_wait_any(), and also returns as soon as
+			@p event is signalled, clearing it. With an event, @p devs
+			may be empty, to wait on the event alone.
+
+			@ingroup API
+			@param devs The devices to wait on.
+			@param num_devs The number of devices in @p devs.
+			@param ready An array of @p num_devs flags, set to 1 for
+				each device which is ready and 0 for the others.
+			@param milliseconds timeout in milliseconds, 0 to only
+				check, or -1 for blocking wait.
+			@param event The event to wait on too, or NULL.
+
+			@returns
+				This function returns the number of ready devices, 0
+				if the timeout expired or the event was signalled
+				first, and -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_wait_any_event(hid_device **devs, size_t num_devs, int *ready, int milliseconds, hid_wake_event *event);
+
+		/** @brief Read every queued Input report from a HID device.
+
+			Moves as many of the reports already received as fit into
+			@p data, back to back, without waiting for new ones.
+			Report i starts at @p offsets[i] and ends at @p
+			offsets[i+1]. On libusb the queue is taken in a single
+			critical section and the copying is done outside it.
+			Reports which do not fit stay queued for the next call.
+
+			hidraw keeps no queue of its own, so the reports are read
+			from the kernel one by one until none is left. As the
+			size of a report is only known once it has been read,
+			one which turns out not to fit is kept back and handed
+			out by the next read. On the other backends a report
+			longer than the whole of @p data is returned truncated,
+			as hid_read() would.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param data A buffer to put the reports into.
+			@param length The size of @p data in bytes.
+			@param offsets An array of @p max_reports + 1 entries for
+				the report boundaries.
+			@param timestamps An array of @p max_reports entries for
+				the arrival times of the reports, see
+				hid_read_timestamped(). May be NULL.
+			@param max_reports The maximum number of reports to read.
+
+			@returns
+				This function returns the number of reports read, 0 if
+				there were none, and -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_read_all(hid_device *device, unsigned char *data, size_t length, size_t *offsets, unsigned long long *timestamps, size_t max_reports);
+
 		/** @brief Set the device handle to be non-blocking.
 
 			In non-blocking mode calls to hid_read() will return
@@ -386,6 +833,109 @@ extern "C" {
 		*/
 		HID_API_EXPORT const wchar_t* HID_API_CALL hid_error(hid_device *device);
 
+		/** @brief Get The struct #hid_device_info from a HID device.
+
+			The information is collected once, the first time this
+			function is called for a device, and is then served from
+			memory.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+
+			@returns
+				This function returns a pointer to the struct
+				#hid_device_info for this device, or NULL in the case of
+				failure. The struct is owned by the device and is valid
+				until the device is closed with hid_close(). Do not free
+				it with hid_free_enumeration().
+		*/
+		HID_API_EXPORT struct hid_device_info * HID_API_CALL hid_get_device_info(hid_device *device);
+
+		/** @brief Get the report descriptor of a HID device.
+
+			The descriptor is read from the device on every call.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param buf The buffer to copy the descriptor into.
+			@param buf_size The size of the buffer in bytes. A buffer of
+				#HID_API_MAX_REPORT_DESCRIPTOR_SIZE bytes is always large
+				enough.
+
+			@returns
+				This function returns the number of bytes copied into
+				@p buf, or -1 on error.
+		*/
+		int HID_API_EXPORT_CALL hid_get_report_descriptor(hid_device *device, unsigned char *buf, size_t buf_size);
+
+		/** @brief Get the runtime statistics of a HID device.
+
+			The counters are kept with relaxed atomic operations in
+			the read and write paths and can be read from any thread
+			while the device is in use. Each counter is read on its
+			own, so a snapshot taken during traffic need not be
+			consistent between counters.
+
+			The hidraw kernel interface does not expose the arrival
+			time of reports or its queue, so on hidraw the read
+			latency histogram, the dropped reports and the queue
+			high water mark stay at 0.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param stats The struct to fill in.
+
+			@returns
+				This function returns 0 on success and -1 on error.
+		*/
+		int HID_API_EXPORT_CALL hid_get_device_stats(hid_device *device, struct hid_device_stats *stats);
+
+		/** @brief Reset the runtime statistics of a HID device to 0.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+		*/
+		void HID_API_EXPORT_CALL hid_reset_device_stats(hid_device *device);
+
+		/** @brief Only deliver the Input reports of a device which
+			changed.
+
+			An Input report which equals the last one delivered with
+			the same report id is dropped before it is queued, and
+			counted in hid_device_stats::reports_suppressed. This
+			applies to every read function and to hid_wait_any(),
+			except that on hidraw, where reports are filtered as
+			they are read, hid_wait_any() can still report a device
+			ready whose reports are then all dropped. The first
+			report after the filter is set is always delivered.
+			Reports of different lengths always differ.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param report_id The report id to filter, or -1 for
+				every report. For devices which do not use numbered
+				reports every report has report id 0.
+			@param mask NULL to compare whole reports, or the bits
+				to compare. Byte i of the mask applies to byte i of
+				the report as returned by hid_read(), the report id
+				first for numbered reports. Bytes past the mask are
+				not compared.
+			@param mask_length The bytes of mask.
+
+			@returns
+				This function returns 0 on success and -1 on error.
+		*/
+		int HID_API_EXPORT_CALL hid_set_change_filter(hid_device *device, int report_id, const unsigned char *mask, size_t mask_length);
+
+		/** @brief Deliver every Input report with a report id again,
+			or of every report id for -1.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param report_id The report id, or -1.
+		*/
+		void HID_API_EXPORT_CALL hid_clear_change_filter(hid_device *device, int report_id);
+
 #ifdef __cplusplus
 }
 #endif
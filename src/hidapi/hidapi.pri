@@ -7,28 +7,71 @@ greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 !build_hidapi_lib:DEFINES += HIDAPI_NO_LIB
 
 SOURCES += \
-    qhidapi.cpp \
-    qhiddeviceinfomodel.cpp \
-    qhidapi_p.cpp \
-    hexformatdelegate.cpp \
-    qhiddeviceinfoview.cpp
+    $$PWD/qhidapi.cpp \
+    $$PWD/qhiddeviceinfomodel.cpp \
+    $$PWD/qhidapi_p.cpp \
+    $$PWD/hexformatdelegate.cpp \
+    $$PWD/qhiddeviceinfoview.cpp \
+    $$PWD/qhiddevice.cpp \
+    $$PWD/qhiddevice_p.cpp \
+    $$PWD/qhidreportdescriptor.cpp \
+    $$PWD/qhidreportbatch.cpp \
+    $$PWD/qhiddevicestats.cpp \
+    $$PWD/qhidscanner_p.cpp \
+    $$PWD/qhiddevicefilter.cpp \
+    $$PWD/qhiddevicecache_p.cpp \
+    $$PWD/qhidshareddevice_p.cpp \
+    $$PWD/qhidstateregister_p.cpp \
+    $$PWD/qhidreplaydevice_p.cpp \
+    $$PWD/qhidcapturereader.cpp \
+    $$PWD/hidapi_trace.c \
+    $$PWD/hidapi_capture.c \
+    $$PWD/hidapi_change.c
 
 HEADERS += \
-    qhidapi_global.h \
-    qhidapi.h \
-    qhiddeviceinfomodel.h \
-    qhiddeviceinfo.h \
-    qhidapi_p.h \
-    hexformatdelegate.h \
-    qhiddeviceinfoview.h \
-    hidapi.h
+    $$PWD/qhidapi_global.h \
+    $$PWD/qhidapi.h \
+    $$PWD/qhiddeviceinfomodel.h \
+    $$PWD/qhiddeviceinfo.h \
+    $$PWD/qhidapi_p.h \
+    $$PWD/hexformatdelegate.h \
+    $$PWD/qhiddeviceinfoview.h \
+    $$PWD/hidapi.h \
+    $$PWD/hidapi_stats.h \
+    $$PWD/qhiddevice.h \
+    $$PWD/qhiddevice_p.h \
+    $$PWD/qhidreportdescriptor.h \
+    $$PWD/qhidreportbatch.h \
+    $$PWD/qhiddevicestats.h \
+    $$PWD/qhidscanner_p.h \
+    $$PWD/qhiddevicefilter.h \
+    $$PWD/qhiddevicecache_p.h \
+    $$PWD/qhidshareddevice_p.h \
+    $$PWD/qhidstateregister_p.h \
+    $$PWD/qhidreplaydevice_p.h \
+    $$PWD/qhidcapturereader.h \
+    $$PWD/hidapi_trace.h \
+    $$PWD/hidapi_capture.h \
+    $$PWD/hidapi_change.h \
+    $$PWD/qhidtrace_p.h
 
-unix|win32|macx:contains(DEFINES, USE_LIBUSB) | android {
-    SOURCES += libusb/hid.c
-    INCLUDEPATH += /usr/include/libusb-1.0
-    LIBS += -lusb-1.0
+hidapi_trace {
+    # Tracepoints on the I/O paths, see hidapi_trace.h.
+    DEFINES += HIDAPI_TRACE
+}
+
+hidapi_virtual {
+    # In-process scripted devices instead of hardware, see hidapi_virtual.h.
+    SOURCES += $$PWD/virtual/hid.c
+    HEADERS += $$PWD/hidapi_virtual.h
 } else {
-    unix: SOURCES += linux/hid.c
-    win32: SOURCES += linux/hid.c
-    macx: SOURCES += linux/hid.c
+    unix|win32|macx:contains(DEFINES, USE_LIBUSB) | android {
+        SOURCES += $$PWD/libusb/hid.c
+        INCLUDEPATH += /usr/include/libusb-1.0
+        LIBS += -lusb-1.0
+    } else {
+        unix: SOURCES += $$PWD/linux/hid.c
+        win32: SOURCES += $$PWD/linux/hid.c
+        macx: SOURCES += $$PWD/linux/hid.c
+    }
 }
@@ -0,0 +1,970 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ Capture into memory-mapped segment files, shared by
+ every backend. See hidapi_capture.h for the format.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        http://github.com/signal11/hidapi .
+********************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "hidapi_capture.h"
+
+#define MAX_TAGS 256
+/* Bytes of the queue between the recording threads and the compressor. */
+#define QUEUE_SIZE (4 * 1024 * 1024)
+/* Queued records encoded in one go, the longest run of repeats. */
+#define BATCH 256
+/* Reports of a chunk kept to encode the next ones against, a power of 2. */
+#define DELTA_SLOTS 1024
+/* Room for the longest delta encoded record. */
+#define MAX_ENCODED (32 + UINT16_MAX + BATCH * 10)
+/* Milliseconds the preparer waits before trying again to create a
+   segment after it failed to. */
+#define RETRY_INTERVAL 100
+
+/* The last report of a chunk with the key, the next one is encoded
+   against. Only valid in the chunk of the generation. */
+struct delta_slot {
+	uint32_t key;
+	uint32_t generation;
+	size_t length;
+	size_t capacity;
+	unsigned char *data;
+};
+
+struct hid_capture {
+	pthread_mutex_t mutex;
+	char *path;
+	size_t segment_size;
+	unsigned int max_segments;
+
+	/* The segment being written, NULL until the preparer has one ready
+	   if the last could not be created. sequence is then the number the
+	   next one takes. */
+	int fd;
+	unsigned char *segment;
+	size_t offset;
+	unsigned long long sequence;
+	int encoding;
+
+	/* The preparer thread creates, allocates and maps the next segment
+	   ahead of time, so starting it only swaps it in, and unmaps the
+	   full ones and deletes the oldest off the recording path. spare is
+	   NULL while there is none ready, retired while there is none to
+	   unmap. */
+	pthread_t preparer;
+	pthread_cond_t prepare;
+	int preparing;
+	int preparer_stopping;
+	int spare_fd;
+	unsigned char *spare;
+	int retired_fd;
+	unsigned char *retired;
+	/* The oldest segment not deleted yet. */
+	unsigned long long oldest;
+
+	/* Records stop at limit, the index of the segment takes the rest. */
+	size_t limit;
+	struct hid_capture_index *index;
+	struct hid_capture_index_entry *entries;
+	/* Where the records of the next index entry start. */
+	size_t next_entry;
+
+	uint32_t record_sequence;
+	unsigned long long dropped;
+
+	/* The HID_CAPTURE_DEVICE payload of every tag handed out, written
+	   again at the start of each segment. */
+	unsigned char *devices[MAX_TAGS];
+	size_t device_lens[MAX_TAGS];
+	int num_tags;
+
+	/* HID_CAPTURE_ENCODING_DELTA: records are queued for the compressor
+	   thread, which owns the segment and the state below. */
+	pthread_t compressor;
+	pthread_cond_t queued;
+	int compressing;
+	int stopping;
+	unsigned char *queue;
+	size_t queue_head;
+	size_t queue_tail;
+	size_t queue_used;
+
+	struct delta_slot *slots;
+	uint32_t generation;
+	unsigned long long previous_timestamp;
+	unsigned char *scratch;
+};
+
+static unsigned long long clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static size_t align(size_t size)
+{
+	return (size + HID_CAPTURE_ALIGNMENT - 1) & ~(size_t) (HID_CAPTURE_ALIGNMENT - 1);
+}
+
+/* Bytes taken by an index with room for capacity entries. */
+static size_t index_size(size_t capacity)
+{
+	return align(sizeof(struct hid_capture_index) + capacity * sizeof(struct hid_capture_index_entry));
+}
+
+static void segment_path(const struct hid_capture *capture, unsigned long long sequence, char *buf, size_t size)
+{
+	int len = snprintf(buf, size, "%s", capture->path);
+	if (len >= 0 && (size_t) len < size)
+		snprintf(buf + len, size - len, HID_CAPTURE_SEGMENT_SUFFIX, sequence);
+}
+
+/* Unmaps the current segment. If it is the last one, its index is
+   moved up to follow the records and the segment truncated after it. */
+static void finish_segment(struct hid_capture *capture, int truncate)
+{
+	size_t end = capture->segment_size;
+
+	if (capture->segment) {
+		if (truncate) {
+			struct hid_capture_segment_header *header = (struct hid_capture_segment_header *) capture->segment;
+			/* Delta encoded records end anywhere. */
+			size_t at = align(capture->offset);
+
+			end = at + index_size(capture->index->count);
+			capture->index->capacity = capture->index->count;
+			memmove(capture->segment + at, capture->index, end - at);
+			header->index_offset = at;
+		}
+		munmap(capture->segment, capture->segment_size);
+		capture->segment = NULL;
+		capture->index = NULL;
+		capture->entries = NULL;
+	}
+	if (capture->fd >= 0) {
+		if (truncate) {
+			/* On failure the unused space is left, which reads as
+			   records of type 0. */
+			int res = ftruncate(capture->fd, (off_t) end);
+			(void) res;
+		}
+		close(capture->fd);
+		capture->fd = -1;
+	}
+}
+
+/* Whether the next record starts a new chunk, as the last one is full. */
+static int chunk_due(const struct hid_capture *capture)
+{
+	return capture->offset >= capture->next_entry && capture->index->count < capture->index->capacity;
+}
+
+/* Adds the index entry of a chunk starting at the offset. The entry is
+   published before the record, so the chunk is never missing a record
+   a reader can see. */
+static void start_chunk(struct hid_capture *capture, unsigned long long timestamp)
+{
+	uint32_t count = capture->index->count;
+	struct hid_capture_index_entry *entry = &capture->entries[count];
+
+	entry->timestamp = timestamp;
+	entry->offset = capture->offset;
+	__atomic_store_n(&capture->index->count, count + 1, __ATOMIC_RELEASE);
+	capture->next_entry = capture->offset + HID_CAPTURE_INDEX_INTERVAL;
+	/* Forget the reports of the last chunk. */
+	capture->generation++;
+}
+
+static void count_record(struct hid_capture *capture, int type, const unsigned char *data, size_t length)
+{
+	struct hid_capture_index_entry *entry = &capture->entries[capture->index->count - 1];
+
+	entry->records++;
+	if (type == HID_CAPTURE_DEVICE)
+		entry->flags |= HID_CAPTURE_INDEX_DEVICE;
+	else if (length > 0)
+		entry->report_ids[data[0] / 8] |= 1 << (data[0] % 8);
+}
+
+/* Must be called with the mutex locked. */
+static void append(struct hid_capture *capture, int tag, int type, unsigned long long timestamp, const unsigned char *data, size_t length)
+{
+	struct hid_capture_record *record = (struct hid_capture_record *) (capture->segment + capture->offset);
+
+	if (chunk_due(capture))
+		start_chunk(capture, timestamp);
+	count_record(capture, type, data, length);
+
+	if (length > 0)
+		memcpy(record + 1, data, length);
+	record->timestamp = timestamp;
+	record->sequence = capture->record_sequence++;
+	record->length = (uint16_t) length;
+	record->tag = (uint8_t) tag;
+	/* Last, so that a reader of the live mapping never sees a
+	   record before its payload. */
+	__atomic_store_n(&record->type, (uint8_t) type, __ATOMIC_RELEASE);
+
+	capture->offset += align(sizeof(*record) + length);
+}
+
+static size_t put_varint(unsigned char *out, unsigned long long value)
+{
+	size_t len = 0;
+
+	while (value >= 0x80) {
+		out[len++] = (unsigned char) (value | 0x80);
+		value >>= 7;
+	}
+	out[len++] = (unsigned char) value;
+
+	return len;
+}
+
+/* The difference of two timestamps, zigzag encoded so that a record
+   older than the one before it still takes few bytes. */
+static unsigned long long zigzag(unsigned long long timestamp, unsigned long long previous)
+{
+	long long diff = (long long) (timestamp - previous);
+	return ((unsigned long long) diff << 1) ^ (unsigned long long) (diff >> 63);
+}
+
+static uint32_t delta_key(const struct hid_capture_record *record)
+{
+	const unsigned char *data = (const unsigned char *) (record + 1);
+	return (uint32_t) record->tag << 16 | (uint32_t) record->type << 8 | (record->length > 0? data[0]: 0);
+}
+
+/* Returns the slot of the last report with the key in the chunk, or
+   NULL. With insert, the slot to keep it in instead, or NULL if every
+   slot is taken. */
+static struct delta_slot *find_slot(struct hid_capture *capture, uint32_t key, int insert)
+{
+	uint32_t hash = (key * 2654435761u) >> 22;
+	int i;
+
+	for (i = 0; i < DELTA_SLOTS; i++) {
+		struct delta_slot *slot = &capture->slots[(hash + i) & (DELTA_SLOTS - 1)];
+		if (slot->generation != capture->generation)
+			return insert? slot: NULL;
+		if (slot->key == key)
+			return slot;
+	}
+
+	return NULL;
+}
+
+/* Writes the runs of the XOR of data with previous. Returns the bytes
+   taken, or 0 if that would be more than room. */
+static size_t encode_xor(unsigned char *out, const unsigned char *previous, const unsigned char *data, size_t length, size_t room)
+{
+	size_t len = 0;
+	size_t i = 0;
+
+	while (i < length) {
+		size_t zeros = i;
+		size_t start;
+
+		while (i < length && previous[i] == data[i])
+			i++;
+		zeros = i - zeros;
+		/* A single equal byte costs less kept in the run. */
+		start = i;
+		while (i < length && (previous[i] != data[i] || (i + 1 < length && previous[i + 1] != data[i + 1])))
+			i++;
+
+		if (len + 20 + (i - start) > room)
+			return 0;
+		len += put_varint(out + len, zeros);
+		len += put_varint(out + len, i - start);
+		for (; start < i; start++)
+			out[len++] = previous[start] ^ data[start];
+	}
+
+	return len;
+}
+
+/* Encodes batch[0], with the repeats of it right behind it, into out.
+   fresh is set if it starts a chunk. Returns the bytes taken, and the
+   records encoded in *count. Only the compressor thread, or
+   start_segment() with the mutex locked, uses the encoder state. */
+static size_t encode(struct hid_capture *capture, struct hid_capture_record **batch, size_t n, int fresh, unsigned char *out, size_t *count)
+{
+	const struct hid_capture_record *record = batch[0];
+	const unsigned char *data = (const unsigned char *) (record + 1);
+	struct delta_slot *slot = NULL;
+	size_t len = 2;
+	size_t literal;
+
+	*count = 1;
+	out[0] = record->type;
+	out[1] = record->tag;
+	len += put_varint(out + len, zigzag(record->timestamp, fresh? 0: capture->previous_timestamp));
+
+	if (!fresh && record->type != HID_CAPTURE_DEVICE)
+		slot = find_slot(capture, delta_key(record), 0);
+
+	if (slot && slot->length == record->length && memcmp(slot->data, data, record->length) == 0) {
+		size_t run = 1;
+		size_t i;
+
+		while (run < n && batch[run]->tag == record->tag && batch[run]->type == record->type &&
+		       batch[run]->length == record->length && memcmp(batch[run] + 1, data, record->length) == 0)
+			run++;
+
+		out[0] |= HID_CAPTURE_DELTA_REPEAT << 4;
+		out[len++] = record->length > 0? data[0]: 0;
+		len += put_varint(out + len, run - 1);
+		for (i = 1; i < run; i++)
+			len += put_varint(out + len, zigzag(batch[i]->timestamp, batch[i - 1]->timestamp));
+		*count = run;
+		return len;
+	}
+
+	literal = len + put_varint(out + len, record->length) + record->length;
+	if (slot && slot->length == record->length && record->length > 0) {
+		size_t xor = encode_xor(out + len + 1, slot->data, data, record->length, literal - len - 1);
+		if (xor > 0) {
+			out[0] |= HID_CAPTURE_DELTA_XOR << 4;
+			out[len] = data[0];
+			return len + 1 + xor;
+		}
+	}
+
+	len += put_varint(out + len, record->length);
+	memcpy(out + len, data, record->length);
+
+	return literal;
+}
+
+/* Writes the encoding of count records of batch at the offset, and
+   keeps the last one to encode the next with the same key against. */
+static void commit(struct hid_capture *capture, struct hid_capture_record **batch, size_t count, int fresh, const unsigned char *out, size_t size)
+{
+	const struct hid_capture_record *last = batch[count - 1];
+	size_t i;
+
+	if (fresh)
+		start_chunk(capture, batch[0]->timestamp);
+	for (i = 0; i < count; i++)
+		count_record(capture, batch[i]->type, (const unsigned char *) (batch[i] + 1), batch[i]->length);
+
+	memcpy(capture->segment + capture->offset + 1, out + 1, size - 1);
+	/* The first byte last, as for raw records. */
+	__atomic_store_n(capture->segment + capture->offset, out[0], __ATOMIC_RELEASE);
+	capture->offset += size;
+	capture->previous_timestamp = last->timestamp;
+
+	if (last->type != HID_CAPTURE_DEVICE) {
+		struct delta_slot *slot = find_slot(capture, delta_key(last), 1);
+		if (!slot)
+			return;
+		if (slot->capacity < last->length) {
+			unsigned char *data = realloc(slot->data, last->length);
+			if (!data) {
+				/* The slot may hold an older report of the key,
+				   which the reader no longer has. */
+				slot->generation = capture->generation - 1;
+				return;
+			}
+			slot->data = data;
+			slot->capacity = last->length;
+		}
+		memcpy(slot->data, last + 1, last->length);
+		slot->length = last->length;
+		slot->key = delta_key(last);
+		slot->generation = capture->generation;
+	}
+}
+
+/* Appends a record which is not queued, a device record repeated at the
+   start of a segment. */
+static void append_encoded(struct hid_capture *capture, int tag, int type, unsigned long long timestamp, const unsigned char *data, size_t length)
+{
+	struct hid_capture_record *record = (struct hid_capture_record *) capture->scratch;
+	unsigned char *out = capture->scratch + MAX_ENCODED;
+	int fresh = chunk_due(capture);
+	size_t count;
+	size_t size;
+
+	if (length > UINT16_MAX)
+		return;
+	record->timestamp = timestamp;
+	record->length = (uint16_t) length;
+	record->tag = (uint8_t) tag;
+	record->type = (uint8_t) type;
+	memcpy(record + 1, data, length);
+
+	size = encode(capture, &record, 1, fresh, out, &count);
+	if (capture->offset + size <= capture->limit)
+		commit(capture, &record, 1, fresh, out, size);
+}
+
+/* Entries in the index of a segment, one for each interval of records
+   and one more for the chunk the records start in. */
+static size_t index_capacity(const struct hid_capture *capture)
+{
+	return capture->segment_size / HID_CAPTURE_INDEX_INTERVAL + 1;
+}
+
+/* Creates, allocates and maps segment sequence, with its header and
+   empty index in place, so a reader of the live capture sees an empty
+   segment rather than a broken one. Called by the preparer without the
+   mutex, as it can take a while. Returns the mapping, or NULL. */
+static unsigned char *create_segment(const struct hid_capture *capture, unsigned long long sequence, int *fd)
+{
+	char path[4096];
+	struct hid_capture_segment_header *header;
+	struct hid_capture_index *index;
+	unsigned char *segment;
+	int res;
+
+	segment_path(capture, sequence, path, sizeof(path));
+	*fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (*fd < 0)
+		return NULL;
+
+	/* Allocate every block now, rather than on the first write to each
+	   page, and fail now if the disk is full. */
+	res = posix_fallocate(*fd, 0, (off_t) capture->segment_size);
+	if (res == EOPNOTSUPP || res == EINVAL)
+		res = ftruncate(*fd, (off_t) capture->segment_size);
+	if (res != 0) {
+		close(*fd);
+		*fd = -1;
+		unlink(path);
+		return NULL;
+	}
+
+#ifdef MAP_POPULATE
+	segment = mmap(NULL, capture->segment_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, *fd, 0);
+#else
+	segment = mmap(NULL, capture->segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+#endif
+	if (segment == MAP_FAILED) {
+		close(*fd);
+		*fd = -1;
+		unlink(path);
+		return NULL;
+	}
+	madvise(segment, capture->segment_size, MADV_SEQUENTIAL);
+
+	header = (struct hid_capture_segment_header *) segment;
+	memcpy(header->magic, HID_CAPTURE_MAGIC, sizeof(header->magic));
+	header->version = HID_CAPTURE_VERSION;
+	header->byte_order = HID_CAPTURE_BYTE_ORDER;
+	header->header_size = sizeof(*header);
+	header->flags = (capture->encoding == HID_CAPTURE_ENCODING_DELTA)? HID_CAPTURE_FLAG_DELTA: 0;
+	header->sequence = sequence;
+	header->index_offset = capture->limit;
+
+	index = (struct hid_capture_index *) (segment + capture->limit);
+	index->capacity = (uint32_t) index_capacity(capture);
+	index->interval = HID_CAPTURE_INDEX_INTERVAL;
+
+	return segment;
+}
+
+/* Swaps in the spare segment and repeats the device records into it,
+   then wakes the preparer to make the next spare. Leaves segment NULL
+   if there is no spare ready, the preparer is still trying. Must be
+   called with the mutex locked. */
+static int start_segment(struct hid_capture *capture)
+{
+	struct hid_capture_segment_header *header;
+	int tag;
+
+	pthread_cond_signal(&capture->prepare);
+	if (!capture->spare)
+		return -1;
+
+	capture->segment = capture->spare;
+	capture->fd = capture->spare_fd;
+	capture->spare = NULL;
+	capture->spare_fd = -1;
+
+	header = (struct hid_capture_segment_header *) capture->segment;
+	header->start_monotonic = clock_ns(CLOCK_MONOTONIC);
+	header->start_realtime = clock_ns(CLOCK_REALTIME);
+	capture->offset = sizeof(*header);
+	capture->index = (struct hid_capture_index *) (capture->segment + capture->limit);
+	capture->entries = (struct hid_capture_index_entry *) (capture->index + 1);
+	capture->next_entry = capture->offset;
+
+	for (tag = 0; tag < capture->num_tags; tag++) {
+		size_t size = align(sizeof(struct hid_capture_record) + capture->device_lens[tag]);
+		if (!capture->devices[tag])
+			continue;
+		if (capture->encoding == HID_CAPTURE_ENCODING_DELTA)
+			append_encoded(capture, tag, HID_CAPTURE_DEVICE, header->start_monotonic, capture->devices[tag], capture->device_lens[tag]);
+		else if (capture->offset + size <= capture->limit)
+			append(capture, tag, HID_CAPTURE_DEVICE, header->start_monotonic, capture->devices[tag], capture->device_lens[tag]);
+	}
+
+	return 0;
+}
+
+/* Hands the full segment to the preparer to unmap and starts the next
+   one. The rest of the segment is still zero, which ends it. Must be
+   called with the mutex locked. */
+static void rotate_segment(struct hid_capture *capture)
+{
+	if (capture->retired) {
+		/* The preparer has not got to the last one yet. */
+		finish_segment(capture, 0);
+	} else {
+		capture->retired = capture->segment;
+		capture->retired_fd = capture->fd;
+		capture->segment = NULL;
+		capture->index = NULL;
+		capture->entries = NULL;
+		capture->fd = -1;
+	}
+	capture->sequence++;
+	start_segment(capture);
+}
+
+static void *preparer_thread(void *param)
+{
+	struct hid_capture *capture = param;
+
+	pthread_mutex_lock(&capture->mutex);
+	while (!capture->preparer_stopping) {
+		unsigned char *retired = capture->retired;
+		int retired_fd = capture->retired_fd;
+		int needed = !capture->spare;
+		/* The spare follows the segment being written, or takes the
+		   place of the one which could not be created. */
+		unsigned long long sequence = capture->sequence + (capture->segment? 1: 0);
+		unsigned long long oldest = capture->oldest;
+		unsigned long long keep = oldest;
+		unsigned char *spare = NULL;
+		int fd = -1;
+
+		/* Drop the oldest segments once there are too many. */
+		if (capture->segment && capture->max_segments > 0 && capture->sequence >= capture->max_segments)
+			keep = capture->sequence - capture->max_segments + 1;
+		if (keep < oldest)
+			keep = oldest;
+
+		if (!retired && !needed && keep == oldest) {
+			pthread_cond_wait(&capture->prepare, &capture->mutex);
+			continue;
+		}
+		capture->retired = NULL;
+		capture->retired_fd = -1;
+		capture->oldest = keep;
+		pthread_mutex_unlock(&capture->mutex);
+
+		if (retired) {
+			munmap(retired, capture->segment_size);
+			close(retired_fd);
+		}
+		for (; oldest < keep; oldest++) {
+			char path[4096];
+			segment_path(capture, oldest, path, sizeof(path));
+			unlink(path);
+		}
+		if (needed)
+			spare = create_segment(capture, sequence, &fd);
+
+		pthread_mutex_lock(&capture->mutex);
+		if (spare) {
+			capture->spare = spare;
+			capture->spare_fd = fd;
+		} else if (needed) {
+			/* Most likely the disk is full, try again in a while
+			   rather than on every record dropped meanwhile. */
+			struct timespec deadline;
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_nsec += RETRY_INTERVAL * 1000000L;
+			deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+			deadline.tv_nsec %= 1000000000L;
+			while (!capture->preparer_stopping &&
+			       pthread_cond_timedwait(&capture->prepare, &capture->mutex, &deadline) != ETIMEDOUT)
+				;
+		}
+	}
+	pthread_mutex_unlock(&capture->mutex);
+
+	return NULL;
+}
+
+/* Encodes n queued records into the segment, starting the next one
+   when it is full. */
+static void compress(struct hid_capture *capture, struct hid_capture_record **batch, size_t n)
+{
+	unsigned char *out = capture->scratch;
+	int rotated = 0;
+	size_t i = 0;
+
+	while (i < n) {
+		size_t count;
+		size_t size;
+		int fresh;
+
+		if (!capture->segment) {
+			int res;
+
+			pthread_mutex_lock(&capture->mutex);
+			res = start_segment(capture);
+			if (res < 0)
+				capture->dropped += n - i;
+			pthread_mutex_unlock(&capture->mutex);
+			if (res < 0)
+				return;
+		}
+
+		fresh = chunk_due(capture);
+		size = encode(capture, batch + i, n - i, fresh, out, &count);
+		if (capture->offset + size > capture->limit) {
+			if (!rotated) {
+				/* Encode again, against nothing. */
+				pthread_mutex_lock(&capture->mutex);
+				rotate_segment(capture);
+				pthread_mutex_unlock(&capture->mutex);
+				rotated = 1;
+				continue;
+			}
+			/* Too long for a segment of its own. */
+			pthread_mutex_lock(&capture->mutex);
+			capture->dropped += count;
+			pthread_mutex_unlock(&capture->mutex);
+		} else {
+			commit(capture, batch + i, count, fresh, out, size);
+		}
+		rotated = 0;
+		i += count;
+	}
+}
+
+static void *compressor_thread(void *param)
+{
+	struct hid_capture *capture = param;
+	struct hid_capture_record *batch[BATCH];
+
+	pthread_mutex_lock(&capture->mutex);
+	for (;;) {
+		size_t head;
+		size_t used;
+		size_t taken = 0;
+		size_t n = 0;
+
+		while (capture->queue_used == 0 && !capture->stopping)
+			pthread_cond_wait(&capture->queued, &capture->mutex);
+		if (capture->queue_used == 0)
+			break;
+		head = capture->queue_head;
+		used = capture->queue_used;
+		pthread_mutex_unlock(&capture->mutex);
+
+		/* The recording threads only write to the free part of the
+		   queue, so the records taken are read unlocked. */
+		while (n < BATCH && taken < used) {
+			struct hid_capture_record *record = (struct hid_capture_record *) (capture->queue + head);
+			size_t size;
+
+			if (QUEUE_SIZE - head < sizeof(*record) || record->type == 0) {
+				taken += QUEUE_SIZE - head;
+				head = 0;
+				continue;
+			}
+			size = align(sizeof(*record) + record->length);
+			batch[n++] = record;
+			head += size;
+			taken += size;
+		}
+		compress(capture, batch, n);
+
+		pthread_mutex_lock(&capture->mutex);
+		capture->queue_head = head;
+		capture->queue_used -= taken;
+	}
+	pthread_mutex_unlock(&capture->mutex);
+
+	return NULL;
+}
+
+/* Copies a record into the queue of the compressor. Records do not wrap
+   around the end of the queue, the space left there is skipped and
+   marked with a type 0 header if it holds one. Must be called with the
+   mutex locked. */
+static int enqueue(struct hid_capture *capture, int tag, int type, unsigned long long timestamp, const unsigned char *data, size_t length)
+{
+	struct hid_capture_record *record;
+	size_t size = align(sizeof(*record) + length);
+	size_t pos = capture->queue_tail;
+	size_t skipped = 0;
+
+	if (pos + size > QUEUE_SIZE) {
+		skipped = QUEUE_SIZE - pos;
+		pos = 0;
+	}
+	if (capture->queue_used + skipped + size > QUEUE_SIZE)
+		return -1;
+	if (skipped >= sizeof(*record))
+		((struct hid_capture_record *) (capture->queue + capture->queue_tail))->type = 0;
+
+	record = (struct hid_capture_record *) (capture->queue + pos);
+	record->timestamp = timestamp;
+	record->sequence = 0;
+	record->length = (uint16_t) length;
+	record->tag = (uint8_t) tag;
+	record->type = (uint8_t) type;
+	if (length > 0)
+		memcpy(record + 1, data, length);
+
+	capture->queue_tail = pos + size;
+	capture->queue_used += skipped + size;
+
+	return 0;
+}
+
+struct hid_capture HID_API_EXPORT *hid_capture_open(const char *path, size_t segment_size, unsigned int max_segments)
+{
+	return hid_capture_open_encoded(path, segment_size, max_segments, HID_CAPTURE_ENCODING_RAW);
+}
+
+struct hid_capture HID_API_EXPORT *hid_capture_open_encoded(const char *path, size_t segment_size, unsigned int max_segments, int encoding)
+{
+	struct hid_capture *capture;
+	size_t page = (size_t) sysconf(_SC_PAGESIZE);
+
+	if (!path || (encoding != HID_CAPTURE_ENCODING_RAW && encoding != HID_CAPTURE_ENCODING_DELTA))
+		return NULL;
+
+	capture = calloc(1, sizeof(*capture));
+	if (!capture)
+		return NULL;
+	capture->path = strdup(path);
+	if (!capture->path) {
+		free(capture);
+		return NULL;
+	}
+	pthread_mutex_init(&capture->mutex, NULL);
+	pthread_cond_init(&capture->queued, NULL);
+	pthread_cond_init(&capture->prepare, NULL);
+	capture->segment_size = (segment_size + page - 1) / page * page;
+	if (capture->segment_size < page)
+		capture->segment_size = page;
+	capture->max_segments = max_segments;
+	capture->fd = -1;
+	capture->spare_fd = -1;
+	capture->retired_fd = -1;
+	capture->encoding = encoding;
+	/* Records stop at the same place in every segment. */
+	capture->limit = capture->segment_size - index_size(index_capacity(capture));
+
+	if (encoding == HID_CAPTURE_ENCODING_DELTA) {
+		capture->queue = malloc(QUEUE_SIZE);
+		capture->slots = calloc(DELTA_SLOTS, sizeof(struct delta_slot));
+		/* append_encoded() takes a record and its encoding. */
+		capture->scratch = malloc(2 * MAX_ENCODED);
+		if (!capture->queue || !capture->slots || !capture->scratch) {
+			hid_capture_close(capture);
+			return NULL;
+		}
+	}
+
+	/* The first segment is made here, so that a capture which can not
+	   be written fails to open. */
+	capture->spare = create_segment(capture, 0, &capture->spare_fd);
+	if (!capture->spare || start_segment(capture) < 0) {
+		hid_capture_close(capture);
+		return NULL;
+	}
+
+	if (pthread_create(&capture->preparer, NULL, preparer_thread, capture) != 0) {
+		hid_capture_close(capture);
+		return NULL;
+	}
+	capture->preparing = 1;
+
+	if (encoding == HID_CAPTURE_ENCODING_DELTA) {
+		if (pthread_create(&capture->compressor, NULL, compressor_thread, capture) != 0) {
+			hid_capture_close(capture);
+			return NULL;
+		}
+		capture->compressing = 1;
+	}
+
+	return capture;
+}
+
+void HID_API_EXPORT hid_capture_close(struct hid_capture *capture)
+{
+	int tag;
+
+	if (!capture)
+		return;
+
+	if (capture->compressing) {
+		/* The compressor empties the queue before it stops. */
+		pthread_mutex_lock(&capture->mutex);
+		capture->stopping = 1;
+		pthread_cond_signal(&capture->queued);
+		pthread_mutex_unlock(&capture->mutex);
+		pthread_join(capture->compressor, NULL);
+	}
+
+	if (capture->preparing) {
+		pthread_mutex_lock(&capture->mutex);
+		capture->preparer_stopping = 1;
+		pthread_cond_signal(&capture->prepare);
+		pthread_mutex_unlock(&capture->mutex);
+		pthread_join(capture->preparer, NULL);
+	}
+
+	finish_segment(capture, 1);
+	if (capture->retired) {
+		munmap(capture->retired, capture->segment_size);
+		close(capture->retired_fd);
+	}
+	if (capture->spare) {
+		/* Never started, it would read as an empty segment. */
+		char path[4096];
+		segment_path(capture, ((struct hid_capture_segment_header *) capture->spare)->sequence, path, sizeof(path));
+		munmap(capture->spare, capture->segment_size);
+		close(capture->spare_fd);
+		unlink(path);
+	}
+	for (tag = 0; tag < capture->num_tags; tag++)
+		free(capture->devices[tag]);
+	if (capture->slots) {
+		for (tag = 0; tag < DELTA_SLOTS; tag++)
+			free(capture->slots[tag].data);
+	}
+	free(capture->slots);
+	free(capture->scratch);
+	free(capture->queue);
+	pthread_cond_destroy(&capture->prepare);
+	pthread_cond_destroy(&capture->queued);
+	pthread_mutex_destroy(&capture->mutex);
+	free(capture->path);
+	free(capture);
+}
+
+void HID_API_EXPORT hid_capture_record(struct hid_capture *capture, int tag, int type, unsigned long long timestamp, const unsigned char *data, size_t length)
+{
+	size_t size = align(sizeof(struct hid_capture_record) + length);
+
+	pthread_mutex_lock(&capture->mutex);
+
+	if (capture->encoding == HID_CAPTURE_ENCODING_DELTA) {
+		int empty = (capture->queue_used == 0);
+
+		if (length > UINT16_MAX || enqueue(capture, tag, type, timestamp, data, length) < 0)
+			capture->dropped++;
+		else if (empty)
+			pthread_cond_signal(&capture->queued);
+		pthread_mutex_unlock(&capture->mutex);
+		return;
+	}
+
+	if (length > UINT16_MAX || sizeof(struct hid_capture_segment_header) + size > capture->limit) {
+		capture->dropped++;
+		pthread_mutex_unlock(&capture->mutex);
+		return;
+	}
+
+	if (!capture->segment)
+		start_segment(capture);
+	else if (capture->offset + size > capture->limit)
+		rotate_segment(capture);
+
+	if (capture->segment && capture->offset + size <= capture->limit)
+		append(capture, tag, type, timestamp, data, length);
+	else
+		capture->dropped++;
+
+	pthread_mutex_unlock(&capture->mutex);
+}
+
+int HID_API_EXPORT hid_capture_attach(struct hid_capture *capture, hid_device *device)
+{
+	struct hid_device_info *info;
+	struct hid_capture_device *desc;
+	unsigned char descriptor[HID_API_MAX_REPORT_DESCRIPTOR_SIZE];
+	unsigned char *payload;
+	size_t path_len;
+	size_t len;
+	int descriptor_size;
+	int tag;
+
+	if (!capture || !device)
+		return -1;
+
+	info = hid_get_device_info(device);
+	descriptor_size = hid_get_report_descriptor(device, descriptor, sizeof(descriptor));
+	if (descriptor_size < 0)
+		descriptor_size = 0;
+	path_len = (info && info->path)? strlen(info->path): 0;
+
+	len = sizeof(*desc) + descriptor_size + path_len;
+	payload = malloc(len);
+	if (!payload)
+		return -1;
+	desc = (struct hid_capture_device *) payload;
+	desc->vendor_id = info? info->vendor_id: 0;
+	desc->product_id = info? info->product_id: 0;
+	desc->release_number = info? info->release_number: 0;
+	desc->descriptor_size = (uint16_t) descriptor_size;
+	memcpy(payload + sizeof(*desc), descriptor, descriptor_size);
+	if (path_len > 0)
+		memcpy(payload + sizeof(*desc) + descriptor_size, info->path, path_len);
+
+	pthread_mutex_lock(&capture->mutex);
+	if (capture->num_tags == MAX_TAGS) {
+		pthread_mutex_unlock(&capture->mutex);
+		free(payload);
+		return -1;
+	}
+	tag = capture->num_tags++;
+	capture->devices[tag] = payload;
+	capture->device_lens[tag] = len;
+	pthread_mutex_unlock(&capture->mutex);
+
+	hid_capture_record(capture, tag, HID_CAPTURE_DEVICE, clock_ns(CLOCK_MONOTONIC), payload, len);
+	hid_set_capture(device, capture, tag);
+
+	return tag;
+}
+
+void HID_API_EXPORT hid_capture_detach(hid_device *device)
+{
+	if (device)
+		hid_set_capture(device, NULL, 0);
+}
+
+unsigned long long HID_API_EXPORT hid_capture_dropped(struct hid_capture *capture)
+{
+	unsigned long long dropped;
+
+	pthread_mutex_lock(&capture->mutex);
+	dropped = capture->dropped;
+	pthread_mutex_unlock(&capture->mutex);
+
+	return dropped;
+}
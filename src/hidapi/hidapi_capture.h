@@ -0,0 +1,307 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ Capture of the reports exchanged with devices into
+ memory-mapped segment files.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        http://github.com/signal11/hidapi .
+********************************************************/
+
+#ifndef HIDAPI_CAPTURE_H__
+#define HIDAPI_CAPTURE_H__
+
+#include <stdint.h>
+
+#include "hidapi.h"
+
+/* A capture is a sequence of segment files named after the path given
+   to hid_capture_open() followed by HID_CAPTURE_SEGMENT_SUFFIX, with
+   the segment number in place of the %06llu. Each segment starts with
+   a struct hid_capture_segment_header, followed by records. A record
+   is a struct hid_capture_record followed by its payload, padded to
+   HID_CAPTURE_ALIGNMENT bytes. The records end at the first record
+   with type 0, at the index or at the end of the file.
+
+   Each segment also holds a sparse index, a struct hid_capture_index
+   at the index_offset of the header. It has an entry for every
+   HID_CAPTURE_INDEX_INTERVAL bytes of records, so a reader can find
+   the records around a time, or the chunks holding a report id, with
+   a binary search instead of a scan. While a segment is written its
+   index is at its end, after the space left for records. Once it is
+   finished by hid_capture_close() the index follows the records.
+
+   A capture opened with HID_CAPTURE_ENCODING_DELTA sets
+   HID_CAPTURE_FLAG_DELTA in the header of its segments, and packs its
+   records into bytes without padding, each starting with a byte
+   holding the type in bits 0-2 and one of the HID_CAPTURE_DELTA_*
+   operations in bits 4-5, then the tag byte and the difference of the
+   timestamp from that of the record before it in the chunk, or from 0
+   for the first one, zigzag encoded as a varint. A varint stores 7
+   bits per byte, least significant first, with bit 7 set in every byte
+   but the last. The rest depends on the operation:
+
+   - HID_CAPTURE_DELTA_LITERAL: the length of the payload as a varint,
+     then the payload.
+   - HID_CAPTURE_DELTA_XOR: the report id, then the payload as the XOR
+     with the last payload in the chunk of the same tag, type and first
+     byte, and of the same length, stored as runs up to that length:
+     a varint count of zero bytes, a varint count of bytes and those
+     bytes.
+   - HID_CAPTURE_DELTA_REPEAT: the report id, then a varint count of
+     further repeats, each with its own zigzag timestamp difference.
+     The payloads all equal the last one of the same tag, type and
+     first byte in the chunk.
+
+   Each index chunk starts without a previous record, so it can be
+   decoded on its own. Delta encoded records have no sequence numbers.
+
+   Every value is stored in the byte order of the host, which is
+   recorded in the byte_order field of the segment header. */
+
+/** The first 8 bytes of every segment. */
+#define HID_CAPTURE_MAGIC "HIDCAP\r\n"
+/** Version of the segment format. */
+#define HID_CAPTURE_VERSION 1
+/** Appended to the capture path, with the segment number. */
+#define HID_CAPTURE_SEGMENT_SUFFIX ".%06llu.hidcap"
+/** Records start on multiples of this many bytes. */
+#define HID_CAPTURE_ALIGNMENT 8
+/** Written to the byte_order field, reads 0x04030201 when swapped. */
+#define HID_CAPTURE_BYTE_ORDER 0x01020304
+/** Bytes of records between two index entries. */
+#define HID_CAPTURE_INDEX_INTERVAL 65536
+/** Set in hid_capture_index_entry::flags if the chunk holds a
+    HID_CAPTURE_DEVICE record. */
+#define HID_CAPTURE_INDEX_DEVICE 0x1
+/** Set in hid_capture_segment_header::flags if the records are delta
+    encoded. */
+#define HID_CAPTURE_FLAG_DELTA 0x1
+/** Operations of delta encoded records. */
+#define HID_CAPTURE_DELTA_LITERAL 0
+#define HID_CAPTURE_DELTA_XOR 1
+#define HID_CAPTURE_DELTA_REPEAT 2
+
+/** Encodings of the records, see hid_capture_open_encoded(). */
+enum hid_capture_encoding {
+	/** Records are copied into the mapping as they come. */
+	HID_CAPTURE_ENCODING_RAW = 0,
+	/** Records are delta encoded by a thread of the capture. */
+	HID_CAPTURE_ENCODING_DELTA = 1
+};
+
+/** Record types. */
+enum hid_capture_type {
+	/** Input report read from the device. */
+	HID_CAPTURE_INPUT = 1,
+	/** Output report written with hid_write(). */
+	HID_CAPTURE_OUTPUT = 2,
+	/** Feature report sent with hid_send_feature_report(). */
+	HID_CAPTURE_FEATURE_SET = 3,
+	/** Feature report returned by hid_get_feature_report(). */
+	HID_CAPTURE_FEATURE_GET = 4,
+	/** Description of a device, a struct hid_capture_device. Written
+	    when the device is attached and again at the start of each
+	    segment, so every segment can be read on its own. */
+	HID_CAPTURE_DEVICE = 5
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+		/** Header at the start of every segment, 64 bytes. */
+		struct hid_capture_segment_header {
+			/** HID_CAPTURE_MAGIC */
+			char magic[8];
+			/** HID_CAPTURE_VERSION */
+			uint32_t version;
+			/** HID_CAPTURE_BYTE_ORDER */
+			uint32_t byte_order;
+			/** Size of this header, where the first record starts */
+			uint32_t header_size;
+			/** HID_CAPTURE_FLAG_* flags */
+			uint32_t flags;
+			/** Number of the segment in the capture, from 0 */
+			uint64_t sequence;
+			/** CLOCK_MONOTONIC, in ns, when the segment was started */
+			uint64_t start_monotonic;
+			/** CLOCK_REALTIME, in ns, at the same time, to turn record
+			    timestamps into wall clock time */
+			uint64_t start_realtime;
+			/** Offset of the struct hid_capture_index, 0 if the
+			    segment has none */
+			uint64_t index_offset;
+			/** Reserved, 0 */
+			uint64_t reserved;
+		};
+
+		/** Header of every record, 16 bytes. */
+		struct hid_capture_record {
+			/** CLOCK_MONOTONIC in ns. For Input reports the arrival
+			    time as given by hid_read_timestamped(). */
+			uint64_t timestamp;
+			/** Number of the record in the capture, wrapping
+			    around. A gap means records were dropped. */
+			uint32_t sequence;
+			/** Bytes of payload following the header */
+			uint16_t length;
+			/** The device, as returned by hid_capture_attach() */
+			uint8_t tag;
+			/** One of the enum hid_capture_type values, written last */
+			uint8_t type;
+		};
+
+		/** Payload of a HID_CAPTURE_DEVICE record, followed by the
+		    report descriptor and then the path of the device in UTF-8,
+		    without a terminating NUL, up to the end of the payload. */
+		struct hid_capture_device {
+			uint16_t vendor_id;
+			uint16_t product_id;
+			uint16_t release_number;
+			uint16_t descriptor_size;
+		};
+
+		/** Header of the index of a segment, 16 bytes, followed by
+		    count struct hid_capture_index_entry. */
+		struct hid_capture_index {
+			/** Entries written. In a segment being written the
+			    entry is filled in before the count is raised. */
+			uint32_t count;
+			/** Entries there is room for */
+			uint32_t capacity;
+			/** HID_CAPTURE_INDEX_INTERVAL when written */
+			uint32_t interval;
+			/** Reserved, 0 */
+			uint32_t reserved;
+		};
+
+		/** Index entry for a chunk of records, 56 bytes. The chunk
+		    ends where the next one starts, or with the records. */
+		struct hid_capture_index_entry {
+			/** Timestamp of the first record of the chunk */
+			uint64_t timestamp;
+			/** Offset of the first record of the chunk */
+			uint64_t offset;
+			/** Records in the chunk */
+			uint32_t records;
+			/** HID_CAPTURE_INDEX_* flags */
+			uint32_t flags;
+			/** Bit n % 8 of byte n / 8 is set if the first byte of a
+			    report in the chunk is n, its report id for devices
+			    which use numbered reports. */
+			uint8_t report_ids[32];
+		};
+
+		struct hid_capture;
+
+		/** @brief Start a capture.
+
+			The segments are created with their full size allocated
+			and are mapped into memory, so recording a report is a
+			copy into the mapping. The kernel writes the pages back
+			in its own time, and a capture survives the crash of the
+			process. A thread of the capture creates and maps the
+			next segment ahead of time, so when a segment is full
+			starting the next one only swaps it in. Until it is
+			ready, after a failure to create it or if segments fill
+			faster than they are made, records are dropped, and it
+			is tried again every 100 ms.
+
+			@ingroup API
+			@param path The path of the segments, before the
+				HID_CAPTURE_SEGMENT_SUFFIX.
+			@param segment_size The size of each segment in bytes,
+				rounded up to the page size.
+			@param max_segments The number of segments kept, older
+				ones are deleted. 0 keeps every segment.
+
+			@returns
+				This function returns a pointer to the capture,
+				or NULL on failure.
+		*/
+		struct hid_capture HID_API_EXPORT * HID_API_CALL hid_capture_open(const char *path, size_t segment_size, unsigned int max_segments);
+
+		/** @brief Start a capture with the given encoding.
+
+			With HID_CAPTURE_ENCODING_DELTA, recording a report only
+			copies it into a queue. A thread of the capture encodes
+			the queued reports as the difference from the previous
+			report with the same report id, and suppresses reports
+			equal to it, which takes a fraction of the space for
+			devices sending mostly unchanged reports. Reports are
+			dropped if the queue is full.
+
+			@ingroup API
+			@param path The path of the segments, before the
+				HID_CAPTURE_SEGMENT_SUFFIX.
+			@param segment_size The size of each segment in bytes,
+				rounded up to the page size.
+			@param max_segments The number of segments kept, older
+				ones are deleted. 0 keeps every segment.
+			@param encoding One of the enum hid_capture_encoding
+				values.
+
+			@returns
+				This function returns a pointer to the capture,
+				or NULL on failure.
+		*/
+		struct hid_capture HID_API_EXPORT * HID_API_CALL hid_capture_open_encoded(const char *path, size_t segment_size, unsigned int max_segments, int encoding);
+
+		/** @brief Finish a capture.
+
+			The last segment is truncated to the records written,
+			after the queued records have been encoded. Every device must have been detached first.
+
+			@ingroup API
+			@param capture The capture returned by hid_capture_open().
+		*/
+		void HID_API_EXPORT HID_API_CALL hid_capture_close(struct hid_capture *capture);
+
+		/** @brief Start recording the reports of a device.
+
+			Input reports are recorded as they are read, by the read
+			thread of the libusb backend, and Output and Feature
+			reports as they are sent. A device can only be attached
+			to one capture at a time.
+
+			@ingroup API
+			@param capture The capture returned by hid_capture_open().
+			@param device A device handle returned from hid_open().
+
+			@returns
+				This function returns the tag of the device in the
+				records, or -1 on error. At most 256 devices can be
+				attached to a capture over its lifetime.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_capture_attach(struct hid_capture *capture, hid_device *device);
+
+		/** @brief Stop recording the reports of a device. Once this
+			returns, no more records of the device are written. */
+		void HID_API_EXPORT HID_API_CALL hid_capture_detach(hid_device *device);
+
+		/** @brief Get the number of records which could not be
+			written, because they were too long, the queue of a delta
+			encoded capture was full or the next segment was not
+			ready. */
+		unsigned long long HID_API_EXPORT HID_API_CALL hid_capture_dropped(struct hid_capture *capture);
+
+		/** @brief Append a record. Called by the backends. */
+		void HID_API_EXPORT HID_API_CALL hid_capture_record(struct hid_capture *capture, int tag, int type, unsigned long long timestamp, const unsigned char *data, size_t length);
+
+		/** @brief Set the capture a device records into, NULL to stop.
+			Implemented by each backend, use hid_capture_attach(). */
+		void HID_API_EXPORT HID_API_CALL hid_set_capture(hid_device *device, struct hid_capture *capture, int tag);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
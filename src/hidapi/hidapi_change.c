@@ -0,0 +1,189 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ Change-only delivery of Input reports, shared by the
+ backends. See hid_set_change_filter() in hidapi.h.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        http://github.com/signal11/hidapi .
+********************************************************/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hidapi_change.h"
+
+int hid_change_uses_numbered_reports(const unsigned char *descriptor, size_t size)
+{
+	size_t i = 0;
+
+	while (i < size) {
+		int key = descriptor[i];
+
+		if (key == 0x85/*Report ID*/)
+			return 1;
+
+		if ((key & 0xf0) == 0xf0) {
+			/* Long Item, the next byte holds the length of its
+			   data. See the HID specification, version 1.11,
+			   section 6.2.2.3. */
+			i += 3 + ((i + 1 < size)? descriptor[i + 1]: 0);
+		}
+		else {
+			/* Short Item, the size code is in the bottom two
+			   bits, 3 meaning 4 bytes. */
+			int size_code = key & 0x3;
+			i += 1 + ((size_code == 3)? 4: size_code);
+		}
+	}
+
+	return 0;
+}
+
+static void reset_key(struct hid_change_key *key)
+{
+	free(key->mask);
+	free(key->last);
+	memset(key, 0, sizeof(*key));
+}
+
+int hid_change_set(struct hid_change_filter **filter, int numbered, int report_id, const unsigned char *mask, size_t mask_length)
+{
+	int first = report_id;
+	int last = report_id;
+	int id;
+
+	if (report_id < -1 || report_id > 255 || (!numbered && report_id > 0))
+		return -1;
+	if (report_id < 0 || !numbered) {
+		first = 0;
+		last = numbered? 255: 0;
+	}
+
+	if (!*filter) {
+		*filter = calloc(1, sizeof(struct hid_change_filter));
+		if (!*filter)
+			return -1;
+	}
+	(*filter)->numbered = numbered;
+
+	for (id = first; id <= last; id++) {
+		struct hid_change_key *key = &(*filter)->keys[id];
+
+		reset_key(key);
+		if (mask && mask_length > 0) {
+			key->mask = malloc(mask_length);
+			if (!key->mask) {
+				hid_change_clear(filter, report_id);
+				return -1;
+			}
+			memcpy(key->mask, mask, mask_length);
+			key->mask_length = mask_length;
+		}
+		key->active = 1;
+	}
+
+	return 0;
+}
+
+void hid_change_clear(struct hid_change_filter **filter, int report_id)
+{
+	int id;
+
+	if (!*filter)
+		return;
+
+	for (id = 0; id < 256; id++) {
+		if (report_id < 0 || id == report_id || !(*filter)->numbered)
+			reset_key(&(*filter)->keys[id]);
+	}
+
+	for (id = 0; id < 256; id++) {
+		if ((*filter)->keys[id].active)
+			return;
+	}
+	hid_change_free(*filter);
+	*filter = NULL;
+}
+
+void hid_change_free(struct hid_change_filter *filter)
+{
+	int id;
+
+	if (!filter)
+		return;
+
+	for (id = 0; id < 256; id++)
+		reset_key(&filter->keys[id]);
+	free(filter);
+}
+
+/* Whether the report differs from the last one in a bit of the mask.
+   The masked reports are compared 8 bytes at a time, without a branch
+   per word, which compilers turn into vector instructions. Unmasked
+   reports are left to memcmp(), which libc vectorizes itself. */
+static int differs(const struct hid_change_key *key, const unsigned char *data, size_t length)
+{
+	const unsigned char *last = key->last;
+	const unsigned char *mask = key->mask;
+	size_t n = (key->mask_length < length)? key->mask_length: length;
+	uint64_t diff = 0;
+	size_t i;
+
+	if (!mask)
+		return memcmp(last, data, length) != 0;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		uint64_t a, b, m;
+		memcpy(&a, last + i, 8);
+		memcpy(&b, data + i, 8);
+		memcpy(&m, mask + i, 8);
+		diff |= (a ^ b) & m;
+	}
+	for (; i < n; i++)
+		diff |= (last[i] ^ data[i]) & mask[i];
+
+	return diff != 0;
+}
+
+int hid_change_suppress(struct hid_change_filter *filter, const unsigned char *data, size_t length)
+{
+	struct hid_change_key *key;
+
+	if (!filter)
+		return 0;
+
+	key = &filter->keys[(filter->numbered && length > 0)? data[0]: 0];
+	if (!key->active)
+		return 0;
+
+	if (key->have_last && key->last_length == length && !differs(key, data, length))
+		return 1;
+
+	if (key->last_capacity < length) {
+		unsigned char *last = realloc(key->last, length);
+		if (!last) {
+			/* Deliver the next one too, rather than compare it
+			   with an older report. */
+			key->have_last = 0;
+			return 0;
+		}
+		key->last = last;
+		key->last_capacity = length;
+	}
+	if (length > 0)
+		memcpy(key->last, data, length);
+	key->last_length = length;
+	key->have_last = 1;
+
+	return 0;
+}
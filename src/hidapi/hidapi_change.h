@@ -0,0 +1,69 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ Change-only delivery of Input reports, shared by the
+ backends. Internal, not part of the API.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        http://github.com/signal11/hidapi .
+********************************************************/
+
+#ifndef HIDAPI_CHANGE_H__
+#define HIDAPI_CHANGE_H__
+
+#include <stddef.h>
+
+#include "hidapi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+		/* The filter of the reports with one report id, and the
+		   last of them delivered. */
+		struct hid_change_key {
+			int active;
+			/* NULL to compare whole reports */
+			unsigned char *mask;
+			size_t mask_length;
+			unsigned char *last;
+			size_t last_length;
+			size_t last_capacity;
+			int have_last;
+		};
+
+		/* The filter of a device, NULL while no report id is
+		   filtered. The backends only use it with a lock held. */
+		struct hid_change_filter {
+			/* Whether reports start with their report id */
+			int numbered;
+			struct hid_change_key keys[256];
+		};
+
+		/* Returns 1 if a report descriptor has a Report ID item. */
+		int hid_change_uses_numbered_reports(const unsigned char *descriptor, size_t size);
+
+		/* Implement hid_set_change_filter() and
+		   hid_clear_change_filter(), creating the filter when
+		   needed and freeing it once nothing is filtered. */
+		int hid_change_set(struct hid_change_filter **filter, int numbered, int report_id, const unsigned char *mask, size_t mask_length);
+		void hid_change_clear(struct hid_change_filter **filter, int report_id);
+		void hid_change_free(struct hid_change_filter *filter);
+
+		/* Returns 1 if a report is to be dropped as unchanged,
+		   otherwise keeps it to compare the next one with and
+		   returns 0. */
+		int hid_change_suppress(struct hid_change_filter *filter, const unsigned char *data, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
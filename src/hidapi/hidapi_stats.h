@@ -0,0 +1,73 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ Helpers shared by the backends to keep struct
+ hid_device_stats up to date. Internal, not part of the API.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        http://github.com/signal11/hidapi .
+********************************************************/
+
+#ifndef HIDAPI_STATS_H__
+#define HIDAPI_STATS_H__
+
+#include "hidapi.h"
+
+/* Every counter is only ever updated with relaxed atomic operations, they
+   order nothing and cost no more than a plain add on x86. */
+static inline void hid_stats_add(unsigned long long *counter, unsigned long long value)
+{
+	__atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+static inline void hid_stats_max(unsigned long long *counter, unsigned long long value)
+{
+	unsigned long long cur = __atomic_load_n(counter, __ATOMIC_RELAXED);
+	while (value > cur &&
+	       !__atomic_compare_exchange_n(counter, &cur, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/* Counts the time from start to end, in ns, in its log2 bucket. */
+static inline void hid_stats_latency(unsigned long long *histogram, unsigned long long start, unsigned long long end)
+{
+	unsigned long long ns = (end > start)? end - start: 0;
+	int bucket = ns? 63 - __builtin_clzll(ns): 0;
+
+	if (bucket >= HID_STATS_LATENCY_BUCKETS)
+		bucket = HID_STATS_LATENCY_BUCKETS - 1;
+	hid_stats_add(&histogram[bucket], 1);
+}
+
+/* struct hid_device_stats only holds unsigned long long counters, so it is
+   copied and cleared as an array of them. */
+#define HID_STATS_COUNTERS (sizeof(struct hid_device_stats) / sizeof(unsigned long long))
+
+static inline void hid_stats_copy(struct hid_device_stats *dst, struct hid_device_stats *src)
+{
+	unsigned long long *from = (unsigned long long *) src;
+	unsigned long long *to = (unsigned long long *) dst;
+	size_t i;
+
+	for (i = 0; i < HID_STATS_COUNTERS; i++)
+		to[i] = __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+}
+
+static inline void hid_stats_reset(struct hid_device_stats *stats)
+{
+	unsigned long long *counters = (unsigned long long *) stats;
+	size_t i;
+
+	for (i = 0; i < HID_STATS_COUNTERS; i++)
+		__atomic_store_n(&counters[i], 0, __ATOMIC_RELAXED);
+}
+
+#endif
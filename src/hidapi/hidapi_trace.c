@@ -0,0 +1,265 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ Tracepoint recording and export, shared by every backend.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        http://github.com/signal11/hidapi .
+********************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hidapi_trace.h"
+
+#ifdef HIDAPI_TRACE
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+struct trace_event {
+	unsigned long long timestamp;
+	const char *name;
+	long long arg;
+	int tid;
+	char phase;
+};
+
+/* Written by one thread at a time, the owner, and read by the exporter.
+   The owner fills in events[count] before publishing it by storing
+   count + 1 with release semantics, so the exporter never sees a
+   half written event. */
+struct trace_buffer {
+	struct trace_buffer *next;
+	/* 1 while a thread owns the buffer. A thread which exits gives
+	   its buffer up for the next new thread, events included. */
+	int in_use;
+	size_t count;
+	unsigned long long dropped;
+	struct trace_event events[HID_TRACE_BUFFER_EVENTS];
+};
+
+static int enabled = 0;
+/* Buffers are only ever pushed, so walking the list needs no lock. */
+static struct trace_buffer *buffers = NULL;
+static __thread struct trace_buffer *thread_buffer = NULL;
+static __thread int thread_id = 0;
+static pthread_key_t exit_key;
+static pthread_once_t exit_key_once = PTHREAD_ONCE_INIT;
+
+static unsigned long long monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int current_tid(void)
+{
+#ifdef __linux__
+	return (int) syscall(SYS_gettid);
+#else
+	static int next_tid = 1;
+	return __atomic_fetch_add(&next_tid, 1, __ATOMIC_RELAXED);
+#endif
+}
+
+static void release_buffer(void *buffer)
+{
+	__atomic_store_n(&((struct trace_buffer *) buffer)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void create_exit_key(void)
+{
+	pthread_key_create(&exit_key, release_buffer);
+}
+
+/* Takes over the buffer of a thread which has exited, or pushes a new
+   one. Only runs on the first event of a thread. */
+static struct trace_buffer *claim_buffer(void)
+{
+	struct trace_buffer *buffer;
+	int unused;
+
+	pthread_once(&exit_key_once, create_exit_key);
+
+	for (buffer = __atomic_load_n(&buffers, __ATOMIC_ACQUIRE); buffer; buffer = buffer->next) {
+		unused = 0;
+		if (__atomic_compare_exchange_n(&buffer->in_use, &unused, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			break;
+	}
+
+	if (!buffer) {
+		buffer = calloc(1, sizeof(*buffer));
+		if (!buffer)
+			return NULL;
+		buffer->in_use = 1;
+		buffer->next = __atomic_load_n(&buffers, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&buffers, &buffer->next, buffer, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			;
+	}
+
+	pthread_setspecific(exit_key, buffer);
+	thread_id = current_tid();
+
+	return buffer;
+}
+
+void HID_API_EXPORT hid_trace_record(const char *name, char phase, long long arg)
+{
+	struct trace_buffer *buffer;
+	struct trace_event *event;
+	size_t count;
+
+	if (!__atomic_load_n(&enabled, __ATOMIC_RELAXED))
+		return;
+
+	buffer = thread_buffer;
+	if (!buffer) {
+		buffer = thread_buffer = claim_buffer();
+		if (!buffer)
+			return;
+	}
+
+	count = buffer->count;
+	if (count == HID_TRACE_BUFFER_EVENTS) {
+		__atomic_fetch_add(&buffer->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	event = &buffer->events[count];
+	event->timestamp = monotonic_ns();
+	event->name = name;
+	event->arg = arg;
+	event->tid = thread_id;
+	event->phase = phase;
+	__atomic_store_n(&buffer->count, count + 1, __ATOMIC_RELEASE);
+}
+
+int HID_API_EXPORT hid_trace_start(void)
+{
+	__atomic_store_n(&enabled, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+void HID_API_EXPORT hid_trace_stop(void)
+{
+	__atomic_store_n(&enabled, 0, __ATOMIC_RELAXED);
+}
+
+void HID_API_EXPORT hid_trace_clear(void)
+{
+	struct trace_buffer *buffer;
+
+	for (buffer = __atomic_load_n(&buffers, __ATOMIC_ACQUIRE); buffer; buffer = buffer->next) {
+		__atomic_store_n(&buffer->count, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&buffer->dropped, 0, __ATOMIC_RELAXED);
+	}
+}
+
+unsigned long long HID_API_EXPORT hid_trace_dropped(void)
+{
+	struct trace_buffer *buffer;
+	unsigned long long dropped = 0;
+
+	for (buffer = __atomic_load_n(&buffers, __ATOMIC_ACQUIRE); buffer; buffer = buffer->next)
+		dropped += __atomic_load_n(&buffer->dropped, __ATOMIC_RELAXED);
+
+	return dropped;
+}
+
+/* The names are string literals from the tracepoints, but quotes and
+   backslashes are escaped all the same. */
+static void write_name(FILE *f, const char *name)
+{
+	for (; *name; name++) {
+		if (*name == '"' || *name == '\\')
+			fputc('\\', f);
+		fputc(*name, f);
+	}
+}
+
+int HID_API_EXPORT hid_trace_export_chrome(const char *path)
+{
+	struct trace_buffer *buffer;
+	FILE *f;
+	size_t i, count;
+	int written = 0;
+	int pid = (int) getpid();
+
+	f = fopen(path, "w");
+	if (!f)
+		return -1;
+
+	fputs("{\"traceEvents\":[", f);
+	for (buffer = __atomic_load_n(&buffers, __ATOMIC_ACQUIRE); buffer; buffer = buffer->next) {
+		count = __atomic_load_n(&buffer->count, __ATOMIC_ACQUIRE);
+		for (i = 0; i < count; i++) {
+			const struct trace_event *event = &buffer->events[i];
+
+			fputs(written? ",\n{\"name\":\"": "\n{\"name\":\"", f);
+			write_name(f, event->name);
+			fprintf(f, "\",\"ph\":\"%c\",\"ts\":%llu.%03llu,\"pid\":%d,\"tid\":%d",
+				event->phase, event->timestamp / 1000, event->timestamp % 1000, pid, event->tid);
+			if (event->phase == 'i')
+				fputs(",\"s\":\"t\"", f);
+			if (event->phase != 'B')
+				fprintf(f, ",\"args\":{\"value\":%lld}", event->arg);
+			fputc('}', f);
+			written++;
+		}
+	}
+	fputs("\n],\"displayTimeUnit\":\"ns\"}\n", f);
+
+	if (fclose(f) != 0)
+		return -1;
+
+	return written;
+}
+
+#else
+
+int HID_API_EXPORT hid_trace_start(void)
+{
+	return -1;
+}
+
+void HID_API_EXPORT hid_trace_stop(void)
+{
+}
+
+void HID_API_EXPORT hid_trace_clear(void)
+{
+}
+
+unsigned long long HID_API_EXPORT hid_trace_dropped(void)
+{
+	return 0;
+}
+
+int HID_API_EXPORT hid_trace_export_chrome(const char *path)
+{
+	(void) path;
+	return -1;
+}
+
+void HID_API_EXPORT hid_trace_record(const char *name, char phase, long long arg)
+{
+	(void) name;
+	(void) phase;
+	(void) arg;
+}
+
+#endif
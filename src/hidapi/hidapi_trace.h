@@ -0,0 +1,99 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ Tracepoints on the I/O paths, recorded into per-thread
+ buffers and exported as Chrome trace-event JSON.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        http://github.com/signal11/hidapi .
+********************************************************/
+
+#ifndef HIDAPI_TRACE_H__
+#define HIDAPI_TRACE_H__
+
+#include "hidapi.h"
+
+/* The tracepoints are only compiled in when HIDAPI_TRACE is defined,
+   with CONFIG += hidapi_trace. Otherwise they compile to nothing and
+   the functions below fail. */
+#ifdef HIDAPI_TRACE
+#define HID_TRACE_BEGIN(name) hid_trace_record(name, 'B', 0)
+#define HID_TRACE_END(name, arg) hid_trace_record(name, 'E', (long long) (arg))
+#define HID_TRACE_INSTANT(name, arg) hid_trace_record(name, 'i', (long long) (arg))
+#else
+#define HID_TRACE_BEGIN(name) do { } while (0)
+#define HID_TRACE_END(name, arg) do { } while (0)
+#define HID_TRACE_INSTANT(name, arg) do { } while (0)
+#endif
+
+/** Events kept per thread, later events are dropped. */
+#ifndef HID_TRACE_BUFFER_EVENTS
+#define HID_TRACE_BUFFER_EVENTS 65536
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+		/** @brief Start recording the tracepoints.
+
+			Each thread records into its own buffer of
+			HID_TRACE_BUFFER_EVENTS events, allocated on its first
+			event, without taking any lock. Once a buffer is full
+			further events of the thread are dropped.
+
+			@ingroup API
+
+			@returns
+				This function returns 0 on success and -1 if the
+				library was built without HIDAPI_TRACE.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_trace_start(void);
+
+		/** @brief Stop recording the tracepoints. The events
+			recorded so far are kept. */
+		void HID_API_EXPORT HID_API_CALL hid_trace_stop(void);
+
+		/** @brief Discard the events recorded so far.
+
+			Must only be called while recording is stopped and no
+			traced call is in progress.
+		*/
+		void HID_API_EXPORT HID_API_CALL hid_trace_clear(void);
+
+		/** @brief Get the number of events dropped because a
+			thread's buffer was full. */
+		unsigned long long HID_API_EXPORT HID_API_CALL hid_trace_dropped(void);
+
+		/** @brief Write the recorded events to a file in the Chrome
+			trace-event JSON format.
+
+			The file can be loaded in chrome://tracing or Perfetto.
+			Times are in microseconds of CLOCK_MONOTONIC. Events
+			recorded while the export runs may be left out.
+
+			@ingroup API
+			@param path The file to write.
+
+			@returns
+				This function returns the number of events written,
+				or -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_trace_export_chrome(const char *path);
+
+		/** @brief Record an event. Called by the HID_TRACE_* macros,
+			name must be a string literal. */
+		void HID_API_EXPORT HID_API_CALL hid_trace_record(const char *name, char phase, long long arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
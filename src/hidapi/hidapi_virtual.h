@@ -0,0 +1,165 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ Scripting interface of the in-process virtual backend.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        http://github.com/signal11/hidapi .
+********************************************************/
+
+#ifndef HIDAPI_VIRTUAL_H__
+#define HIDAPI_VIRTUAL_H__
+
+#include "hidapi.h"
+
+/** Prefix of the paths of virtual devices, followed by the device id. */
+#define HID_VIRTUAL_PATH_PREFIX "virtual:"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+		/** Description of a scripted device for hid_virtual_add_device().
+		    Zero values pick the defaults given for each field. */
+		struct hid_virtual_device_config {
+			/** Device Vendor ID */
+			unsigned short vendor_id;
+			/** Device Product ID */
+			unsigned short product_id;
+			/** Device Release Number in binary-coded decimal */
+			unsigned short release_number;
+			/** Usage Page, reported by the enumeration */
+			unsigned short usage_page;
+			/** Usage, reported by the enumeration */
+			unsigned short usage;
+			/** The USB interface number */
+			int interface_number;
+			/** One of the HID_BUS_* values, HID_BUS_USB if 0 */
+			int bus_type;
+			/** Serial Number, or NULL for none */
+			const wchar_t *serial_number;
+			/** Manufacturer String, or NULL for none */
+			const wchar_t *manufacturer_string;
+			/** Product String, or NULL for none */
+			const wchar_t *product_string;
+			/** Report descriptor returned by
+			    hid_get_report_descriptor(), or NULL for none */
+			const unsigned char *report_descriptor;
+			/** Size of @p report_descriptor in bytes */
+			size_t report_descriptor_size;
+
+			/** Size in bytes of the generated Input reports,
+			    including the report ID byte. 64 if 0. */
+			size_t report_size;
+			/** Report ID put in the first byte of the generated
+			    reports, or 0 for unnumbered reports */
+			unsigned char report_id;
+			/** Generated Input reports per second. With 0, reports
+			    are only delivered by hid_virtual_push_report(). */
+			unsigned int report_rate;
+			/** Delay in microseconds between the time a report is
+			    due and the time it is delivered, applied to the
+			    generated reports. */
+			unsigned int latency_us;
+			/** Number of reports generated before the device is
+			    unplugged, or 0 to never unplug it. */
+			unsigned long long disconnect_after;
+			/** Reports queued per open handle before the oldest are
+			    dropped, as the libusb backend does. 30 if 0. */
+			size_t queue_limit;
+		};
+
+		/** @brief Plug in a scripted device.
+
+			The device shows up in the enumeration straight away, with
+			the path HID_VIRTUAL_PATH_PREFIX followed by the returned
+			id. Devices are independent of hid_init() and hid_exit()
+			and stay until they are removed.
+
+			Each generated report carries the report ID, if any,
+			followed by the 64 bit little endian number of the report,
+			counting from 0, and then by bytes holding the low 8 bits
+			of the report number. Every handle open on the device
+			receives every report, as with hidraw.
+
+			@ingroup API
+			@param config The description of the device. The strings
+				and the descriptor are copied.
+
+			@returns
+				This function returns the id of the device, which is
+				greater than 0, or -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_virtual_add_device(const struct hid_virtual_device_config *config);
+
+		/** @brief Unplug a scripted device.
+
+			The device leaves the enumeration. Handles still open on
+			it can read the reports already queued, after which
+			reads fail with -1.
+
+			@ingroup API
+			@param id The id returned by hid_virtual_add_device().
+
+			@returns
+				This function returns 0 on success and -1 if there is
+				no such device.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_virtual_remove_device(int id);
+
+		/** @brief Unplug every scripted device. */
+		void HID_API_EXPORT HID_API_CALL hid_virtual_remove_all(void);
+
+		/** @brief Deliver an Input report to every open handle of a
+			device straight away, whatever its report rate.
+
+			@ingroup API
+			@param id The id returned by hid_virtual_add_device().
+			@param data The report, including the report ID byte
+				for numbered reports.
+			@param length The length of @p data in bytes.
+
+			@returns
+				This function returns 0 on success and -1 if there is
+				no such device or it has been unplugged.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_virtual_push_report(int id, const unsigned char *data, size_t length);
+
+		/** @brief Get the last Output report written to a device.
+
+			@ingroup API
+			@param id The id returned by hid_virtual_add_device().
+			@param data A buffer to put the report into, including
+				the report ID byte as passed to hid_write().
+			@param length The size of @p data in bytes.
+
+			@returns
+				This function returns the length of the report, 0 if
+				none has been written, and -1 if there is no such
+				device.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_virtual_get_output_report(int id, unsigned char *data, size_t length);
+
+		/** @brief Get the number of Input reports delivered by a
+			device, generated or pushed.
+
+			@ingroup API
+			@param id The id returned by hid_virtual_add_device().
+
+			@returns
+				This function returns the number of reports.
+		*/
+		unsigned long long HID_API_EXPORT HID_API_CALL hid_virtual_reports_delivered(int id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -42,6 +42,7 @@
 #include <fcntl.h>
 #include <pthread.h>
 #include <wchar.h>
+#include <fnmatch.h>
 
 /* GNU / LibUSB */
 #include <libusb.h>
@@ -50,6 +51,10 @@
 #endif
 
 #include "hidapi.h"
+#include "hidapi_stats.h"
+#include "hidapi_trace.h"
+#include "hidapi_capture.h"
+#include "hidapi_change.h"
 
 #ifdef __ANDROID__
 
@@ -138,6 +143,7 @@ instead to differentiate between interfaces on a composite HID device. */
 struct input_report {
 	uint8_t *data;
 	size_t len;
+	unsigned long long timestamp; /* CLOCK_MONOTONIC, in ns */
 	struct input_report *next;
 };
 
@@ -146,6 +152,9 @@ struct hid_device_ {
 	/* Handle to the actual device. */
 	libusb_device_handle *device_handle;
 
+	/* The context the device was opened through, which runs its events. */
+	libusb_context *usb_context;
+
 	/* Endpoint information */
 	int input_endpoint;
 	int output_endpoint;
@@ -173,12 +182,47 @@ struct hid_device_ {
 
 	/* List of received input reports. */
 	struct input_report *input_reports;
+
+	/* Information collected by hid_get_device_info(). */
+	struct hid_device_info *device_info;
+
+	/* Runtime statistics, only updated with relaxed atomics. */
+	struct hid_device_stats stats;
+
+	/* Set by hid_capture_attach(), only changed with the mutex
+	   locked, so it can not go away under a record in progress. */
+	struct hid_capture *capture;
+	int capture_tag;
+
+	/* Set by hid_set_change_filter(), only used with the mutex locked. */
+	struct hid_change_filter *changes;
+};
+
+struct hid_context_ {
+	libusb_context *usb_context;
 };
 
+/* The shared context, and the number of references taken on it by
+   hid_init(). */
 static libusb_context *usb_context = NULL;
+static int usb_context_refs = 0;
+static pthread_mutex_t usb_context_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Signalled by every read thread when a report is queued or the thread
+   stops, for hid_wait_any(). The generation counts the signals, so a
+   waiter can tell whether anything happened since it last looked. */
+static pthread_mutex_t wait_any_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wait_any_condition = PTHREAD_COND_INITIALIZER;
+static unsigned long wait_any_generation = 0;
+static int wait_any_waiters = 0;
+
+/* Signalled on the same condition, guarded by wait_any_mutex. */
+struct hid_wake_event_ {
+	int signalled;
+};
 
 uint16_t get_usb_code_for_current_locale(void);
-static int return_data(hid_device *dev, unsigned char *data, size_t length);
+static int return_data(hid_device *dev, unsigned char *data, size_t length, unsigned long long *timestamp);
 
 static hid_device *new_hid_device(void)
 {
@@ -199,6 +243,11 @@ static void free_hid_device(hid_device *dev)
 	pthread_cond_destroy(&dev->condition);
 	pthread_mutex_destroy(&dev->mutex);
 
+	hid_change_free(dev->changes);
+
+	/* Free the information collected by hid_get_device_info() */
+	hid_free_enumeration(dev->device_info);
+
 	/* Free the device itself */
 	free(dev);
 }
@@ -335,12 +384,35 @@ static inline int libusb_get_string_descriptor(libusb_device_handle *dev,
 #endif
 
 
-/* Get the first language the device says it reports. This comes from
-   USB string #0. */
-static uint16_t get_first_language(libusb_device_handle *dev)
+/* The language IDs supported by a device, read from USB string #0. The
+   table is cached per device, so that the control transfer is only done
+   once rather than for every string. A device is identified by its bus
+   and address, which are checked against the VID/PID as addresses are
+   reused after an unplug. */
+#define MAX_LANGUAGES 31
+#define LANGUAGE_CACHE_SIZE 64
+
+struct language_table {
+	uint8_t bus;
+	uint8_t address;
+	uint16_t vendor_id;
+	uint16_t product_id;
+	int num_langs;
+	uint16_t langs[MAX_LANGUAGES];
+};
+
+static struct language_table language_cache[LANGUAGE_CACHE_SIZE];
+static int language_cache_count = 0;
+static int language_cache_next = 0;
+static pthread_mutex_t language_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Read the language table of the device into langs. Returns the number of
+   languages, which is 0 if the device has no string descriptors. */
+static int read_language_table(libusb_device_handle *dev, uint16_t *langs)
 {
-	uint16_t buf[32];
+	uint16_t buf[MAX_LANGUAGES + 1];
 	int len;
+	int i;
 
 	/* Get the string from libusb. */
 	len = libusb_get_string_descriptor(dev,
@@ -349,42 +421,87 @@ static uint16_t get_first_language(libusb_device_handle *dev)
 			(unsigned char*)buf,
 			sizeof(buf));
 	if (len < 4)
-		return 0x0;
+		return 0;
 
-	return buf[1]; /* First two bytes are len and descriptor type. */
+	len /= 2; /* language IDs are two-bytes each. */
+	/* Start at index 1 because there are two bytes of protocol data. */
+	for (i = 1; i < len; i++)
+		langs[i - 1] = buf[i];
+
+	return len - 1;
 }
 
-static int is_language_supported(libusb_device_handle *dev, uint16_t lang)
+/* Pick the language to read strings from the device in: the one of the
+   current locale if the device supports it, otherwise the first language
+   the device reports. */
+static uint16_t get_usb_language(libusb_device_handle *dev)
 {
-	uint16_t buf[32];
-	int len;
+	libusb_device *usb_dev = libusb_get_device(dev);
+	struct libusb_device_descriptor desc;
+	struct language_table *table = NULL;
+	struct language_table entry;
+	uint16_t lang;
 	int i;
 
-	/* Get the string from libusb. */
-	len = libusb_get_string_descriptor(dev,
-			0x0, /* String ID */
-			0x0, /* Language */
-			(unsigned char*)buf,
-			sizeof(buf));
-	if (len < 4)
-		return 0x0;
+	memset(&entry, 0, sizeof(entry));
+	entry.bus = libusb_get_bus_number(usb_dev);
+	entry.address = libusb_get_device_address(usb_dev);
+	if (libusb_get_device_descriptor(usb_dev, &desc) >= 0) {
+		entry.vendor_id = desc.idVendor;
+		entry.product_id = desc.idProduct;
+	}
 
+	pthread_mutex_lock(&language_cache_mutex);
+	for (i = 0; i < language_cache_count; i++) {
+		struct language_table *t = &language_cache[i];
+		if (t->bus == entry.bus && t->address == entry.address &&
+		    t->vendor_id == entry.vendor_id && t->product_id == entry.product_id) {
+			entry = *t;
+			table = &entry;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&language_cache_mutex);
+
+	if (!table) {
+		/* Not cached, read it without holding the lock. */
+		entry.num_langs = read_language_table(dev, entry.langs);
+		table = &entry;
+
+		if (entry.num_langs > 0) {
+			pthread_mutex_lock(&language_cache_mutex);
+			language_cache[language_cache_next] = entry;
+			language_cache_next = (language_cache_next + 1) % LANGUAGE_CACHE_SIZE;
+			if (language_cache_count < LANGUAGE_CACHE_SIZE)
+				language_cache_count++;
+			pthread_mutex_unlock(&language_cache_mutex);
+		}
+	}
 
-	len /= 2; /* language IDs are two-bytes each. */
-	/* Start at index 1 because there are two bytes of protocol data. */
-	for (i = 1; i < len; i++) {
-		if (buf[i] == lang)
-			return 1;
+	if (table->num_langs == 0)
+		return 0x0;
+
+	lang = get_usb_code_for_current_locale();
+	for (i = 0; i < table->num_langs; i++) {
+		if (table->langs[i] == lang)
+			return lang;
 	}
 
-	return 0;
+	return table->langs[0];
 }
 
+#ifndef __ANDROID__
+/* One UTF-16LE to wchar_t converter for the whole process. iconv_t can't
+   be used by two threads at once, so it is guarded by a mutex. It is
+   closed by hid_exit(). */
+static iconv_t string_ic = (iconv_t)-1;
+static pthread_mutex_t string_ic_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
 /* This function returns a newly allocated wide string containing the USB
-   device string numbered by the index. The returned string must be freed
-   by using free(). */
-static wchar_t *get_usb_string(libusb_device_handle *dev, uint8_t idx)
+   device string numbered by the index, read in the language lang. The
+   returned string must be freed by using free(). */
+static wchar_t *get_usb_string_lang(libusb_device_handle *dev, uint8_t idx, uint16_t lang)
 {
 	char buf[512];
 	int len;
@@ -393,7 +510,6 @@ static wchar_t *get_usb_string(libusb_device_handle *dev, uint8_t idx)
 #ifndef __ANDROID__ /* we don't use iconv on Android */
 	wchar_t wbuf[256];
 	/* iconv variables */
-	iconv_t ic;
 	size_t inbytes;
 	size_t outbytes;
 	size_t res;
@@ -405,12 +521,6 @@ static wchar_t *get_usb_string(libusb_device_handle *dev, uint8_t idx)
 	char *outptr;
 #endif
 
-	/* Determine which language to use. */
-	uint16_t lang;
-	lang = get_usb_code_for_current_locale();
-	if (!is_language_supported(dev, lang))
-		lang = get_first_language(dev);
-
 	/* Get the string from libusb. */
 	len = libusb_get_string_descriptor(dev,
 			idx,
@@ -442,11 +552,19 @@ static wchar_t *get_usb_string(libusb_device_handle *dev, uint8_t idx)
 	/* buf does not need to be explicitly NULL-terminated because
 	   it is only passed into iconv() which does not need it. */
 
-	/* Initialize iconv. */
-	ic = iconv_open("WCHAR_T", "UTF-16LE");
-	if (ic == (iconv_t)-1) {
-		LOG("iconv_open() failed\n");
-		return NULL;
+	pthread_mutex_lock(&string_ic_mutex);
+
+	/* Initialize iconv the first time through. */
+	if (string_ic == (iconv_t)-1) {
+		string_ic = iconv_open("WCHAR_T", "UTF-16LE");
+		if (string_ic == (iconv_t)-1) {
+			LOG("iconv_open() failed\n");
+			goto err;
+		}
+	}
+	else {
+		/* Return the converter to its initial state. */
+		iconv(string_ic, NULL, NULL, NULL, NULL);
 	}
 
 	/* Convert to native wchar_t (UTF-32 on glibc/BSD systems).
@@ -455,7 +573,7 @@ static wchar_t *get_usb_string(libusb_device_handle *dev, uint8_t idx)
 	inbytes = len-2;
 	outptr = (char*) wbuf;
 	outbytes = sizeof(wbuf);
-	res = iconv(ic, &inptr, &inbytes, &outptr, &outbytes);
+	res = iconv(string_ic, &inptr, &inbytes, &outptr, &outbytes);
 	if (res == (size_t)-1) {
 		LOG("iconv() failed\n");
 		goto err;
@@ -470,13 +588,46 @@ static wchar_t *get_usb_string(libusb_device_handle *dev, uint8_t idx)
 	str = wcsdup(wbuf);
 
 err:
-	iconv_close(ic);
+	pthread_mutex_unlock(&string_ic_mutex);
 
 #endif
 
 	return str;
 }
 
+/* This function returns a newly allocated wide string containing the USB
+   device string numbered by the index. The returned string must be freed
+   by using free(). */
+static wchar_t *get_usb_string(libusb_device_handle *dev, uint8_t idx)
+{
+	return get_usb_string_lang(dev, idx, get_usb_language(dev));
+}
+
+/* Read the serial number, manufacturer and product strings of the device in
+   one pass, resolving the language once. Indexes of 0 and strings which are
+   already set are skipped. */
+static void get_usb_strings(libusb_device_handle *dev,
+	uint8_t serial_idx, wchar_t **serial_number,
+	uint8_t manufacturer_idx, wchar_t **manufacturer_string,
+	uint8_t product_idx, wchar_t **product_string)
+{
+	uint16_t lang;
+
+	if ((serial_idx == 0 || *serial_number) &&
+	    (manufacturer_idx == 0 || *manufacturer_string) &&
+	    (product_idx == 0 || *product_string))
+		return;
+
+	lang = get_usb_language(dev);
+
+	if (serial_idx > 0 && !*serial_number)
+		*serial_number = get_usb_string_lang(dev, serial_idx, lang);
+	if (manufacturer_idx > 0 && !*manufacturer_string)
+		*manufacturer_string = get_usb_string_lang(dev, manufacturer_idx, lang);
+	if (product_idx > 0 && !*product_string)
+		*product_string = get_usb_string_lang(dev, product_idx, lang);
+}
+
 static char *make_path(libusb_device *dev, int interface_number)
 {
 	char str[64];
@@ -490,54 +641,346 @@ static char *make_path(libusb_device *dev, int interface_number)
 }
 
 
-int HID_API_EXPORT hid_init(void)
+static void init_locale(void)
 {
-	if (!usb_context) {
-		const char *locale;
+	const char *locale;
 
+	/* Set the locale if it's not set. */
+	locale = setlocale(LC_CTYPE, NULL);
+	if (!locale)
+		setlocale(LC_CTYPE, "");
+}
+
+/* Create the shared context if there is none. Must be called with
+   usb_context_mutex held. */
+static int init_shared_context(void)
+{
+	if (!usb_context) {
 		/* Init Libusb */
-		if (libusb_init(&usb_context))
+		if (libusb_init(&usb_context)) {
+			usb_context = NULL;
 			return -1;
+		}
+		init_locale();
+	}
+	return 0;
+}
+
+int HID_API_EXPORT hid_init(void)
+{
+	int res;
+
+	pthread_mutex_lock(&usb_context_mutex);
+	res = init_shared_context();
+	if (res == 0)
+		usb_context_refs++;
+	pthread_mutex_unlock(&usb_context_mutex);
+
+	return res;
+}
+
+/* Initialization on demand by the functions which use the shared
+   context. A reference is only taken if there is none, so that the
+   matching hid_exit() of a caller who never called hid_init() still
+   finalizes the library. */
+static int implicit_init(void)
+{
+	int res;
+
+	pthread_mutex_lock(&usb_context_mutex);
+	res = init_shared_context();
+	if (res == 0 && usb_context_refs == 0)
+		usb_context_refs = 1;
+	pthread_mutex_unlock(&usb_context_mutex);
+
+	return res;
+}
 
-		/* Set the locale if it's not set. */
-		locale = setlocale(LC_CTYPE, NULL);
-		if (!locale)
-			setlocale(LC_CTYPE, "");
+/* Find the libusb context to use for ctx, which is the shared context
+   if ctx is NULL. */
+static int resolve_context(hid_context *ctx, libusb_context **usb_ctx)
+{
+	if (ctx) {
+		*usb_ctx = ctx->usb_context;
+		return 0;
 	}
 
+	if (implicit_init() < 0)
+		return -1;
+	*usb_ctx = usb_context;
 	return 0;
 }
 
 int HID_API_EXPORT hid_exit(void)
 {
+	pthread_mutex_lock(&usb_context_mutex);
+	if (usb_context_refs > 1) {
+		/* Someone else still uses the library. */
+		usb_context_refs--;
+		pthread_mutex_unlock(&usb_context_mutex);
+		return 0;
+	}
+	usb_context_refs = 0;
 	if (usb_context) {
 		libusb_exit(usb_context);
 		usb_context = NULL;
 	}
+	pthread_mutex_unlock(&usb_context_mutex);
+
+	/* The caches are shared with the private contexts, but are
+	   rebuilt on demand. */
+	pthread_mutex_lock(&language_cache_mutex);
+	language_cache_count = 0;
+	language_cache_next = 0;
+	pthread_mutex_unlock(&language_cache_mutex);
+
+#ifndef __ANDROID__
+	pthread_mutex_lock(&string_ic_mutex);
+	if (string_ic != (iconv_t)-1) {
+		iconv_close(string_ic);
+		string_ic = (iconv_t)-1;
+	}
+	pthread_mutex_unlock(&string_ic_mutex);
+#endif
 
 	return 0;
 }
 
+#ifdef INVASIVE_GET_USAGE
+/* Read the usage page and usage of an interface of a device which has been
+   opened by the caller. Returns 0 on success and -1 on failure. */
+static int get_interface_usage(libusb_device_handle *handle, int interface_num,
+	unsigned short *usage_page, unsigned short *usage)
+{
+	int res;
+	int ret = -1;
+
+	/*
+	This section is removed because it is too
+	invasive on the system. Getting a Usage Page
+	and Usage requires parsing the HID Report
+	descriptor. Getting a HID Report descriptor
+	involves claiming the interface. Claiming the
+	interface involves detaching the kernel driver.
+	Detaching the kernel driver is hard on the system
+	because it will unclaim interfaces (if another
+	app has them claimed) and the re-attachment of
+	the driver will sometimes change /dev entry names.
+	It is for these reasons that this section is
+	#if 0. For composite devices, use the interface
+	field in the hid_device_info struct to distinguish
+	between interfaces. */
+	unsigned char data[256];
+#ifdef DETACH_KERNEL_DRIVER
+	int detached = 0;
+	/* Usage Page and Usage */
+	res = libusb_kernel_driver_active(handle, interface_num);
+	if (res == 1) {
+		res = libusb_detach_kernel_driver(handle, interface_num);
+		if (res < 0)
+			LOG("Couldn't detach kernel driver, even though a kernel driver was attached.");
+		else
+			detached = 1;
+	}
+#endif
+	res = libusb_claim_interface(handle, interface_num);
+	if (res >= 0) {
+		/* Get the HID Report Descriptor. */
+		res = libusb_control_transfer(handle, LIBUSB_ENDPOINT_IN|LIBUSB_RECIPIENT_INTERFACE, LIBUSB_REQUEST_GET_DESCRIPTOR, LIBUSB_DT_REPORT << 8, interface_num, data, sizeof(data), 5000);
+		if (res >= 0) {
+			/* Parse the usage and usage page
+			   out of the report descriptor. */
+			ret = get_usage(data, res, usage_page, usage);
+		}
+		else
+			LOG("libusb_control_transfer() for getting the HID report failed with %d\n", res);
+
+		/* Release the interface */
+		res = libusb_release_interface(handle, interface_num);
+		if (res < 0)
+			LOG("Can't release the interface.\n");
+	}
+	else
+		LOG("Can't claim interface %d\n", res);
+#ifdef DETACH_KERNEL_DRIVER
+	/* Re-attach kernel driver if necessary. */
+	if (detached) {
+		res = libusb_attach_kernel_driver(handle, interface_num);
+		if (res < 0)
+			LOG("Couldn't re-attach kernel driver.\n");
+	}
+#endif
+
+	return ret;
+}
+#endif /* INVASIVE_GET_USAGE */
+
+/* Fill in the strings, and the usage if INVASIVE_GET_USAGE is defined, of
+   an enumerated device which has been opened by the caller. Fields which
+   are already set are left alone. */
+static void fill_device_strings(libusb_device_handle *handle,
+	const struct libusb_device_descriptor *desc, int interface_num,
+	struct hid_device_info *cur_dev)
+{
+	/* Serial Number, Manufacturer and Product strings */
+	get_usb_strings(handle,
+		desc->iSerialNumber, &cur_dev->serial_number,
+		desc->iManufacturer, &cur_dev->manufacturer_string,
+		desc->iProduct, &cur_dev->product_string);
+
+#ifdef INVASIVE_GET_USAGE
+	if (cur_dev->usage_page == 0 && cur_dev->usage == 0)
+		get_interface_usage(handle, interface_num, &cur_dev->usage_page, &cur_dev->usage);
+#else
+	(void) interface_num;
+#endif
+}
+
 struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id)
 {
+	return hid_enumerate_ex(vendor_id, product_id, 0);
+}
+
+struct hid_device_info  HID_API_EXPORT *hid_enumerate_ex(unsigned short vendor_id, unsigned short product_id, unsigned int flags)
+{
+	struct hid_enumeration_filter filter;
+
+	memset(&filter, 0, sizeof(filter));
+	filter.vendor_id = vendor_id;
+	filter.product_id = product_id;
+	filter.interface_number = -1;
+	filter.flags = flags;
+
+	return hid_enumerate_filter(&filter);
+}
+
+/* Convert a wide string to UTF-8. This does not go through the locale,
+   as wcstombs() does, which cannot convert non-ASCII characters under
+   the default "C" locale. The caller must free() the returned string. */
+static char *wchar_to_utf8(const wchar_t *wstr)
+{
+	size_t len = 0;
+	size_t i;
+	char *ret, *p;
+
+	for (i = 0; wstr[i]; i++) {
+		unsigned long c = (unsigned long) wstr[i];
+		len += (c < 0x80)? 1: (c < 0x800)? 2: (c < 0x10000)? 3: 4;
+	}
+
+	ret = malloc(len + 1);
+	if (!ret)
+		return NULL;
+
+	p = ret;
+	for (i = 0; wstr[i]; i++) {
+		unsigned long c = (unsigned long) wstr[i];
+		if (c < 0x80) {
+			*p++ = (char) c;
+		}
+		else if (c < 0x800) {
+			*p++ = (char) (0xC0 | (c >> 6));
+			*p++ = (char) (0x80 | (c & 0x3F));
+		}
+		else if (c < 0x10000) {
+			*p++ = (char) (0xE0 | (c >> 12));
+			*p++ = (char) (0x80 | ((c >> 6) & 0x3F));
+			*p++ = (char) (0x80 | (c & 0x3F));
+		}
+		else {
+			*p++ = (char) (0xF0 | ((c >> 18) & 0x07));
+			*p++ = (char) (0x80 | ((c >> 12) & 0x3F));
+			*p++ = (char) (0x80 | ((c >> 6) & 0x3F));
+			*p++ = (char) (0x80 | (c & 0x3F));
+		}
+	}
+	*p = '\0';
+
+	return ret;
+}
+
+/* Returns 1 if the serial number of the device matches the pattern of the
+   filter. The serial number read is handed over in *serial_number. */
+static int filter_matches_serial(const struct hid_enumeration_filter *filter,
+	libusb_device_handle *handle, const struct libusb_device_descriptor *desc,
+	wchar_t **serial_number)
+{
+	char *serial_utf8;
+	int matched;
+
+	if (!filter->serial_number)
+		return 1;
+
+	if (handle && desc->iSerialNumber > 0 && !*serial_number)
+		*serial_number = get_usb_string(handle, desc->iSerialNumber);
+	if (!*serial_number)
+		return fnmatch(filter->serial_number, "", 0) == 0;
+
+	serial_utf8 = wchar_to_utf8(*serial_number);
+	if (!serial_utf8)
+		return 0;
+	matched = fnmatch(filter->serial_number, serial_utf8, 0) == 0;
+	free(serial_utf8);
+
+	return matched;
+}
+
+hid_context HID_API_EXPORT *hid_context_new(void)
+{
+	hid_context *ctx = calloc(1, sizeof(hid_context));
+	if (!ctx)
+		return NULL;
+
+	if (libusb_init(&ctx->usb_context)) {
+		free(ctx);
+		return NULL;
+	}
+	init_locale();
+
+	return ctx;
+}
+
+void HID_API_EXPORT hid_context_free(hid_context *ctx)
+{
+	if (!ctx)
+		return;
+
+	libusb_exit(ctx->usb_context);
+	free(ctx);
+}
+
+struct hid_device_info  HID_API_EXPORT *hid_enumerate_filter(const struct hid_enumeration_filter *filter)
+{
+	return hid_enumerate_context(NULL, filter);
+}
+
+struct hid_device_info  HID_API_EXPORT *hid_enumerate_context(hid_context *ctx, const struct hid_enumeration_filter *filter)
+{
+	libusb_context *usb_ctx;
 	libusb_device **devs;
 	libusb_device *dev;
-	libusb_device_handle *handle;
 	ssize_t num_devs;
 	int i = 0;
 
 	struct hid_device_info *root = NULL; /* return object */
 	struct hid_device_info *cur_dev = NULL;
 
-	if(hid_init() < 0)
+	if (resolve_context(ctx, &usb_ctx) < 0)
 		return NULL;
 
-	num_devs = libusb_get_device_list(usb_context, &devs);
+	/* Everything on libusb is USB. */
+	if (filter->bus_type != HID_BUS_ANY && filter->bus_type != HID_BUS_USB)
+		return NULL;
+
+	num_devs = libusb_get_device_list(usb_ctx, &devs);
 	if (num_devs < 0)
 		return NULL;
 	while ((dev = devs[i++]) != NULL) {
 		struct libusb_device_descriptor desc;
 		struct libusb_config_descriptor *conf_desc = NULL;
+		libusb_device_handle *handle = NULL;
+		wchar_t *serial_number = NULL;
+		int serial_checked = 0;
 		int j, k;
 		int interface_num = 0;
 
@@ -545,6 +988,12 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 		unsigned short dev_vid = desc.idVendor;
 		unsigned short dev_pid = desc.idProduct;
 
+		/* Check the VID/PID against the filter before looking
+		   at the configuration. */
+		if ((filter->vendor_id != 0x0 && filter->vendor_id != dev_vid) ||
+		    (filter->product_id != 0x0 && filter->product_id != dev_pid))
+			continue;
+
 		res = libusb_get_active_config_descriptor(dev, &conf_desc);
 		if (res < 0)
 			libusb_get_config_descriptor(dev, 0, &conf_desc);
@@ -553,125 +1002,97 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 				const struct libusb_interface *intf = &conf_desc->interface[j];
 				for (k = 0; k < intf->num_altsetting; k++) {
 					const struct libusb_interface_descriptor *intf_desc;
-					intf_desc = &intf->altsetting[k];
-					if (intf_desc->bInterfaceClass == LIBUSB_CLASS_HID) {
-						interface_num = intf_desc->bInterfaceNumber;
-
-						/* Check the VID/PID against the arguments */
-						if ((vendor_id == 0x0 || vendor_id == dev_vid) &&
-						    (product_id == 0x0 || product_id == dev_pid)) {
-							struct hid_device_info *tmp;
-
-							/* VID/PID match. Create the record. */
-							tmp = calloc(1, sizeof(struct hid_device_info));
-							if (cur_dev) {
-								cur_dev->next = tmp;
-							}
-							else {
-								root = tmp;
-							}
-							cur_dev = tmp;
+					struct hid_device_info *tmp;
+					int need_handle;
 
-							/* Fill out the record */
-							cur_dev->next = NULL;
-							cur_dev->path = make_path(dev, interface_num);
-
-							res = libusb_open(dev, &handle);
+					intf_desc = &intf->altsetting[k];
+					if (intf_desc->bInterfaceClass != LIBUSB_CLASS_HID)
+						continue;
 
-							if (res >= 0) {
-								/* Serial Number */
-								if (desc.iSerialNumber > 0)
-									cur_dev->serial_number =
-										get_usb_string(handle, desc.iSerialNumber);
+					interface_num = intf_desc->bInterfaceNumber;
 
-								/* Manufacturer and Product strings */
-								if (desc.iManufacturer > 0)
-									cur_dev->manufacturer_string =
-										get_usb_string(handle, desc.iManufacturer);
-								if (desc.iProduct > 0)
-									cur_dev->product_string =
-										get_usb_string(handle, desc.iProduct);
+					/* Check the interface against the filter */
+					if (filter->interface_number >= 0 &&
+					    filter->interface_number != interface_num)
+						continue;
 
+					/* The device is only opened if there is
+					   something to read from it. */
+					need_handle = !(filter->flags & HID_ENUMERATE_NO_STRINGS) ||
+						filter->serial_number != NULL;
 #ifdef INVASIVE_GET_USAGE
-{
-							/*
-							This section is removed because it is too
-							invasive on the system. Getting a Usage Page
-							and Usage requires parsing the HID Report
-							descriptor. Getting a HID Report descriptor
-							involves claiming the interface. Claiming the
-							interface involves detaching the kernel driver.
-							Detaching the kernel driver is hard on the system
-							because it will unclaim interfaces (if another
-							app has them claimed) and the re-attachment of
-							the driver will sometimes change /dev entry names.
-							It is for these reasons that this section is
-							#if 0. For composite devices, use the interface
-							field in the hid_device_info struct to distinguish
-							between interfaces. */
-								unsigned char data[256];
-#ifdef DETACH_KERNEL_DRIVER
-								int detached = 0;
-								/* Usage Page and Usage */
-								res = libusb_kernel_driver_active(handle, interface_num);
-								if (res == 1) {
-									res = libusb_detach_kernel_driver(handle, interface_num);
-									if (res < 0)
-										LOG("Couldn't detach kernel driver, even though a kernel driver was attached.");
-									else
-										detached = 1;
-								}
-#endif
-								res = libusb_claim_interface(handle, interface_num);
-								if (res >= 0) {
-									/* Get the HID Report Descriptor. */
-									res = libusb_control_transfer(handle, LIBUSB_ENDPOINT_IN|LIBUSB_RECIPIENT_INTERFACE, LIBUSB_REQUEST_GET_DESCRIPTOR, (LIBUSB_DT_REPORT << 8)|interface_num, 0, data, sizeof(data), 5000);
-									if (res >= 0) {
-										unsigned short page=0, usage=0;
-										/* Parse the usage and usage page
-										   out of the report descriptor. */
-										get_usage(data, res,  &page, &usage);
-										cur_dev->usage_page = page;
-										cur_dev->usage = usage;
-									}
-									else
-										LOG("libusb_control_transfer() for getting the HID report failed with %d\n", res);
-
-									/* Release the interface */
-									res = libusb_release_interface(handle, interface_num);
-									if (res < 0)
-										LOG("Can't release the interface.\n");
-								}
-								else
-									LOG("Can't claim interface %d\n", res);
-#ifdef DETACH_KERNEL_DRIVER
-								/* Re-attach kernel driver if necessary. */
-								if (detached) {
-									res = libusb_attach_kernel_driver(handle, interface_num);
-									if (res < 0)
-										LOG("Couldn't re-attach kernel driver.\n");
-								}
+					need_handle = need_handle ||
+						filter->usage_page != 0 || filter->usage != 0;
 #endif
-}
-#endif /* INVASIVE_GET_USAGE */
+					if (need_handle && !handle) {
+						if (libusb_open(dev, &handle) < 0)
+							handle = NULL;
+					}
 
-								libusb_close(handle);
-							}
-							/* VID/PID */
-							cur_dev->vendor_id = dev_vid;
-							cur_dev->product_id = dev_pid;
+					/* The serial number is per device, so it is
+					   only checked once. */
+					if (!serial_checked) {
+						if (!filter_matches_serial(filter, handle, &desc, &serial_number))
+							goto next_device;
+						serial_checked = 1;
+					}
 
-							/* Release Number */
-							cur_dev->release_number = desc.bcdDevice;
+					/* Filter match. Create the record. */
+					tmp = calloc(1, sizeof(struct hid_device_info));
+					if (!tmp)
+						goto next_device;
 
-							/* Interface Number */
-							cur_dev->interface_number = interface_num;
+#ifdef INVASIVE_GET_USAGE
+					/* Check the usage against the filter */
+					if (filter->usage_page != 0 || filter->usage != 0) {
+						if (!handle ||
+						    get_interface_usage(handle, interface_num, &tmp->usage_page, &tmp->usage) < 0 ||
+						    (filter->usage_page != 0 && filter->usage_page != tmp->usage_page) ||
+						    (filter->usage != 0 && filter->usage != tmp->usage)) {
+							free(tmp);
+							continue;
 						}
 					}
+#endif
+
+					if (cur_dev) {
+						cur_dev->next = tmp;
+					}
+					else {
+						root = tmp;
+					}
+					cur_dev = tmp;
+
+					/* Fill out the record */
+					cur_dev->next = NULL;
+					cur_dev->path = make_path(dev, interface_num);
+
+					/* The serial number read for the filter is
+					   kept even without strings. */
+					if (serial_number)
+						cur_dev->serial_number = wcsdup(serial_number);
+
+					if (handle && !(filter->flags & HID_ENUMERATE_NO_STRINGS))
+						fill_device_strings(handle, &desc, interface_num, cur_dev);
+
+					/* VID/PID */
+					cur_dev->vendor_id = dev_vid;
+					cur_dev->product_id = dev_pid;
+
+					/* Release Number */
+					cur_dev->release_number = desc.bcdDevice;
+
+					/* Interface Number */
+					cur_dev->interface_number = interface_num;
 				} /* altsettings */
 			} /* interfaces */
+next_device:
 			libusb_free_config_descriptor(conf_desc);
 		}
+
+		if (handle)
+			libusb_close(handle);
+		free(serial_number);
 	}
 
 	libusb_free_device_list(devs, 1);
@@ -679,6 +1100,106 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 	return root;
 }
 
+int HID_API_EXPORT hid_enumerate_fill_strings(struct hid_device_info *info)
+{
+	return hid_enumerate_fill_strings_context(NULL, info);
+}
+
+int HID_API_EXPORT hid_enumerate_fill_strings_context(hid_context *ctx, struct hid_device_info *info)
+{
+	libusb_context *usb_ctx;
+	libusb_device **devs;
+	libusb_device *dev;
+	libusb_device_handle *handle;
+	unsigned int bus, address, interface_num;
+	ssize_t num_devs;
+	int res = -1;
+	int i = 0;
+
+	if (resolve_context(ctx, &usb_ctx) < 0)
+		return -1;
+
+	/* The path is made by make_path(): bus:address:interface */
+	if (!info || !info->path ||
+	    sscanf(info->path, "%x:%x:%x", &bus, &address, &interface_num) != 3)
+		return -1;
+
+	num_devs = libusb_get_device_list(usb_ctx, &devs);
+	if (num_devs < 0)
+		return -1;
+	while ((dev = devs[i++]) != NULL) {
+		struct libusb_device_descriptor desc;
+
+		if (libusb_get_bus_number(dev) != bus ||
+		    libusb_get_device_address(dev) != address)
+			continue;
+
+		if (libusb_get_device_descriptor(dev, &desc) < 0)
+			break;
+
+		if (libusb_open(dev, &handle) >= 0) {
+			fill_device_strings(handle, &desc, interface_num, info);
+			libusb_close(handle);
+			res = 0;
+		}
+		break;
+	}
+
+	libusb_free_device_list(devs, 1);
+
+	return res;
+}
+
+int HID_API_EXPORT hid_get_location(const char *path, char *buf, size_t buf_size)
+{
+	libusb_device **devs;
+	libusb_device *dev;
+	unsigned int bus, address, interface_num;
+	uint8_t ports[8];
+	char location[64];
+	ssize_t num_devs;
+	int res = -1;
+	int i = 0;
+
+	if (implicit_init() < 0)
+		return -1;
+
+	/* The path is made by make_path(): bus:address:interface */
+	if (!path || !buf || buf_size == 0 ||
+	    sscanf(path, "%x:%x:%x", &bus, &address, &interface_num) != 3)
+		return -1;
+
+	num_devs = libusb_get_device_list(usb_context, &devs);
+	if (num_devs < 0)
+		return -1;
+	while ((dev = devs[i++]) != NULL) {
+		int num_ports, len, j;
+
+		if (libusb_get_bus_number(dev) != bus ||
+		    libusb_get_device_address(dev) != address)
+			continue;
+
+		/* Same form as sysfs: bus-port.port...:interface */
+		num_ports = libusb_get_port_numbers(dev, ports, sizeof(ports));
+		if (num_ports < 0)
+			break;
+		len = snprintf(location, sizeof(location), "%u-", bus);
+		for (j = 0; j < num_ports; j++)
+			len += snprintf(location + len, sizeof(location) - len, j? ".%u": "%u", ports[j]);
+		len += snprintf(location + len, sizeof(location) - len, ":%u", interface_num);
+
+		if (len < (int) buf_size && len < (int) sizeof(location)) {
+			memcpy(buf, location, len + 1);
+			res = len;
+		}
+		break;
+	}
+
+	libusb_free_device_list(devs, 1);
+
+	return res;
+}
+
 void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
 {
 	struct hid_device_info *d = devs;
@@ -693,42 +1214,119 @@ void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
 	}
 }
 
-hid_device * hid_open(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number)
+/* Find the path of the first HID interface of the first device matching
+   vendor_id, product_id and, if it is not NULL, serial_number. Only the
+   device descriptors cached by libusb are looked at, so no device is
+   opened unless its VID/PID matches and a serial number has to be
+   compared. The caller must free() the returned path. */
+static char *find_path_by_id(libusb_context *usb_ctx,
+	unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number)
 {
-	struct hid_device_info *devs, *cur_dev;
-	const char *path_to_open = NULL;
-	hid_device *handle = NULL;
+	libusb_device **devs;
+	libusb_device *dev;
+	libusb_device_handle *handle;
+	char *path = NULL;
+	ssize_t num_devs;
+	int i = 0;
 
-	devs = hid_enumerate(vendor_id, product_id);
-	cur_dev = devs;
-	while (cur_dev) {
-		if (cur_dev->vendor_id == vendor_id &&
-		    cur_dev->product_id == product_id) {
-			if (serial_number) {
-				if (cur_dev->serial_number &&
-				    wcscmp(serial_number, cur_dev->serial_number) == 0) {
-					path_to_open = cur_dev->path;
+	num_devs = libusb_get_device_list(usb_ctx, &devs);
+	if (num_devs < 0)
+		return NULL;
+	while (path == NULL && (dev = devs[i++]) != NULL) {
+		struct libusb_device_descriptor desc;
+		struct libusb_config_descriptor *conf_desc = NULL;
+		int j, k;
+
+		if (libusb_get_device_descriptor(dev, &desc) < 0)
+			continue;
+
+		/* Check the VID/PID against the arguments */
+		if (desc.idVendor != vendor_id || desc.idProduct != product_id)
+			continue;
+
+		if (serial_number) {
+			wchar_t *serial = NULL;
+			int match;
+
+			if (desc.iSerialNumber == 0)
+				continue;
+			if (libusb_open(dev, &handle) < 0)
+				continue;
+			serial = get_usb_string(handle, desc.iSerialNumber);
+			libusb_close(handle);
+
+			match = serial && wcscmp(serial_number, serial) == 0;
+			free(serial);
+			if (!match)
+				continue;
+		}
+
+		if (libusb_get_active_config_descriptor(dev, &conf_desc) < 0)
+			libusb_get_config_descriptor(dev, 0, &conf_desc);
+		if (!conf_desc)
+			continue;
+
+		for (j = 0; j < conf_desc->bNumInterfaces && path == NULL; j++) {
+			const struct libusb_interface *intf = &conf_desc->interface[j];
+			for (k = 0; k < intf->num_altsetting; k++) {
+				const struct libusb_interface_descriptor *intf_desc;
+				intf_desc = &intf->altsetting[k];
+				if (intf_desc->bInterfaceClass == LIBUSB_CLASS_HID) {
+					path = make_path(dev, intf_desc->bInterfaceNumber);
 					break;
 				}
 			}
-			else {
-				path_to_open = cur_dev->path;
-				break;
-			}
 		}
-		cur_dev = cur_dev->next;
+		libusb_free_config_descriptor(conf_desc);
 	}
 
+	libusb_free_device_list(devs, 1);
+
+	return path;
+}
+
+hid_device * hid_open(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number)
+{
+	return hid_open_context(NULL, vendor_id, product_id, serial_number);
+}
+
+hid_device * HID_API_EXPORT hid_open_context(hid_context *ctx, unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number)
+{
+	libusb_context *usb_ctx;
+	char *path_to_open;
+	hid_device *handle = NULL;
+
+	if (resolve_context(ctx, &usb_ctx) < 0)
+		return NULL;
+
+	path_to_open = find_path_by_id(usb_ctx, vendor_id, product_id, serial_number);
 	if (path_to_open) {
 		/* Open the device */
-		handle = hid_open_path(path_to_open);
+		handle = hid_open_path_context(ctx, path_to_open);
+		free(path_to_open);
 	}
 
-	hid_free_enumeration(devs);
-
 	return handle;
 }
 
+static void notify_wait_any(void)
+{
+	pthread_mutex_lock(&wait_any_mutex);
+	wait_any_generation++;
+	if (wait_any_waiters > 0)
+		pthread_cond_broadcast(&wait_any_condition);
+	pthread_mutex_unlock(&wait_any_mutex);
+}
+
+/* CLOCK_MONOTONIC in nanoseconds. clock_gettime() is served by the vDSO,
+   so this does not cost a system call. */
+static unsigned long long monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 static void read_callback(struct libusb_transfer *transfer)
 {
 	hid_device *dev = transfer->user_data;
@@ -736,18 +1334,42 @@ static void read_callback(struct libusb_transfer *transfer)
 
 	if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
 
-		struct input_report *rpt = malloc(sizeof(*rpt));
+		struct input_report *rpt;
+		unsigned long long timestamp;
+
+		HID_TRACE_BEGIN("read_callback");
+		timestamp = monotonic_ns();
+
+		HID_TRACE_BEGIN("mutex_wait");
+		pthread_mutex_lock(&dev->mutex);
+		HID_TRACE_END("mutex_wait", 0);
+
+		/* Captured here, on the read thread, rather than by the
+		   reader of the report. */
+		if (dev->capture)
+			hid_capture_record(dev->capture, dev->capture_tag, HID_CAPTURE_INPUT, timestamp, transfer->buffer, transfer->actual_length);
+
+		/* An unchanged report is dropped before it is copied, and
+		   wakes no reader. */
+		if (hid_change_suppress(dev->changes, transfer->buffer, transfer->actual_length)) {
+			hid_stats_add(&dev->stats.reports_suppressed, 1);
+			pthread_mutex_unlock(&dev->mutex);
+			HID_TRACE_END("read_callback", 0);
+			goto resubmit;
+		}
+
+		rpt = malloc(sizeof(*rpt));
 		rpt->data = malloc(transfer->actual_length);
 		memcpy(rpt->data, transfer->buffer, transfer->actual_length);
 		rpt->len = transfer->actual_length;
+		rpt->timestamp = timestamp;
 		rpt->next = NULL;
 
-		pthread_mutex_lock(&dev->mutex);
-
 		/* Attach the new report object to the end of the list. */
 		if (dev->input_reports == NULL) {
 			/* The list is empty. Put it at the root. */
 			dev->input_reports = rpt;
+			hid_stats_max(&dev->stats.queue_high_water, 1);
 			pthread_cond_signal(&dev->condition);
 		}
 		else {
@@ -759,15 +1381,20 @@ static void read_callback(struct libusb_transfer *transfer)
 				num_queued++;
 			}
 			cur->next = rpt;
+			hid_stats_max(&dev->stats.queue_high_water, num_queued + 2);
 
 			/* Pop one off if we've reached 30 in the queue. This
 			   way we don't grow forever if the user never reads
 			   anything from the device. */
 			if (num_queued > 30) {
-				return_data(dev, NULL, 0);
+				return_data(dev, NULL, 0, NULL);
+				hid_stats_add(&dev->stats.reports_dropped, 1);
 			}
 		}
 		pthread_mutex_unlock(&dev->mutex);
+
+		notify_wait_any();
+		HID_TRACE_END("read_callback", transfer->actual_length);
 	}
 	else if (transfer->status == LIBUSB_TRANSFER_CANCELLED) {
 		dev->shutdown_thread = 1;
@@ -786,6 +1413,7 @@ static void read_callback(struct libusb_transfer *transfer)
 		LOG("Unknown transfer code: %d\n", transfer->status);
 	}
 
+resubmit:
 	/* Re-submit the transfer object. */
 	res = libusb_submit_transfer(transfer);
 	if (res != 0) {
@@ -824,7 +1452,7 @@ static void *read_thread(void *param)
 	/* Handle all the events. */
 	while (!dev->shutdown_thread) {
 		int res;
-		res = libusb_handle_events(usb_context);
+		res = libusb_handle_events(dev->usb_context);
 		if (res < 0) {
 			/* There was an error. */
 			LOG("read_thread(): libusb reports error # %d\n", res);
@@ -844,7 +1472,7 @@ static void *read_thread(void *param)
 	libusb_cancel_transfer(dev->transfer);
 
 	while (!dev->cancelled)
-		libusb_handle_events_completed(usb_context, &dev->cancelled);
+		libusb_handle_events_completed(dev->usb_context, &dev->cancelled);
 
 	/* Now that the read thread is stopping, Wake any threads which are
 	   waiting on data (in hid_read_timeout()). Do this under a mutex to
@@ -855,6 +1483,8 @@ static void *read_thread(void *param)
 	pthread_cond_broadcast(&dev->condition);
 	pthread_mutex_unlock(&dev->mutex);
 
+	notify_wait_any();
+
 	/* The dev->transfer->buffer and dev->transfer objects are cleaned up
 	   in hid_close(). They are not cleaned up here because this thread
 	   could end either due to a disconnect or due to a user
@@ -869,6 +1499,12 @@ static void *read_thread(void *param)
 
 hid_device * HID_API_EXPORT hid_open_path(const char *path)
 {
+	return hid_open_path_context(NULL, path);
+}
+
+hid_device * HID_API_EXPORT hid_open_path_context(hid_context *ctx, const char *path)
+{
+	libusb_context *usb_ctx;
 	hid_device *dev = NULL;
 
 	libusb_device **devs;
@@ -877,12 +1513,16 @@ hid_device * HID_API_EXPORT hid_open_path(const char *path)
 	int d = 0;
 	int good_open = 0;
 
-	if(hid_init() < 0)
+	if (resolve_context(ctx, &usb_ctx) < 0)
 		return NULL;
 
 	dev = new_hid_device();
+	dev->usb_context = usb_ctx;
 
-	libusb_get_device_list(usb_context, &devs);
+	if (libusb_get_device_list(usb_ctx, &devs) < 0) {
+		free_hid_device(dev);
+		return NULL;
+	}
 	while ((usb_dev = devs[d++]) != NULL) {
 		struct libusb_device_descriptor desc;
 		struct libusb_config_descriptor *conf_desc = NULL;
@@ -1000,7 +1640,27 @@ hid_device * HID_API_EXPORT hid_open_path(const char *path)
 }
 
 
-int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t length)
+/* Records a report sent to the device, if it is being captured. */
+static void capture_report(hid_device *dev, int type, const unsigned char *data, size_t length)
+{
+	if (!__atomic_load_n(&dev->capture, __ATOMIC_RELAXED))
+		return;
+
+	pthread_mutex_lock(&dev->mutex);
+	if (dev->capture)
+		hid_capture_record(dev->capture, dev->capture_tag, type, monotonic_ns(), data, length);
+	pthread_mutex_unlock(&dev->mutex);
+}
+
+void HID_API_EXPORT hid_set_capture(hid_device *dev, struct hid_capture *capture, int tag)
+{
+	pthread_mutex_lock(&dev->mutex);
+	dev->capture_tag = tag;
+	__atomic_store_n(&dev->capture, capture, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&dev->mutex);
+}
+
+static int write_report(hid_device *dev, const unsigned char *data, size_t length)
 {
 	int res;
 	int report_number = data[0];
@@ -1050,9 +1710,33 @@ int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t
 	}
 }
 
+int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t length)
+{
+	unsigned long long start;
+	int res;
+
+	HID_TRACE_BEGIN("hid_write");
+	start = monotonic_ns();
+	res = write_report(dev, data, length);
+
+	if (res < 0) {
+		hid_stats_add(&dev->stats.write_errors, 1);
+	}
+	else {
+		hid_stats_add(&dev->stats.reports_written, 1);
+		hid_stats_add(&dev->stats.bytes_written, res);
+		hid_stats_latency(dev->stats.write_latency, start, monotonic_ns());
+		capture_report(dev, HID_CAPTURE_OUTPUT, data, length);
+	}
+
+	HID_TRACE_END("hid_write", res);
+	return res;
+}
+
 /* Helper function, to simplify hid_read().
-   This should be called with dev->mutex locked. */
-static int return_data(hid_device *dev, unsigned char *data, size_t length)
+   This should be called with dev->mutex locked. Reports handed to
+   the caller, that is with data set, are counted in the statistics. */
+static int return_data(hid_device *dev, unsigned char *data, size_t length, unsigned long long *timestamp)
 {
 	/* Copy the data out of the linked list item (rpt) into the
 	   return buffer (data), and delete the liked list item. */
@@ -1060,6 +1744,13 @@ static int return_data(hid_device *dev, unsigned char *data, size_t length)
 	size_t len = (length < rpt->len)? length: rpt->len;
 	if (len > 0)
 		memcpy(data, rpt->data, len);
+	if (timestamp)
+		*timestamp = rpt->timestamp;
+	if (data) {
+		hid_stats_add(&dev->stats.reports_read, 1);
+		hid_stats_add(&dev->stats.bytes_read, len);
+		hid_stats_latency(dev->stats.read_latency, rpt->timestamp, monotonic_ns());
+	}
 	dev->input_reports = rpt->next;
 	free(rpt->data);
 	free(rpt);
@@ -1074,6 +1765,11 @@ static void cleanup_mutex(void *param)
 
 
 int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+{
+	return hid_read_timeout_timestamped(dev, data, length, milliseconds, NULL);
+}
+
+int HID_API_EXPORT hid_read_timeout_timestamped(hid_device *dev, unsigned char *data, size_t length, int milliseconds, unsigned long long *timestamp)
 {
 	int bytes_read = -1;
 
@@ -1084,13 +1780,16 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 	return transferred;
 #endif
 
+	HID_TRACE_BEGIN("hid_read");
+	HID_TRACE_BEGIN("mutex_wait");
 	pthread_mutex_lock(&dev->mutex);
+	HID_TRACE_END("mutex_wait", 0);
 	pthread_cleanup_push(&cleanup_mutex, dev);
 
 	/* There's an input report queued up. Return it. */
 	if (dev->input_reports) {
 		/* Return the first one */
-		bytes_read = return_data(dev, data, length);
+		bytes_read = return_data(dev, data, length, timestamp);
 		goto ret;
 	}
 
@@ -1107,7 +1806,7 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 			pthread_cond_wait(&dev->condition, &dev->mutex);
 		}
 		if (dev->input_reports) {
-			bytes_read = return_data(dev, data, length);
+			bytes_read = return_data(dev, data, length, timestamp);
 		}
 	}
 	else if (milliseconds > 0) {
@@ -1126,7 +1825,7 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 			res = pthread_cond_timedwait(&dev->condition, &dev->mutex, &ts);
 			if (res == 0) {
 				if (dev->input_reports) {
-					bytes_read = return_data(dev, data, length);
+					bytes_read = return_data(dev, data, length, timestamp);
 					break;
 				}
 
@@ -1136,6 +1835,7 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 			}
 			else if (res == ETIMEDOUT) {
 				/* Timed out. */
+				hid_stats_add(&dev->stats.read_timeouts, 1);
 				bytes_read = 0;
 				break;
 			}
@@ -1155,6 +1855,10 @@ ret:
 	pthread_mutex_unlock(&dev->mutex);
 	pthread_cleanup_pop(0);
 
+	if (bytes_read < 0)
+		hid_stats_add(&dev->stats.read_errors, 1);
+
+	HID_TRACE_END("hid_read", bytes_read);
 	return bytes_read;
 }
 
@@ -1163,6 +1867,187 @@ int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length)
 	return hid_read_timeout(dev, data, length, dev->blocking ? -1 : 0);
 }
 
+int HID_API_EXPORT hid_read_timestamped(hid_device *dev, unsigned char *data, size_t length, unsigned long long *timestamp)
+{
+	return hid_read_timeout_timestamped(dev, data, length, dev->blocking ? -1 : 0, timestamp);
+}
+
+int HID_API_EXPORT hid_read_all(hid_device *dev, unsigned char *data, size_t length, size_t *offsets, unsigned long long *timestamps, size_t max_reports)
+{
+	struct input_report *taken, *last = NULL, *rpt;
+	size_t needed = 0;
+	size_t num_reports = 0;
+	int shutdown;
+	unsigned long long now;
+
+	if (!data || !offsets)
+		return -1;
+
+	/* Detach as many reports as fit in one go, the copies and frees are
+	   done after the read thread has been let go again. */
+	HID_TRACE_BEGIN("hid_read_all");
+	HID_TRACE_BEGIN("mutex_wait");
+	pthread_mutex_lock(&dev->mutex);
+	HID_TRACE_END("mutex_wait", 0);
+	taken = dev->input_reports;
+	for (rpt = taken; rpt != NULL && num_reports < max_reports; rpt = rpt->next) {
+		if (needed + rpt->len > length) {
+			/* A report longer than the whole buffer would stay at
+			   the head of the queue for ever, so it is taken
+			   truncated, as hid_read() would. */
+			if (num_reports == 0 && length > 0) {
+				num_reports = 1;
+				last = rpt;
+			}
+			break;
+		}
+		needed += rpt->len;
+		num_reports++;
+		last = rpt;
+	}
+	if (last) {
+		dev->input_reports = last->next;
+		last->next = NULL;
+	}
+	else {
+		taken = NULL;
+	}
+	shutdown = dev->shutdown_thread;
+	pthread_mutex_unlock(&dev->mutex);
+
+	if (num_reports == 0) {
+		if (shutdown)
+			hid_stats_add(&dev->stats.read_errors, 1);
+		HID_TRACE_END("hid_read_all", 0);
+		return shutdown? -1: 0;
+	}
+
+	now = monotonic_ns();
+	offsets[0] = 0;
+	num_reports = 0;
+	while (taken) {
+		size_t len;
+
+		rpt = taken;
+		taken = rpt->next;
+
+		len = (length - offsets[num_reports] < rpt->len)? length - offsets[num_reports]: rpt->len;
+		memcpy(data + offsets[num_reports], rpt->data, len);
+		offsets[num_reports + 1] = offsets[num_reports] + len;
+		if (timestamps)
+			timestamps[num_reports] = rpt->timestamp;
+		hid_stats_latency(dev->stats.read_latency, rpt->timestamp, now);
+		num_reports++;
+
+		free(rpt->data);
+		free(rpt);
+	}
+
+	hid_stats_add(&dev->stats.reports_read, num_reports);
+	hid_stats_add(&dev->stats.bytes_read, offsets[num_reports]);
+
+	HID_TRACE_END("hid_read_all", num_reports);
+	return (int) num_reports;
+}
+
+/* Mark the devices which have a report queued or whose read thread has
+   stopped. Returns the number of them. */
+static int mark_ready_devices(hid_device **devs, size_t num_devs, int *ready)
+{
+	size_t i;
+	int num_ready = 0;
+
+	for (i = 0; i < num_devs; i++) {
+		pthread_mutex_lock(&devs[i]->mutex);
+		ready[i] = devs[i]->input_reports != NULL || devs[i]->shutdown_thread;
+		pthread_mutex_unlock(&devs[i]->mutex);
+		num_ready += ready[i];
+	}
+
+	return num_ready;
+}
+
+hid_wake_event HID_API_EXPORT *hid_wake_event_new(void)
+{
+	return calloc(1, sizeof(hid_wake_event));
+}
+
+void HID_API_EXPORT hid_wake_event_free(hid_wake_event *event)
+{
+	free(event);
+}
+
+void HID_API_EXPORT hid_wake_event_signal(hid_wake_event *event)
+{
+	pthread_mutex_lock(&wait_any_mutex);
+	event->signalled = 1;
+	wait_any_generation++;
+	if (wait_any_waiters > 0)
+		pthread_cond_broadcast(&wait_any_condition);
+	pthread_mutex_unlock(&wait_any_mutex);
+}
+
+int HID_API_EXPORT hid_wait_any(hid_device **devs, size_t num_devs, int *ready, int milliseconds)
+{
+	return hid_wait_any_event(devs, num_devs, ready, milliseconds, NULL);
+}
+
+int HID_API_EXPORT hid_wait_any_event(hid_device **devs, size_t num_devs, int *ready, int milliseconds, hid_wake_event *event)
+{
+	struct timespec ts;
+	unsigned long generation;
+	int num_ready;
+	int woken = 0;
+	int res = 0;
+
+	if ((num_devs > 0 && (!devs || !ready)) || (num_devs == 0 && !event))
+		return -1;
+
+	if (milliseconds > 0) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += milliseconds / 1000;
+		ts.tv_nsec += (milliseconds % 1000) * 1000000;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+	}
+
+	for (;;) {
+		/* Take the generation before looking, so that a report
+		   queued while looking wakes the wait below at once. */
+		pthread_mutex_lock(&wait_any_mutex);
+		generation = wait_any_generation;
+		if (event && event->signalled) {
+			event->signalled = 0;
+			woken = 1;
+		}
+		pthread_mutex_unlock(&wait_any_mutex);
+
+		num_ready = mark_ready_devices(devs, num_devs, ready);
+		if (num_ready > 0 || woken || milliseconds == 0 || res == ETIMEDOUT)
+			return num_ready;
+
+		pthread_mutex_lock(&wait_any_mutex);
+		wait_any_waiters++;
+		while (generation == wait_any_generation) {
+			if (milliseconds < 0) {
+				pthread_cond_wait(&wait_any_condition, &wait_any_mutex);
+			}
+			else {
+				res = pthread_cond_timedwait(&wait_any_condition, &wait_any_mutex, &ts);
+				if (res != 0)
+					break;
+			}
+		}
+		wait_any_waiters--;
+		pthread_mutex_unlock(&wait_any_mutex);
+
+		if (res != 0 && res != ETIMEDOUT)
+			return -1;
+	}
+}
+
 int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
 {
 	dev->blocking = !nonblock;
@@ -1183,6 +2068,7 @@ int HID_API_EXPORT hid_send_feature_report(hid_device *dev, const unsigned char
 		skipped_report_id = 1;
 	}
 
+	HID_TRACE_BEGIN("hid_send_feature_report");
 	res = libusb_control_transfer(dev->device_handle,
 		LIBUSB_REQUEST_TYPE_CLASS|LIBUSB_RECIPIENT_INTERFACE|LIBUSB_ENDPOINT_OUT,
 		0x09/*HID set_report*/,
@@ -1190,6 +2076,7 @@ int HID_API_EXPORT hid_send_feature_report(hid_device *dev, const unsigned char
 		dev->interface,
 		(unsigned char *)data, length,
 		1000/*timeout millis*/);
+	HID_TRACE_END("hid_send_feature_report", res);
 
 	if (res < 0)
 		return -1;
@@ -1198,6 +2085,8 @@ int HID_API_EXPORT hid_send_feature_report(hid_device *dev, const unsigned char
 	if (skipped_report_id)
 		length++;
 
+	capture_report(dev, HID_CAPTURE_FEATURE_SET, data - skipped_report_id, length);
+
 	return length;
 }
 
@@ -1214,6 +2103,7 @@ int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data,
 		length--;
 		skipped_report_id = 1;
 	}
+	HID_TRACE_BEGIN("hid_get_feature_report");
 	res = libusb_control_transfer(dev->device_handle,
 		LIBUSB_REQUEST_TYPE_CLASS|LIBUSB_RECIPIENT_INTERFACE|LIBUSB_ENDPOINT_IN,
 		0x01/*HID get_report*/,
@@ -1221,6 +2111,7 @@ int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data,
 		dev->interface,
 		(unsigned char *)data, length,
 		1000/*timeout millis*/);
+	HID_TRACE_END("hid_get_feature_report", res);
 
 	if (res < 0)
 		return -1;
@@ -1228,6 +2119,8 @@ int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data,
 	if (skipped_report_id)
 		res++;
 
+	capture_report(dev, HID_CAPTURE_FEATURE_GET, data - skipped_report_id, res);
+
 	return res;
 }
 
@@ -1257,7 +2150,7 @@ void HID_API_EXPORT hid_close(hid_device *dev)
 	/* Clear out the queue of received reports. */
 	pthread_mutex_lock(&dev->mutex);
 	while (dev->input_reports) {
-		return_data(dev, NULL, 0);
+		return_data(dev, NULL, 0, NULL);
 	}
 	pthread_mutex_unlock(&dev->mutex);
 
@@ -1301,6 +2194,120 @@ HID_API_EXPORT const wchar_t * HID_API_CALL  hid_error(hid_device *dev)
 	return NULL;
 }
 
+HID_API_EXPORT struct hid_device_info * HID_API_CALL hid_get_device_info(hid_device *dev)
+{
+	struct libusb_device_descriptor desc;
+	libusb_device *usb_dev;
+	struct hid_device_info *info;
+
+	/* Served from memory once it has been collected. */
+	if (dev->device_info)
+		return dev->device_info;
+
+	usb_dev = libusb_get_device(dev->device_handle);
+	if (libusb_get_device_descriptor(usb_dev, &desc) < 0)
+		return NULL;
+
+	info = calloc(1, sizeof(struct hid_device_info));
+	if (!info)
+		return NULL;
+
+	info->next = NULL;
+	info->path = make_path(usb_dev, dev->interface);
+
+	/* VID/PID */
+	info->vendor_id = desc.idVendor;
+	info->product_id = desc.idProduct;
+
+	/* Serial Number, Manufacturer and Product strings */
+	get_usb_strings(dev->device_handle,
+		dev->serial_index, &info->serial_number,
+		dev->manufacturer_index, &info->manufacturer_string,
+		dev->product_index, &info->product_string);
+
+	/* Release Number */
+	info->release_number = desc.bcdDevice;
+
+	/* Interface Number */
+	info->interface_number = dev->interface;
+
+	dev->device_info = info;
+
+	return info;
+}
+
+int HID_API_EXPORT_CALL hid_get_report_descriptor(hid_device *dev, unsigned char *buf, size_t buf_size)
+{
+	int res;
+
+	if (buf_size > HID_API_MAX_REPORT_DESCRIPTOR_SIZE)
+		buf_size = HID_API_MAX_REPORT_DESCRIPTOR_SIZE;
+
+	/* The interface is claimed in hid_open_path(), so the descriptor
+	   can be fetched without touching the kernel driver. */
+	res = libusb_control_transfer(dev->device_handle,
+		LIBUSB_ENDPOINT_IN|LIBUSB_RECIPIENT_INTERFACE,
+		LIBUSB_REQUEST_GET_DESCRIPTOR,
+		(LIBUSB_DT_REPORT << 8),
+		dev->interface,
+		buf, (uint16_t) buf_size,
+		5000/*timeout millis*/);
+
+	if (res < 0) {
+		LOG("libusb_control_transfer() for getting the HID report descriptor failed with %d\n", res);
+		return -1;
+	}
+
+	return res;
+}
+
+int HID_API_EXPORT_CALL hid_get_device_stats(hid_device *dev, struct hid_device_stats *stats)
+{
+	if (!dev || !stats)
+		return -1;
+
+	hid_stats_copy(stats, &dev->stats);
+
+	return 0;
+}
+
+void HID_API_EXPORT_CALL hid_reset_device_stats(hid_device *dev)
+{
+	if (dev)
+		hid_stats_reset(&dev->stats);
+}
+
+int HID_API_EXPORT_CALL hid_set_change_filter(hid_device *dev, int report_id, const unsigned char *mask, size_t mask_length)
+{
+	unsigned char descriptor[HID_API_MAX_REPORT_DESCRIPTOR_SIZE];
+	int size;
+	int res;
+
+	if (!dev)
+		return -1;
+
+	/* Before taking the mutex, this is a control transfer. */
+	size = hid_get_report_descriptor(dev, descriptor, sizeof(descriptor));
+	if (size < 0)
+		return -1;
+
+	pthread_mutex_lock(&dev->mutex);
+	res = hid_change_set(&dev->changes, hid_change_uses_numbered_reports(descriptor, size), report_id, mask, mask_length);
+	pthread_mutex_unlock(&dev->mutex);
+
+	return res;
+}
+
+void HID_API_EXPORT_CALL hid_clear_change_filter(hid_device *dev, int report_id)
+{
+	if (!dev)
+		return;
+
+	pthread_mutex_lock(&dev->mutex);
+	hid_change_clear(&dev->changes, report_id);
+	pthread_mutex_unlock(&dev->mutex);
+}
+
 
 struct lang_map_entry {
 	const char *name;
@@ -34,8 +34,15 @@
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <sys/utsname.h>
+#include <sys/sysmacros.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <poll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <dirent.h>
+#include <limits.h>
+#include <fnmatch.h>
 
 /* Linux */
 #include <linux/hidraw.h>
@@ -44,6 +51,10 @@
 #include <libudev.h>
 
 #include "hidapi.h"
+#include "hidapi_stats.h"
+#include "hidapi_trace.h"
+#include "hidapi_capture.h"
+#include "hidapi_change.h"
 
 /* Definitions from linux/hidraw.h. Since these are new, some distros
    may not have header files which contain them. */
@@ -54,6 +65,9 @@
 #define HIDIOCGFEATURE(len)    _IOC(_IOC_WRITE|_IOC_READ, 'H', 0x07, len)
 #endif
 
+/* The longest report hidraw returns, HID_MAX_BUFFER_SIZE of the kernel. */
+#define MAX_REPORT_SIZE 16384
+
 
 /* USB HID device property names */
 const char *device_string_names[] = {
@@ -75,8 +89,37 @@ struct hid_device_ {
 	int device_handle;
 	int blocking;
 	int uses_numbered_reports;
+	struct hid_device_info *device_info;
+	struct hid_device_stats stats;
+
+	/* Set by hid_capture_attach(), only changed with capture_mutex
+	   locked, so it can not go away under a record in progress. */
+	struct hid_capture *capture;
+	int capture_tag;
+	pthread_mutex_t capture_mutex;
+
+	/* Set by hid_set_change_filter(), only used with change_mutex
+	   locked. */
+	struct hid_change_filter *changes;
+	pthread_mutex_t change_mutex;
+
+	/* A report hid_read_all() read but had no room for, handed out
+	   by the next read. pending holds MAX_REPORT_SIZE bytes once
+	   allocated, pending_length is 0 while it holds no report. */
+	unsigned char *pending;
+	size_t pending_length;
+	unsigned long long pending_timestamp;
+};
+
+/* hidraw keeps no per-context state, the context only exists so that
+   code written against the context functions works on every backend. */
+struct hid_context_ {
+	int unused;
 };
 
+/* The number of references taken by hid_init(). */
+static int init_refs = 0;
+static pthread_mutex_t init_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static __u32 kernel_version = 0;
 
@@ -107,6 +150,9 @@ static hid_device *new_hid_device(void)
 	dev->device_handle = -1;
 	dev->blocking = 1;
 	dev->uses_numbered_reports = 0;
+	dev->device_info = NULL;
+	pthread_mutex_init(&dev->capture_mutex, NULL);
+	pthread_mutex_init(&dev->change_mutex, NULL);
 
 	return dev;
 }
@@ -199,6 +245,105 @@ static int uses_numbered_reports(__u8 *report_descriptor, __u32 size) {
 	return 0;
 }
 
+/* Get bytes from a HID Report Descriptor.
+   Only call with a num_bytes of 0, 1, 2, or 4. */
+static unsigned int get_bytes(unsigned char *rpt, size_t len, size_t num_bytes, size_t cur)
+{
+	/* Return if there aren't enough bytes. */
+	if (cur + num_bytes >= len)
+		return 0;
+
+	if (num_bytes == 0)
+		return 0;
+	else if (num_bytes == 1) {
+		return rpt[cur+1];
+	}
+	else if (num_bytes == 2) {
+		return (rpt[cur+2] * 256 + rpt[cur+1]);
+	}
+	else if (num_bytes == 4) {
+		return (rpt[cur+4] * 0x01000000 +
+		        rpt[cur+3] * 0x00010000 +
+		        rpt[cur+2] * 0x00000100 +
+		        rpt[cur+1] * 0x00000001);
+	}
+	else
+		return 0;
+}
+
+/* Retrieves the device's Usage Page and Usage from the report
+   descriptor. The algorithm is simple, as it just returns the first
+   Usage and Usage Page that it finds in the descriptor.
+   The return value is 0 on success and -1 on failure. */
+static int get_usage(unsigned char *report_descriptor, size_t size,
+                     unsigned short *usage_page, unsigned short *usage)
+{
+	unsigned int i = 0;
+	int size_code;
+	int data_len, key_size;
+	int usage_found = 0, usage_page_found = 0;
+
+	while (i < size) {
+		int key = report_descriptor[i];
+		int key_cmd = key & 0xfc;
+
+		//printf("key: %02hhx\n", key);
+
+		if ((key & 0xf0) == 0xf0) {
+			/* This is a Long Item. The next byte contains the
+			   length of the data section (value) for this key.
+			   See the HID specification, version 1.11, section
+			   6.2.2.3, titled "Long Items." */
+			if (i+1 < size)
+				data_len = report_descriptor[i+1];
+			else
+				data_len = 0; /* malformed report */
+			key_size = 3;
+		}
+		else {
+			/* This is a Short Item. The bottom two bits of the
+			   key contain the size code for the data section
+			   (value) for this key.  Refer to the HID
+			   specification, version 1.11, section 6.2.2.2,
+			   titled "Short Items." */
+			size_code = key & 0x3;
+			switch (size_code) {
+			case 0:
+			case 1:
+			case 2:
+				data_len = size_code;
+				break;
+			case 3:
+				data_len = 4;
+				break;
+			default:
+				/* Can't ever happen since size_code is & 0x3 */
+				data_len = 0;
+				break;
+			};
+			key_size = 1;
+		}
+
+		if (key_cmd == 0x4) {
+			*usage_page  = get_bytes(report_descriptor, size, data_len, i);
+			usage_page_found = 1;
+			//printf("Usage Page: %x\n", (uint32_t)*usage_page);
+		}
+		if (key_cmd == 0x8) {
+			*usage = get_bytes(report_descriptor, size, data_len, i);
+			usage_found = 1;
+			//printf("Usage: %x\n", (uint32_t)*usage);
+		}
+
+		if (usage_page_found && usage_found)
+			return 0; /* success */
+
+		/* Skip over this key and it's associated data */
+		i += data_len + key_size;
+	}
+
+	return -1; /* failure */
+}
 /*
  * The caller is responsible for free()ing the (newly-allocated) character
  * strings pointed to by serial_number_utf8 and product_name_utf8 after use.
@@ -256,6 +401,106 @@ next_line:
 	return (found_id && found_name && found_serial);
 }
 
+/* Build a struct hid_device_info for the hidraw node raw_dev. The fields
+   parsed out of the uevent of its HID parent are passed in. Returns NULL if
+   the device can't be described. With HID_ENUMERATE_NO_STRINGS in flags
+   the string fields are left NULL. The caller must free the result with
+   hid_free_enumeration(). */
+static struct hid_device_info *create_device_info_for_device(struct udev_device *raw_dev,
+	int bus_type, unsigned short dev_vid, unsigned short dev_pid,
+	const char *serial_number_utf8, const char *product_name_utf8,
+	unsigned int flags)
+{
+	struct hid_device_info *cur_dev;
+	struct udev_device *usb_dev; /* The device's USB udev node. */
+	struct udev_device *intf_dev; /* The device's interface (in the USB sense). */
+	const char *dev_path;
+	const char *str;
+
+	cur_dev = calloc(1, sizeof(struct hid_device_info));
+	if (!cur_dev)
+		return NULL;
+
+	/* Fill out the record */
+	dev_path = udev_device_get_devnode(raw_dev);
+	cur_dev->next = NULL;
+	cur_dev->path = dev_path? strdup(dev_path): NULL;
+
+	/* VID/PID */
+	cur_dev->vendor_id = dev_vid;
+	cur_dev->product_id = dev_pid;
+
+	/* Serial Number */
+	if (!(flags & HID_ENUMERATE_NO_STRINGS))
+		cur_dev->serial_number = utf8_to_wchar_t(serial_number_utf8);
+
+	/* Release Number */
+	cur_dev->release_number = 0x0;
+
+	/* Interface Number */
+	cur_dev->interface_number = -1;
+
+	switch (bus_type) {
+		case BUS_USB:
+			/* The device pointed to by raw_dev contains information about
+			   the hidraw device. In order to get information about the
+			   USB device, get the parent device with the
+			   subsystem/devtype pair of "usb"/"usb_device". This will
+			   be several levels up the tree, but the function will find
+			   it. */
+			usb_dev = udev_device_get_parent_with_subsystem_devtype(
+					raw_dev,
+					"usb",
+					"usb_device");
+
+			if (!usb_dev) {
+				/* Free this device */
+				hid_free_enumeration(cur_dev);
+				return NULL;
+			}
+
+			/* Manufacturer and Product strings */
+			if (!(flags & HID_ENUMERATE_NO_STRINGS)) {
+				cur_dev->manufacturer_string = copy_udev_string(usb_dev, device_string_names[DEVICE_STRING_MANUFACTURER]);
+				cur_dev->product_string = copy_udev_string(usb_dev, device_string_names[DEVICE_STRING_PRODUCT]);
+			}
+
+			/* Release Number */
+			str = udev_device_get_sysattr_value(usb_dev, "bcdDevice");
+			cur_dev->release_number = (str)? strtol(str, NULL, 16): 0x0;
+
+			/* Get a handle to the interface's udev node. */
+			intf_dev = udev_device_get_parent_with_subsystem_devtype(
+					raw_dev,
+					"usb",
+					"usb_interface");
+			if (intf_dev) {
+				str = udev_device_get_sysattr_value(intf_dev, "bInterfaceNumber");
+				cur_dev->interface_number = (str)? strtol(str, NULL, 16): -1;
+			}
+
+			break;
+
+		case BUS_BLUETOOTH:
+			/* Manufacturer and Product strings */
+			if (!(flags & HID_ENUMERATE_NO_STRINGS)) {
+				cur_dev->manufacturer_string = wcsdup(L"");
+				cur_dev->product_string = utf8_to_wchar_t(product_name_utf8);
+			}
+
+			break;
+
+		default:
+			/* Unknown device type - this should never happen, as the
+			 * callers only pass USB and Bluetooth devices */
+			break;
+	}
+
+	/* hid_dev, usb_dev and intf_dev don't need to be (and can't be)
+	   unref()d.  It will cause a double-free() error.  I'm not
+	   sure why.  */
+	return cur_dev;
+}
 
 static int get_device_string(hid_device *dev, enum device_string_id key, wchar_t *string, size_t maxlen)
 {
@@ -357,28 +602,385 @@ end:
 	return ret;
 }
 
-int HID_API_EXPORT hid_init(void)
+/* Set up the process wide state on first use. Must be called with
+   init_mutex held. */
+static void init_library(void)
 {
 	const char *locale;
 
+	if (kernel_version != 0)
+		return;
+
 	/* Set the locale if it's not set. */
 	locale = setlocale(LC_CTYPE, NULL);
 	if (!locale)
 		setlocale(LC_CTYPE, "");
 
 	kernel_version = detect_kernel_version();
+}
+
+int HID_API_EXPORT hid_init(void)
+{
+	pthread_mutex_lock(&init_mutex);
+	init_library();
+	init_refs++;
+	pthread_mutex_unlock(&init_mutex);
 
 	return 0;
 }
 
+/* Initialization on demand, which only takes a reference if there is
+   none. See the libusb implementation. */
+static void implicit_init(void)
+{
+	pthread_mutex_lock(&init_mutex);
+	init_library();
+	if (init_refs == 0)
+		init_refs = 1;
+	pthread_mutex_unlock(&init_mutex);
+}
+
 int HID_API_EXPORT hid_exit(void)
 {
-	/* Nothing to do for this in the Linux/hidraw implementation. */
+	/* Nothing is freed in the Linux/hidraw implementation, only the
+	   reference is dropped. */
+	pthread_mutex_lock(&init_mutex);
+	if (init_refs > 0)
+		init_refs--;
+	pthread_mutex_unlock(&init_mutex);
+
 	return 0;
 }
 
+hid_context HID_API_EXPORT *hid_context_new(void)
+{
+	pthread_mutex_lock(&init_mutex);
+	init_library();
+	pthread_mutex_unlock(&init_mutex);
+
+	return calloc(1, sizeof(hid_context));
+}
+
+void HID_API_EXPORT hid_context_free(hid_context *ctx)
+{
+	free(ctx);
+}
+
+struct hid_device_info HID_API_EXPORT *hid_enumerate_context(hid_context *ctx, const struct hid_enumeration_filter *filter)
+{
+	(void) ctx;
+	return hid_enumerate_filter(filter);
+}
+
+int HID_API_EXPORT hid_enumerate_fill_strings_context(hid_context *ctx, struct hid_device_info *info)
+{
+	(void) ctx;
+	return hid_enumerate_fill_strings(info);
+}
+
+hid_device * HID_API_EXPORT hid_open_context(hid_context *ctx, unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number)
+{
+	(void) ctx;
+	return hid_open(vendor_id, product_id, serial_number);
+}
+
+hid_device * HID_API_EXPORT hid_open_path_context(hid_context *ctx, const char *path)
+{
+	(void) ctx;
+	return hid_open_path(path);
+}
+
 
 struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+{
+	return hid_enumerate_ex(vendor_id, product_id, 0);
+}
+
+/* Read the sysfs attribute name of the directory dir into buf, dropping
+   the trailing newline. Returns the length of the value, or -1 if it
+   can't be read. */
+static int read_sysfs_attr(const char *dir, const char *name, char *buf, size_t size)
+{
+	char path[PATH_MAX];
+	ssize_t len;
+	int fd;
+
+	if (snprintf(path, sizeof(path), "%s/%s", dir, name) >= (int) sizeof(path))
+		return -1;
+
+	fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	len = read(fd, buf, size - 1);
+	close(fd);
+	if (len < 0)
+		return -1;
+
+	while (len > 0 && buf[len-1] == '\n')
+		len--;
+	buf[len] = '\0';
+
+	return (int) len;
+}
+
+/* Walk up from the sysfs directory dir (which is modified) to the first
+   directory which has the attribute name. Returns 1 if one was found. */
+static int find_sysfs_parent_with_attr(char *dir, const char *name)
+{
+	char path[PATH_MAX];
+	char *slash;
+
+	while ((slash = strrchr(dir, '/')) != NULL && slash != dir) {
+		*slash = '\0';
+		if (strcmp(dir, "/sys/devices") == 0)
+			return 0;
+		if (snprintf(path, sizeof(path), "%s/%s", dir, name) < (int) sizeof(path) &&
+		    access(path, F_OK) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Like parse_uevent_info(), but splits uevent in place rather than copying
+   it. serial_number_utf8 and product_name_utf8 point into uevent. */
+static int parse_uevent_buffer(char *uevent, int *bus_type,
+	unsigned short *vendor_id, unsigned short *product_id,
+	const char **serial_number_utf8, const char **product_name_utf8)
+{
+	char *line = uevent;
+	int found_id = 0;
+	int found_serial = 0;
+	int found_name = 0;
+
+	while (line && *line) {
+		char *end = strchr(line, '\n');
+		char *value;
+
+		if (end)
+			*end = '\0';
+
+		value = strchr(line, '=');
+		if (value) {
+			*value++ = '\0';
+			if (strcmp(line, "HID_ID") == 0) {
+				if (sscanf(value, "%x:%hx:%hx", bus_type, vendor_id, product_id) == 3)
+					found_id = 1;
+			} else if (strcmp(line, "HID_NAME") == 0) {
+				*product_name_utf8 = value;
+				found_name = 1;
+			} else if (strcmp(line, "HID_UNIQ") == 0) {
+				*serial_number_utf8 = value;
+				found_serial = 1;
+			}
+		}
+
+		line = end ? end + 1 : NULL;
+	}
+
+	return (found_id && found_name && found_serial);
+}
+
+/* Returns 1 if the IDs and serial number parsed out of a uevent match
+   filter. This is checked before any string is converted. */
+static int filter_matches_ids(const struct hid_enumeration_filter *filter,
+	int bus_type, unsigned short dev_vid, unsigned short dev_pid,
+	const char *serial_number_utf8)
+{
+	if (filter->vendor_id != 0x0 && filter->vendor_id != dev_vid)
+		return 0;
+	if (filter->product_id != 0x0 && filter->product_id != dev_pid)
+		return 0;
+	if (filter->bus_type != HID_BUS_ANY && filter->bus_type != bus_type)
+		return 0;
+	if (filter->serial_number &&
+	    fnmatch(filter->serial_number, serial_number_utf8? serial_number_utf8: "", 0) != 0)
+		return 0;
+
+	return 1;
+}
+
+/* Read the usage page and usage of the HID device in the sysfs directory
+   hid_dir from its report_descriptor attribute, without opening the
+   device. Returns 0 on success and -1 on failure. */
+static int read_sysfs_usage(const char *hid_dir, unsigned short *usage_page, unsigned short *usage)
+{
+	unsigned char descriptor[HID_API_MAX_REPORT_DESCRIPTOR_SIZE];
+	char path[PATH_MAX];
+	ssize_t len;
+	int fd;
+
+	if (snprintf(path, sizeof(path), "%s/report_descriptor", hid_dir) >= (int) sizeof(path))
+		return -1;
+
+	fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	len = read(fd, descriptor, sizeof(descriptor));
+	close(fd);
+	if (len <= 0)
+		return -1;
+
+	return get_usage(descriptor, len, usage_page, usage);
+}
+
+/* Apply the usage criteria of filter to the HID device in hid_dir, storing
+   the usage in cur_dev. Returns 1 if the device matches. */
+static int filter_matches_usage(const struct hid_enumeration_filter *filter,
+	const char *hid_dir, struct hid_device_info *cur_dev)
+{
+	unsigned short page = 0, usage = 0;
+
+	if (filter->usage_page == 0 && filter->usage == 0)
+		return 1;
+
+	if (read_sysfs_usage(hid_dir, &page, &usage) < 0)
+		return 0;
+
+	if ((filter->usage_page != 0 && filter->usage_page != page) ||
+	    (filter->usage != 0 && filter->usage != usage))
+		return 0;
+
+	cur_dev->usage_page = page;
+	cur_dev->usage = usage;
+
+	return 1;
+}
+
+/* hid_enumerate_filter() with HID_ENUMERATE_SYSFS. The same records as the
+   udev path are built straight from /sys/class/hidraw, reusing one buffer
+   for every attribute read, so the only allocations are the records
+   themselves. */
+static struct hid_device_info *enumerate_sysfs(const struct hid_enumeration_filter *filter)
+{
+	char buf[4096]; /* uevent, then the other attributes in turn */
+	char link[PATH_MAX];
+	char hid_dir[PATH_MAX];
+	char usb_dir[PATH_MAX];
+	DIR *dir;
+	struct dirent *entry;
+
+	struct hid_device_info *root = NULL; /* return object */
+	struct hid_device_info *cur_dev = NULL;
+
+	dir = opendir("/sys/class/hidraw");
+	if (!dir)
+		return NULL;
+
+	while ((entry = readdir(dir)) != NULL) {
+		struct hid_device_info *tmp;
+		const char *serial_number_utf8 = NULL;
+		const char *product_name_utf8 = NULL;
+		unsigned short dev_vid;
+		unsigned short dev_pid;
+		int interface_number = -1;
+		int bus_type;
+
+		if (strncmp(entry->d_name, "hidraw", 6) != 0)
+			continue;
+
+		/* /sys/class/hidraw/hidrawN/device is the HID device. */
+		if (snprintf(link, sizeof(link), "/sys/class/hidraw/%s/device", entry->d_name) >= (int) sizeof(link) ||
+		    !realpath(link, hid_dir))
+			continue;
+
+		if (read_sysfs_attr(hid_dir, "uevent", buf, sizeof(buf)) < 0)
+			continue;
+
+		if (!parse_uevent_buffer(buf, &bus_type, &dev_vid, &dev_pid,
+		                         &serial_number_utf8, &product_name_utf8))
+			continue;
+
+		if (bus_type != BUS_USB && bus_type != BUS_BLUETOOTH) {
+			/* We only know how to handle USB and BT devices. */
+			continue;
+		}
+
+		/* Check the IDs and serial number against the filter */
+		if (!filter_matches_ids(filter, bus_type, dev_vid, dev_pid, serial_number_utf8))
+			continue;
+
+		if (bus_type == BUS_USB) {
+			/* usb_dir becomes the USB interface, then the USB
+			   device, several levels up the tree. */
+			strcpy(usb_dir, hid_dir);
+			if (!find_sysfs_parent_with_attr(usb_dir, "bInterfaceNumber"))
+				continue;
+			if (read_sysfs_attr(usb_dir, "bInterfaceNumber", link, sizeof(link)) > 0)
+				interface_number = strtol(link, NULL, 16);
+			if (!find_sysfs_parent_with_attr(usb_dir, "idVendor"))
+				continue;
+		}
+
+		if (filter->interface_number >= 0 && filter->interface_number != interface_number)
+			continue;
+
+		tmp = calloc(1, sizeof(struct hid_device_info));
+		if (!tmp)
+			break;
+
+		if (!filter_matches_usage(filter, hid_dir, tmp)) {
+			free(tmp);
+			continue;
+		}
+
+		/* Fill out the record */
+		snprintf(link, sizeof(link), "/dev/%s", entry->d_name);
+		tmp->path = strdup(link);
+		tmp->vendor_id = dev_vid;
+		tmp->product_id = dev_pid;
+		tmp->interface_number = interface_number;
+
+		if (!(filter->flags & HID_ENUMERATE_NO_STRINGS)) {
+			/* These point into buf, so convert them before it
+			   is reused. */
+			tmp->serial_number = utf8_to_wchar_t(serial_number_utf8);
+			if (bus_type == BUS_BLUETOOTH) {
+				tmp->manufacturer_string = wcsdup(L"");
+				tmp->product_string = utf8_to_wchar_t(product_name_utf8);
+			}
+		}
+
+		if (bus_type == BUS_USB) {
+			if (read_sysfs_attr(usb_dir, "bcdDevice", buf, sizeof(buf)) > 0)
+				tmp->release_number = strtol(buf, NULL, 16);
+
+			if (!(filter->flags & HID_ENUMERATE_NO_STRINGS)) {
+				if (read_sysfs_attr(usb_dir, device_string_names[DEVICE_STRING_MANUFACTURER], buf, sizeof(buf)) >= 0)
+					tmp->manufacturer_string = utf8_to_wchar_t(buf);
+				if (read_sysfs_attr(usb_dir, device_string_names[DEVICE_STRING_PRODUCT], buf, sizeof(buf)) >= 0)
+					tmp->product_string = utf8_to_wchar_t(buf);
+			}
+		}
+
+		if (cur_dev) {
+			cur_dev->next = tmp;
+		}
+		else {
+			root = tmp;
+		}
+		cur_dev = tmp;
+	}
+
+	closedir(dir);
+
+	return root;
+}
+
+struct hid_device_info  HID_API_EXPORT *hid_enumerate_ex(unsigned short vendor_id, unsigned short product_id, unsigned int flags)
+{
+	struct hid_enumeration_filter filter;
+
+	memset(&filter, 0, sizeof(filter));
+	filter.vendor_id = vendor_id;
+	filter.product_id = product_id;
+	filter.interface_number = -1;
+	filter.flags = flags;
+
+	return hid_enumerate_filter(&filter);
+}
+
+struct hid_device_info  HID_API_EXPORT *hid_enumerate_filter(const struct hid_enumeration_filter *filter)
 {
 	struct udev *udev;
 	struct udev_enumerate *enumerate;
@@ -386,9 +988,11 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 
 	struct hid_device_info *root = NULL; /* return object */
 	struct hid_device_info *cur_dev = NULL;
-	struct hid_device_info *prev_dev = NULL; /* previous device */
 
-	hid_init();
+	implicit_init();
+
+	if (filter->flags & HID_ENUMERATE_SYSFS)
+		return enumerate_sysfs(filter);
 
 	/* Create the udev object */
 	udev = udev_new();
@@ -402,16 +1006,12 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 	udev_enumerate_add_match_subsystem(enumerate, "hidraw");
 	udev_enumerate_scan_devices(enumerate);
 	devices = udev_enumerate_get_list_entry(enumerate);
-	/* For each item, see if it matches the vid/pid, and if so
+	/* For each item, see if it matches the filter, and if so
 	   create a udev_device record for it */
 	udev_list_entry_foreach(dev_list_entry, devices) {
 		const char *sysfs_path;
-		const char *dev_path;
-		const char *str;
 		struct udev_device *raw_dev; /* The device's hidraw udev node. */
 		struct udev_device *hid_dev; /* The device's HID udev node. */
-		struct udev_device *usb_dev; /* The device's USB udev node. */
-		struct udev_device *intf_dev; /* The device's interface (in the USB sense). */
 		unsigned short dev_vid;
 		unsigned short dev_pid;
 		char *serial_number_utf8 = NULL;
@@ -423,7 +1023,6 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 		   and create a udev_device object (dev) representing it */
 		sysfs_path = udev_list_entry_get_name(dev_list_entry);
 		raw_dev = udev_device_new_from_syspath(udev, sysfs_path);
-		dev_path = udev_device_get_devnode(raw_dev);
 
 		hid_dev = udev_device_get_parent_with_subsystem_devtype(
 			raw_dev,
@@ -453,111 +1052,66 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 			goto next;
 		}
 
-		/* Check the VID/PID against the arguments */
-		if ((vendor_id == 0x0 || vendor_id == dev_vid) &&
-		    (product_id == 0x0 || product_id == dev_pid)) {
+		/* Check the IDs and serial number against the filter */
+		if (!filter_matches_ids(filter, bus_type, dev_vid, dev_pid, serial_number_utf8))
+			goto next;
+
+		/* Check the interface before any string is converted */
+		if (filter->interface_number >= 0) {
+			struct udev_device *intf_dev;
+			const char *str = NULL;
+
+			intf_dev = udev_device_get_parent_with_subsystem_devtype(
+				raw_dev,
+				"usb",
+				"usb_interface");
+			if (intf_dev)
+				str = udev_device_get_sysattr_value(intf_dev, "bInterfaceNumber");
+			if (!str || strtol(str, NULL, 16) != filter->interface_number)
+				goto next;
+		}
+
+		{
 			struct hid_device_info *tmp;
+			unsigned short usage_page = 0, usage = 0;
+
+			/* Check the usage, read from sysfs */
+			if (filter->usage_page != 0 || filter->usage != 0) {
+				if (read_sysfs_usage(udev_device_get_syspath(hid_dev), &usage_page, &usage) < 0 ||
+				    (filter->usage_page != 0 && filter->usage_page != usage_page) ||
+				    (filter->usage != 0 && filter->usage != usage))
+					goto next;
+			}
+
+			/* Filter match. Create the record. */
+			tmp = create_device_info_for_device(raw_dev,
+				bus_type,
+				dev_vid,
+				dev_pid,
+				serial_number_utf8,
+				product_name_utf8,
+				filter->flags);
+			if (!tmp) {
+				/* The device has no USB parent or we ran
+				   out of memory. */
+				goto next;
+			}
+			tmp->usage_page = usage_page;
+			tmp->usage = usage;
 
-			/* VID/PID match. Create the record. */
-			tmp = malloc(sizeof(struct hid_device_info));
 			if (cur_dev) {
 				cur_dev->next = tmp;
 			}
 			else {
 				root = tmp;
 			}
-			prev_dev = cur_dev;
 			cur_dev = tmp;
-
-			/* Fill out the record */
-			cur_dev->next = NULL;
-			cur_dev->path = dev_path? strdup(dev_path): NULL;
-
-			/* VID/PID */
-			cur_dev->vendor_id = dev_vid;
-			cur_dev->product_id = dev_pid;
-
-			/* Serial Number */
-			cur_dev->serial_number = utf8_to_wchar_t(serial_number_utf8);
-
-			/* Release Number */
-			cur_dev->release_number = 0x0;
-
-			/* Interface Number */
-			cur_dev->interface_number = -1;
-
-			switch (bus_type) {
-				case BUS_USB:
-					/* The device pointed to by raw_dev contains information about
-					   the hidraw device. In order to get information about the
-					   USB device, get the parent device with the
-					   subsystem/devtype pair of "usb"/"usb_device". This will
-					   be several levels up the tree, but the function will find
-					   it. */
-					usb_dev = udev_device_get_parent_with_subsystem_devtype(
-							raw_dev,
-							"usb",
-							"usb_device");
-
-					if (!usb_dev) {
-						/* Free this device */
-						free(cur_dev->serial_number);
-						free(cur_dev->path);
-						free(cur_dev);
-
-						/* Take it off the device list. */
-						if (prev_dev) {
-							prev_dev->next = NULL;
-							cur_dev = prev_dev;
-						}
-						else {
-							cur_dev = root = NULL;
-						}
-
-						goto next;
-					}
-
-					/* Manufacturer and Product strings */
-					cur_dev->manufacturer_string = copy_udev_string(usb_dev, device_string_names[DEVICE_STRING_MANUFACTURER]);
-					cur_dev->product_string = copy_udev_string(usb_dev, device_string_names[DEVICE_STRING_PRODUCT]);
-
-					/* Release Number */
-					str = udev_device_get_sysattr_value(usb_dev, "bcdDevice");
-					cur_dev->release_number = (str)? strtol(str, NULL, 16): 0x0;
-
-					/* Get a handle to the interface's udev node. */
-					intf_dev = udev_device_get_parent_with_subsystem_devtype(
-							raw_dev,
-							"usb",
-							"usb_interface");
-					if (intf_dev) {
-						str = udev_device_get_sysattr_value(intf_dev, "bInterfaceNumber");
-						cur_dev->interface_number = (str)? strtol(str, NULL, 16): -1;
-					}
-
-					break;
-
-				case BUS_BLUETOOTH:
-					/* Manufacturer and Product strings */
-					cur_dev->manufacturer_string = wcsdup(L"");
-					cur_dev->product_string = utf8_to_wchar_t(product_name_utf8);
-
-					break;
-
-				default:
-					/* Unknown device type - this should never happen, as we
-					 * check for USB and Bluetooth devices above */
-					break;
-			}
 		}
 
 	next:
 		free(serial_number_utf8);
 		free(product_name_utf8);
 		udev_device_unref(raw_dev);
-		/* hid_dev, usb_dev and intf_dev don't need to be (and can't be)
-		   unref()d.  It will cause a double-free() error.  I'm not
-		   sure why.  */
 	}
 	/* Free the enumerator and udev objects. */
 	udev_enumerate_unref(enumerate);
@@ -566,52 +1120,317 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 	return root;
 }
 
-void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
+int HID_API_EXPORT hid_enumerate_fill_strings(struct hid_device_info *info)
 {
-	struct hid_device_info *d = devs;
-	while (d) {
-		struct hid_device_info *next = d->next;
-		free(d->path);
-		free(d->serial_number);
-		free(d->manufacturer_string);
-		free(d->product_string);
-		free(d);
-		d = next;
-	}
-}
+	struct udev *udev;
+	struct udev_device *raw_dev, *hid_dev;
+	struct hid_device_info *full = NULL;
+	struct stat s;
+	char *serial_number_utf8 = NULL;
+	char *product_name_utf8 = NULL;
 
-hid_device * hid_open(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number)
-{
-	struct hid_device_info *devs, *cur_dev;
-	const char *path_to_open = NULL;
-	hid_device *handle = NULL;
+	if (!info || !info->path)
+		return -1;
 
-	devs = hid_enumerate(vendor_id, product_id);
-	cur_dev = devs;
-	while (cur_dev) {
-		if (cur_dev->vendor_id == vendor_id &&
-		    cur_dev->product_id == product_id) {
-			if (serial_number) {
-				if (wcscmp(serial_number, cur_dev->serial_number) == 0) {
-					path_to_open = cur_dev->path;
-					break;
-				}
+	/* Get the dev_t (major/minor numbers) of the hidraw node. */
+	if (stat(info->path, &s) < 0)
+		return -1;
+
+	/* Create the udev object */
+	udev = udev_new();
+	if (!udev) {
+		printf("Can't create udev\n");
+		return -1;
+	}
+
+	raw_dev = udev_device_new_from_devnum(udev, 'c', s.st_rdev);
+	if (raw_dev) {
+		hid_dev = udev_device_get_parent_with_subsystem_devtype(
+			raw_dev,
+			"hid",
+			NULL);
+		if (hid_dev) {
+			unsigned short dev_vid;
+			unsigned short dev_pid;
+			int bus_type;
+
+			if (parse_uevent_info(
+			        udev_device_get_sysattr_value(hid_dev, "uevent"),
+			        &bus_type,
+			        &dev_vid,
+			        &dev_pid,
+			        &serial_number_utf8,
+			        &product_name_utf8) &&
+			    (bus_type == BUS_USB || bus_type == BUS_BLUETOOTH)) {
+				full = create_device_info_for_device(raw_dev,
+					bus_type,
+					dev_vid,
+					dev_pid,
+					serial_number_utf8,
+					product_name_utf8,
+					0);
 			}
-			else {
-				path_to_open = cur_dev->path;
-				break;
+		}
+		udev_device_unref(raw_dev);
+	}
+
+	free(serial_number_utf8);
+	free(product_name_utf8);
+	udev_unref(udev);
+
+	if (!full)
+		return -1;
+
+	/* Move over the strings which are still missing. */
+	if (!info->serial_number) {
+		info->serial_number = full->serial_number;
+		full->serial_number = NULL;
+	}
+	if (!info->manufacturer_string) {
+		info->manufacturer_string = full->manufacturer_string;
+		full->manufacturer_string = NULL;
+	}
+	if (!info->product_string) {
+		info->product_string = full->product_string;
+		full->product_string = NULL;
+	}
+	hid_free_enumeration(full);
+
+	return 0;
+}
+
+int HID_API_EXPORT hid_get_location(const char *path, char *buf, size_t buf_size)
+{
+	char link[PATH_MAX];
+	char location[PATH_MAX];
+	char interface_number[PATH_MAX];
+	char *instance;
+	struct stat s;
+	size_t len;
+
+	if (!path || !buf || buf_size == 0)
+		return -1;
+
+	/* The sysfs path of the HID device holds the chain of ports. It is
+	   found through the dev_t, so a renamed device node works too. */
+	if (stat(path, &s) < 0 || !S_ISCHR(s.st_mode))
+		return -1;
+	snprintf(link, sizeof(link), "/sys/dev/char/%u:%u/device", major(s.st_rdev), minor(s.st_rdev));
+	if (!realpath(link, location))
+		return -1;
+
+	/* The last component is the HID instance, 0003:VVVV:PPPP.NNNN,
+	   whose number changes on every replug. The USB interface above it
+	   is named after the chain of ports and the interface number, which
+	   do not. Other buses keep the HID instance. */
+	instance = strrchr(location, '/');
+	if (instance && instance != location) {
+		*instance = '\0';
+		snprintf(interface_number, sizeof(interface_number), "%s/bInterfaceNumber", location);
+		if (access(interface_number, F_OK) != 0)
+			*instance = '/';
+	}
+
+	len = strlen(location);
+	if (len >= buf_size)
+		return -1;
+	memcpy(buf, location, len + 1);
+
+	return (int) len;
+}
+
+void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
+{
+	struct hid_device_info *d = devs;
+	while (d) {
+		struct hid_device_info *next = d->next;
+		free(d->path);
+		free(d->serial_number);
+		free(d->manufacturer_string);
+		free(d->product_string);
+		free(d);
+		d = next;
+	}
+}
+
+/* Convert a wide string to UTF-8. This does not go through the locale,
+   as wcstombs() does, which cannot convert non-ASCII characters under
+   the default "C" locale. The caller must free() the returned string. */
+static char *wchar_to_utf8(const wchar_t *wstr)
+{
+	size_t len = 0;
+	size_t i;
+	char *ret, *p;
+
+	for (i = 0; wstr[i]; i++) {
+		unsigned long c = (unsigned long) wstr[i];
+		len += (c < 0x80)? 1: (c < 0x800)? 2: (c < 0x10000)? 3: 4;
+	}
+
+	ret = malloc(len + 1);
+	if (!ret)
+		return NULL;
+
+	p = ret;
+	for (i = 0; wstr[i]; i++) {
+		unsigned long c = (unsigned long) wstr[i];
+		if (c < 0x80) {
+			*p++ = (char) c;
+		}
+		else if (c < 0x800) {
+			*p++ = (char) (0xC0 | (c >> 6));
+			*p++ = (char) (0x80 | (c & 0x3F));
+		}
+		else if (c < 0x10000) {
+			*p++ = (char) (0xE0 | (c >> 12));
+			*p++ = (char) (0x80 | ((c >> 6) & 0x3F));
+			*p++ = (char) (0x80 | (c & 0x3F));
+		}
+		else {
+			*p++ = (char) (0xF0 | ((c >> 18) & 0x07));
+			*p++ = (char) (0x80 | ((c >> 12) & 0x3F));
+			*p++ = (char) (0x80 | ((c >> 6) & 0x3F));
+			*p++ = (char) (0x80 | (c & 0x3F));
+		}
+	}
+	*p = '\0';
+
+	return ret;
+}
+
+/* Find the hidraw node of the first USB or Bluetooth device matching
+   vendor_id, product_id and, if it is not NULL, serial_number. Rather than
+   enumerating the whole bus, udev is asked for the HID devices whose HID_ID
+   or HID_UNIQ properties match, and then for the hidraw child of the first
+   one which matches both. The caller must free() the returned path. */
+static char *find_path_by_id(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number)
+{
+	struct udev *udev;
+	struct udev_enumerate *enumerate;
+	struct udev_list_entry *devices, *dev_list_entry;
+	char hid_id[32];
+	char *serial_utf8 = NULL;
+	char *path = NULL;
+
+	/* Create the udev object */
+	udev = udev_new();
+	if (!udev) {
+		printf("Can't create udev\n");
+		return NULL;
+	}
+
+	/* HID_ID=0003:000005AC:00008242, the bus type is matched below. */
+	snprintf(hid_id, sizeof(hid_id), "*:%08X:%08X", vendor_id, product_id);
+
+	enumerate = udev_enumerate_new(udev);
+	udev_enumerate_add_match_subsystem(enumerate, "hid");
+	udev_enumerate_add_match_property(enumerate, "HID_ID", hid_id);
+
+	if (serial_number) {
+		/* HID_UNIQ holds the serial number in UTF-8. The match is an
+		   fnmatch() pattern, so escape its special characters. */
+		char *pattern;
+		size_t len, i, j = 0;
+
+		serial_utf8 = wchar_to_utf8(serial_number);
+		if (!serial_utf8)
+			goto end;
+
+		len = strlen(serial_utf8);
+		pattern = calloc(2 * len + 1, 1);
+		if (!pattern)
+			goto end;
+
+		for (i = 0; i < len; i++) {
+			if (strchr("*?[]\\", serial_utf8[i]))
+				pattern[j++] = '\\';
+			pattern[j++] = serial_utf8[i];
+		}
+		udev_enumerate_add_match_property(enumerate, "HID_UNIQ", pattern);
+
+		free(pattern);
+	}
+
+	udev_enumerate_scan_devices(enumerate);
+	devices = udev_enumerate_get_list_entry(enumerate);
+	udev_list_entry_foreach(dev_list_entry, devices) {
+		struct udev_device *hid_dev;
+		struct udev_enumerate *children;
+		struct udev_list_entry *child;
+		const char *str;
+		int bus_type = 0;
+		unsigned short dev_vid = 0, dev_pid = 0;
+
+		hid_dev = udev_device_new_from_syspath(udev, udev_list_entry_get_name(dev_list_entry));
+		if (!hid_dev)
+			continue;
+
+		/* udev returns the devices which match any of the properties,
+		   so check them all. We only know how to handle USB and BT
+		   devices. */
+		str = udev_device_get_property_value(hid_dev, "HID_ID");
+		if (!str || sscanf(str, "%x:%hx:%hx", &bus_type, &dev_vid, &dev_pid) != 3 ||
+		    (bus_type != BUS_USB && bus_type != BUS_BLUETOOTH) ||
+		    dev_vid != vendor_id || dev_pid != product_id) {
+			udev_device_unref(hid_dev);
+			continue;
+		}
+
+		if (serial_utf8) {
+			str = udev_device_get_property_value(hid_dev, "HID_UNIQ");
+			if (!str || strcmp(str, serial_utf8) != 0) {
+				udev_device_unref(hid_dev);
+				continue;
 			}
 		}
-		cur_dev = cur_dev->next;
+
+		/* Find the hidraw node below this HID device. */
+		children = udev_enumerate_new(udev);
+		udev_enumerate_add_match_parent(children, hid_dev);
+		udev_enumerate_add_match_subsystem(children, "hidraw");
+		udev_enumerate_scan_devices(children);
+		child = udev_enumerate_get_list_entry(children);
+		if (child) {
+			struct udev_device *raw_dev;
+			raw_dev = udev_device_new_from_syspath(udev, udev_list_entry_get_name(child));
+			if (raw_dev) {
+				const char *dev_path = udev_device_get_devnode(raw_dev);
+				if (dev_path)
+					path = strdup(dev_path);
+				udev_device_unref(raw_dev);
+			}
+		}
+		udev_enumerate_unref(children);
+		udev_device_unref(hid_dev);
+
+		if (path)
+			break;
 	}
 
+end:
+	free(serial_utf8);
+
+	/* Free the enumerator and udev objects. */
+	udev_enumerate_unref(enumerate);
+	udev_unref(udev);
+
+	return path;
+}
+
+hid_device * hid_open(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number)
+{
+	char *path_to_open;
+	hid_device *handle = NULL;
+
+	implicit_init();
+
+	path_to_open = find_path_by_id(vendor_id, product_id, serial_number);
 	if (path_to_open) {
 		/* Open the device */
 		handle = hid_open_path(path_to_open);
+		free(path_to_open);
 	}
 
-	hid_free_enumeration(devs);
-
 	return handle;
 }
 
@@ -619,7 +1438,7 @@ hid_device * HID_API_EXPORT hid_open_path(const char *path)
 {
 	hid_device *dev = NULL;
 
-	hid_init();
+	implicit_init();
 
 	dev = new_hid_device();
 
@@ -663,17 +1482,77 @@ hid_device * HID_API_EXPORT hid_open_path(const char *path)
 }
 
 
+/* CLOCK_MONOTONIC in nanoseconds. clock_gettime() is served by the vDSO,
+   so this does not cost a system call. */
+static unsigned long long monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Records a report, if the device is being captured. */
+static void capture_report(hid_device *dev, int type, unsigned long long timestamp, const unsigned char *data, size_t length)
+{
+	if (!__atomic_load_n(&dev->capture, __ATOMIC_RELAXED))
+		return;
+
+	pthread_mutex_lock(&dev->capture_mutex);
+	if (dev->capture)
+		hid_capture_record(dev->capture, dev->capture_tag, type, timestamp, data, length);
+	pthread_mutex_unlock(&dev->capture_mutex);
+}
+
+/* Whether a report read is dropped by the change filter. */
+static int change_suppressed(hid_device *dev, const unsigned char *data, size_t length)
+{
+	int res;
+
+	if (!__atomic_load_n(&dev->changes, __ATOMIC_RELAXED))
+		return 0;
+
+	pthread_mutex_lock(&dev->change_mutex);
+	res = hid_change_suppress(dev->changes, data, length);
+	pthread_mutex_unlock(&dev->change_mutex);
+
+	return res;
+}
+
+void HID_API_EXPORT hid_set_capture(hid_device *dev, struct hid_capture *capture, int tag)
+{
+	pthread_mutex_lock(&dev->capture_mutex);
+	dev->capture_tag = tag;
+	__atomic_store_n(&dev->capture, capture, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&dev->capture_mutex);
+}
+
 int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t length)
 {
 	int bytes_written;
+	unsigned long long start;
 
+	HID_TRACE_BEGIN("hid_write");
+	start = monotonic_ns();
 	bytes_written = write(dev->device_handle, data, length);
 
+	/* The write is synchronous, so its latency is the time spent in
+	   write() until the kernel has handed the report over. */
+	if (bytes_written < 0) {
+		hid_stats_add(&dev->stats.write_errors, 1);
+	}
+	else {
+		hid_stats_add(&dev->stats.reports_written, 1);
+		hid_stats_add(&dev->stats.bytes_written, bytes_written);
+		hid_stats_latency(dev->stats.write_latency, start, monotonic_ns());
+		capture_report(dev, HID_CAPTURE_OUTPUT, start, data, length);
+	}
+
+	HID_TRACE_END("hid_write", bytes_written);
 	return bytes_written;
 }
 
 
-int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+static int read_report(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
 {
 	int bytes_read;
 
@@ -719,11 +1598,243 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 	return bytes_read;
 }
 
+int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+{
+	return hid_read_timeout_timestamped(dev, data, length, milliseconds, NULL);
+}
+
+int HID_API_EXPORT hid_read_timeout_timestamped(hid_device *dev, unsigned char *data, size_t length, int milliseconds, unsigned long long *timestamp)
+{
+	int bytes_read;
+	unsigned long long now = 0;
+	unsigned long long deadline = 0;
+
+	HID_TRACE_BEGIN("hid_read");
+	if (dev->pending_length > 0) {
+		/* Already captured and counted when it was read. */
+		bytes_read = (int) ((length < dev->pending_length)? length: dev->pending_length);
+		memcpy(data, dev->pending, bytes_read);
+		if (timestamp)
+			*timestamp = dev->pending_timestamp;
+		dev->pending_length = 0;
+		HID_TRACE_END("hid_read", bytes_read);
+		return bytes_read;
+	}
+
+	if (milliseconds > 0 && __atomic_load_n(&dev->changes, __ATOMIC_RELAXED))
+		deadline = monotonic_ns() + (unsigned long long) milliseconds * 1000000ULL;
+
+	for (;;) {
+		bytes_read = read_report(dev, data, length, milliseconds);
+		if (bytes_read <= 0)
+			break;
+
+		/* hidraw does not keep the arrival time, this is when it was read. */
+		if (timestamp || __atomic_load_n(&dev->capture, __ATOMIC_RELAXED))
+			now = monotonic_ns();
+		capture_report(dev, HID_CAPTURE_INPUT, now, data, bytes_read);
+
+		/* The kernel queues every report, so unchanged ones are
+		   dropped here, and the read waits on for what is left of
+		   the timeout. */
+		if (!change_suppressed(dev, data, bytes_read))
+			break;
+		hid_stats_add(&dev->stats.reports_suppressed, 1);
+		if (milliseconds > 0) {
+			unsigned long long left = deadline - monotonic_ns();
+			if ((long long) left <= 0) {
+				bytes_read = 0;
+				break;
+			}
+			milliseconds = (int) ((left + 999999) / 1000000);
+		}
+	}
+
+	if (bytes_read > 0) {
+		if (timestamp)
+			*timestamp = now;
+		hid_stats_add(&dev->stats.reports_read, 1);
+		hid_stats_add(&dev->stats.bytes_read, bytes_read);
+	}
+	else if (bytes_read < 0) {
+		hid_stats_add(&dev->stats.read_errors, 1);
+	}
+	else if (milliseconds != 0) {
+		hid_stats_add(&dev->stats.read_timeouts, 1);
+	}
+
+	HID_TRACE_END("hid_read", bytes_read);
+	return bytes_read;
+}
+
 int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length)
 {
 	return hid_read_timeout(dev, data, length, (dev->blocking)? -1: 0);
 }
 
+int HID_API_EXPORT hid_read_timestamped(hid_device *dev, unsigned char *data, size_t length, unsigned long long *timestamp)
+{
+	return hid_read_timeout_timestamped(dev, data, length, (dev->blocking)? -1: 0, timestamp);
+}
+
+/* An eventfd, polled along with the devices. */
+struct hid_wake_event_ {
+	int fd;
+};
+
+hid_wake_event HID_API_EXPORT *hid_wake_event_new(void)
+{
+	hid_wake_event *event = calloc(1, sizeof(hid_wake_event));
+	if (!event)
+		return NULL;
+
+	event->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (event->fd < 0) {
+		free(event);
+		return NULL;
+	}
+
+	return event;
+}
+
+void HID_API_EXPORT hid_wake_event_free(hid_wake_event *event)
+{
+	if (!event)
+		return;
+
+	close(event->fd);
+	free(event);
+}
+
+void HID_API_EXPORT hid_wake_event_signal(hid_wake_event *event)
+{
+	uint64_t one = 1;
+	ssize_t res = write(event->fd, &one, sizeof(one));
+	(void) res; /* only fails if the counter is full, when it is signalled anyway. */
+}
+
+int HID_API_EXPORT hid_wait_any(hid_device **devs, size_t num_devs, int *ready, int milliseconds)
+{
+	return hid_wait_any_event(devs, num_devs, ready, milliseconds, NULL);
+}
+
+int HID_API_EXPORT hid_wait_any_event(hid_device **devs, size_t num_devs, int *ready, int milliseconds, hid_wake_event *event)
+{
+	struct pollfd stack_fds[16];
+	struct pollfd *fds = stack_fds;
+	size_t num_fds = num_devs + (event? 1: 0);
+	size_t i;
+	int pending = 0;
+	int ret;
+
+	if ((num_devs > 0 && (!devs || !ready)) || num_fds == 0)
+		return -1;
+
+	if (num_fds > sizeof(stack_fds) / sizeof(stack_fds[0])) {
+		fds = malloc(num_fds * sizeof(struct pollfd));
+		if (!fds)
+			return -1;
+	}
+
+	for (i = 0; i < num_devs; i++) {
+		fds[i].fd = devs[i]->device_handle;
+		fds[i].events = POLLIN;
+		fds[i].revents = 0;
+		if (devs[i]->pending_length > 0)
+			pending = 1;
+	}
+	if (event) {
+		fds[num_devs].fd = event->fd;
+		fds[num_devs].events = POLLIN;
+		fds[num_devs].revents = 0;
+	}
+
+	/* A report kept back by hid_read_all() is ready without waiting. */
+	ret = poll(fds, num_fds, pending? 0: milliseconds);
+	if (ret > 0 || (ret == 0 && pending)) {
+		/* A disconnected device is ready too, its read returns -1. */
+		ret = 0;
+		for (i = 0; i < num_devs; i++) {
+			ready[i] = devs[i]->pending_length > 0 ||
+				(fds[i].revents & (POLLIN | POLLERR | POLLHUP | POLLNVAL)) != 0;
+			ret += ready[i];
+		}
+		if (event && (fds[num_devs].revents & POLLIN)) {
+			/* Reading the counter clears it. */
+			uint64_t count;
+			ssize_t res = read(event->fd, &count, sizeof(count));
+			(void) res;
+		}
+	}
+	else if (num_devs > 0) {
+		memset(ready, 0, num_devs * sizeof(int));
+	}
+
+	if (fds != stack_fds)
+		free(fds);
+
+	return ret;
+}
+
+int HID_API_EXPORT hid_read_all(hid_device *dev, unsigned char *data, size_t length, size_t *offsets, unsigned long long *timestamps, size_t max_reports)
+{
+	size_t num_reports = 0;
+
+	if (!data || !offsets)
+		return -1;
+
+	offsets[0] = 0;
+	while (num_reports < max_reports) {
+		size_t used = offsets[num_reports];
+		size_t room = length - used;
+		unsigned long long timestamp = 0;
+		int res;
+
+		/* The first report is handed out even if it does not fit,
+		   truncated as hid_read() would, so a report longer than
+		   the whole buffer can not hold up the reads for ever. */
+		if (room == 0 || (num_reports > 0 && dev->pending_length > room))
+			break;
+
+		if (dev->pending_length > 0 || room >= MAX_REPORT_SIZE) {
+			res = hid_read_timeout_timestamped(dev, data + used, room, 0, &timestamp);
+		}
+		else {
+			/* The size of a report is only known once it has been
+			   read, and hidraw truncates it to the space given, so
+			   it is read whole into pending and kept there for the
+			   next read if it does not fit. */
+			if (!dev->pending) {
+				dev->pending = malloc(MAX_REPORT_SIZE);
+				if (!dev->pending)
+					return num_reports > 0? (int) num_reports: -1;
+			}
+			res = hid_read_timeout_timestamped(dev, dev->pending, MAX_REPORT_SIZE, 0, &timestamp);
+			if (res > 0 && (size_t) res > room) {
+				if (num_reports > 0) {
+					dev->pending_length = res;
+					dev->pending_timestamp = timestamp;
+					break;
+				}
+				res = (int) room;
+			}
+			if (res > 0)
+				memcpy(data + used, dev->pending, res);
+		}
+		if (res < 0)
+			return num_reports > 0? (int) num_reports: -1;
+		if (res == 0)
+			break;
+
+		if (timestamps)
+			timestamps[num_reports] = timestamp;
+		offsets[num_reports + 1] = used + res;
+		num_reports++;
+	}
+
+	return (int) num_reports;
+}
+
 int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
 {
 	/* Do all non-blocking in userspace using poll(), since it looks
@@ -739,9 +1850,13 @@ int HID_API_EXPORT hid_send_feature_report(hid_device *dev, const unsigned char
 {
 	int res;
 
+	HID_TRACE_BEGIN("hid_send_feature_report");
 	res = ioctl(dev->device_handle, HIDIOCSFEATURE(length), data);
+	HID_TRACE_END("hid_send_feature_report", res);
 	if (res < 0)
 		perror("ioctl (SFEATURE)");
+	else
+		capture_report(dev, HID_CAPTURE_FEATURE_SET, monotonic_ns(), data, length);
 
 	return res;
 }
@@ -750,10 +1865,13 @@ int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data,
 {
 	int res;
 
+	HID_TRACE_BEGIN("hid_get_feature_report");
 	res = ioctl(dev->device_handle, HIDIOCGFEATURE(length), data);
+	HID_TRACE_END("hid_get_feature_report", res);
 	if (res < 0)
 		perror("ioctl (GFEATURE)");
-
+	else
+		capture_report(dev, HID_CAPTURE_FEATURE_GET, monotonic_ns(), data, res);
 
 	return res;
 }
@@ -764,6 +1882,11 @@ void HID_API_EXPORT hid_close(hid_device *dev)
 	if (!dev)
 		return;
 	close(dev->device_handle);
+	hid_free_enumeration(dev->device_info);
+	pthread_mutex_destroy(&dev->capture_mutex);
+	hid_change_free(dev->changes);
+	pthread_mutex_destroy(&dev->change_mutex);
+	free(dev->pending);
 	free(dev);
 }
 
@@ -793,3 +1916,145 @@ HID_API_EXPORT const wchar_t * HID_API_CALL  hid_error(hid_device *dev)
 {
 	return NULL;
 }
+
+HID_API_EXPORT struct hid_device_info * HID_API_CALL hid_get_device_info(hid_device *dev)
+{
+	struct udev *udev;
+	struct udev_device *udev_dev, *hid_dev;
+	struct stat s;
+	char *serial_number_utf8 = NULL;
+	char *product_name_utf8 = NULL;
+
+	/* Served from memory once it has been collected. */
+	if (dev->device_info)
+		return dev->device_info;
+
+	/* Create the udev object */
+	udev = udev_new();
+	if (!udev) {
+		printf("Can't create udev\n");
+		return NULL;
+	}
+
+	/* Get the dev_t (major/minor numbers) from the file handle. */
+	if (fstat(dev->device_handle, &s) < 0) {
+		udev_unref(udev);
+		return NULL;
+	}
+
+	/* Open a udev device from the dev_t. 'c' means character device. */
+	udev_dev = udev_device_new_from_devnum(udev, 'c', s.st_rdev);
+	if (udev_dev) {
+		hid_dev = udev_device_get_parent_with_subsystem_devtype(
+			udev_dev,
+			"hid",
+			NULL);
+		if (hid_dev) {
+			unsigned short dev_vid;
+			unsigned short dev_pid;
+			int bus_type;
+			int result;
+
+			result = parse_uevent_info(
+			           udev_device_get_sysattr_value(hid_dev, "uevent"),
+			           &bus_type,
+			           &dev_vid,
+			           &dev_pid,
+			           &serial_number_utf8,
+			           &product_name_utf8);
+
+			if (result && (bus_type == BUS_USB || bus_type == BUS_BLUETOOTH)) {
+				dev->device_info = create_device_info_for_device(udev_dev,
+					bus_type,
+					dev_vid,
+					dev_pid,
+					serial_number_utf8,
+					product_name_utf8,
+					0);
+			}
+		}
+		udev_device_unref(udev_dev);
+	}
+
+	free(serial_number_utf8);
+	free(product_name_utf8);
+	udev_unref(udev);
+
+	return dev->device_info;
+}
+
+int HID_API_EXPORT_CALL hid_get_report_descriptor(hid_device *dev, unsigned char *buf, size_t buf_size)
+{
+	int res, desc_size = 0;
+	struct hidraw_report_descriptor rpt_desc;
+
+	/* Get Report Descriptor Size */
+	res = ioctl(dev->device_handle, HIDIOCGRDESCSIZE, &desc_size);
+	if (res < 0) {
+		perror("HIDIOCGRDESCSIZE");
+		return -1;
+	}
+
+	/* Get Report Descriptor */
+	memset(&rpt_desc, 0x0, sizeof(rpt_desc));
+	rpt_desc.size = desc_size;
+	res = ioctl(dev->device_handle, HIDIOCGRDESC, &rpt_desc);
+	if (res < 0) {
+		perror("HIDIOCGRDESC");
+		return -1;
+	}
+
+	if (buf_size > rpt_desc.size)
+		buf_size = rpt_desc.size;
+
+	memcpy(buf, rpt_desc.value, buf_size);
+
+	return (int) buf_size;
+}
+
+int HID_API_EXPORT_CALL hid_get_device_stats(hid_device *dev, struct hid_device_stats *stats)
+{
+	if (!dev || !stats)
+		return -1;
+
+	hid_stats_copy(stats, &dev->stats);
+
+	return 0;
+}
+
+void HID_API_EXPORT_CALL hid_reset_device_stats(hid_device *dev)
+{
+	if (dev)
+		hid_stats_reset(&dev->stats);
+}
+
+int HID_API_EXPORT_CALL hid_set_change_filter(hid_device *dev, int report_id, const unsigned char *mask, size_t mask_length)
+{
+	struct hid_change_filter *changes;
+	int res;
+
+	if (!dev)
+		return -1;
+
+	pthread_mutex_lock(&dev->change_mutex);
+	changes = dev->changes;
+	res = hid_change_set(&changes, dev->uses_numbered_reports, report_id, mask, mask_length);
+	__atomic_store_n(&dev->changes, changes, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&dev->change_mutex);
+
+	return res;
+}
+
+void HID_API_EXPORT_CALL hid_clear_change_filter(hid_device *dev, int report_id)
+{
+	struct hid_change_filter *changes;
+
+	if (!dev)
+		return;
+
+	pthread_mutex_lock(&dev->change_mutex);
+	changes = dev->changes;
+	hid_change_clear(&changes, report_id);
+	__atomic_store_n(&dev->changes, changes, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&dev->change_mutex);
+}
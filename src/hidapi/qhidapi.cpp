@@ -1,5 +1,6 @@
 #include "qhidapi.h"
 #include "qhidapi_p.h"
+#include "qhidstateregister_p.h"
 
 /*
 Copyright (C) 2013 - 2016 by Simon Meaden <[simonmeaden@virginmedia.com]>
@@ -21,6 +22,9 @@ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH RE
  *
  * You can use enumerate to generate a list of available devices. The vendor and product id's can then be used to \c open() the devices.
  *
+ * Constructing a QHidApi does no work beyond allocating it. The hidapi library is initialised the first time a
+ * device is enumerated or opened, and is shared with every other QHidApi and QHidDevice in the process.
+ *
  * HIDAPI is a multi-platform library which allows an application to interface with USB and Bluetooth HID-Class devices on Windows,
  * Linux, and Mac OS X. While it can be used to communicate with standard HID devices like keyboards, mice, and Joysticks, it is
  * most useful when used with custom (Vendor-Defined) HID devices. Many devices do this in order to not require a custom driver
@@ -66,6 +70,7 @@ QHidApi::QHidApi(ushort vendorId, ushort productId, QObject *parent) :
 }
 
 QHidApi::~QHidApi() {
+    delete d_ptr;
 }
 
 /*!
@@ -134,12 +139,159 @@ QString QHidApi::indexedString(quint32 deviceId, int index) {
  * \endcode
  * will return the all devices of the specified manufacturer and product id's.
  *
+ * With QuickEnumeration only the details which can be read without opening the devices are returned,
+ * that is the path, vendor and product ids, release number and interface number. This is much faster
+ * with the libusb backend, which otherwise opens every device and reads each string from it. The
+ * strings of a single device can then be read with fetchStrings().
+ *
  * \param vendorId - an optional unsigned int vendor id
  * \param productId - an optional unsigned int product id.
+ * \param mode - FullEnumeration (the default) or QuickEnumeration.
  * \return a QList<HidDeviceInfo> containing all relevant devices, or an empty list if no devices match.
+ * \see fetchStrings()
+ */
+QList<QHidDeviceInfo> QHidApi::enumerate(ushort vendorId, ushort productId, EnumerationMode mode) {
+    return d_ptr->enumerate(vendorId, productId, mode);
+}
+
+/*!
+ * \brief Enumerates the HID Devices which match a filter.
+ *
+ * The filter is checked by the hidapi backend while it enumerates, so devices which do not match are dropped
+ * before their strings are read or they are opened, rather than after the full list has been built.
+ *
+ * \param filter - the criteria the devices must match.
+ * \param mode - FullEnumeration (the default) or QuickEnumeration.
+ * \return a QList<HidDeviceInfo> containing the matching devices, or an empty list if no devices match.
+ * \see QHidDeviceFilter
+ */
+QList<QHidDeviceInfo> QHidApi::enumerate(const QHidDeviceFilter &filter, EnumerationMode mode) {
+    return d_ptr->enumerate(filter, mode);
+}
+
+/*!
+ * \brief Reads the strings of a device returned by a QuickEnumeration.
+ *
+ * Fills in the manufacturer, product and serial number strings of info, which are left
+ * empty by enumerate() in QuickEnumeration mode. The device is located by its path.
+ *
+ * \param info - the device details returned by enumerate().
+ * \return true if the device could be read, otherwise false.
+ */
+bool QHidApi::fetchStrings(QHidDeviceInfo &info) {
+    return d_ptr->fetchStrings(info);
+}
+
+/*!
+ * \brief Enumerates the HID devices without blocking.
+ *
+ * The devices are listed without opening them, as with QuickEnumeration, and then the strings of each
+ * device are read on a pool of at most maxThreadCount() threads. deviceFound() is emitted for each device
+ * as its strings arrive, so the results come in as fast as the devices answer. A device which takes longer
+ * than deadline milliseconds, or waits longer than that for a thread, is reported without its strings, so
+ * that wedged devices can not hold up the scan. enumerationFinished() is emitted once every device has
+ * been reported.
+ *
+ * \param vendorId - an optional unsigned int vendor id
+ * \param productId - an optional unsigned int product id.
+ * \param deadline - the time in milliseconds allowed for each device.
+ * \see deviceFound(), enumerationFinished()
  */
-QList<QHidDeviceInfo> QHidApi::enumerate(ushort vendorId, ushort productId) {
-    return d_ptr->enumerate(vendorId, productId);
+void QHidApi::enumerateAsync(ushort vendorId, ushort productId, int deadline) {
+    d_ptr->enumerateAsync(vendorId, productId, deadline);
+}
+
+/*!
+ * \brief Opens all matching HID devices without blocking.
+ *
+ * Each device is opened on a pool of at most maxThreadCount() threads. deviceOpened() is emitted with
+ * the new id of each device as it opens, and deviceOpenFailed() for each device which could not be opened
+ * or took longer than deadline milliseconds, either to open or waiting for a thread. A device which is
+ * already open is reported with its existing id. openAllFinished() is emitted once every device has been reported.
+ *
+ * \param vendorId - an optional unsigned int vendor id
+ * \param productId - an optional unsigned int product id.
+ * \param deadline - the time in milliseconds allowed for each device.
+ * \see deviceOpened(), deviceOpenFailed(), openAllFinished()
+ */
+void QHidApi::openAll(ushort vendorId, ushort productId, int deadline) {
+    d_ptr->openAll(vendorId, productId, deadline);
+}
+
+/*!
+ * \brief Returns the maximum number of devices which enumerateAsync() and openAll() work on at once.
+ */
+int QHidApi::maxThreadCount() const {
+    return d_ptr->maxThreadCount();
+}
+
+/*!
+ * \brief Sets the maximum number of devices which enumerateAsync() and openAll() work on at once.
+ *
+ * The default is 8.
+ */
+void QHidApi::setMaxThreadCount(int count) {
+    d_ptr->setMaxThreadCount(count);
+}
+
+/*!
+ * \brief Returns whether this object uses the shared hidapi context or one of its own.
+ */
+QHidApi::ContextMode QHidApi::contextMode() const {
+    return d_ptr->mContextMode;
+}
+
+/*!
+ * \brief Sets whether this object uses the shared hidapi context or one of its own.
+ *
+ * In PrivateContext mode devices are enumerated and opened through a context owned by this
+ * object. With the libusb backend it has its own libusb_context, so the event handling of its
+ * devices does not contend with that of other QHidApi objects. The default is SharedContext.
+ *
+ * The mode can only be changed before the first enumerate() or open(), later calls are ignored.
+ */
+void QHidApi::setContextMode(ContextMode mode) {
+    d_ptr->setContextMode(mode);
+}
+
+/*!
+ * \brief Keeps device details and report descriptors in a file between runs.
+ *
+ * Each entry is keyed by the device path, its physical location (the chain of USB ports it is
+ * plugged into) and its release number. The cached devices can be listed with cachedDevices() and opened
+ * by vendor/product id and serial number straight away, without a bus scan. In the meantime the cache
+ * is checked against the bus in the background, entries for devices which have gone, moved or been
+ * updated are dropped, and cacheValidated() is emitted. Full enumerations and report descriptor reads
+ * update the file.
+ *
+ * \param fileName - the cache file, which is created if it does not exist.
+ * \return true if an existing cache file was read.
+ * \see cachedDevices(), reportDescriptor(), cacheValidated()
+ */
+bool QHidApi::setCacheFile(const QString &fileName) {
+    return d_ptr->setCacheFile(fileName);
+}
+
+/*!
+ * \brief Returns the devices held in the cache file, which may not have been validated yet.
+ *
+ * \see setCacheFile()
+ */
+QList<QHidDeviceInfo> QHidApi::cachedDevices() const {
+    return d_ptr->cachedDevices();
+}
+
+/*!
+ * \brief Returns the report descriptor of an open device.
+ *
+ * The descriptor is served from the cache file when it holds one for the device, otherwise it is read
+ * from the device.
+ *
+ * \param id A quint32 device id.
+ * \return the report descriptor, which is invalid if it could not be read.
+ */
+QHidReportDescriptor QHidApi::reportDescriptor(quint32 id) {
+    return d_ptr->reportDescriptor(id);
 }
 
 /*!
@@ -198,6 +350,225 @@ QByteArray QHidApi::read(quint32 deviceId, int timeout) {
     return d_ptr->read(deviceId, timeout);
 }
 
+/*!
+ * \brief  Read an Input report from a HID device into a QByteArray, with timeout and the time it arrived.
+ *
+ * \param id A quint32 device id.
+ * \param timeout timeout in milliseconds or -1 for blocking wait.
+ * \param timestamp set to the arrival time of the report, in nanoseconds of the monotonic clock.
+ *        See QHidDevice::lastReportTimestamp().
+ *
+ * \return Returns the data in a QByteArray, which is empty on timeout or error.
+ */
+QByteArray QHidApi::read(quint32 deviceId, int timeout, qint64 *timestamp) {
+    return d_ptr->read(deviceId, timeout, timestamp);
+}
+
+/*!
+ * \brief Waits until any of several devices has an Input report to read.
+ *
+ * All the devices are waited on at once, with a single poll() on hidraw, so one thread can service
+ * many devices without a round of short read timeouts. A device which has failed, for example
+ * because it was unplugged, is ready too, its read() returns an empty QByteArray.
+ *
+ * Devices opened with openShared() are checked every few milliseconds instead.
+ *
+ * \param ids the quint32 device ids to wait on.
+ * \param timeout timeout in milliseconds, 0 to only check, or -1 for blocking wait.
+ * \return the ids, in the order given, which have a report to read, or an empty list on timeout.
+ */
+QList<quint32> QHidApi::readReady(const QList<quint32> &ids, int timeout) {
+    return d_ptr->readReady(ids, timeout);
+}
+
+/*!
+ * \brief Reads the first Input report to arrive from any of several devices.
+ *
+ * \param ids the quint32 device ids to wait on.
+ * \param report set to the report read, which is empty if the device has failed.
+ * \param timeout timeout in milliseconds, 0 to only check, or -1 for blocking wait.
+ * \return the id of the device the report was read from, or 0 on timeout.
+ * \see readReady()
+ */
+quint32 QHidApi::readAny(const QList<quint32> &ids, QByteArray &report, int timeout) {
+    return d_ptr->readAny(ids, report, timeout);
+}
+
+/*!
+ * \brief Reads every Input report already received from a device, without waiting for new ones.
+ *
+ * The reports queued for the device are moved out in one go into a single buffer, which is much
+ * cheaper than one read() per report for a consumer catching up after a stall. On libusb the
+ * queue is taken in a single critical section.
+ *
+ * \param id A quint32 device id.
+ * \param maxReports the maximum number of reports to return.
+ * \return the reports, oldest first. The batch is empty if there were none or on error.
+ */
+QHidReportBatch QHidApi::drain(quint32 id, int maxReports) {
+    return d_ptr->drain(id, maxReports);
+}
+
+/*!
+ * \brief Starts keeping the latest Input report of each report id of a device.
+ *
+ * For consumers which only care about the current state of a device, such as a gauge or
+ * joystick display. The reader thread of the device publishes every report into a slot
+ * for its report id, and latestReport() copies a slot out in constant time without
+ * locking, queueing or allocating, however far behind the consumer is. Reports still go
+ * to read() and drain() as well, a consumer only using latestReport() should not read.
+ *
+ * Only devices opened with openShared() are tracked, their QHidSharedDevice reader thread is
+ * the one place reports are published from. Devices opened with open() are not, even with
+ * the libusb backend which reads them on a thread of its own.
+ *
+ * \param id A quint32 device id, returned by openShared().
+ * \return true if the latest reports are being kept, false if id is not a shared device.
+ */
+bool QHidApi::trackLatestReports(quint32 id) {
+    return d_ptr->trackLatestReports(id);
+}
+
+/*!
+ * \brief Copies the latest Input report with the given report id into data.
+ *
+ * trackLatestReports() must have been called for the device first. Reports are stored
+ * as they are read, including the report id byte of numbered reports.
+ *
+ * \param id A quint32 device id.
+ * \param reportId the report id, or 0 for devices which do not use numbered reports.
+ * \param data the buffer to copy the report into.
+ * \param length the size of data, longer reports are truncated.
+ * \param timestamp set to the arrival time of the report, see QHidDevice::lastReportTimestamp().
+ *        Comparing it with the previous one tells whether the state has changed.
+ * Only devices opened with openShared() keep their latest reports, for any other device
+ * this returns 0.
+ *
+ * \return the number of bytes copied, or 0 if no such report has arrived since
+ *         trackLatestReports() was called.
+ */
+int QHidApi::latestReport(quint32 id, quint8 reportId, uchar *data, int length, qint64 *timestamp) {
+    return d_ptr->latestReport(id, reportId, data, length, timestamp);
+}
+
+/*!
+ * \brief Returns the latest Input report with the given report id.
+ *
+ * As latestReport(quint32, quint8, uchar*, int, qint64*), but allocates the QByteArray returned.
+ *
+ * \return the report, or an empty QByteArray if no such report has arrived yet.
+ */
+QByteArray QHidApi::latestReport(quint32 id, quint8 reportId, qint64 *timestamp) {
+    QByteArray report(QHidStateRegister::MAX_REPORT_SIZE, Qt::Uninitialized);
+    int size = d_ptr->latestReport(id, reportId, reinterpret_cast<uchar*>(report.data()), report.size(), timestamp);
+    report.resize(size);
+    return report;
+}
+
+/*!
+ * \brief Returns a snapshot of the runtime statistics of a device.
+ *
+ * The counters cover every read and write made on the device since it was opened or since
+ * resetDeviceStats(), and cost nothing to keep. For a device opened with openShared() they are
+ * those of this id alone: the reports handed to it and those it missed by falling behind, its
+ * timeouts and writes, and the read latency up to the delivery of each report to it. Only
+ * QHidDeviceStats::reportsSuppressed() is that of the device, as the change filter is shared.
+ *
+ * \param id A quint32 device id.
+ * \return the statistics, or an invalid QHidDeviceStats if there is no such device.
+ */
+QHidDeviceStats QHidApi::deviceStats(quint32 id) {
+    return d_ptr->deviceStats(id);
+}
+
+/*!
+ * \brief Resets the runtime statistics of a device to 0.
+ *
+ * For a device opened with openShared() this only resets the statistics of this id, every other
+ * id sharing the device keeps its own. The shared QHidDeviceStats::reportsSuppressed() is not reset.
+ *
+ * \param id A quint32 device id.
+ */
+void QHidApi::resetDeviceStats(quint32 id) {
+    d_ptr->resetDeviceStats(id);
+}
+
+/*!
+ * \brief Only delivers the Input reports of a device which differ from the last one delivered.
+ *
+ * A report which is the same as the previous report with its id, in the bits set in mask, is
+ * dropped by the backend as it arrives, before it is queued, and counted in
+ * QHidDeviceStats::reportsSuppressed(). Byte i of the mask applies to byte i of the report as read,
+ * the report id first for devices which use numbered reports, and bytes past the end of the mask
+ * are not compared. QHidReportDescriptor::fieldMask() builds a mask from the fields that matter.
+ * With no mask every byte is compared. The first report after the filter is set is always
+ * delivered, and captures still record every report.
+ *
+ * For a device opened with openShared() the filter applies to every id sharing it.
+ *
+ * \param id A quint32 device id.
+ * \param reportId the report id to filter, or -1 for every report id. Devices which do not use
+ * numbered reports use 0.
+ * \param mask the bits to compare, or an empty QByteArray to compare every byte.
+ * \return true if the filter was set, false if there is no such device or it is a replay device.
+ */
+bool QHidApi::setChangeFilter(quint32 id, int reportId, const QByteArray &mask) {
+    return d_ptr->setChangeFilter(id, reportId, mask);
+}
+
+/*!
+ * \brief Removes a filter set by setChangeFilter(), delivering every Input report again.
+ *
+ * \param id A quint32 device id.
+ * \param reportId the report id to stop filtering, or -1 for every report id.
+ */
+void QHidApi::clearChangeFilter(quint32 id, int reportId) {
+    d_ptr->clearChangeFilter(id, reportId);
+}
+
+/*!
+ * \brief Starts recording every report exchanged with a device into a capture file.
+ *
+ * The capture is a series of segment files, named fileName followed by the segment number and
+ * \c .hidcap, in the format described in hidapi_capture.h. Each segment is allocated in full and
+ * mapped into memory, so recording a report costs a copy and nothing else, and a capture survives
+ * a crash of the application. With libusb Input reports are recorded by the read thread of the
+ * backend, as they arrive, rather than by the thread calling read().
+ *
+ * Devices started with the same fileName are recorded into the same capture, each with its own tag.
+ * Input, Output and Feature reports are all recorded, with their time and direction.
+ *
+ * With DeltaCapture, meant for recording over days, a report is copied into a queue and a thread
+ * of the capture stores it as the XOR with the last report with the same report id, or as a repeat
+ * count if the two are equal, with varint timestamps. Devices which send mostly unchanged reports
+ * then take a fraction of the space. Reports are dropped if the thread falls behind.
+ * QHidCaptureReader reads both encodings.
+ *
+ * \param id A quint32 device id.
+ * \param fileName the path of the capture, before the segment number.
+ * \param segmentSize the size of each segment in bytes. A new segment is started when one is full.
+ * \param maxSegments the number of segments kept, older segments are deleted. 0 keeps them all.
+ * \param encoding how the records are stored, used when the capture is created by the first device
+ *        recorded into fileName.
+ * \return true if the capture was started, false if there is no such device, it is already being
+ *         captured or the first segment could not be created.
+ */
+bool QHidApi::startCapture(quint32 id, const QString &fileName, qint64 segmentSize, int maxSegments,
+                           CaptureEncoding encoding) {
+    return d_ptr->startCapture(id, fileName, segmentSize, maxSegments, encoding);
+}
+
+/*!
+ * \brief Stops recording a device started with startCapture().
+ *
+ * The capture file is finished once its last device is stopped. Closing a device stops it as well.
+ *
+ * \param id A quint32 device id.
+ */
+void QHidApi::stopCapture(quint32 id) {
+    d_ptr->stopCapture(id);
+}
+
 /*!
  * \brief Get a feature report from a HID device.
  *
@@ -312,6 +683,26 @@ bool QHidApi::setNonBlocking(quint32 deviceId) {
  * The path name be determined by calling hid_enumerate(), or a platform-specific path
  * name can be used (eg: /dev/hidraw0 on Linux).
  *
+ * A path of the form \c{replay://<capture>[?options]} opens a device which plays back the
+ * Input reports recorded with startCapture() into \c{<capture>}, the fileName given to it,
+ * without any hardware. The options, joined with \c{&}, are:
+ *
+ * \list
+ * \li \c{speed=<factor>} plays the reports at factor times their recorded rate, 1 by
+ *     default. 0 makes every report readable at once.
+ * \li \c{device=<tag>} picks the device when several were recorded into the capture, by
+ *     the order they were started in from 0. The first one by default.
+ * \li \c{writes=validate} fails writes and sent feature reports which differ from the
+ *     ones recorded, in order, and sets error(). By default they are accepted unchecked.
+ * \li \c{loop=1} starts again from the first report after the last one, instead of
+ *     returning no more reports. A pass lasts at least a millisecond at speed 1, even if
+ *     every report was recorded at the same time.
+ * \endlist
+ *
+ * Feature reports read return the recorded ones, and reportDescriptor() the recorded
+ * descriptor. For example \c{replay:///tmp/session?speed=10} plays \c{/tmp/session} at
+ * ten times its recorded rate.
+ *
  * \param path - the path to the device
  * \return a quint32 id for the device.
  */
@@ -319,3 +710,20 @@ quint32 QHidApi::open(QString path) {
     return d_ptr->open(path);
 }
 
+/*!
+ * \brief Open a HID device by its path name, sharing it with the rest of the process.
+ *
+ * Every QHidApi and QHidDevice which opens the same path with openShared() uses one underlying
+ * device and one reader thread. Each of them receives every input report arriving after it opened
+ * the device, instead of racing the others for them. Writes and feature reports go straight to the
+ * shared device. A reader which falls more than a few hundred reports behind loses the oldest ones.
+ *
+ * Shared devices always use the shared hidapi context, whatever the contextMode().
+ *
+ * \param path - the path to the device
+ * \return a quint32 id for the device, or 0 if it could not be opened.
+ */
+quint32 QHidApi::openShared(QString path) {
+    return d_ptr->openShared(path);
+}
+
@@ -18,6 +18,10 @@ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH RE
 
 #include "qhidapi_global.h"
 #include "qhiddeviceinfo.h"
+#include "qhiddevicefilter.h"
+#include "qhidreportdescriptor.h"
+#include "qhidreportbatch.h"
+#include "qhiddevicestats.h"
 
 class QHidApiPrivate;
 
@@ -26,18 +30,59 @@ class QHIDAPISHARED_EXPORT QHidApi : public QObject {
     Q_OBJECT
 
 public:
+    enum EnumerationMode {
+        FullEnumeration,
+        QuickEnumeration
+    };
+
+    enum ContextMode {
+        SharedContext,
+        PrivateContext
+    };
+
+    enum CaptureEncoding {
+        RawCapture,
+        DeltaCapture
+    };
+
     QHidApi(ushort vendorId, QObject *parent=0);
     QHidApi(ushort vendorId, ushort productId, QObject *parent=0);
     QHidApi(QObject *parent=0);
     ~QHidApi();
 
-    QList<QHidDeviceInfo> enumerate(ushort vendorId=0x0, ushort productId=0x0);
+    QList<QHidDeviceInfo> enumerate(ushort vendorId=0x0, ushort productId=0x0, EnumerationMode mode=FullEnumeration);
+    QList<QHidDeviceInfo> enumerate(const QHidDeviceFilter &filter, EnumerationMode mode=FullEnumeration);
+    bool fetchStrings(QHidDeviceInfo &info);
+    void enumerateAsync(ushort vendorId=0x0, ushort productId=0x0, int deadline=1000);
+    void openAll(ushort vendorId=0x0, ushort productId=0x0, int deadline=1000);
+    int maxThreadCount() const;
+    void setMaxThreadCount(int count);
+    ContextMode contextMode() const;
+    void setContextMode(ContextMode mode);
+    bool setCacheFile(const QString &fileName);
+    QList<QHidDeviceInfo> cachedDevices() const;
+    QHidReportDescriptor reportDescriptor(quint32 id);
 
     quint32 open(ushort vendor_id, ushort product_id, QString serial_number=QString());
     quint32 open(QString path);
+    quint32 openShared(QString path);
     void close(quint32 deviceId);
     QByteArray read(quint32 deviceId);
     QByteArray read(quint32 id, int timeout);
+    QByteArray read(quint32 id, int timeout, qint64 *timestamp);
+    QList<quint32> readReady(const QList<quint32> &ids, int timeout=-1);
+    quint32 readAny(const QList<quint32> &ids, QByteArray &report, int timeout=-1);
+    QHidReportBatch drain(quint32 id, int maxReports=1024);
+    bool trackLatestReports(quint32 id);
+    int latestReport(quint32 id, quint8 reportId, uchar *data, int length, qint64 *timestamp=0);
+    QByteArray latestReport(quint32 id, quint8 reportId, qint64 *timestamp=0);
+    QHidDeviceStats deviceStats(quint32 id);
+    void resetDeviceStats(quint32 id);
+    bool setChangeFilter(quint32 id, int reportId=-1, const QByteArray &mask=QByteArray());
+    void clearChangeFilter(quint32 id, int reportId=-1);
+    bool startCapture(quint32 id, const QString &fileName, qint64 segmentSize=64 * 1024 * 1024, int maxSegments=0,
+                      CaptureEncoding encoding=RawCapture);
+    void stopCapture(quint32 id);
     int write(quint32 id, QByteArray data, quint8 reportId);
     int write(quint32 id, QByteArray data);
     bool setBlocking(quint32 id);
@@ -51,6 +96,12 @@ public:
     QString error(quint32 id);
 
 signals:
+    void deviceFound(const QHidDeviceInfo &info);
+    void enumerationFinished();
+    void deviceOpened(quint32 id, const QHidDeviceInfo &info);
+    void deviceOpenFailed(const QHidDeviceInfo &info);
+    void openAllFinished();
+    void cacheValidated();
 
 public slots:
 
@@ -1,5 +1,17 @@
 #include "qhidapi_p.h"
 #include "qhidapi.h"
+#include "qhiddevice_p.h"
+#include "qhidscanner_p.h"
+#include "qhiddevicecache_p.h"
+#include "qhidshareddevice_p.h"
+#include "qhidreplaydevice_p.h"
+#include "qhidstateregister_p.h"
+#include "qhidtrace_p.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QThread>
+#include <QVector>
 /*
 Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
 
@@ -8,16 +20,52 @@ Permission to use, copy, modify, and/or distribute this software for any purpose
 THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 */
 
+/*
+ * If no wake event could be created for them, readReady() looks at the devices opened
+ * with openShared() this often, in milliseconds.
+ */
+static const int SHARED_POLL_INTERVAL = 5;
+
 QHidApiPrivate::QHidApiPrivate(ushort vendorId, ushort productId, QHidApi *parent) :
     mVendorId(vendorId),
     mProductId(productId),
     mNextId(1),
+    mInitialised(false),
+    mContextMode(QHidApi::SharedContext),
+    mContext(NULL),
+    mWakeEvent(NULL),
     q_ptr(parent) {
-    init();
-    enumerate(vendorId, productId);
+    mScanner = new QHidScanner(this, parent);
+    QObject::connect(mScanner, SIGNAL(deviceFound(QHidDeviceInfo)), parent, SIGNAL(deviceFound(QHidDeviceInfo)));
+    QObject::connect(mScanner, SIGNAL(enumerationFinished()), parent, SIGNAL(enumerationFinished()));
+    QObject::connect(mScanner, SIGNAL(deviceOpened(quint32,QHidDeviceInfo)), parent, SIGNAL(deviceOpened(quint32,QHidDeviceInfo)));
+    QObject::connect(mScanner, SIGNAL(deviceOpenFailed(QHidDeviceInfo)), parent, SIGNAL(deviceOpenFailed(QHidDeviceInfo)));
+    QObject::connect(mScanner, SIGNAL(openAllFinished()), parent, SIGNAL(openAllFinished()));
+
+    mCache = new QHidDeviceCache(parent);
+    QObject::connect(mCache, SIGNAL(validated()), parent, SIGNAL(cacheValidated()));
 }
 
 QHidApiPrivate::~QHidApiPrivate() {
+    // wait for the pool before the library can be finalised.
+    delete mScanner;
+
+    foreach (quint32 id, mCaptureIds.keys()) {
+        stopCapture(id);
+    }
+
+    foreach (hid_device *device, mIdDeviceMap) {
+        hid_close(device);
+    }
+
+    foreach (const SharedHandle &shared, mSharedMap) {
+        shared.device->unsubscribe(shared.subscriber);
+        shared.device->release();
+    }
+
+    qDeleteAll(mReplayMap);
+    hid_wake_event_free(mWakeEvent);
+
     exit();
 }
 
@@ -117,16 +165,26 @@ QString QHidApiPrivate::indexedString(quint32 id, int index) {
 /*!
  * \brief initialises the library.
  *
- * Initialises the hidapi library. Calling it is not strictly necessary, as it will be called automatically by
- * enumerate() and any of the open_*() functions if it is needed. This function should be called at the
- * beginning of execution however, if there is a chance of HIDAPI handles being opened by different threads simultaneously.
+ * Takes this object's reference on the process wide hidapi library, or creates its private context
+ * in PrivateContext mode. Calling it is not strictly necessary, as it will be called automatically by
+ * enumerate() and any of the open_*() functions if it is needed. Further calls do nothing.
  *
  * \return 0 if successful, otherwise returns -1;
  * \see enumerate()
  */
 int QHidApiPrivate::init() {
-    int res = hid_init();
-    return res;
+    if (mInitialised) {
+        return 0;
+    }
+
+    if (mContextMode == QHidApi::PrivateContext) {
+        mContext = hid_context_new();
+        mInitialised = (mContext != NULL);
+    } else {
+        mInitialised = (hid_init() == 0);
+    }
+
+    return (mInitialised ? 0 : -1);
 }
 
 /*!
@@ -138,8 +196,27 @@ int QHidApiPrivate::init() {
  * \return This function returns 0 on success and -1 on error.
  */
 int QHidApiPrivate::exit() {
-    int res = hid_exit();
-    return res;
+    if (mInitialised) {
+        mInitialised = false;
+        if (mContext != NULL) {
+            hid_context_free(mContext);
+            mContext = NULL;
+        } else {
+            hid_exit();
+        }
+    }
+    return 0;
+}
+
+/*
+ * The context is created by init(), so the mode is fixed from then on.
+ */
+void QHidApiPrivate::setContextMode(QHidApi::ContextMode mode) {
+    if (mInitialised) {
+        qWarning("QHidApi::setContextMode: the context is already in use");
+        return;
+    }
+    mContextMode = mode;
 }
 
 /*!
@@ -163,37 +240,279 @@ int QHidApiPrivate::exit() {
  * \endcode
  * will return the all devices of the specified manufacturer and product id's.
  *
+ * With QHidApi::QuickEnumeration the strings are not read, see fetchStrings().
+ *
  * \param vendorId - an optional unsigned int vendor id
  * \param productId - an optional unsigned int product id.
+ * \param mode - QHidApi::FullEnumeration or QHidApi::QuickEnumeration.
  * \return a QList<HidDeviceInfo> containing all relevant devices, or an empty list if no devices match.
  */
-QList<QHidDeviceInfo> QHidApiPrivate::enumerate(ushort vendorId, ushort productId) {
-    hid_device_info *info = hid_enumerate(vendorId, productId);
+QList<QHidDeviceInfo> QHidApiPrivate::enumerate(ushort vendorId, ushort productId, QHidApi::EnumerationMode mode) {
+    return enumerate(QHidDeviceFilter(vendorId, productId), mode);
+}
+
+/*!
+ * \brief Enumerates the HID Devices which match a filter.
+ *
+ * \param filter - the criteria the devices must match, handed down to hid_enumerate_filter().
+ * \param mode - QHidApi::FullEnumeration or QHidApi::QuickEnumeration.
+ * \return a QList<HidDeviceInfo> containing the matching devices, or an empty list if no devices match.
+ */
+QList<QHidDeviceInfo> QHidApiPrivate::enumerate(const QHidDeviceFilter &filter, QHidApi::EnumerationMode mode) {
+    init();
+
+    QByteArray serialPattern = filter.serialNumberPattern().toUtf8();
+    hid_enumeration_filter hidFilter;
+
+    memset(&hidFilter, 0, sizeof(hidFilter));
+    hidFilter.vendor_id = filter.vendorId();
+    hidFilter.product_id = filter.productId();
+    hidFilter.interface_number = filter.interfaceNumber();
+    hidFilter.usage_page = filter.usagePage();
+    hidFilter.usage = filter.usage();
+    hidFilter.bus_type = filter.busType();
+    hidFilter.serial_number = (serialPattern.isEmpty() ? NULL : serialPattern.constData());
+    hidFilter.flags = (mode == QHidApi::QuickEnumeration ? HID_ENUMERATE_NO_STRINGS : 0);
+
+    hid_device_info *devs = hid_enumerate_context(mContext, &hidFilter);
+    hid_device_info *info = devs;
+    QSet<quint32> firstSeen;
     mDeviceInfoList.clear();
 
+    // quick enumerations have no strings, so are not worth caching.
+    bool updateCache = (mode == QHidApi::FullEnumeration && !mCache->fileName().isEmpty());
+
     while (info != NULL) {
-        QHidDeviceInfo i;
-        i.path = QString(info->path);
-        i.vendorId = info->vendor_id;
-        i.manufacturerString = QString::fromWCharArray(info->manufacturer_string);
-        i.productId = info->product_id;
-        i.productString = QString::fromWCharArray(info->product_string);
-        i.releaseNumber = info->release_number;
-        i.serialNumber = QString::fromWCharArray(info->serial_number);
-#if defined(Q_OS_WIN32) || defined(Q_OS_MAC)
-        i.usagePage = info->usage_page;
-        i.usage = info->usage;
-#endif
-        i.interfaceNumber = info->interface_number;
+        QHidDeviceInfo i = QHidDevicePrivate::fromHidDeviceInfo(info);
         mDeviceInfoList.append(i);
+        indexPath(i, firstSeen);
+
+        if (updateCache) {
+            mCache->update(i);
+        }
+
         info = info->next;
     }
 
-    hid_free_enumeration(info);
+    hid_free_enumeration(devs);
+
+    if (updateCache) {
+        mCache->save();
+    }
 
     return mDeviceInfoList;
 }
 
+/*
+ * Indexes the path so that open(vendorId, productId, serialNumber) can skip the bus scan.
+ */
+void QHidApiPrivate::indexPath(const QHidDeviceInfo &info, QSet<quint32> &firstSeen) {
+    quint32 product = (quint32(info.vendorId) << 16) | info.productId;
+    if (!info.serialNumber.isEmpty()) {
+        mPathIndex.insert(qMakePair(product, info.serialNumber), info.path);
+    }
+    if (!firstSeen.contains(product)) {
+        firstSeen.insert(product);
+        mPathIndex.insert(qMakePair(product, QString()), info.path);
+    }
+}
+
+/*!
+ * \brief Uses fileName to keep device details and report descriptors between runs.
+ *
+ * The cached devices are indexed straight away, so that open() can find them without
+ * a bus scan, and are checked against the bus in the background.
+ *
+ * \param fileName - the cache file, which is created if it does not exist.
+ * \return true if an existing cache file was read.
+ */
+bool QHidApiPrivate::setCacheFile(const QString &fileName) {
+    init();
+
+    bool loaded = mCache->load(fileName);
+    QList<QHidDeviceInfo> devices = mCache->devices();
+    QSet<quint32> firstSeen;
+
+    foreach (QHidDeviceInfo info, devices) {
+        indexPath(info, firstSeen);
+    }
+    if (mDeviceInfoList.isEmpty()) {
+        mDeviceInfoList = devices;
+    }
+
+    mCache->validate();
+
+    return loaded;
+}
+
+/*!
+ * \brief Returns the devices held in the cache file.
+ */
+QList<QHidDeviceInfo> QHidApiPrivate::cachedDevices() const {
+    return mCache->devices();
+}
+
+/*!
+ * \brief Returns the report descriptor of an open device.
+ *
+ * The descriptor is served from the cache file when it holds one for the device, otherwise
+ * it is read from the device and stored in the cache.
+ *
+ * \param id A quint32 device id.
+ * \return the report descriptor, which is invalid if it could not be read.
+ */
+QHidReportDescriptor QHidApiPrivate::reportDescriptor(quint32 id) {
+    if (mReplayMap.contains(id)) {
+        return QHidReportDescriptor(mReplayMap.value(id)->reportDescriptor());
+    }
+
+    hid_device *device = findId(id);
+    if (device == NULL) {
+        return QHidReportDescriptor();
+    }
+
+    QString path = mPathMap.key(id);
+    if (path.isEmpty()) {
+        hid_device_info *info = hid_get_device_info(device);
+        if (info != NULL) {
+            path = QString(info->path);
+        }
+    }
+
+    QByteArray data = mCache->reportDescriptor(path);
+    if (data.isEmpty()) {
+        data.resize(HID_API_MAX_REPORT_DESCRIPTOR_SIZE);
+        int res = hid_get_report_descriptor(device, reinterpret_cast<unsigned char*>(data.data()), data.size());
+        if (res <= 0) {
+            return QHidReportDescriptor();
+        }
+        data.resize(res);
+
+        if (!mCache->fileName().isEmpty() && !path.isEmpty()) {
+            if (!mCache->contains(path)) {
+                mCache->update(QHidDevicePrivate::fromHidDeviceInfo(hid_get_device_info(device)));
+            }
+            mCache->setReportDescriptor(path, data);
+            mCache->save();
+        }
+    }
+
+    return QHidReportDescriptor(data);
+}
+
+/*!
+ * \brief Reads the strings of a device returned by a quick enumeration.
+ *
+ * Only the strings which are still empty are read. The cached device list and the
+ * serial number index used by open() are updated to match.
+ *
+ * \param info - the device details returned by enumerate().
+ * \return true if the device could be read, otherwise false.
+ */
+bool QHidApiPrivate::fetchStrings(QHidDeviceInfo &info) {
+    init();
+
+    if (!readStrings(info, mContext)) {
+        return false;
+    }
+
+    updateDeviceInfo(info);
+
+    return true;
+}
+
+/*
+ * Reads the missing strings of info from the device through context. Touches no member
+ * state, so that it can be run from the scanner's pool threads.
+ */
+bool QHidApiPrivate::readStrings(QHidDeviceInfo &info, hid_context *context) {
+    QByteArray path = info.path.toLocal8Bit();
+    hid_device_info devInfo;
+
+    if (path.isEmpty()) {
+        return false;
+    }
+
+    memset(&devInfo, 0, sizeof(devInfo));
+    devInfo.path = path.data();
+
+    if (hid_enumerate_fill_strings_context(context, &devInfo) < 0) {
+        return false;
+    }
+
+    QHidDeviceInfo filled = QHidDevicePrivate::fromHidDeviceInfo(&devInfo);
+
+    // the strings were allocated by hidapi, the path belongs to us.
+    free(devInfo.serial_number);
+    free(devInfo.manufacturer_string);
+    free(devInfo.product_string);
+
+    if (info.manufacturerString.isEmpty()) {
+        info.manufacturerString = filled.manufacturerString;
+    }
+    if (info.productString.isEmpty()) {
+        info.productString = filled.productString;
+    }
+    if (info.serialNumber.isEmpty()) {
+        info.serialNumber = filled.serialNumber;
+    }
+#if defined(Q_OS_WIN32) || defined(Q_OS_MAC)
+    if (info.usagePage == 0) {
+        info.usagePage = filled.usagePage;
+        info.usage = filled.usage;
+    }
+#endif
+
+    return true;
+}
+
+/*
+ * Stores the details read by readStrings() in the cached device list and the
+ * serial number index used by open().
+ */
+void QHidApiPrivate::updateDeviceInfo(const QHidDeviceInfo &info) {
+    for (int i = 0; i < mDeviceInfoList.size(); i++) {
+        if (mDeviceInfoList.at(i).path == info.path) {
+            mDeviceInfoList[i] = info;
+        }
+    }
+
+    if (!info.serialNumber.isEmpty()) {
+        quint32 product = (quint32(info.vendorId) << 16) | info.productId;
+        mPathIndex.insert(qMakePair(product, info.serialNumber), info.path);
+    }
+}
+
+/*!
+ * \brief Enumerates the HID devices, reading the strings of each device on a thread pool.
+ *
+ * \param vendorId - the vendor id, or 0 for any vendor.
+ * \param productId - the product id, or 0 for any product.
+ * \param deadline - the time in milliseconds allowed for each device.
+ */
+void QHidApiPrivate::enumerateAsync(ushort vendorId, ushort productId, int deadline) {
+    mScanner->enumerate(vendorId, productId, deadline);
+}
+
+/*!
+ * \brief Opens all matching HID devices on a thread pool.
+ *
+ * \param vendorId - the vendor id, or 0 for any vendor.
+ * \param productId - the product id, or 0 for any product.
+ * \param deadline - the time in milliseconds allowed for each device.
+ */
+void QHidApiPrivate::openAll(ushort vendorId, ushort productId, int deadline) {
+    mScanner->openAll(vendorId, productId, deadline);
+}
+
+int QHidApiPrivate::maxThreadCount() const {
+    return mScanner->maxThreadCount();
+}
+
+void QHidApiPrivate::setMaxThreadCount(int count) {
+    mScanner->setMaxThreadCount(count);
+}
+
 /*!
  * \brief Open a HID device using a Vendor ID (VID), Product ID (PID) and optionally a serial number.
  *
@@ -223,9 +542,65 @@ quint32 QHidApiPrivate::open(ushort vendorId, ushort productId, QString serialNu
  * \param id - the quint32 id for the device.
  */
 void QHidApiPrivate::close(quint32 id) {
+    stopCapture(id);
+
+    if (mSharedMap.contains(id)) {
+        SharedHandle shared = mSharedMap.take(id);
+        shared.device->unsubscribe(shared.subscriber);
+        shared.device->release();
+        forgetId(id);
+        return;
+    }
+
+    if (mReplayMap.contains(id)) {
+        delete mReplayMap.take(id);
+        forgetId(id);
+        return;
+    }
+
     hid_device *dev = findId(id);
     if (dev != NULL) {
         hid_close(dev);
+        forgetId(id);
+    }
+}
+
+/*
+ * Removes every reference to a closed device id, so that a later open() of the
+ * same device gets a fresh handle rather than the one that was closed.
+ */
+void QHidApiPrivate::forgetId(quint32 id) {
+    hid_device *dev = mIdDeviceMap.take(id);
+    mDeviceIdMap.remove(dev);
+
+    QMutableMapIterator<QString, quint32> pathIt(mPathMap);
+    while (pathIt.hasNext()) {
+        if (pathIt.next().value() == id)
+            pathIt.remove();
+    }
+
+    QString serialNumber;
+    QMutableMapIterator<QString, quint32> serIt(mSerDevices);
+    while (serIt.hasNext()) {
+        if (serIt.next().value() == id) {
+            serialNumber = serIt.key();
+            serIt.remove();
+        }
+    }
+
+    QMutableMapIterator<ushort, QMultiMap<ushort, QVariant> > vmapIt(mVendorMap);
+    while (vmapIt.hasNext()) {
+        QMultiMap<ushort, QVariant> &pmap = vmapIt.next().value();
+        QMutableMapIterator<ushort, QVariant> pmapIt(pmap);
+        while (pmapIt.hasNext()) {
+            QVariant v = pmapIt.next().value();
+            if ((v.type() == QVariant::UInt && v.toUInt() == id) ||
+                    (v.type() == QVariant::String && !serialNumber.isEmpty() && v.toString() == serialNumber)) {
+                pmapIt.remove();
+            }
+        }
+        if (pmap.isEmpty())
+            vmapIt.remove();
     }
 }
 
@@ -234,6 +609,9 @@ hid_device *QHidApiPrivate::findId(quint32 id) {
         hid_device* dev = mIdDeviceMap.value(id);
         return dev;
     }
+    if (mSharedMap.contains(id)) {
+        return mSharedMap.value(id).device->device();
+    }
     return NULL;
 }
 
@@ -249,6 +627,17 @@ hid_device *QHidApiPrivate::findId(quint32 id) {
  * \return Returns the data in a QByteArray. If no packet was available to be read and the handle is in non-blocking mode, Returns the data in a QByteArray.
  */
 QByteArray QHidApiPrivate::read(quint32 id) {
+    QHID_TRACE_SCOPE("QHidApi::read");
+    if (mSharedMap.contains(id)) {
+        const SharedHandle &shared = mSharedMap[id];
+        return shared.device->read(shared.subscriber, shared.blocking ? -1 : 0);
+    }
+
+    if (mReplayMap.contains(id)) {
+        QHidReplayDevice *replay = mReplayMap.value(id);
+        return replay->read(replay->isBlocking() ? -1 : 0);
+    }
+
     hid_device *device = findId(id);
 
     if (device != NULL) {
@@ -282,15 +671,29 @@ QByteArray QHidApiPrivate::read(quint32 id) {
  *
  * \return Returns the data in a QByteArray.
  */
-QByteArray QHidApiPrivate::read(quint32 id, int timeout) {
+QByteArray QHidApiPrivate::read(quint32 id, int timeout, qint64 *timestamp) {
+    QHID_TRACE_SCOPE("QHidApi::read");
+    if (mSharedMap.contains(id)) {
+        const SharedHandle &shared = mSharedMap[id];
+        return shared.device->read(shared.subscriber, timeout, timestamp);
+    }
+
+    if (mReplayMap.contains(id)) {
+        return mReplayMap.value(id)->read(timeout, timestamp);
+    }
+
     hid_device *device = findId(id);
 
     if (device != NULL) {
         unsigned char buf[65];
+        unsigned long long received = 0;
 
-        int rep = hid_read_timeout(device, buf, 65, timeout);
+        int rep = hid_read_timeout_timestamped(device, buf, 65, timeout, &received);
 
         if (rep > 0) {
+            if (timestamp != NULL) {
+                *timestamp = qint64(received);
+            }
             QByteArray data(reinterpret_cast<char*>(buf), rep);
             return data;
         }
@@ -299,6 +702,301 @@ QByteArray QHidApiPrivate::read(quint32 id, int timeout) {
     return QByteArray();
 }
 
+/*!
+ * \brief Waits until any of several devices has an Input report to read.
+ *
+ * \param ids the quint32 device ids to wait on.
+ * \param timeout timeout in milliseconds, 0 to only check, or -1 for blocking wait.
+ * \return the ids, in the order given, which have a report to read.
+ */
+QList<quint32> QHidApiPrivate::readReady(const QList<quint32> &ids, int timeout) {
+    QVector<hid_device*> devices;
+    QVector<quint32> deviceIds;
+    QList<quint32> sharedIds;
+    QList<quint32> replayIds;
+    QSet<quint32> readySet;
+    QList<quint32> ready;
+
+    foreach (quint32 id, ids) {
+        if (mSharedMap.contains(id)) {
+            sharedIds.append(id);
+        } else if (mReplayMap.contains(id)) {
+            replayIds.append(id);
+        } else if (mIdDeviceMap.contains(id)) {
+            devices.append(mIdDeviceMap.value(id));
+            deviceIds.append(id);
+        }
+    }
+
+    if (devices.isEmpty() && sharedIds.isEmpty() && replayIds.isEmpty()) {
+        return ready;
+    }
+
+    // shared devices are fed by their reader thread rather than hidapi, they wake the wait
+    // below through the event. It is added before looking at them, so a report which
+    // arrives in between ends the wait at once.
+    hid_wake_event *event = NULL;
+    if (!sharedIds.isEmpty()) {
+        if (mWakeEvent == NULL) {
+            mWakeEvent = hid_wake_event_new();
+        }
+        event = mWakeEvent;
+    }
+    if (event != NULL) {
+        foreach (quint32 id, sharedIds) {
+            mSharedMap[id].device->addWakeEvent(event);
+        }
+    }
+    bool polled = !sharedIds.isEmpty() && event == NULL;
+
+    QVector<int> flags(devices.size());
+    QElapsedTimer timer;
+    timer.start();
+
+    forever {
+        foreach (quint32 id, sharedIds) {
+            const SharedHandle &shared = mSharedMap[id];
+            if (shared.device->hasReport(shared.subscriber)) {
+                readySet.insert(id);
+            }
+        }
+        // replay devices know when their next report is due, the wait ends then.
+        qint64 due = -1;
+        foreach (quint32 id, replayIds) {
+            qint64 nsecs = mReplayMap.value(id)->nsecsToReport();
+            if (nsecs == 0) {
+                readySet.insert(id);
+            } else if (due < 0 || nsecs < due) {
+                due = nsecs;
+            }
+        }
+
+        int wait = timeout;
+        if (!readySet.isEmpty()) {
+            wait = 0;
+        } else if (timeout >= 0) {
+            wait = int(qMax(qint64(0), timeout - timer.elapsed()));
+        }
+        if (due >= 0) {
+            qint64 dueMsecs = (due + 999999) / 1000000;
+            if (wait < 0 || wait > dueMsecs) {
+                wait = int(dueMsecs);
+            }
+        }
+        if (polled && (wait < 0 || wait > SHARED_POLL_INTERVAL)) {
+            wait = SHARED_POLL_INTERVAL;
+        }
+
+        int res = 0;
+        if (!devices.isEmpty() || event != NULL) {
+            res = hid_wait_any_event(devices.data(), size_t(devices.size()), flags.data(), wait, event);
+            for (int i = 0; res > 0 && i < devices.size(); i++) {
+                if (flags.at(i)) {
+                    readySet.insert(deviceIds.at(i));
+                }
+            }
+        } else if (wait > 0) {
+            QThread::msleep(ulong(wait));
+        }
+
+        if (!readySet.isEmpty() || res < 0 || (timeout >= 0 && timer.elapsed() >= timeout)) {
+            break;
+        }
+    }
+
+    if (event != NULL) {
+        foreach (quint32 id, sharedIds) {
+            mSharedMap[id].device->removeWakeEvent(event);
+        }
+    }
+
+    foreach (quint32 id, ids) {
+        if (readySet.contains(id) && !ready.contains(id)) {
+            ready.append(id);
+        }
+    }
+
+    return ready;
+}
+
+/*!
+ * \brief Reads every Input report already received from a device.
+ *
+ * \param id A quint32 device id.
+ * \param maxReports the maximum number of reports to return.
+ * \return the reports, oldest first.
+ */
+QHidReportBatch QHidApiPrivate::drain(quint32 id, int maxReports) {
+    QHID_TRACE_SCOPE("QHidApi::drain");
+    if (mSharedMap.contains(id)) {
+        const SharedHandle &shared = mSharedMap[id];
+        return shared.device->drain(shared.subscriber, maxReports);
+    }
+
+    if (mReplayMap.contains(id)) {
+        return mReplayMap.value(id)->drain(maxReports);
+    }
+
+    return QHidDevicePrivate::drain(findId(id), maxReports);
+}
+
+/*
+ * Only shared devices publish into the register, from their QHidSharedDevice reader thread.
+ */
+bool QHidApiPrivate::trackLatestReports(quint32 id) {
+    if (!mSharedMap.contains(id)) {
+        return false;
+    }
+
+    SharedHandle &shared = mSharedMap[id];
+    if (shared.state == NULL) {
+        shared.state = shared.device->stateRegister();
+    }
+
+    return true;
+}
+
+int QHidApiPrivate::latestReport(quint32 id, quint8 reportId, uchar *data, int length, qint64 *timestamp) {
+    QMap<quint32, SharedHandle>::const_iterator it = mSharedMap.constFind(id);
+    if (it == mSharedMap.constEnd() || it->state == NULL) {
+        return 0;
+    }
+
+    return it->state->read(reportId, data, length, timestamp);
+}
+
+QHidDeviceStats QHidApiPrivate::deviceStats(quint32 id) {
+    QHidDeviceStats stats;
+    hid_device_stats counters;
+
+    if (mSharedMap.contains(id)) {
+        const SharedHandle &shared = mSharedMap[id];
+        shared.device->stats(shared.subscriber, &counters);
+        stats.setStats(counters);
+        return stats;
+    }
+
+    if (mReplayMap.contains(id)) {
+        mReplayMap.value(id)->stats(&counters);
+        stats.setStats(counters);
+        return stats;
+    }
+
+    hid_device *device = findId(id);
+    if (device != NULL && hid_get_device_stats(device, &counters) == 0) {
+        stats.setStats(counters);
+    }
+
+    return stats;
+}
+
+/*
+ * Devices recorded into the same file share one capture, which is closed with its last device.
+ */
+bool QHidApiPrivate::startCapture(quint32 id, const QString &fileName, qint64 segmentSize, int maxSegments,
+                                  QHidApi::CaptureEncoding encoding) {
+    hid_device *device = findId(id);
+    if (device == NULL || mCaptureIds.contains(id)) {
+        return false;
+    }
+
+    hid_capture *capture = mCaptures.value(fileName);
+    if (capture == NULL) {
+        capture = hid_capture_open_encoded(QFile::encodeName(fileName).constData(), size_t(segmentSize),
+                                           uint(qMax(0, maxSegments)),
+                                           encoding == QHidApi::DeltaCapture ? HID_CAPTURE_ENCODING_DELTA
+                                                                             : HID_CAPTURE_ENCODING_RAW);
+        if (capture == NULL) {
+            return false;
+        }
+        mCaptures.insert(fileName, capture);
+    }
+
+    if (hid_capture_attach(capture, device) < 0) {
+        if (!mCaptureIds.values().contains(fileName)) {
+            hid_capture_close(mCaptures.take(fileName));
+        }
+        return false;
+    }
+
+    mCaptureIds.insert(id, fileName);
+    return true;
+}
+
+void QHidApiPrivate::stopCapture(quint32 id) {
+    if (!mCaptureIds.contains(id)) {
+        return;
+    }
+
+    QString fileName = mCaptureIds.take(id);
+    hid_capture_detach(findId(id));
+
+    if (!mCaptureIds.values().contains(fileName)) {
+        hid_capture_close(mCaptures.take(fileName));
+    }
+}
+
+void QHidApiPrivate::resetDeviceStats(quint32 id) {
+    if (mSharedMap.contains(id)) {
+        const SharedHandle &shared = mSharedMap[id];
+        shared.device->resetStats(shared.subscriber);
+        return;
+    }
+
+    if (mReplayMap.contains(id)) {
+        mReplayMap.value(id)->resetStats();
+        return;
+    }
+
+    hid_device *device = findId(id);
+    if (device != NULL) {
+        hid_reset_device_stats(device);
+    }
+}
+
+/*
+ * The filter is kept by the backend, so a shared device filters for every subscriber and a
+ * replay device cannot filter.
+ */
+bool QHidApiPrivate::setChangeFilter(quint32 id, int reportId, const QByteArray &mask) {
+    hid_device *device = findId(id);
+    if (device == NULL) {
+        return false;
+    }
+
+    return hid_set_change_filter(device, reportId, reinterpret_cast<const unsigned char*>(mask.constData()),
+                                 size_t(mask.size())) == 0;
+}
+
+void QHidApiPrivate::clearChangeFilter(quint32 id, int reportId) {
+    hid_device *device = findId(id);
+    if (device != NULL) {
+        hid_clear_change_filter(device, reportId);
+    }
+}
+
+/*!
+ * \brief Reads the first Input report to arrive from any of several devices.
+ *
+ * \param ids the quint32 device ids to wait on.
+ * \param report set to the report read.
+ * \param timeout timeout in milliseconds, 0 to only check, or -1 for blocking wait.
+ * \return the id of the device the report was read from, or 0 on timeout.
+ */
+quint32 QHidApiPrivate::readAny(const QList<quint32> &ids, QByteArray &report, int timeout) {
+    QList<quint32> ready = readReady(ids, timeout);
+
+    report.clear();
+    if (ready.isEmpty()) {
+        return 0;
+    }
+
+    quint32 id = ready.first();
+    report = read(id, 0);
+
+    return id;
+}
+
 /*!
  * \brief Get a feature report from a HID device.
  *
@@ -312,6 +1010,15 @@ QByteArray QHidApiPrivate::read(quint32 id, int timeout) {
 
  */
 QByteArray QHidApiPrivate::featureReport(quint32 id, uint reportId) {
+    QHID_TRACE_SCOPE("QHidApi::featureReport");
+    if (mReplayMap.contains(id)) {
+        unsigned char buf[65];
+        buf[0] = reportId;
+
+        int rep = mReplayMap.value(id)->featureReport(buf, sizeof(buf));
+        return (rep > 0 ? QByteArray(reinterpret_cast<char*>(buf), rep) : QByteArray());
+    }
+
     hid_device *device = findId(id);
 
     if (device != NULL) {
@@ -343,8 +1050,14 @@ QByteArray QHidApiPrivate::featureReport(quint32 id, uint reportId) {
  * \return the number of bytes written, or -1 on error.
  */
 int QHidApiPrivate::sendFeatureReport(quint32 id, quint8 reportId, QByteArray data) {
+    QHID_TRACE_SCOPE("QHidApi::sendFeatureReport");
     if (data.length() > 64) return -1;
 
+    if (mReplayMap.contains(id)) {
+        data.prepend(reportId);
+        return mReplayMap.value(id)->sendFeatureReport(reinterpret_cast<uchar*>(data.data()), data.length());
+    }
+
     hid_device *device = findId(id);
 
     if (device != NULL) {
@@ -372,8 +1085,20 @@ int QHidApiPrivate::sendFeatureReport(quint32 id, quint8 reportId, QByteArray da
  * \return the number of bytes written, or -1 on error.
  */
 int QHidApiPrivate::write(quint32 id, QByteArray data, quint8 reportNumber) {
+    QHID_TRACE_SCOPE("QHidApi::write");
     if (data.length() > 64) return -1;
 
+    if (mReplayMap.contains(id)) {
+        data.prepend(reportNumber);
+        return mReplayMap.value(id)->write(reinterpret_cast<uchar*>(data.data()), data.length());
+    }
+
+    if (mSharedMap.contains(id)) {
+        const SharedHandle &shared = mSharedMap[id];
+        data.prepend(reportNumber);
+        return shared.device->write(shared.subscriber, reinterpret_cast<uchar*>(data.data()), data.length());
+    }
+
     hid_device *device = findId(id);
 
     if (device != NULL) {
@@ -401,8 +1126,18 @@ int QHidApiPrivate::write(quint32 id, QByteArray data, quint8 reportNumber) {
  * \return the number of bytes written, or -1 on error.
  */
 int QHidApiPrivate::write(quint32 id, QByteArray data) {
+    QHID_TRACE_SCOPE("QHidApi::write");
     if (data.length() > 65) return -1;
 
+    if (mReplayMap.contains(id)) {
+        return mReplayMap.value(id)->write(reinterpret_cast<uchar*>(data.data()), data.length());
+    }
+
+    if (mSharedMap.contains(id)) {
+        const SharedHandle &shared = mSharedMap[id];
+        return shared.device->write(shared.subscriber, reinterpret_cast<uchar*>(data.data()), data.length());
+    }
+
     hid_device *device = findId(id);
 
     if (device != NULL) {
@@ -422,6 +1157,10 @@ int QHidApiPrivate::write(quint32 id, QByteArray data) {
  * \return This function returns a string containing the last error which occurred on the device or an empty QString if none has occurred.
  */
 QString QHidApiPrivate::error(quint32 id) {
+    if (mReplayMap.contains(id)) {
+        return mReplayMap.value(id)->error();
+    }
+
     hid_device *device = findId(id);
 
     if (device != NULL) {
@@ -450,10 +1189,23 @@ QString QHidApiPrivate::error(quint32 id) {
  * \return Returns true on success and false on error.
  */
 bool QHidApiPrivate::setBlocking(quint32 id) {
+    if (mSharedMap.contains(id)) {
+        // the shared device is only read by its reader thread.
+        mSharedMap[id].blocking = true;
+        return true;
+    }
+
+    if (mReplayMap.contains(id)) {
+        mReplayMap.value(id)->setBlocking(true);
+        return true;
+    }
+
     hid_device *device = findId(id);
+    if (device == NULL) {
+        return false;
+    }
 
-    int rep = hid_set_nonblocking(device, 1);
-    return !!rep;
+    return hid_set_nonblocking(device, 0) == 0;
 }
 
 /*!
@@ -468,10 +1220,22 @@ bool QHidApiPrivate::setBlocking(quint32 id) {
  * \return Returns true on success and false on error.
  */
 bool QHidApiPrivate::setNonBlocking(quint32 id) {
+    if (mSharedMap.contains(id)) {
+        mSharedMap[id].blocking = false;
+        return true;
+    }
+
+    if (mReplayMap.contains(id)) {
+        mReplayMap.value(id)->setBlocking(false);
+        return true;
+    }
+
     hid_device *device = findId(id);
+    if (device == NULL) {
+        return false;
+    }
 
-    int rep = hid_set_nonblocking(device, 0);
-    return !!rep;
+    return hid_set_nonblocking(device, 1) == 0;
 }
 
 /*!
@@ -493,12 +1257,73 @@ quint32 QHidApiPrivate::open(QString path) {
         return id;
     }
 
+    if (QHidReplayDevice::isReplayPath(path)) {
+        return openReplay(path);
+    }
+
+    init();
+
     // if not open it.
-    hid_device *device = hid_open_path(path.toLocal8Bit().data());
+    hid_device *device = hid_open_path_context(mContext, path.toLocal8Bit().data());
 
     // sorry doesn't exist
     if (device == NULL) return 0;
 
+    return registerDevice(path, device);
+}
+
+/*!
+ * \brief Open a HID device by its path name, sharing it with the rest of the process.
+ *
+ * \param path - the path to the device
+ * \return a quint32 id for the device, or 0 if it could not be opened.
+ */
+quint32 QHidApiPrivate::openShared(QString path) {
+
+    // have we opened this path before.
+    if (mPathMap.contains(path)) {
+        return mPathMap.value(path);
+    }
+
+    // the shared device holds its own reference on the library.
+    QHidSharedDevice *device = QHidSharedDevice::acquire(path);
+    if (device == NULL) return 0;
+
+    SharedHandle shared;
+    shared.device = device;
+    shared.subscriber = device->subscribe();
+    shared.blocking = true;
+    shared.state = NULL;
+
+    quint32 id = nextId();
+    mSharedMap.insert(id, shared);
+    mPathMap.insert(path, id);
+
+    return id;
+}
+
+/*
+ * Opens a device playing back a capture, see QHidReplayDevice for the path.
+ * returns the new id, or 0 if the capture could not be read.
+ */
+quint32 QHidApiPrivate::openReplay(const QString &path) {
+    QHidReplayDevice *device = QHidReplayDevice::open(path);
+    if (device == NULL) return 0;
+
+    quint32 id = nextId();
+    mReplayMap.insert(id, device);
+    mPathMap.insert(path, id);
+
+    return id;
+}
+
+/*
+ * Assigns an id to a device opened with the supplied path.
+ * returns the new id, or the existing id if the device is already known.
+ */
+quint32 QHidApiPrivate::registerDevice(const QString &path, hid_device *device) {
+    quint32 id = 0;
+
     // have we already opened it.
     if (mDeviceIdMap.contains(device)) {
         id = mDeviceIdMap.value(device);
@@ -521,10 +1346,14 @@ quint32 QHidApiPrivate::open(QString path) {
  * returns the handle id if successful, otherwise  returns 0.
  */
 quint32 QHidApiPrivate::openNewProduct(ushort vendorId, ushort productId, QString serialNumber) {
+    init();
+
     hid_device *device = NULL;
     quint32 id = 0;
     if (serialNumber.isEmpty()) {
-        device = hid_open(vendorId, productId, NULL);
+        device = openIndexedPath(vendorId, productId, serialNumber);
+        if (device == NULL)
+            device = hid_open_context(mContext, vendorId, productId, NULL);
         if (device != NULL) {
             id = nextId();
             QVariant v(id);
@@ -535,11 +1364,14 @@ quint32 QHidApiPrivate::openNewProduct(ushort vendorId, ushort productId, QStrin
             mDeviceIdMap.insert(device, id);
         }
     } else {
-        wchar_t* sn = new wchar_t[serialNumber.length() + 1];
-        serialNumber.toWCharArray(sn);
-        sn[serialNumber.length()] = 0x0;
-        device = hid_open(0x4d8, 0xf1fa, NULL);
-//        device = hid_open(vendorId, productId, sn/*, Q_NULLPTR*/);
+        device = openIndexedPath(vendorId, productId, serialNumber);
+        if (device == NULL) {
+            wchar_t* sn = new wchar_t[serialNumber.length() + 1];
+            serialNumber.toWCharArray(sn);
+            sn[serialNumber.length()] = 0x0;
+            device = hid_open_context(mContext, vendorId, productId, sn);
+            delete[] sn;
+        }
         if (device != Q_NULLPTR) {
             id = nextId();
             QVariant v(serialNumber);
@@ -554,6 +1386,41 @@ quint32 QHidApiPrivate::openNewProduct(ushort vendorId, ushort productId, QStrin
     return id;
 }
 
+/*
+ * Opens the device recorded for the supplied vendor/product/serial number by the last
+ * enumerate(). The path may be stale if the device was unplugged since, so the opened
+ * device is checked against the ids and closed again if it doesn't match.
+ *
+ * returns the handle if successful, otherwise returns NULL.
+ */
+hid_device *QHidApiPrivate::openIndexedPath(ushort vendorId, ushort productId, const QString &serialNumber) {
+    quint32 product = (quint32(vendorId) << 16) | productId;
+    QString path = mPathIndex.value(qMakePair(product, serialNumber));
+    if (path.isEmpty())
+        return NULL;
+
+    hid_device *device = hid_open_path_context(mContext, path.toLocal8Bit().data());
+    if (device == NULL) {
+        mPathIndex.remove(qMakePair(product, serialNumber));
+        return NULL;
+    }
+
+    hid_device_info *info = hid_get_device_info(device);
+    bool matches = info != NULL &&
+            info->vendor_id == vendorId &&
+            info->product_id == productId &&
+            (serialNumber.isEmpty() ||
+             (info->serial_number != NULL && QString::fromWCharArray(info->serial_number) == serialNumber));
+
+    if (!matches) {
+        hid_close(device);
+        mPathIndex.remove(qMakePair(product, serialNumber));
+        return NULL;
+    }
+
+    return device;
+}
+
 /*
  * Opens a product for the supplied vendor/product/serial number. First checks if we already have
  * this combination open, otherwise opens a new one.
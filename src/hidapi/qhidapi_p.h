@@ -10,26 +10,63 @@ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH RE
 
 #include <QObject>
 #include <QMap>
+#include <QHash>
+#include <QPair>
 #include <QList>
 #include <QVariant>
+#include <QSet>
 
 #include "qhiddeviceinfo.h"
+#include "qhidreportdescriptor.h"
+#include "qhidapi.h"
 #include "hidapi.h"
+#include "hidapi_capture.h"
 
-class QHidApi;
+class QHidScanner;
+class QHidDeviceCache;
+class QHidSharedDevice;
+class QHidReplayDevice;
+class QHidStateRegister;
 
 class QHidApiPrivate {
 public:
     QHidApiPrivate(ushort vendorId, ushort productId, QHidApi *parent);
     ~QHidApiPrivate();
 
-    QList<QHidDeviceInfo> enumerate(ushort vendorId=0x0, ushort productId=0x0);
+    QList<QHidDeviceInfo> enumerate(ushort vendorId=0x0, ushort productId=0x0,
+                                    QHidApi::EnumerationMode mode=QHidApi::FullEnumeration);
+    QList<QHidDeviceInfo> enumerate(const QHidDeviceFilter &filter,
+                                    QHidApi::EnumerationMode mode=QHidApi::FullEnumeration);
+    bool fetchStrings(QHidDeviceInfo &info);
+    static bool readStrings(QHidDeviceInfo &info, hid_context *context);
+    void updateDeviceInfo(const QHidDeviceInfo &info);
+    void enumerateAsync(ushort vendorId, ushort productId, int deadline);
+    void openAll(ushort vendorId, ushort productId, int deadline);
+    int maxThreadCount() const;
+    void setMaxThreadCount(int count);
+    bool setCacheFile(const QString &fileName);
+    QList<QHidDeviceInfo> cachedDevices() const;
+    QHidReportDescriptor reportDescriptor(quint32 id);
 
     quint32 open(ushort vendor_id, ushort product_id, QString serial_number=QString());
     quint32 open(QString path);
+    quint32 openShared(QString path);
+    quint32 openReplay(const QString &path);
     void close(quint32 id);
     QByteArray read(quint32 id);
-    QByteArray read(quint32 id, int timeout);
+    QByteArray read(quint32 id, int timeout, qint64 *timestamp=NULL);
+    QList<quint32> readReady(const QList<quint32> &ids, int timeout);
+    quint32 readAny(const QList<quint32> &ids, QByteArray &report, int timeout);
+    QHidReportBatch drain(quint32 id, int maxReports);
+    bool trackLatestReports(quint32 id);
+    int latestReport(quint32 id, quint8 reportId, uchar *data, int length, qint64 *timestamp);
+    QHidDeviceStats deviceStats(quint32 id);
+    void resetDeviceStats(quint32 id);
+    bool setChangeFilter(quint32 id, int reportId, const QByteArray &mask);
+    void clearChangeFilter(quint32 id, int reportId);
+    bool startCapture(quint32 id, const QString &fileName, qint64 segmentSize, int maxSegments,
+                      QHidApi::CaptureEncoding encoding);
+    void stopCapture(quint32 id);
     int write(quint32 id, QByteArray data, quint8 reportNumber);
     int write(quint32 id, QByteArray data);
     bool setBlocking(quint32 id);
@@ -44,14 +81,25 @@ public:
     quint32 nextId();
     int init();
     int exit();
+    void setContextMode(QHidApi::ContextMode mode);
     hid_device *findId(quint32 id);
     quint32 openProduct(ushort vendorId, ushort productId, QString serialNumber);
     quint32 openNewProduct(ushort vendorId, ushort productId, QString serialNumber);
+    hid_device *openIndexedPath(ushort vendorId, ushort productId, const QString &serialNumber);
+    void forgetId(quint32 id);
+    quint32 registerDevice(const QString &path, hid_device *device);
+    void indexPath(const QHidDeviceInfo &info, QSet<quint32> &firstSeen);
 
     static const int MAX_STR = 255;
 
     quint32 mVendorId, mProductId;
     quint32 mNextId;
+    bool mInitialised;
+    QHidApi::ContextMode mContextMode;
+    /*
+     * the private context in PrivateContext mode, otherwise NULL for the shared one.
+     */
+    hid_context *mContext;
     QList<QHidDeviceInfo> mDeviceInfoList;
     /*
      * map of vendorId -> productId.
@@ -73,6 +121,54 @@ public:
      * reverse of idDeviceMap. Used to check if we already heve a device opened..
      */
     QMap<hid_device*, quint32> mDeviceIdMap;
+    /*
+     * map of (vendorId << 16 | productId, serialNumber) -> path, filled by enumerate().
+     * An empty serial number maps to the first device found with that vendor/product id.
+     */
+    QHash<QPair<quint32, QString>, QString> mPathIndex;
+    /*
+     * a subscription to a device opened with openShared().
+     */
+    struct SharedHandle {
+        QHidSharedDevice *device;
+        int subscriber;
+        bool blocking;
+        /*
+         * set by trackLatestReports(), owned by the shared device.
+         */
+        QHidStateRegister *state;
+    };
+    /*
+     * map of id -> shared device. Shared devices are not in mIdDeviceMap, they are
+     * closed by the last user in the process.
+     */
+    QMap<quint32, SharedHandle> mSharedMap;
+    /*
+     * map of id -> device playing back a capture, opened with a replay:// path.
+     * Replay devices have no hid_device, so findId() returns NULL for them.
+     */
+    QMap<quint32, QHidReplayDevice*> mReplayMap;
+    /*
+     * ends a readReady() wait in hidapi when a shared device receives a report, created on
+     * first use.
+     */
+    hid_wake_event *mWakeEvent;
+    /*
+     * map of file name -> capture, shared by every id recorded into the same file.
+     */
+    QMap<QString, hid_capture*> mCaptures;
+    /*
+     * map of id -> file name of the capture it is recorded into.
+     */
+    QMap<quint32, QString> mCaptureIds;
+    /*
+     * runs enumerateAsync() and openAll() on a thread pool, owned by the QHidApi.
+     */
+    QHidScanner *mScanner;
+    /*
+     * device details and report descriptors kept between runs, owned by the QHidApi.
+     */
+    QHidDeviceCache *mCache;
 
 private:
     QHidApi *q_ptr;
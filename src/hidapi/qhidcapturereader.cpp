@@ -0,0 +1,805 @@
+#include "qhidcapturereader.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QRunnable>
+#include <QStringList>
+#include <QThread>
+#include <QThreadPool>
+
+#include <string.h>
+#include <algorithm>
+
+#include "hidapi_capture.h"
+/*
+Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/*!
+ * \class QHidCaptureReader
+ * \brief \c QHidCaptureReader reads a capture written by QHidApi::startCapture() or hid_capture_open().
+ *
+ * Every segment of the capture is mapped into memory rather than read, and opening a capture
+ * only reads the index of each segment, not its records. The index lets seek() find the records
+ * around a time with a binary search, and records() and decode() skip the chunks of records
+ * which can not hold the report id asked for. Segments without an index, or with a damaged one, are indexed by
+ * reading them through once.
+ *
+ * Times are the CLOCK_MONOTONIC timestamps of the records, in ns. Records are kept in the
+ * order they were written, and the timestamps of reports sent and received on different
+ * threads can be slightly out of order, so a range may miss a record at its very edge.
+ *
+ * \code
+ *     QHidCaptureReader reader;
+ *     reader.open("/var/log/session");
+ *     qint64 from = reader.startTime() + 3600 * Q_INT64_C(1000000000);
+ *     foreach (const QHidCaptureReader::DecodedReport &report,
+ *              reader.decode(from, from + Q_INT64_C(1000000000), 0, 2)) {
+ *         ...
+ *     }
+ * \endcode
+ *
+ * The data of a Record points into the mapped segment, it is only valid while the reader is open.
+ *
+ * Captures written with QHidApi::DeltaCapture are read the same way. Their records can only be
+ * decoded from the start of the chunk holding them, which next() does once per chunk. The data of
+ * the reports stored as a difference is a copy, and their sequence is 0.
+ */
+
+/*
+ * Chunks decoded by each pool task, about a MiB of records.
+ */
+static const int CHUNKS_PER_TASK = 16;
+
+static bool readVarint(const uchar *data, qint64 &offset, qint64 end, quint64 &value) {
+    value = 0;
+
+    for (int shift = 0; offset < end && shift < 64; shift += 7) {
+        uchar byte = data[offset++];
+        value |= quint64(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * The key of the report a delta encoded one is stored against, as hidapi_capture.c makes it.
+ */
+static quint32 deltaKey(int tag, int type, uchar reportId) {
+    return quint32(tag) << 16 | quint32(type) << 8 | reportId;
+}
+
+/*
+ * Decodes a run of chunks on a pool thread, into a vector of its own.
+ */
+class QHidDecodeTask : public QRunnable {
+public:
+    QHidDecodeTask(const QHidCaptureReader *reader, const QList<QHidCaptureReader::ChunkRef> &chunks,
+                   qint64 from, qint64 to, int tag, int reportId, QVector<QHidCaptureReader::DecodedReport> *reports) :
+        mReader(reader),
+        mChunks(chunks),
+        mFrom(from),
+        mTo(to),
+        mTag(tag),
+        mReportId(reportId),
+        mReports(reports) {
+    }
+
+    void run() {
+        mReader->decodeChunks(mChunks, mFrom, mTo, mTag, mReportId, *mReports);
+    }
+
+private:
+    const QHidCaptureReader *mReader;
+    QList<QHidCaptureReader::ChunkRef> mChunks;
+    qint64 mFrom, mTo;
+    int mTag, mReportId;
+    QVector<QHidCaptureReader::DecodedReport> *mReports;
+};
+
+/*!
+ * \brief Constructs a reader with no capture open.
+ */
+QHidCaptureReader::QHidCaptureReader() :
+    mEndTime(0) {
+}
+
+QHidCaptureReader::~QHidCaptureReader() {
+    close();
+}
+
+/*!
+ * \brief Opens a capture.
+ *
+ * \param fileName the fileName given to QHidApi::startCapture(), or the path given to
+ * hid_capture_open(), without the segment suffix.
+ * \return true if every segment of the capture could be mapped, otherwise false.
+ */
+bool QHidCaptureReader::open(const QString &fileName) {
+    close();
+
+    QFileInfo info(fileName);
+    QString base = info.fileName();
+    QString suffix = QStringLiteral(".hidcap");
+    QStringList names = info.absoluteDir().entryList(QStringList() << base + QStringLiteral(".*") + suffix, QDir::Files);
+
+    // the segment number is zero-padded, but can outgrow the padding.
+    QMap<qulonglong, QString> segments;
+    foreach (const QString &name, names) {
+        bool ok;
+        qulonglong sequence = name.mid(base.size() + 1, name.size() - base.size() - 1 - suffix.size()).toULongLong(&ok);
+        if (ok) {
+            segments.insert(sequence, name);
+        }
+    }
+
+    foreach (const QString &name, segments) {
+        if (!mapSegment(info.absoluteDir().filePath(name))) {
+            close();
+            return false;
+        }
+    }
+
+    if (mSegments.isEmpty()) {
+        return false;
+    }
+
+    // every segment starts with the devices attached so far, later ones are flagged in the index.
+    for (int i = 0; i < mChunks.size(); i++) {
+        if (!(mChunks.at(i).flags & HID_CAPTURE_INDEX_DEVICE)) {
+            continue;
+        }
+
+        ChunkRef chunk = { mChunks.at(i).segment, mChunks.at(i).offset, chunkEnd(i) };
+        QList<Record> records;
+        readChunk(chunk, records);
+        foreach (const Record &record, records) {
+            if (record.type != HID_CAPTURE_DEVICE || mDescriptors.contains(record.tag) ||
+                    record.data.size() < int(sizeof(hid_capture_device))) {
+                continue;
+            }
+
+            hid_capture_device device;
+            memcpy(&device, record.data.constData(), sizeof(device));
+            int descriptorSize = qMin(int(device.descriptor_size), record.data.size() - int(sizeof(device)));
+            mDescriptors.insert(record.tag, QHidReportDescriptor(record.data.mid(int(sizeof(device)), descriptorSize)));
+            mPaths.insert(record.tag, QString::fromUtf8(record.data.mid(int(sizeof(device)) + descriptorSize)));
+        }
+    }
+
+    if (!mChunks.isEmpty()) {
+        ChunkRef chunk = { mChunks.last().segment, mChunks.last().offset, chunkEnd(mChunks.size() - 1) };
+        QList<Record> records;
+        readChunk(chunk, records);
+        if (!records.isEmpty()) {
+            mEndTime = records.last().timestamp;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Maps a segment and appends its index to mChunks.
+ */
+bool QHidCaptureReader::mapSegment(const QString &path) {
+    QFile *file = new QFile(path);
+    hid_capture_segment_header header;
+
+    if (!file->open(QIODevice::ReadOnly) || file->size() < qint64(sizeof(header))) {
+        delete file;
+        return false;
+    }
+
+    qint64 size = file->size();
+    const uchar *data = file->map(0, size);
+    if (data == NULL) {
+        delete file;
+        return false;
+    }
+
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, HID_CAPTURE_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != HID_CAPTURE_VERSION || header.byte_order != HID_CAPTURE_BYTE_ORDER ||
+            header.header_size < sizeof(header) || header.header_size > quint64(size)) {
+        delete file;
+        return false;
+    }
+
+    Segment segment;
+    segment.file = file;
+    segment.data = data;
+    segment.start = header.header_size;
+    segment.end = size;
+    segment.delta = (header.flags & HID_CAPTURE_FLAG_DELTA) != 0;
+    if (header.index_offset >= header.header_size && header.index_offset <= quint64(size)) {
+        segment.end = qint64(header.index_offset);
+    }
+    mSegments.append(segment);
+
+    if (!readIndex(mSegments.size() - 1, qint64(header.index_offset), size)) {
+        scanIndex(mSegments.size() - 1);
+    }
+
+    return true;
+}
+
+/*
+ * Appends the index written into a segment to mChunks.
+ * returns false if it has none or it does not match the records.
+ */
+bool QHidCaptureReader::readIndex(int segment, qint64 indexOffset, qint64 size) {
+    const Segment &s = mSegments.at(segment);
+    hid_capture_index index;
+
+    if (indexOffset < s.start || indexOffset + qint64(sizeof(index)) > size) {
+        return false;
+    }
+
+    memcpy(&index, s.data + indexOffset, sizeof(index));
+    if (index.count == 0 || index.count > index.capacity ||
+            indexOffset + qint64(sizeof(index)) + qint64(index.count) * qint64(sizeof(hid_capture_index_entry)) > size) {
+        return false;
+    }
+
+    int first = mChunks.size();
+    const uchar *entries = s.data + indexOffset + sizeof(index);
+    for (quint32 i = 0; i < index.count; i++) {
+        hid_capture_index_entry entry;
+        memcpy(&entry, entries + i * sizeof(entry), sizeof(entry));
+
+        qint64 previous = (i == 0 ? s.start - 1 : mChunks.last().offset);
+        if (qint64(entry.offset) <= previous || qint64(entry.offset) >= s.end) {
+            mChunks.resize(first);
+            return false;
+        }
+
+        Chunk chunk;
+        chunk.segment = segment;
+        chunk.timestamp = qint64(entry.timestamp);
+        chunk.offset = qint64(entry.offset);
+        chunk.records = entry.records;
+        chunk.flags = entry.flags;
+        memcpy(chunk.reportIds, entry.report_ids, sizeof(chunk.reportIds));
+        mChunks.append(chunk);
+    }
+
+    return true;
+}
+
+/*
+ * Indexes a segment by reading its records, into the chunks the writer would have made.
+ */
+void QHidCaptureReader::scanIndex(int segment) {
+    const Segment &s = mSegments.at(segment);
+    qint64 nextChunk = s.start;
+    Record record;
+
+    if (s.delta) {
+        for (qint64 offset = s.start; offset < s.end; offset = nextChunk) {
+            QList<Record> records;
+            nextChunk = decodeDelta(s, offset, s.end, records);
+            if (records.isEmpty()) {
+                break;
+            }
+
+            Chunk chunk;
+            memset(&chunk, 0, sizeof(chunk));
+            chunk.segment = segment;
+            chunk.timestamp = records.first().timestamp;
+            chunk.offset = offset;
+            chunk.records = quint32(records.size());
+            foreach (const Record &r, records) {
+                if (r.type == HID_CAPTURE_DEVICE) {
+                    chunk.flags |= HID_CAPTURE_INDEX_DEVICE;
+                } else if (!r.data.isEmpty()) {
+                    uchar id = uchar(r.data.at(0));
+                    chunk.reportIds[id / 8] |= uchar(1 << (id % 8));
+                }
+            }
+            mChunks.append(chunk);
+        }
+        return;
+    }
+
+    for (qint64 offset = s.start, after; recordAt(s, offset, s.end, record, after); offset = after) {
+        if (offset >= nextChunk) {
+            Chunk chunk;
+            memset(&chunk, 0, sizeof(chunk));
+            chunk.segment = segment;
+            chunk.timestamp = record.timestamp;
+            chunk.offset = offset;
+            mChunks.append(chunk);
+            nextChunk = offset + HID_CAPTURE_INDEX_INTERVAL;
+        }
+
+        Chunk &chunk = mChunks.last();
+        chunk.records++;
+        if (record.type == HID_CAPTURE_DEVICE) {
+            chunk.flags |= HID_CAPTURE_INDEX_DEVICE;
+        } else if (!record.data.isEmpty()) {
+            uchar id = uchar(record.data.at(0));
+            chunk.reportIds[id / 8] |= uchar(1 << (id % 8));
+        }
+    }
+}
+
+/*!
+ * \brief Unmaps the capture. The data of the records returned so far is no longer valid.
+ */
+void QHidCaptureReader::close() {
+    foreach (const Segment &segment, mSegments) {
+        delete segment.file;
+    }
+
+    mSegments.clear();
+    mChunks.clear();
+    mDescriptors.clear();
+    mPaths.clear();
+    mEndTime = 0;
+}
+
+/*!
+ * \brief Returns true if a capture is open.
+ */
+bool QHidCaptureReader::isOpen() const {
+    return !mSegments.isEmpty();
+}
+
+/*!
+ * \brief Returns the tags of the devices recorded, as returned by hid_capture_attach().
+ */
+QList<int> QHidCaptureReader::devices() const {
+    return mDescriptors.keys();
+}
+
+/*!
+ * \brief Returns the report descriptor recorded for a device.
+ */
+QHidReportDescriptor QHidCaptureReader::reportDescriptor(int tag) const {
+    return mDescriptors.value(tag);
+}
+
+/*!
+ * \brief Returns the path the device had when it was recorded.
+ */
+QString QHidCaptureReader::devicePath(int tag) const {
+    return mPaths.value(tag);
+}
+
+/*!
+ * \brief Returns the timestamp of the first record in the capture.
+ */
+qint64 QHidCaptureReader::startTime() const {
+    return (mChunks.isEmpty() ? 0 : mChunks.first().timestamp);
+}
+
+/*!
+ * \brief Returns the timestamp of the last record in the capture.
+ */
+qint64 QHidCaptureReader::endTime() const {
+    return mEndTime;
+}
+
+/*!
+ * \brief Returns the number of records in the capture, the device descriptions repeated at the
+ * start of each segment included, as counted by the index.
+ */
+qint64 QHidCaptureReader::recordCount() const {
+    qint64 count = 0;
+
+    foreach (const Chunk &chunk, mChunks) {
+        count += chunk.records;
+    }
+
+    return count;
+}
+
+/*
+ * Reads the record at offset into record if it ends by end, and sets after to the offset of the next one.
+ */
+bool QHidCaptureReader::recordAt(const Segment &segment, qint64 offset, qint64 end, Record &record, qint64 &after) const {
+    hid_capture_record header;
+
+    if (offset + qint64(sizeof(header)) > end) {
+        return false;
+    }
+
+    memcpy(&header, segment.data + offset, sizeof(header));
+    if (header.type == 0 || offset + qint64(sizeof(header)) + header.length > end) {
+        return false;
+    }
+
+    record.timestamp = qint64(header.timestamp);
+    record.sequence = header.sequence;
+    record.type = header.type;
+    record.tag = header.tag;
+    record.data = QByteArray::fromRawData(reinterpret_cast<const char*>(segment.data + offset + sizeof(header)), header.length);
+    after = offset + ((qint64(sizeof(header)) + header.length + HID_CAPTURE_ALIGNMENT - 1) & ~qint64(HID_CAPTURE_ALIGNMENT - 1));
+
+    return true;
+}
+
+/*
+ * Decodes the delta encoded records of a chunk starting at offset, up to end or the start of the
+ * next chunk, whichever is first. returns where the records decoded end. Decoding stops at the
+ * first record which does not make sense, as for a segment cut short by a crash.
+ */
+qint64 QHidCaptureReader::decodeDelta(const Segment &segment, qint64 offset, qint64 end, QList<Record> &records) const {
+    const uchar *data = segment.data;
+    const qint64 nextChunk = offset + HID_CAPTURE_INDEX_INTERVAL;
+    QHash<quint32, QByteArray> previous;
+    quint64 timestamp = 0;
+
+    while (offset + 2 <= end && offset < nextChunk && data[offset] != 0) {
+        qint64 at = offset;
+        Record record;
+        record.sequence = 0;
+        record.type = data[at] & 0x7;
+        record.tag = data[at + 1];
+        int operation = data[at] >> 4;
+        at += 2;
+
+        quint64 value;
+        if (!readVarint(data, at, end, value)) {
+            break;
+        }
+        // zigzag encoded, so that a record older than the one before it takes few bytes.
+        timestamp += (value >> 1) ^ (0 - (value & 1));
+        record.timestamp = qint64(timestamp);
+
+        int count = 1;
+        if (operation == HID_CAPTURE_DELTA_LITERAL) {
+            if (!readVarint(data, at, end, value) || value > quint64(end - at)) {
+                break;
+            }
+            record.data = QByteArray::fromRawData(reinterpret_cast<const char*>(data + at), int(value));
+            at += qint64(value);
+        } else if (operation == HID_CAPTURE_DELTA_XOR || operation == HID_CAPTURE_DELTA_REPEAT) {
+            if (at >= end) {
+                break;
+            }
+            QHash<quint32, QByteArray>::const_iterator it = previous.constFind(deltaKey(record.tag, record.type, data[at++]));
+            if (it == previous.constEnd()) {
+                break;
+            }
+            record.data = *it;
+
+            if (operation == HID_CAPTURE_DELTA_REPEAT) {
+                if (!readVarint(data, at, end, value) || value > quint64(end - at)) {
+                    break;
+                }
+                count += int(value);
+            } else {
+                // runs of equal bytes and of the XOR of the bytes which differ.
+                char *payload = record.data.data();
+                qint64 length = record.data.size();
+                qint64 pos = 0;
+                quint64 zeros = 0;
+                while (pos < length && readVarint(data, at, end, zeros) && zeros <= quint64(length - pos) &&
+                       readVarint(data, at, end, value) && value <= quint64(length - pos - qint64(zeros)) &&
+                       value <= quint64(end - at)) {
+                    pos += qint64(zeros);
+                    for (quint64 i = 0; i < value; i++) {
+                        payload[pos++] ^= char(data[at++]);
+                    }
+                }
+                if (pos < length) {
+                    break;
+                }
+            }
+        } else {
+            break;
+        }
+
+        records.append(record);
+        for (int i = 1; i < count; i++) {
+            if (!readVarint(data, at, end, value)) {
+                return offset;
+            }
+            timestamp += (value >> 1) ^ (0 - (value & 1));
+            record.timestamp = qint64(timestamp);
+            records.append(record);
+        }
+        if (record.type != HID_CAPTURE_DEVICE) {
+            uchar id = (record.data.isEmpty() ? 0 : uchar(record.data.at(0)));
+            previous.insert(deltaKey(record.tag, record.type, id), record.data);
+        }
+        offset = at;
+    }
+
+    return offset;
+}
+
+/*
+ * Reads every record of a chunk into records.
+ */
+void QHidCaptureReader::readChunk(const ChunkRef &chunk, QList<Record> &records) const {
+    const Segment &segment = mSegments.at(chunk.segment);
+
+    if (segment.delta) {
+        decodeDelta(segment, chunk.offset, chunk.end, records);
+        return;
+    }
+
+    Record record;
+    for (qint64 offset = chunk.offset; recordAt(segment, offset, chunk.end, record, offset); ) {
+        records.append(record);
+    }
+}
+
+qint64 QHidCaptureReader::chunkEnd(int chunk) const {
+    const Chunk &c = mChunks.at(chunk);
+
+    if (chunk + 1 < mChunks.size() && mChunks.at(chunk + 1).segment == c.segment) {
+        return mChunks.at(chunk + 1).offset;
+    }
+
+    return mSegments.at(c.segment).end;
+}
+
+bool QHidCaptureReader::chunkBefore(qint64 timestamp, const Chunk &chunk) {
+    return timestamp < chunk.timestamp;
+}
+
+bool QHidCaptureReader::chunkBeforePosition(const Chunk &chunk, const Position &position) {
+    return chunk.segment < position.segment || (chunk.segment == position.segment && chunk.offset < position.offset);
+}
+
+/*
+ * The first chunk of a segment starting at or after offset, or -1 if there is none.
+ */
+int QHidCaptureReader::chunkFrom(int segment, qint64 offset) const {
+    Position position = { segment, offset };
+    int chunk = int(std::lower_bound(mChunks.constBegin(), mChunks.constEnd(), position, chunkBeforePosition) - mChunks.constBegin());
+
+    return (chunk < mChunks.size() && mChunks.at(chunk).segment == segment ? chunk : -1);
+}
+
+/*!
+ * \brief Returns the position of the first record at or after a time.
+ *
+ * The index is searched in O(log n) for the chunk the time falls in, which is then read up
+ * to the record.
+ *
+ * \param timestamp a CLOCK_MONOTONIC timestamp in ns.
+ * \return the position to pass to next(), at the end of the capture if every record is earlier.
+ */
+QHidCaptureReader::Position QHidCaptureReader::seek(qint64 timestamp) const {
+    Position position = { mSegments.size(), 0 };
+    if (mChunks.isEmpty()) {
+        return position;
+    }
+
+    int chunk = int(std::upper_bound(mChunks.constBegin(), mChunks.constEnd(), timestamp, chunkBefore) - mChunks.constBegin());
+    position.segment = mChunks.at(qMax(chunk - 1, 0)).segment;
+    position.offset = mChunks.at(qMax(chunk - 1, 0)).offset;
+
+    Record record;
+    while (next(position, record)) {
+        if (record.timestamp >= timestamp) {
+            // handed out again by the next call to next().
+            position.pending.prepend(record);
+            return position;
+        }
+    }
+
+    return position;
+}
+
+/*!
+ * \brief Reads the record at position and moves position on to the record after it.
+ *
+ * The device descriptions are skipped, see devices().
+ *
+ * \return false at the end of the capture.
+ */
+bool QHidCaptureReader::next(Position &position, Record &record) const {
+    forever {
+        while (!position.pending.isEmpty()) {
+            record = position.pending.takeFirst();
+            if (record.type != HID_CAPTURE_DEVICE) {
+                return true;
+            }
+        }
+
+        if (position.segment < 0 || position.segment >= mSegments.size()) {
+            return false;
+        }
+
+        const Segment &segment = mSegments.at(position.segment);
+        qint64 offset = qMax(position.offset, segment.start);
+
+        if (segment.delta) {
+            // decoded a chunk at a time, offset is where the next chunk to decode starts.
+            int chunk = chunkFrom(position.segment, offset);
+            if (chunk >= 0) {
+                ChunkRef ref = { position.segment, mChunks.at(chunk).offset, chunkEnd(chunk) };
+                readChunk(ref, position.pending);
+                position.offset = ref.end;
+                continue;
+            }
+        } else if (recordAt(segment, offset, segment.end, record, position.offset)) {
+            if (record.type != HID_CAPTURE_DEVICE) {
+                return true;
+            }
+            continue;
+        }
+
+        position.segment++;
+        position.offset = 0;
+    }
+}
+
+bool QHidCaptureReader::numberedReports(int tag) const {
+    if (tag >= 0) {
+        return mDescriptors.value(tag).usesNumberedReports();
+    }
+
+    foreach (const QHidReportDescriptor &descriptor, mDescriptors) {
+        if (!descriptor.usesNumberedReports()) {
+            return false;
+        }
+    }
+
+    return !mDescriptors.isEmpty();
+}
+
+/*
+ * The report id of a report. hidapi prefixes Output and Feature reports with it even for
+ * devices which do not use numbered reports, where it is 0, but not Input reports.
+ */
+int QHidCaptureReader::reportIdOf(const Record &record) const {
+    if (record.data.isEmpty()) {
+        return -1;
+    }
+
+    QMap<int, QHidReportDescriptor>::const_iterator it = mDescriptors.constFind(record.tag);
+    if (record.type == HID_CAPTURE_INPUT && (it == mDescriptors.constEnd() || !it->usesNumberedReports())) {
+        return 0;
+    }
+
+    return uchar(record.data.at(0));
+}
+
+bool QHidCaptureReader::matches(const Record &record, qint64 from, qint64 to, int tag, int reportId) const {
+    return record.type != HID_CAPTURE_DEVICE && record.timestamp >= from && record.timestamp <= to &&
+            (tag < 0 || record.tag == tag) && (reportId < 0 || reportIdOf(record) == reportId);
+}
+
+/*
+ * The chunks which can hold records in [from, to]. The report ids in the index are the
+ * first bytes of the reports, which are only report ids if every device in question uses
+ * numbered reports.
+ */
+QList<QHidCaptureReader::ChunkRef> QHidCaptureReader::findChunks(qint64 from, qint64 to, int tag, int reportId) const {
+    QList<ChunkRef> chunks;
+    bool useIds = reportId >= 0 && reportId < 256 && numberedReports(tag);
+
+    int i = int(std::upper_bound(mChunks.constBegin(), mChunks.constEnd(), from, chunkBefore) - mChunks.constBegin());
+    for (i = qMax(i - 1, 0); i < mChunks.size() && mChunks.at(i).timestamp <= to; i++) {
+        const Chunk &chunk = mChunks.at(i);
+        if (useIds && !(chunk.reportIds[reportId / 8] & (1 << (reportId % 8)))) {
+            continue;
+        }
+
+        ChunkRef ref = { chunk.segment, chunk.offset, chunkEnd(i) };
+        chunks.append(ref);
+    }
+
+    return chunks;
+}
+
+/*!
+ * \brief Returns the reports recorded between two times.
+ *
+ * \param from the earliest timestamp, in ns.
+ * \param to the latest timestamp, in ns.
+ * \param tag only return the reports of this device, or -1 for every device.
+ * \param reportId only return the reports with this report id, or -1 for every report.
+ */
+QList<QHidCaptureReader::Record> QHidCaptureReader::records(qint64 from, qint64 to, int tag, int reportId) const {
+    QList<Record> records;
+
+    foreach (const ChunkRef &chunk, findChunks(from, to, tag, reportId)) {
+        QList<Record> chunkRecords;
+        readChunk(chunk, chunkRecords);
+        foreach (const Record &record, chunkRecords) {
+            if (matches(record, from, to, tag, reportId)) {
+                records.append(record);
+            }
+        }
+    }
+
+    return records;
+}
+
+/*
+ * Decodes the matching reports of chunks into reports. Runs on the pool threads, so it
+ * only reads the reader.
+ */
+void QHidCaptureReader::decodeChunks(const QList<ChunkRef> &chunks, qint64 from, qint64 to, int tag, int reportId,
+                                     QVector<DecodedReport> &reports) const {
+    foreach (const ChunkRef &chunk, chunks) {
+        QList<Record> records;
+        readChunk(chunk, records);
+        foreach (const Record &record, records) {
+            QMap<int, QHidReportDescriptor>::const_iterator descriptor = mDescriptors.constFind(record.tag);
+            if (!matches(record, from, to, tag, reportId) || descriptor == mDescriptors.constEnd()) {
+                continue;
+            }
+
+            QHidReportDescriptor::ReportType type = QHidReportDescriptor::Feature;
+            if (record.type == HID_CAPTURE_INPUT) {
+                type = QHidReportDescriptor::Input;
+            } else if (record.type == HID_CAPTURE_OUTPUT) {
+                type = QHidReportDescriptor::Output;
+            }
+
+            const uchar *data = reinterpret_cast<const uchar*>(record.data.constData());
+            int length = record.data.size();
+            if (type != QHidReportDescriptor::Input || descriptor->usesNumberedReports()) {
+                data++;
+                length--;
+            }
+
+            DecodedReport report;
+            report.timestamp = record.timestamp;
+            report.type = record.type;
+            report.tag = record.tag;
+            report.reportId = quint8(qMax(reportIdOf(record), 0));
+
+            foreach (const QHidReportDescriptor::Field &field, descriptor->fields(type, report.reportId)) {
+                for (int i = 0; i < field.count; i++) {
+                    report.values.append(QHidReportDescriptor::fieldValue(field, i, data, length));
+                }
+            }
+
+            reports.append(report);
+        }
+    }
+}
+
+/*!
+ * \brief Decodes the reports recorded between two times into the values of their fields.
+ *
+ * The chunks of the capture holding the reports are shared out between threadCount threads of
+ * a pool, each of which splits the reports it is given into the fields laid out by the report
+ * descriptor of their device. The values of a report are those of every element of every field
+ * returned by QHidReportDescriptor::fields() for it, in order. Reports of devices recorded
+ * without a report descriptor are left out.
+ *
+ * \param from the earliest timestamp, in ns.
+ * \param to the latest timestamp, in ns.
+ * \param tag only decode the reports of this device, or -1 for every device.
+ * \param reportId only decode the reports with this report id, or -1 for every report.
+ * \param threadCount the number of threads to decode on, 0 for one per processor core.
+ * \return the decoded reports, in the order they were recorded.
+ */
+QVector<QHidCaptureReader::DecodedReport> QHidCaptureReader::decode(qint64 from, qint64 to, int tag, int reportId, int threadCount) const {
+    QList<ChunkRef> chunks = findChunks(from, to, tag, reportId);
+    QVector<QVector<DecodedReport> > results((chunks.size() + CHUNKS_PER_TASK - 1) / CHUNKS_PER_TASK);
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(threadCount > 0 ? threadCount : QThread::idealThreadCount());
+    for (int i = 0; i < results.size(); i++) {
+        pool.start(new QHidDecodeTask(this, chunks.mid(i * CHUNKS_PER_TASK, CHUNKS_PER_TASK), from, to, tag, reportId, &results[i]));
+    }
+    pool.waitForDone();
+
+    QVector<DecodedReport> reports;
+    foreach (const QVector<DecodedReport> &result, results) {
+        reports += result;
+    }
+
+    return reports;
+}
@@ -0,0 +1,135 @@
+#ifndef QHIDCAPTUREREADER_H
+#define QHIDCAPTUREREADER_H
+/*
+Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include <QByteArray>
+#include <QList>
+#include <QMap>
+#include <QString>
+#include <QVector>
+
+#include "qhidapi_global.h"
+#include "qhidreportdescriptor.h"
+
+class QFile;
+
+class QHIDAPISHARED_EXPORT QHidCaptureReader {
+public:
+    struct Record {
+        qint64 timestamp;
+        quint32 sequence;
+        int type;
+        int tag;
+        QByteArray data;
+    };
+
+    struct DecodedReport {
+        qint64 timestamp;
+        int type;
+        int tag;
+        quint8 reportId;
+        QVector<qint64> values;
+    };
+
+    struct Position {
+        int segment;
+        qint64 offset;
+        /*
+         * records read ahead, the rest of a delta encoded chunk.
+         */
+        QList<Record> pending;
+    };
+
+    QHidCaptureReader();
+    ~QHidCaptureReader();
+
+    bool open(const QString &fileName);
+    void close();
+    bool isOpen() const;
+
+    QList<int> devices() const;
+    QHidReportDescriptor reportDescriptor(int tag) const;
+    QString devicePath(int tag) const;
+    qint64 startTime() const;
+    qint64 endTime() const;
+    qint64 recordCount() const;
+
+    Position seek(qint64 timestamp) const;
+    bool next(Position &position, Record &record) const;
+    QList<Record> records(qint64 from, qint64 to, int tag=-1, int reportId=-1) const;
+    QVector<DecodedReport> decode(qint64 from, qint64 to, int tag=-1, int reportId=-1, int threadCount=0) const;
+
+private:
+    /*
+     * an entry of the index of a segment, a copy of struct hid_capture_index_entry.
+     */
+    struct Chunk {
+        int segment;
+        qint64 timestamp;
+        qint64 offset;
+        quint32 records;
+        quint32 flags;
+        uchar reportIds[32];
+    };
+
+    struct Segment {
+        QFile *file;
+        const uchar *data;
+        /*
+         * where the records start and where they end at the latest.
+         */
+        qint64 start;
+        qint64 end;
+        bool delta;
+    };
+
+    /*
+     * a chunk picked by findChunks(), records [offset, end) of segment.
+     */
+    struct ChunkRef {
+        int segment;
+        qint64 offset;
+        qint64 end;
+    };
+
+    bool mapSegment(const QString &path);
+    bool readIndex(int segment, qint64 indexOffset, qint64 size);
+    void scanIndex(int segment);
+    bool recordAt(const Segment &segment, qint64 offset, qint64 end, Record &record, qint64 &after) const;
+    qint64 decodeDelta(const Segment &segment, qint64 offset, qint64 end, QList<Record> &records) const;
+    void readChunk(const ChunkRef &chunk, QList<Record> &records) const;
+    qint64 chunkEnd(int chunk) const;
+    int chunkFrom(int segment, qint64 offset) const;
+    static bool chunkBefore(qint64 timestamp, const Chunk &chunk);
+    static bool chunkBeforePosition(const Chunk &chunk, const Position &position);
+    bool numberedReports(int tag) const;
+    QList<ChunkRef> findChunks(qint64 from, qint64 to, int tag, int reportId) const;
+    bool matches(const Record &record, qint64 from, qint64 to, int tag, int reportId) const;
+    int reportIdOf(const Record &record) const;
+    void decodeChunks(const QList<ChunkRef> &chunks, qint64 from, qint64 to, int tag, int reportId,
+                      QVector<DecodedReport> &reports) const;
+
+    QVector<Segment> mSegments;
+    /*
+     * the index of every segment in order, so a seek is one binary search.
+     */
+    QVector<Chunk> mChunks;
+    /*
+     * map of tag -> report descriptor and path of each recorded device.
+     */
+    QMap<int, QHidReportDescriptor> mDescriptors;
+    QMap<int, QString> mPaths;
+    qint64 mEndTime;
+
+    friend class QHidDecodeTask;
+
+    Q_DISABLE_COPY(QHidCaptureReader)
+};
+
+#endif // QHIDCAPTUREREADER_H
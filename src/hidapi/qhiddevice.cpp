@@ -30,8 +30,6 @@ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH RE
  * Programs which use HIDAPI are driverless, meaning they do not require the use of a custom driver for each device on each platform.
  */
 
-static bool is_init = false;
-
 /*!  Default constructor of QHidApi class.
  *
  * \param parent the parent object.
@@ -40,7 +38,6 @@ QHidDevice::QHidDevice(QObject *parent) :
             QIODevice(parent),
             d_ptr(new QHidDevicePrivate(0x0, 0x0, this))
 {
-    init();
 }
 
 /*!
@@ -71,12 +68,16 @@ QHidDevice::QHidDevice(ushort vendorId, ushort productId, QObject *parent) :
 }
 
 QHidDevice::~QHidDevice() {
+    delete d_ptr;
 }
 
 /*!
  * \brief Get The Manufacturer String from a HID device.
  *
+ * The string is served from the metadata snapshot taken when the device was opened.
+ *
  * \return a QString containing the manufacturers name string, otherwise an empty QString.
+ * \see refresh()
  */
 QString QHidDevice::manufacturerString()
 {
@@ -86,7 +87,10 @@ QString QHidDevice::manufacturerString()
 /*!
  * \brief Get The Product String from a HID device.
  *
+ * The string is served from the metadata snapshot taken when the device was opened.
+ *
  * \return a QString containing the product name string, otherwise an empty QString.
+ * \see refresh()
  */
 QString QHidDevice::productString()
 {
@@ -96,13 +100,102 @@ QString QHidDevice::productString()
 /*!
  * \brief Get The Serial Number String from a HID device.
  *
+ * The string is served from the metadata snapshot taken when the device was opened.
+ *
  * \return a QString containing the Serial number string, otherwise an empty QString.
+ * \see refresh()
  */
 QString QHidDevice::serialNumberString()
 {
     return d_ptr->serialNumberString();
 }
 
+/*!
+ * \brief Get the metadata snapshot taken when the device was opened.
+ *
+ * \return a QHidDeviceInfo describing the open device, or a default constructed one if no device is open.
+ */
+QHidDeviceInfo QHidDevice::deviceInfo()
+{
+    return d_ptr->deviceInfo();
+}
+
+/*!
+ * \brief Get the Device Release Number of the open device in binary-coded decimal.
+ *
+ * \return the release number, or 0 if no device is open.
+ */
+ushort QHidDevice::releaseNumber()
+{
+    return d_ptr->deviceInfo().releaseNumber;
+}
+
+/*!
+ * \brief Get the USB interface number of the open device.
+ *
+ * \return the interface number, or -1 if it is not known.
+ */
+int QHidDevice::interfaceNumber()
+{
+    if (!isOpen()) {
+        return -1;
+    }
+    return d_ptr->deviceInfo().interfaceNumber;
+}
+
+/*!
+ * \brief Get the report descriptor read when the device was opened.
+ *
+ * \return the QHidReportDescriptor of the open device, or an invalid one if no device is open.
+ */
+QHidReportDescriptor QHidDevice::reportDescriptor()
+{
+    return d_ptr->reportDescriptor();
+}
+
+/*!
+ * \brief Get the length of the longest Input report, excluding the report id byte.
+ *
+ * \return the report length in bytes, or 0 if it is not known.
+ */
+int QHidDevice::inputReportSize()
+{
+    return d_ptr->reportDescriptor().maxReportSize(QHidReportDescriptor::Input);
+}
+
+/*!
+ * \brief Get the length of the longest Output report, excluding the report id byte.
+ *
+ * \return the report length in bytes, or 0 if it is not known.
+ */
+int QHidDevice::outputReportSize()
+{
+    return d_ptr->reportDescriptor().maxReportSize(QHidReportDescriptor::Output);
+}
+
+/*!
+ * \brief Get the length of the longest Feature report, excluding the report id byte.
+ *
+ * \return the report length in bytes, or 0 if it is not known.
+ */
+int QHidDevice::featureReportSize()
+{
+    return d_ptr->reportDescriptor().maxReportSize(QHidReportDescriptor::Feature);
+}
+
+/*!
+ * \brief Re-reads the metadata snapshot from the device.
+ *
+ * The strings and the report descriptor are normally read once, when the device is opened.
+ * Call this in the rare case that a live re-read is needed.
+ *
+ * \return Returns true on success and false if no device is open.
+ */
+bool QHidDevice::refresh()
+{
+    return d_ptr->refresh();
+}
+
 /*!
  * \brief Get a string from a HID device, based on its string index.
  *
@@ -162,8 +255,9 @@ bool QHidDevice::open(ushort vendorId, ushort productId, QString serialNumber)
 {
     if( d_ptr->open(vendorId, productId, serialNumber)) {
         setOpenMode(ReadWrite);
+        return true;
     }
-    return 0;
+    return false;
 }
 
 /*!
@@ -179,6 +273,26 @@ bool QHidDevice::open(QString path)
 {
     if (d_ptr->open(path)) {
         setOpenMode(ReadWrite);
+        return true;
+    }
+    return false;
+}
+
+/*!
+ * \brief Open a HID device by its path name, sharing it with the rest of the process.
+ *
+ * Every QHidDevice and QHidApi which opens the same path with openShared() uses one underlying
+ * device and one reader thread, and each of them receives every input report arriving after it
+ * opened the device. See QHidApi::openShared().
+ *
+ * \param path - the path to the device
+ * \return Returns true on success and false on error.
+ */
+bool QHidDevice::openShared(QString path)
+{
+    if (d_ptr->openShared(path)) {
+        setOpenMode(ReadWrite);
+        return true;
     }
     return false;
 }
@@ -192,6 +306,7 @@ bool QHidDevice::open(OpenMode mode)
 {
     if (d_ptr->open()) {
         setOpenMode(mode);
+        return true;
     }
     return false;
 }
@@ -237,6 +352,88 @@ qint64 QHidDevice::read(char* data, qint64 maxSize, int milliseconds)
     return d_ptr->read(data, maxSize, milliseconds);
 }
 
+/*!
+ * \brief Reads every Input report already received, without waiting for new ones.
+ *
+ * The reports queued for the device are moved out in one go into a single buffer, which is much
+ * cheaper than one read() per report for a consumer catching up after a stall.
+ *
+ * \param maxReports the maximum number of reports to return.
+ * \return the reports, oldest first. The batch is empty if there were none or on error.
+ */
+QHidReportBatch QHidDevice::drain(int maxReports)
+{
+    return d_ptr->drain(maxReports);
+}
+
+/*!
+ * \brief Returns the time at which the last report read from the device arrived.
+ *
+ * The time is in nanoseconds of the monotonic clock, the clock used by QElapsedTimer on Linux, and
+ * covers every read path, including reads through QIODevice and drain(). With libusb it is taken as
+ * the transfer completes. hidraw does not record arrival times, so it is taken when the report is
+ * read from the kernel. Devices opened with openShared() are read promptly by their reader thread,
+ * which keeps the two close.
+ *
+ * \return the timestamp, or 0 if no report has been read yet.
+ */
+qint64 QHidDevice::lastReportTimestamp() const
+{
+    return d_ptr->lastReportTimestamp();
+}
+
+/*!
+ * \brief Starts keeping the latest Input report of each report id, for latestReport().
+ *
+ * The device must have been opened with openShared(), its QHidSharedDevice reader thread
+ * publishes the reports. Devices opened with open() are not tracked, whatever the backend.
+ * See QHidApi::trackLatestReports().
+ *
+ * \return true if the latest reports are being kept, false if the device is not shared.
+ */
+bool QHidDevice::trackLatestReports()
+{
+    return d_ptr->trackLatestReports();
+}
+
+/*!
+ * \brief Copies the latest Input report with the given report id into data, without locking.
+ *
+ * Only shared devices keep their latest reports, for any other device this returns 0.
+ *
+ * \param reportId the report id, or 0 for devices which do not use numbered reports.
+ * \param data the buffer to copy the report into.
+ * \param length the size of data, longer reports are truncated.
+ * \param timestamp set to the arrival time of the report.
+ * \return the number of bytes copied, or 0 if no such report has arrived yet.
+ * \see QHidApi::latestReport()
+ */
+int QHidDevice::latestReport(quint8 reportId, char *data, int length, qint64 *timestamp) const
+{
+    return d_ptr->latestReport(reportId, reinterpret_cast<uchar*>(data), length, timestamp);
+}
+
+/*!
+ * \brief Returns a snapshot of the runtime statistics of the device.
+ *
+ * \return the statistics, or an invalid QHidDeviceStats if the device is not open.
+ * \see QHidApi::deviceStats()
+ */
+QHidDeviceStats QHidDevice::stats() const
+{
+    return d_ptr->stats();
+}
+
+/*!
+ * \brief Resets the runtime statistics of the device to 0.
+ *
+ * \see QHidApi::resetDeviceStats()
+ */
+void QHidDevice::resetStats()
+{
+    d_ptr->resetStats();
+}
+
 /*!
  * \brief Get a feature report from a HID device.
  *
@@ -361,39 +558,31 @@ bool QHidDevice::setNonBlocking()
 /*!
  * \brief initialises the library.
  *
- * Initialises the hidapi library. Calling it is not strictly necessary, as it will be called automatically by
- * enumerate() and any of the open_*() functions if it is needed. This function should be called at the
- * beginning of execution however, if there is a chance of HIDAPI handles being opened by different threads simultaneously.
+ * Takes a reference on the process wide hidapi library, initialising it if this is the first one.
+ * Calling it is not strictly necessary, as enumerate() and the open() methods take their own references
+ * when they are needed. This function should be called at the beginning of execution however, if there
+ * is a chance of HIDAPI handles being opened by different threads simultaneously. Each successful
+ * call must be balanced by a call to exit().
  *
  * \return 0 if successful, otherwise returns -1;
  * \see enumerate()
  */
 int QHidDevice::init()
 {
-    //if(is_init == false)
-    {
-        is_init = true;
-        int res = hid_init();
-        return res;
-    }
-    return 0;
+    return hid_init();
 }
 
 /*!
  * \brief Finalize the HIDAPI library.
  *
- * This function frees all of the static data associated with HIDAPI. It should be called at the end of
- * execution to avoid memory leaks.
+ * Drops a reference taken by init(). The static data associated with HIDAPI is freed once the last
+ * reference, including those held by open devices and QHidApi objects, has gone.
  *
  * \return This function returns 0 on success and -1 on error.
  */
 int QHidDevice::exit()
 {
-    if(is_init) {
-        int res = hid_exit();
-        return res;
-    }
-    return 0;
+    return hid_exit();
 }
 
 
@@ -1,5 +1,5 @@
-#ifndef QHIDAPI_H
-#define QHIDAPI_H
+#ifndef QHIDDEVICE_H
+#define QHIDDEVICE_H
 
 /*
 Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
@@ -19,6 +19,9 @@ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH RE
 
 #include "qhidapi_global.h"
 #include "qhiddeviceinfo.h"
+#include "qhidreportdescriptor.h"
+#include "qhidreportbatch.h"
+#include "qhiddevicestats.h"
 
 class QHidDevicePrivate;
 
@@ -36,6 +39,7 @@ public:
 
     bool open(ushort vendor_id, ushort product_id, QString serial_number=QString());
     bool open(QString path);
+    bool openShared(QString path);
     bool open(OpenMode mode) override;
     void close() override;
     bool isSequential() const override { return true; }
@@ -50,7 +54,22 @@ public:
     QString indexedString(int index);
     QString error();
 
+    QHidDeviceInfo deviceInfo();
+    ushort releaseNumber();
+    int interfaceNumber();
+    QHidReportDescriptor reportDescriptor();
+    int inputReportSize();
+    int outputReportSize();
+    int featureReportSize();
+    bool refresh();
+
     qint64  read(char* data, qint64 maxSize, int milliseconds);
+    QHidReportBatch drain(int maxReports=1024);
+    qint64 lastReportTimestamp() const;
+    bool trackLatestReports();
+    int latestReport(quint8 reportId, char *data, int length, qint64 *timestamp=0) const;
+    QHidDeviceStats stats() const;
+    void resetStats();
     //QByteArray read(int milliseconds);
 
     static int init();
@@ -71,4 +90,4 @@ private:
     Q_DISABLE_COPY(QHidDevice)
 };
 
-#endif // QHIDAPI_H
+#endif // QHIDDEVICE_H
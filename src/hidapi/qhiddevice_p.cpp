@@ -1,5 +1,10 @@
 #include "qhiddevice_p.h"
 #include "qhiddevice.h"
+#include "qhidshareddevice_p.h"
+#include "qhidstateregister_p.h"
+#include "qhidtrace_p.h"
+
+#include <QVector>
 /*
 Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
 
@@ -7,96 +12,208 @@ Permission to use, copy, modify, and/or distribute this software for any purpose
 
 THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 */
-static bool is_init = false;
+
+/*
+ * The space hid_read_all() is given per call by drain().
+ */
+static const int DRAIN_CHUNK_SIZE = 4096;
+
 QHidDevicePrivate::QHidDevicePrivate(ushort vendorId, ushort productId, QHidDevice *parent) :
     mVendorId(vendorId),
     mProductId(productId),
-    q_ptr(parent)
+    q_ptr(parent),
+    m_device(nullptr),
+    m_initialised(false),
+    m_shared(nullptr),
+    m_subscriber(0),
+    m_sharedBlocking(true),
+    m_lastTimestamp(0),
+    m_state(nullptr)
 {
-    mDeviceInfoList = enumerate(vendorId, productId);
-    m_device = nullptr;
 }
 
 QHidDevicePrivate::~QHidDevicePrivate()
 {
-    if (m_device != nullptr) {
-        hid_close(m_device);
+    close();
+
+    if (m_initialised) {
+        hid_exit();
+    }
+}
+
+/*
+ * Takes this device's reference on the library the first time it is needed.
+ */
+void QHidDevicePrivate::init()
+{
+    if (!m_initialised) {
+        m_initialised = (hid_init() == 0);
     }
 }
 
 /*!
  * \brief Get The Manufacturer String from a HID device.
  *
+ * The string is served from the metadata snapshot taken when the device was opened.
+ *
  * \return a QString containing the manufacturers name string, otherwise an empty QString.
  */
 QString QHidDevicePrivate::manufacturerString()
 {
-    if (m_device != nullptr) {
+    if (m_device == nullptr) {
         return QString();
     }
 
-    wchar_t buf[MAX_STR];
-
-    int rep = hid_get_manufacturer_string(m_device, buf, MAX_STR);
-
-    if (rep != -1) {
-
-        QString result = QString::fromWCharArray(buf);
-
-        return result;
-    }
-
-    return QString();
+    return m_info.manufacturerString;
 }
 
 /*!
  * \brief Get The Product String from a HID device.
  *
+ * The string is served from the metadata snapshot taken when the device was opened.
+ *
  * \return a QString containing the product name string, otherwise an empty QString.
  */
 QString QHidDevicePrivate::productString()
 {
-    wchar_t buf[MAX_STR];
+    if (m_device == nullptr) {
+        return QString();
+    }
+
+    return m_info.productString;
+}
 
+/*!
+ * \brief Get The Serial Number String from a HID device.
+ *
+ * The string is served from the metadata snapshot taken when the device was opened.
+ *
+ * \return a QString containing the Serial number string, otherwise an empty QString.
+ */
+QString QHidDevicePrivate::serialNumberString()
+{
     if (m_device == nullptr) {
         return QString();
     }
 
-    int rep = hid_get_product_string(m_device, buf, MAX_STR);
+    return m_info.serialNumber;
+}
 
-    if (rep != -1) {
+/*!
+ * \brief Get the metadata snapshot taken when the device was opened.
+ *
+ * \return a QHidDeviceInfo describing the open device, or a default constructed one if no device is open.
+ */
+QHidDeviceInfo QHidDevicePrivate::deviceInfo()
+{
+    if (m_device == nullptr) {
+        return QHidDeviceInfo();
+    }
 
-        QString result = QString::fromWCharArray(buf);
+    return m_info;
+}
 
-        return result;
+/*!
+ * \brief Get the report descriptor read when the device was opened.
+ *
+ * \return the QHidReportDescriptor of the open device, or an invalid one if no device is open.
+ */
+QHidReportDescriptor QHidDevicePrivate::reportDescriptor()
+{
+    if (m_device == nullptr) {
+        return QHidReportDescriptor();
     }
 
-    return QString();
+    return m_reportDescriptor;
 }
 
 /*!
- * \brief Get The Serial Number String from a HID device.
+ * \brief Re-reads the strings and the report descriptor from the device.
  *
- * \return a QString containing the Serial number string, otherwise an empty QString.
+ * This replaces the metadata snapshot taken when the device was opened. Each string is a
+ * sysfs read on hidraw, or a USB control transfer on libusb, so this should only be used
+ * when the snapshot is known to be stale.
+ *
+ * \return Returns true on success and false if no device is open.
  */
-QString QHidDevicePrivate::serialNumberString()
+bool QHidDevicePrivate::refresh()
 {
+    if (m_device == nullptr) {
+        return false;
+    }
+
     wchar_t buf[MAX_STR];
 
-    if (m_device == nullptr) {
-        return QString();
+    if (hid_get_manufacturer_string(m_device, buf, MAX_STR) != -1) {
+        m_info.manufacturerString = QString::fromWCharArray(buf);
+    }
+
+    if (hid_get_product_string(m_device, buf, MAX_STR) != -1) {
+        m_info.productString = QString::fromWCharArray(buf);
     }
 
-    int rep = hid_get_serial_number_string(m_device, buf, MAX_STR);
+    if (hid_get_serial_number_string(m_device, buf, MAX_STR) != -1) {
+        m_info.serialNumber = QString::fromWCharArray(buf);
+    }
 
-    if (rep != -1) {
+    readReportDescriptor();
 
-        QString result = QString::fromWCharArray(buf);
+    return true;
+}
 
-        return result;
+/*
+ * Takes the metadata snapshot of a newly opened device.
+ */
+void QHidDevicePrivate::captureMetadata()
+{
+    m_info = fromHidDeviceInfo(hid_get_device_info(m_device));
+    readReportDescriptor();
+}
+
+void QHidDevicePrivate::readReportDescriptor()
+{
+    unsigned char buf[HID_API_MAX_REPORT_DESCRIPTOR_SIZE];
+
+    int rep = hid_get_report_descriptor(m_device, buf, sizeof(buf));
+
+    if (rep > 0) {
+        m_reportDescriptor = QHidReportDescriptor(QByteArray(reinterpret_cast<char*>(buf), rep));
+    } else {
+        m_reportDescriptor = QHidReportDescriptor();
     }
+}
 
-    return QString();
+/*
+ * Converts a hidapi device info record into a QHidDeviceInfo.
+ */
+QHidDeviceInfo QHidDevicePrivate::fromHidDeviceInfo(const hid_device_info *info)
+{
+    QHidDeviceInfo i = QHidDeviceInfo();
+
+    if (info == nullptr) {
+        return i;
+    }
+
+    i.path = QString(info->path);
+    i.vendorId = info->vendor_id;
+    if (info->manufacturer_string != nullptr) {
+        i.manufacturerString = QString::fromWCharArray(info->manufacturer_string);
+    }
+    i.productId = info->product_id;
+    if (info->product_string != nullptr) {
+        i.productString = QString::fromWCharArray(info->product_string);
+    }
+    i.releaseNumber = info->release_number;
+    if (info->serial_number != nullptr) {
+        i.serialNumber = QString::fromWCharArray(info->serial_number);
+    }
+#if defined(Q_OS_WIN32) || defined(Q_OS_MAC)
+    i.usagePage = info->usage_page;
+    i.usage = info->usage;
+#endif
+    i.interfaceNumber = info->interface_number;
+
+    return i;
 }
 
 /*!
@@ -155,27 +272,21 @@ QString QHidDevicePrivate::indexedString(int index)
 QList<QHidDeviceInfo> QHidDevicePrivate::enumerate(ushort vendorId, ushort productId)
 {
     QList<QHidDeviceInfo> deviceInfoList;
-    hid_device_info *info = hid_enumerate(vendorId, productId);
+
+    if (hid_init() < 0) {
+        return deviceInfoList;
+    }
+
+    hid_device_info *devs = hid_enumerate(vendorId, productId);
+    hid_device_info *info = devs;
 
     while (info != nullptr) {
-        QHidDeviceInfo i;
-        i.path = QString(info->path);
-        i.vendorId = info->vendor_id;
-        i.manufacturerString = QString::fromWCharArray(info->manufacturer_string);
-        i.productId = info->product_id;
-        i.productString = QString::fromWCharArray(info->product_string);
-        i.releaseNumber = info->release_number;
-        i.serialNumber = QString::fromWCharArray(info->serial_number);
-#if defined(Q_OS_WIN32) || defined(Q_OS_MAC)
-        i.usagePage = info->usage_page;
-        i.usage = info->usage;
-#endif
-        i.interfaceNumber = info->interface_number;
-        deviceInfoList.append(i);
+        deviceInfoList.append(fromHidDeviceInfo(info));
         info = info->next;
     }
 
-    hid_free_enumeration(info);
+    hid_free_enumeration(devs);
+    hid_exit();
 
     return deviceInfoList;
 }
@@ -205,9 +316,19 @@ QList<QHidDeviceInfo> QHidDevicePrivate::enumerate(ushort vendorId, ushort produ
  */
 void QHidDevicePrivate::close()
 {
-    if (m_device != nullptr) {
+    if (m_shared != nullptr) {
+        m_shared->unsubscribe(m_subscriber);
+        m_shared->release();
+        m_shared = nullptr;
+        m_state = nullptr;
+        m_device = nullptr;
+    } else if (m_device != nullptr) {
         hid_close(m_device);
+        m_device = nullptr;
     }
+
+    m_info = QHidDeviceInfo();
+    m_reportDescriptor = QHidReportDescriptor();
 }
 
 //hid_device *QHidDevicePrivate::findId(quint32 id) {
@@ -231,13 +352,17 @@ void QHidDevicePrivate::close()
  */
 QByteArray QHidDevicePrivate::read()
 {
+    if (m_shared != nullptr) {
+        return m_shared->read(m_subscriber, m_sharedBlocking ? -1 : 0, &m_lastTimestamp);
+    }
 
     if (m_device != nullptr) {
         unsigned char buf[65];
+        unsigned long long timestamp = 0;
 
-        int rep = hid_read(m_device, buf, 65);
-
+        int rep = hid_read_timestamped(m_device, buf, 65, &timestamp);
         if (rep > 0) {
+            m_lastTimestamp = qint64(timestamp);
             QByteArray data(reinterpret_cast<char*>(buf), rep);
             return data;
         }
@@ -248,11 +373,20 @@ QByteArray QHidDevicePrivate::read()
 
 qint64 QHidDevicePrivate::read(char* data, qint64 maxSize)
 {
+    QHID_TRACE_SCOPE("QHidDevice::read");
 
     size_t length = (size_t)maxSize;
+    if (m_shared != nullptr) {
+        return m_shared->read(m_subscriber, (uchar*)data, int(length), m_sharedBlocking ? -1 : 0, &m_lastTimestamp);
+    }
+
     if (m_device != nullptr) {
+        unsigned long long timestamp = 0;
 
-        int rep = hid_read(m_device, (uint8_t*)data, length);
+        int rep = hid_read_timestamped(m_device, (uint8_t*)data, length, &timestamp);
+        if (rep > 0) {
+            m_lastTimestamp = qint64(timestamp);
+        }
         return rep;
     }
 
@@ -261,17 +395,146 @@ qint64 QHidDevicePrivate::read(char* data, qint64 maxSize)
 
 qint64 QHidDevicePrivate::read(char* data, qint64 maxSize, int milliseconds)
 {
+    QHID_TRACE_SCOPE("QHidDevice::read");
 
     size_t length = (size_t)maxSize;
+    if (m_shared != nullptr) {
+        return m_shared->read(m_subscriber, (uchar*)data, int(length), milliseconds, &m_lastTimestamp);
+    }
+
     if (m_device != nullptr) {
+        unsigned long long timestamp = 0;
 
-        int rep = hid_read_timeout(m_device, (uint8_t*)data, length, milliseconds);
+        int rep = hid_read_timeout_timestamped(m_device, (uint8_t*)data, length, milliseconds, &timestamp);
+        if (rep > 0) {
+            m_lastTimestamp = qint64(timestamp);
+        }
         return rep;
     }
 
     return 0;
 }
 
+/*
+ * Reads every report already received without waiting.
+ */
+QHidReportBatch QHidDevicePrivate::drain(int maxReports)
+{
+    QHID_TRACE_SCOPE("QHidDevice::drain");
+    QHidReportBatch batch;
+
+    if (m_shared != nullptr) {
+        batch = m_shared->drain(m_subscriber, maxReports);
+    } else {
+        batch = drain(m_device, maxReports);
+    }
+
+    if (!batch.isEmpty()) {
+        m_lastTimestamp = batch.timestamp(batch.count() - 1);
+    }
+
+    return batch;
+}
+
+/*
+ * Arrival time of the last report read.
+ */
+qint64 QHidDevicePrivate::lastReportTimestamp() const
+{
+    return m_lastTimestamp;
+}
+
+/*
+ * Only shared devices publish into the register, from their QHidSharedDevice reader thread.
+ */
+bool QHidDevicePrivate::trackLatestReports()
+{
+    if (m_shared == nullptr) {
+        return false;
+    }
+
+    if (m_state == nullptr) {
+        m_state = m_shared->stateRegister();
+    }
+
+    return true;
+}
+
+int QHidDevicePrivate::latestReport(quint8 reportId, uchar *data, int length, qint64 *timestamp) const
+{
+    if (m_state == nullptr) {
+        return 0;
+    }
+
+    return m_state->read(reportId, data, length, timestamp);
+}
+
+QHidDeviceStats QHidDevicePrivate::stats() const
+{
+    QHidDeviceStats stats;
+    hid_device_stats counters;
+
+    if (m_shared != nullptr) {
+        m_shared->stats(m_subscriber, &counters);
+        stats.setStats(counters);
+    } else if (m_device != nullptr && hid_get_device_stats(m_device, &counters) == 0) {
+        stats.setStats(counters);
+    }
+
+    return stats;
+}
+
+void QHidDevicePrivate::resetStats()
+{
+    if (m_shared != nullptr) {
+        m_shared->resetStats(m_subscriber);
+    } else if (m_device != nullptr) {
+        hid_reset_device_stats(m_device);
+    }
+}
+
+/*
+ * Moves the queued reports of device into a batch with as few hid_read_all() calls as
+ * possible, usually one. Shared with QHidApiPrivate.
+ */
+QHidReportBatch QHidDevicePrivate::drain(hid_device *device, int maxReports)
+{
+    QHidReportBatch batch;
+    QVector<size_t> offsets;
+    QVector<unsigned long long> timestamps;
+    size_t largest = 0;
+
+    while (device != nullptr && batch.count() < maxReports) {
+        int used = batch.mData.size();
+        int wanted = maxReports - batch.count();
+
+        batch.mData.resize(used + DRAIN_CHUNK_SIZE);
+        offsets.resize(wanted + 1);
+        timestamps.resize(wanted);
+
+        int res = hid_read_all(device, reinterpret_cast<uchar*>(batch.mData.data()) + used,
+                               DRAIN_CHUNK_SIZE, offsets.data(), timestamps.data(), size_t(wanted));
+        if (res <= 0) {
+            batch.mData.resize(used);
+            break;
+        }
+
+        for (int i = 1; i <= res; i++) {
+            batch.mOffsets.append(used + int(offsets.at(i)));
+            batch.mTimestamps.append(qint64(timestamps.at(i - 1)));
+            largest = qMax(largest, offsets.at(i) - offsets.at(i - 1));
+        }
+        batch.mData.resize(used + int(offsets.at(res)));
+
+        // the queue is empty if the call stopped with room left for another report.
+        if (res < wanted && DRAIN_CHUNK_SIZE - offsets.at(res) >= largest) {
+            break;
+        }
+    }
+
+    return batch;
+}
+
 /*!
  * \brief  Read an Input report from a HID device into a QByteArray,  with timeout.
  *
@@ -291,12 +554,17 @@ qint64 QHidDevicePrivate::read(char* data, qint64 maxSize, int milliseconds)
  */
 QByteArray QHidDevicePrivate::read(int timeout)
 {
+    if (m_shared != nullptr) {
+        return m_shared->read(m_subscriber, timeout, &m_lastTimestamp);
+    }
+
     if (m_device != nullptr) {
         unsigned char buf[65];
+        unsigned long long timestamp = 0;
 
-        int rep = hid_read_timeout(m_device, buf, 65, timeout);
-
+        int rep = hid_read_timeout_timestamped(m_device, buf, 65, timeout, &timestamp);
         if (rep > 0) {
+            m_lastTimestamp = qint64(timestamp);
             QByteArray data(reinterpret_cast<char*>(buf), rep);
             return data;
         }
@@ -319,6 +587,7 @@ QByteArray QHidDevicePrivate::read(int timeout)
  */
 QByteArray QHidDevicePrivate::featureReport(uint reportId)
 {
+    QHID_TRACE_SCOPE("QHidDevice::featureReport");
     if (m_device != nullptr) {
         unsigned char buf[65];
         buf[0] = reportId;
@@ -349,6 +618,7 @@ QByteArray QHidDevicePrivate::featureReport(uint reportId)
  */
 int QHidDevicePrivate::sendFeatureReport(quint8 reportId, QByteArray data)
 {
+    QHID_TRACE_SCOPE("QHidDevice::sendFeatureReport");
     if (data.length() > 64) return -1;
 
     if (m_device != nullptr) {
@@ -376,6 +646,11 @@ int QHidDevicePrivate::sendFeatureReport(quint8 reportId, QByteArray data)
  */
 int QHidDevicePrivate::write(uint8_t* data, quint64 maxlen)
 {
+    QHID_TRACE_SCOPE("QHidDevice::write");
+
+    if (m_shared != nullptr) {
+        return m_shared->write(m_subscriber, data, int(maxlen));
+    }
 
     if (m_device != nullptr) {
 
@@ -402,8 +677,14 @@ int QHidDevicePrivate::write(uint8_t* data, quint64 maxlen)
  */
 int QHidDevicePrivate::write(QByteArray data, quint8 reportNumber)
 {
+    QHID_TRACE_SCOPE("QHidDevice::write");
     if (data.length() > 64) return -1;
 
+    if (m_shared != nullptr) {
+        data.prepend(reportNumber);
+        return m_shared->write(m_subscriber, reinterpret_cast<uchar*>(data.data()), data.length());
+    }
+
     if (m_device != nullptr) {
         data.prepend(reportNumber);
 
@@ -429,8 +710,13 @@ int QHidDevicePrivate::write(QByteArray data, quint8 reportNumber)
  */
 int QHidDevicePrivate::write(QByteArray data)
 {
+    QHID_TRACE_SCOPE("QHidDevice::write");
     if (data.length() > 65) return -1;
 
+    if (m_shared != nullptr) {
+        return m_shared->write(m_subscriber, reinterpret_cast<uchar*>(data.data()), data.length());
+    }
+
     if (m_device != nullptr) {
         int rep = hid_write(m_device, reinterpret_cast<uchar*>(data.data()), data.length());
 
@@ -473,9 +759,13 @@ QString QHidDevicePrivate::error()
  */
 bool QHidDevicePrivate::setBlocking()
 {
+    if (m_shared != nullptr) {
+        // the shared device is only read by its reader thread.
+        m_sharedBlocking = true;
+        return true;
+    }
     if (m_device != nullptr) {
-        int rep = hid_set_nonblocking(m_device, 1);
-        return !!rep;
+        return hid_set_nonblocking(m_device, 0) == 0;
     }
     return false;
 }
@@ -493,9 +783,12 @@ bool QHidDevicePrivate::setBlocking()
  */
 bool QHidDevicePrivate::setNonBlocking()
 {
+    if (m_shared != nullptr) {
+        m_sharedBlocking = false;
+        return true;
+    }
     if (m_device != nullptr) {
-        int rep = hid_set_nonblocking(m_device, 0);
-        return !!rep;
+        return hid_set_nonblocking(m_device, 1) == 0;
     }
     return false;
 }
@@ -511,10 +804,9 @@ bool QHidDevicePrivate::setNonBlocking()
  */
 bool QHidDevicePrivate::open(QString path)
 {
-    if (m_device != nullptr) {
-        hid_close(m_device);
-        m_device = nullptr;
-    }
+    close();
+
+    init();
 
     // if not open it.
     hid_device *device = hid_open_path(path.toLocal8Bit().data());
@@ -523,6 +815,29 @@ bool QHidDevicePrivate::open(QString path)
     if (device == nullptr) return false;
 
     m_device = device;
+    captureMetadata();
+
+    return true;
+}
+
+/*!
+ * \brief Open a HID device by its path name, sharing it with the rest of the process.
+ *
+ * \param path - the path to the device
+ * \return Returns true on success and false on error.
+ */
+bool QHidDevicePrivate::openShared(QString path)
+{
+    close();
+
+    QHidSharedDevice *shared = QHidSharedDevice::acquire(path);
+    if (shared == nullptr) return false;
+
+    m_shared = shared;
+    m_subscriber = shared->subscribe();
+    m_sharedBlocking = true;
+    m_device = shared->device();
+    captureMetadata();
 
     return true;
 }
@@ -533,18 +848,18 @@ bool QHidDevicePrivate::open(QString path)
  */
 bool QHidDevicePrivate::open(ushort vendorId, ushort productId, QString serialNumber)
 {
-    if (m_device != nullptr) {
-        hid_close(m_device);
-        m_device = nullptr;
-    }
+    close();
     mVendorId = vendorId;
     mProductId = productId;
 
+    init();
+
     hid_device *device = nullptr;
     if (serialNumber.isEmpty()) {
         device = hid_open(vendorId, productId, NULL);
         if (device != nullptr) {
             m_device = device;
+            captureMetadata();
             return true;
         }
     } else {
@@ -552,8 +867,10 @@ bool QHidDevicePrivate::open(ushort vendorId, ushort productId, QString serialNu
         serialNumber.toWCharArray(sn);
         sn[serialNumber.length()] = 0x0;
         device = hid_open(vendorId, productId, sn/*, Q_NULLPTR*/);
+        delete[] sn;
         if (device != Q_NULLPTR) {
             m_device = device;
+            captureMetadata();
             return true;
         }
     }
@@ -567,16 +884,17 @@ bool QHidDevicePrivate::open(ushort vendorId, ushort productId, QString serialNu
  */
 bool QHidDevicePrivate::open()
 {
-    if (m_device != nullptr) {
-        hid_close(m_device);
-        m_device = nullptr;
-    }
+    close();
+
+    init();
+
     // if not open it.
     hid_device *device = nullptr;
     if (mSerialNumber.isEmpty()) {
         device = hid_open(mVendorId, mProductId, NULL);
         if (device != nullptr) {
             m_device = device;
+            captureMetadata();
             return true;
         }
     } else {
@@ -585,18 +903,16 @@ bool QHidDevicePrivate::open()
         sn[mSerialNumber.length()] = 0x0;
         //device = hid_open(0x4d8, 0xf1fa, NULL);
         device = hid_open(mVendorId, mProductId, sn/*, Q_NULLPTR*/);
+        delete[] sn;
         if (device != Q_NULLPTR) {
             m_device = device;
+            captureMetadata();
             return true;
         }
     }
 
     // sorry doesn't exist
-    if (device == nullptr) return false;
-
-    m_device = device;
-
-    return true;
+    return false;
 }
 
 
@@ -1,5 +1,5 @@
-#ifndef QHIDAPI_P_H
-#define QHIDAPI_P_H
+#ifndef QHIDDEVICE_P_H
+#define QHIDDEVICE_P_H
 /*
 Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
 
@@ -15,9 +15,13 @@ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH RE
 #include <QIODevice>
 
 #include "qhiddeviceinfo.h"
+#include "qhidreportdescriptor.h"
+#include "qhidreportbatch.h"
 #include "hidapi.h"
 
 class QHidDevice;
+class QHidSharedDevice;
+class QHidStateRegister;
 
 class QHidDevicePrivate {
 public:
@@ -28,12 +32,20 @@ public:
 
     bool open(ushort vendor_id, ushort product_id, QString serial_number=QString());
     bool open(QString path);
+    bool openShared(QString path);
     bool open();
 
     void close();
 
     qint64 read(char* data, qint64 length);
     qint64 read(char* data, qint64 maxSize, int milliseconds);
+    QHidReportBatch drain(int maxReports);
+    static QHidReportBatch drain(hid_device *device, int maxReports);
+    qint64 lastReportTimestamp() const;
+    bool trackLatestReports();
+    int latestReport(quint8 reportId, uchar *data, int length, qint64 *timestamp) const;
+    QHidDeviceStats stats() const;
+    void resetStats();
     int write(uint8_t* data, quint64 maxlen);
 
 
@@ -47,23 +59,53 @@ public:
     QString indexedString(int index);
     QString error();
 
+    QHidDeviceInfo deviceInfo();
+    QHidReportDescriptor reportDescriptor();
+    bool refresh();
+
+    static QHidDeviceInfo fromHidDeviceInfo(const hid_device_info *info);
+
     static const int MAX_STR = 255;
 
     quint32 mVendorId, mProductId;
     QString mSerialNumber;
 
-    QList<QHidDeviceInfo> mDeviceInfoList;
 protected:
+    void init();
+
     QByteArray read();
     QByteArray read(int timeout);
     int write(QByteArray data, quint8 reportNumber);
     int write(QByteArray data);
 
+    void captureMetadata();
+    void readReportDescriptor();
+
 private:
     QHidDevice *q_ptr;
     hid_device *m_device;
+    /*
+     * metadata snapshot taken when the device is opened.
+     */
+    QHidDeviceInfo m_info;
+    QHidReportDescriptor m_reportDescriptor;
+    bool m_initialised;
+    /*
+     * set when the device was opened with openShared(), m_device is then owned by it.
+     */
+    QHidSharedDevice *m_shared;
+    int m_subscriber;
+    bool m_sharedBlocking;
+    /*
+     * arrival time of the last report read, see QHidDevice::lastReportTimestamp().
+     */
+    qint64 m_lastTimestamp;
+    /*
+     * set by trackLatestReports(), owned by m_shared.
+     */
+    QHidStateRegister *m_state;
     Q_DECLARE_PUBLIC(QHidDevice)
 
 };
 
-#endif // QHIDAPI_P_H
+#endif // QHIDDEVICE_P_H
@@ -0,0 +1,261 @@
+#include "qhiddevicecache_p.h"
+#include "hidapi.h"
+
+#include <QFile>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QThreadPool>
+/*
+Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+static QDataStream &operator<<(QDataStream &out, const QHidDeviceCache::Entry &entry) {
+    const QHidDeviceInfo &info = entry.info;
+    ushort usagePage = 0, usage = 0;
+#if defined(Q_OS_WIN32) || defined(Q_OS_MAC)
+    usagePage = info.usagePage;
+    usage = info.usage;
+#endif
+
+    out << info.path << entry.location
+        << info.vendorId << info.productId << info.releaseNumber << qint32(info.interfaceNumber)
+        << info.serialNumber << info.manufacturerString << info.productString
+        << usagePage << usage
+        << entry.reportDescriptor;
+
+    return out;
+}
+
+static QDataStream &operator>>(QDataStream &in, QHidDeviceCache::Entry &entry) {
+    QHidDeviceInfo &info = entry.info;
+    ushort usagePage, usage;
+    qint32 interfaceNumber;
+
+    in >> info.path >> entry.location
+       >> info.vendorId >> info.productId >> info.releaseNumber >> interfaceNumber
+       >> info.serialNumber >> info.manufacturerString >> info.productString
+       >> usagePage >> usage
+       >> entry.reportDescriptor;
+
+    info.interfaceNumber = interfaceNumber;
+#if defined(Q_OS_WIN32) || defined(Q_OS_MAC)
+    info.usagePage = usagePage;
+    info.usage = usage;
+#else
+    Q_UNUSED(usagePage)
+    Q_UNUSED(usage)
+#endif
+
+    return in;
+}
+
+QHidCacheValidator::QHidCacheValidator() {
+    setAutoDelete(false);
+}
+
+void QHidCacheValidator::run() {
+    // the owner may finalise the library while this runs.
+    if (hid_init() < 0) {
+        emit finished(this);
+        return;
+    }
+
+    hid_device_info *devs = hid_enumerate_ex(0x0, 0x0, HID_ENUMERATE_NO_STRINGS);
+
+    for (hid_device_info *info = devs; info != nullptr; info = info->next) {
+        QString path = QString(info->path);
+        mAttached.insert(path, qMakePair(QHidDeviceCache::location(path), info->release_number));
+    }
+
+    hid_free_enumeration(devs);
+    hid_exit();
+
+    emit finished(this);
+}
+
+QHidDeviceCache::QHidDeviceCache(QObject *parent) :
+    QObject(parent) {
+}
+
+/*!
+ * \brief Returns the name of the cache file, or an empty string if there is none.
+ */
+QString QHidDeviceCache::fileName() const {
+    return mFileName;
+}
+
+/*!
+ * \brief Reads the cache file. A missing, unreadable or outdated file leaves the cache empty.
+ *
+ * \return true if the file was read.
+ */
+bool QHidDeviceCache::load(const QString &fileName) {
+    mFileName = fileName;
+    mEntries.clear();
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic, version, count;
+    in >> magic >> version >> count;
+    if (magic != MAGIC || version != VERSION) {
+        return false;
+    }
+
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+        Entry entry;
+        in >> entry;
+        if (in.status() == QDataStream::Ok) {
+            mEntries.insert(entry.info.path, entry);
+        }
+    }
+
+    return in.status() == QDataStream::Ok;
+}
+
+/*!
+ * \brief Writes the cache file, replacing the old one in a single step.
+ *
+ * \return true if the file was written.
+ */
+bool QHidDeviceCache::save() {
+    if (mFileName.isEmpty()) {
+        return false;
+    }
+
+    QSaveFile file(mFileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_0);
+
+    out << MAGIC << VERSION << quint32(mEntries.size());
+    foreach (const Entry &entry, mEntries) {
+        out << entry;
+    }
+
+    return file.commit();
+}
+
+/*!
+ * \brief Returns the cached details of every device.
+ */
+QList<QHidDeviceInfo> QHidDeviceCache::devices() const {
+    QList<QHidDeviceInfo> devices;
+
+    foreach (const Entry &entry, mEntries) {
+        devices.append(entry.info);
+    }
+
+    return devices;
+}
+
+/*!
+ * \brief Returns true if the device at path is cached.
+ */
+bool QHidDeviceCache::contains(const QString &path) const {
+    return mEntries.contains(path);
+}
+
+/*!
+ * \brief Returns the cached report descriptor of the device at path, or an empty QByteArray.
+ */
+QByteArray QHidDeviceCache::reportDescriptor(const QString &path) const {
+    return mEntries.value(path).reportDescriptor;
+}
+
+/*!
+ * \brief Stores freshly enumerated details of a device.
+ *
+ * The report descriptor is kept if the device is still at the same location with the
+ * same release number, otherwise it is dropped.
+ */
+void QHidDeviceCache::update(const QHidDeviceInfo &info) {
+    QString loc = location(info.path);
+    QMap<QString, Entry>::iterator it = mEntries.find(info.path);
+
+    if (it != mEntries.end() &&
+            it->location == loc &&
+            it->info.releaseNumber == info.releaseNumber) {
+        it->info = info;
+        return;
+    }
+
+    Entry entry;
+    entry.info = info;
+    entry.location = loc;
+    mEntries.insert(info.path, entry);
+}
+
+/*!
+ * \brief Stores the report descriptor of the device at path, which must already be cached.
+ */
+void QHidDeviceCache::setReportDescriptor(const QString &path, const QByteArray &descriptor) {
+    QMap<QString, Entry>::iterator it = mEntries.find(path);
+
+    if (it != mEntries.end()) {
+        it->reportDescriptor = descriptor;
+    }
+}
+
+/*!
+ * \brief Checks the cached devices against the bus on a pool thread.
+ *
+ * Entries whose device has gone, moved or changed release number are dropped, and
+ * validated() is emitted.
+ */
+void QHidDeviceCache::validate() {
+    QHidCacheValidator *validator = new QHidCacheValidator();
+    connect(validator, SIGNAL(finished(QHidCacheValidator*)),
+            this, SLOT(validatorFinished(QHidCacheValidator*)), Qt::QueuedConnection);
+    QThreadPool::globalInstance()->start(validator);
+}
+
+void QHidDeviceCache::validatorFinished(QHidCacheValidator *validator) {
+    bool changed = false;
+    QMap<QString, Entry>::iterator it = mEntries.begin();
+
+    while (it != mEntries.end()) {
+        QPair<QString, ushort> attached = validator->mAttached.value(it.key(), qMakePair(QString(), ushort(0)));
+        if (!validator->mAttached.contains(it.key()) ||
+                attached.first != it->location ||
+                attached.second != it->info.releaseNumber) {
+            it = mEntries.erase(it);
+            changed = true;
+        } else {
+            ++it;
+        }
+    }
+
+    validator->deleteLater();
+
+    if (changed) {
+        save();
+    }
+
+    emit validated();
+}
+
+/*!
+ * \brief Returns the physical location of the device at path, see hid_get_location().
+ */
+QString QHidDeviceCache::location(const QString &path) {
+    char buf[512];
+
+    if (hid_get_location(path.toLocal8Bit().constData(), buf, sizeof(buf)) < 0) {
+        return QString();
+    }
+
+    return QString::fromLocal8Bit(buf);
+}
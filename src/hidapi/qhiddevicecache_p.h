@@ -0,0 +1,85 @@
+#ifndef QHIDDEVICECACHE_P_H
+#define QHIDDEVICECACHE_P_H
+/*
+Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include <QObject>
+#include <QRunnable>
+#include <QMap>
+#include <QHash>
+#include <QPair>
+#include <QList>
+#include <QByteArray>
+
+#include "qhiddeviceinfo.h"
+
+/*
+ * Checks the cached devices against the bus on a pool thread.
+ */
+class QHidCacheValidator : public QObject, public QRunnable {
+    Q_OBJECT
+public:
+    QHidCacheValidator();
+
+    void run();
+
+    /*
+     * map of path -> (location, releaseNumber) of the devices currently attached.
+     */
+    QHash<QString, QPair<QString, ushort> > mAttached;
+
+signals:
+    void finished(QHidCacheValidator *validator);
+};
+
+/*
+ * Device details and report descriptors kept in a file between runs. An entry is
+ * only valid while the device at its path has the same location and release number.
+ */
+class QHidDeviceCache : public QObject {
+    Q_OBJECT
+public:
+    struct Entry {
+        QHidDeviceInfo info;
+        QString location;
+        QByteArray reportDescriptor;
+    };
+
+    explicit QHidDeviceCache(QObject *parent = nullptr);
+
+    QString fileName() const;
+    bool load(const QString &fileName);
+    bool save();
+
+    QList<QHidDeviceInfo> devices() const;
+    bool contains(const QString &path) const;
+    QByteArray reportDescriptor(const QString &path) const;
+    void update(const QHidDeviceInfo &info);
+    void setReportDescriptor(const QString &path, const QByteArray &descriptor);
+    void validate();
+
+    static QString location(const QString &path);
+
+    static const quint32 MAGIC = 0x48494443; // "HIDC"
+    static const quint32 VERSION = 1;
+
+signals:
+    void validated();
+
+protected slots:
+    void validatorFinished(QHidCacheValidator *validator);
+
+protected:
+    QString mFileName;
+    /*
+     * map of path -> entry.
+     */
+    QMap<QString, Entry> mEntries;
+};
+
+#endif // QHIDDEVICECACHE_P_H
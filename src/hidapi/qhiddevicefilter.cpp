@@ -0,0 +1,153 @@
+#include "qhiddevicefilter.h"
+/*
+Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/*!
+ * \class QHidDeviceFilter
+ * \brief \c QHidDeviceFilter describes the devices to be returned by QHidApi::enumerate().
+ *
+ * The filter is handed down to the hidapi backend, which checks each criterion as early as it can, so
+ * that devices which do not match are dropped before their strings are read or they are opened. Criteria
+ * which are left at their default values match any device.
+ *
+ * \code
+ *     QHidDeviceFilter filter(0xafaf);
+ *     filter.setInterfaceNumber(1);
+ *     filter.setSerialNumberPattern("AB12*");
+ *     QList<QHidDeviceInfo> devices = api->enumerate(filter);
+ * \endcode
+ */
+
+/*!
+ * \brief Constructs a filter which matches every device.
+ */
+QHidDeviceFilter::QHidDeviceFilter() :
+    mVendorId(0x0),
+    mProductId(0x0),
+    mInterfaceNumber(-1),
+    mUsagePage(0x0),
+    mUsage(0x0),
+    mBusType(AnyBus) {
+}
+
+/*!
+ * \brief Constructs a filter which matches the devices with a vendor id and, optionally, a product id.
+ */
+QHidDeviceFilter::QHidDeviceFilter(ushort vendorId, ushort productId) :
+    mVendorId(vendorId),
+    mProductId(productId),
+    mInterfaceNumber(-1),
+    mUsagePage(0x0),
+    mUsage(0x0),
+    mBusType(AnyBus) {
+}
+
+/*!
+ * \brief Returns the vendor id to match, or 0 for any vendor.
+ */
+ushort QHidDeviceFilter::vendorId() const {
+    return mVendorId;
+}
+
+/*!
+ * \brief Sets the vendor id to match, 0 matches any vendor.
+ */
+void QHidDeviceFilter::setVendorId(ushort vendorId) {
+    mVendorId = vendorId;
+}
+
+/*!
+ * \brief Returns the product id to match, or 0 for any product.
+ */
+ushort QHidDeviceFilter::productId() const {
+    return mProductId;
+}
+
+/*!
+ * \brief Sets the product id to match, 0 matches any product.
+ */
+void QHidDeviceFilter::setProductId(ushort productId) {
+    mProductId = productId;
+}
+
+/*!
+ * \brief Returns the USB interface number to match, or -1 for any interface.
+ */
+int QHidDeviceFilter::interfaceNumber() const {
+    return mInterfaceNumber;
+}
+
+/*!
+ * \brief Sets the USB interface number to match, -1 matches any interface.
+ */
+void QHidDeviceFilter::setInterfaceNumber(int interfaceNumber) {
+    mInterfaceNumber = interfaceNumber;
+}
+
+/*!
+ * \brief Returns the usage page to match, or 0 for any usage page.
+ */
+ushort QHidDeviceFilter::usagePage() const {
+    return mUsagePage;
+}
+
+/*!
+ * \brief Sets the usage page to match, 0 matches any usage page.
+ *
+ * The usage is read from the report descriptor. The hidraw backend reads it from sysfs, the libusb backend
+ * only when built with INVASIVE_GET_USAGE, and ignores the usage criteria otherwise.
+ */
+void QHidDeviceFilter::setUsagePage(ushort usagePage) {
+    mUsagePage = usagePage;
+}
+
+/*!
+ * \brief Returns the usage to match, or 0 for any usage.
+ */
+ushort QHidDeviceFilter::usage() const {
+    return mUsage;
+}
+
+/*!
+ * \brief Sets the usage to match, 0 matches any usage.
+ *
+ * \see setUsagePage()
+ */
+void QHidDeviceFilter::setUsage(ushort usage) {
+    mUsage = usage;
+}
+
+/*!
+ * \brief Returns the bus to match.
+ */
+QHidDeviceFilter::BusType QHidDeviceFilter::busType() const {
+    return mBusType;
+}
+
+/*!
+ * \brief Sets the bus to match, AnyBus matches every bus.
+ */
+void QHidDeviceFilter::setBusType(BusType busType) {
+    mBusType = busType;
+}
+
+/*!
+ * \brief Returns the wildcard pattern the serial number must match, or an empty string for any serial number.
+ */
+QString QHidDeviceFilter::serialNumberPattern() const {
+    return mSerialNumberPattern;
+}
+
+/*!
+ * \brief Sets a shell style wildcard pattern, as used by fnmatch(), which the serial number must match.
+ *
+ * An empty pattern matches any serial number.
+ */
+void QHidDeviceFilter::setSerialNumberPattern(const QString &pattern) {
+    mSerialNumberPattern = pattern;
+}
@@ -0,0 +1,51 @@
+#ifndef QHIDDEVICEFILTER_H
+#define QHIDDEVICEFILTER_H
+/*
+Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include <QString>
+
+#include "qhidapi_global.h"
+
+class QHIDAPISHARED_EXPORT QHidDeviceFilter {
+public:
+    enum BusType {
+        AnyBus = 0x00,
+        UsbBus = 0x03,
+        BluetoothBus = 0x05
+    };
+
+    QHidDeviceFilter();
+    explicit QHidDeviceFilter(ushort vendorId, ushort productId=0x0);
+
+    ushort vendorId() const;
+    void setVendorId(ushort vendorId);
+    ushort productId() const;
+    void setProductId(ushort productId);
+    int interfaceNumber() const;
+    void setInterfaceNumber(int interfaceNumber);
+    ushort usagePage() const;
+    void setUsagePage(ushort usagePage);
+    ushort usage() const;
+    void setUsage(ushort usage);
+    BusType busType() const;
+    void setBusType(BusType busType);
+    QString serialNumberPattern() const;
+    void setSerialNumberPattern(const QString &pattern);
+
+private:
+    ushort mVendorId;
+    ushort mProductId;
+    int mInterfaceNumber;
+    ushort mUsagePage;
+    ushort mUsage;
+    BusType mBusType;
+    QString mSerialNumberPattern;
+};
+
+#endif // QHIDDEVICEFILTER_H
@@ -41,6 +41,7 @@ struct QHidDeviceInfo {
             only if the device contains more than one interface. */
     int interfaceNumber;
 };
+Q_DECLARE_METATYPE(QHidDeviceInfo)
 Q_DECLARE_METATYPE(QHidDeviceInfo*)
 
 #endif // QHIDDEVICEINFO_H
@@ -0,0 +1,254 @@
+#include "qhiddevicestats.h"
+#include "hidapi.h"
+
+#include <QElapsedTimer>
+/*
+Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/*!
+ * \class QHidDeviceStats
+ * \brief \c QHidDeviceStats is a snapshot of the runtime statistics of an open device, returned by
+ * QHidApi::deviceStats() and QHidDevice::stats().
+ *
+ * The backend keeps the counters in its read and write paths with relaxed atomic operations, so
+ * keeping them costs next to nothing and a snapshot can be taken from any thread at any time. Each
+ * counter is read on its own, so a snapshot taken during traffic may be a report or so apart
+ * between counters.
+ *
+ * Rates are worked out between two snapshots:
+ *
+ * \code
+ *     QHidDeviceStats before = api->deviceStats(id);
+ *     ...
+ *     QHidDeviceStats after = api->deviceStats(id);
+ *     qDebug() << after.readRate(before) << "reports/s, p99"
+ *              << after.readLatencyPercentile(99) << "ns";
+ * \endcode
+ *
+ * The latencies are kept in log2 buckets, see bucketUpperBound(). The hidraw backend can not see
+ * when a report reached the kernel nor its queue, so there the read latencies, reportsDropped() and
+ * queueHighWater() stay at 0, except for the reports dropped by a shared device.
+ */
+
+/*!
+ * \brief Constructs an empty, invalid snapshot.
+ */
+QHidDeviceStats::QHidDeviceStats() :
+    mValid(false),
+    mTimestamp(0),
+    mReportsRead(0),
+    mBytesRead(0),
+    mReportsWritten(0),
+    mBytesWritten(0),
+    mReportsDropped(0),
+    mReadTimeouts(0),
+    mReadErrors(0),
+    mWriteErrors(0),
+    mQueueHighWater(0),
+    mReportsSuppressed(0),
+    mReadLatency(HID_STATS_LATENCY_BUCKETS, 0),
+    mWriteLatency(HID_STATS_LATENCY_BUCKETS, 0) {
+}
+
+/*!
+ * \brief Returns true if the snapshot was taken from an open device.
+ */
+bool QHidDeviceStats::isValid() const {
+    return mValid;
+}
+
+/*!
+ * \brief Returns the time the snapshot was taken, in milliseconds of QElapsedTimer::msecsSinceReference().
+ */
+qint64 QHidDeviceStats::timestamp() const {
+    return mTimestamp;
+}
+
+/*!
+ * \brief Returns the number of Input reports handed to the application.
+ */
+quint64 QHidDeviceStats::reportsRead() const {
+    return mReportsRead;
+}
+
+/*!
+ * \brief Returns the number of bytes of the Input reports handed to the application.
+ */
+quint64 QHidDeviceStats::bytesRead() const {
+    return mBytesRead;
+}
+
+/*!
+ * \brief Returns the number of Output reports written.
+ */
+quint64 QHidDeviceStats::reportsWritten() const {
+    return mReportsWritten;
+}
+
+/*!
+ * \brief Returns the number of bytes of the Output reports written.
+ */
+quint64 QHidDeviceStats::bytesWritten() const {
+    return mBytesWritten;
+}
+
+/*!
+ * \brief Returns the number of Input reports lost because a queue was full.
+ *
+ * For devices opened with openShared() this includes the reports the subscriber missed because it
+ * fell too far behind the reader thread of the device.
+ */
+quint64 QHidDeviceStats::reportsDropped() const {
+    return mReportsDropped;
+}
+
+/*!
+ * \brief Returns the number of timed or blocking reads which returned no report.
+ */
+quint64 QHidDeviceStats::readTimeouts() const {
+    return mReadTimeouts;
+}
+
+/*!
+ * \brief Returns the number of reads which failed, usually because the device was unplugged.
+ */
+quint64 QHidDeviceStats::readErrors() const {
+    return mReadErrors;
+}
+
+/*!
+ * \brief Returns the number of writes which failed.
+ */
+quint64 QHidDeviceStats::writeErrors() const {
+    return mWriteErrors;
+}
+
+/*!
+ * \brief Returns the largest number of Input reports which have been waiting to be read.
+ */
+quint64 QHidDeviceStats::queueHighWater() const {
+    return mQueueHighWater;
+}
+
+/*!
+ * \brief Returns the number of Input reports not delivered because they had not changed.
+ *
+ * \see QHidApi::setChangeFilter()
+ */
+quint64 QHidDeviceStats::reportsSuppressed() const {
+    return mReportsSuppressed;
+}
+
+/*!
+ * \brief Returns the Input reports read per second between the earlier snapshot and this one.
+ */
+double QHidDeviceStats::readRate(const QHidDeviceStats &earlier) const {
+    qint64 elapsed = mTimestamp - earlier.mTimestamp;
+    if (elapsed <= 0 || mReportsRead < earlier.mReportsRead) {
+        return 0.0;
+    }
+    return (mReportsRead - earlier.mReportsRead) * 1000.0 / elapsed;
+}
+
+/*!
+ * \brief Returns the Output reports written per second between the earlier snapshot and this one.
+ */
+double QHidDeviceStats::writeRate(const QHidDeviceStats &earlier) const {
+    qint64 elapsed = mTimestamp - earlier.mTimestamp;
+    if (elapsed <= 0 || mReportsWritten < earlier.mReportsWritten) {
+        return 0.0;
+    }
+    return (mReportsWritten - earlier.mReportsWritten) * 1000.0 / elapsed;
+}
+
+/*!
+ * \brief Returns the histogram of the times from the arrival of an Input report to its delivery
+ * to the application.
+ *
+ * Entry i counts the reports delivered in up to bucketUpperBound(i) nanoseconds, and more than
+ * bucketUpperBound(i - 1).
+ */
+QVector<quint64> QHidDeviceStats::readLatencyHistogram() const {
+    return mReadLatency;
+}
+
+/*!
+ * \brief Returns the histogram of the times taken by writes, from the call to the report being
+ * handed over to the operating system, in the buckets of readLatencyHistogram().
+ */
+QVector<quint64> QHidDeviceStats::writeLatencyHistogram() const {
+    return mWriteLatency;
+}
+
+/*!
+ * \brief Returns the read latency, in nanoseconds, which percent percent of the reports stayed within,
+ * rounded up to a bucket bound. Returns 0 if no latency has been recorded.
+ */
+qint64 QHidDeviceStats::readLatencyPercentile(double percent) const {
+    return percentile(mReadLatency, percent);
+}
+
+/*!
+ * \brief Returns the write latency, in nanoseconds, which percent percent of the writes stayed within,
+ * rounded up to a bucket bound. Returns 0 if no latency has been recorded.
+ */
+qint64 QHidDeviceStats::writeLatencyPercentile(double percent) const {
+    return percentile(mWriteLatency, percent);
+}
+
+/*!
+ * \brief Returns the largest latency, in nanoseconds, counted in the given histogram bucket.
+ *
+ * Bucket i covers 2^i to 2^(i + 1) - 1 nanoseconds, the last bucket also counts everything longer.
+ */
+qint64 QHidDeviceStats::bucketUpperBound(int bucket) {
+    return (Q_INT64_C(2) << bucket) - 1;
+}
+
+void QHidDeviceStats::setStats(const hid_device_stats &stats) {
+    QElapsedTimer clock;
+    clock.start();
+
+    mValid = true;
+    mTimestamp = clock.msecsSinceReference();
+    mReportsRead = stats.reports_read;
+    mBytesRead = stats.bytes_read;
+    mReportsWritten = stats.reports_written;
+    mBytesWritten = stats.bytes_written;
+    mReportsDropped = stats.reports_dropped;
+    mReadTimeouts = stats.read_timeouts;
+    mReadErrors = stats.read_errors;
+    mWriteErrors = stats.write_errors;
+    mQueueHighWater = stats.queue_high_water;
+    mReportsSuppressed = stats.reports_suppressed;
+    for (int i = 0; i < HID_STATS_LATENCY_BUCKETS; i++) {
+        mReadLatency[i] = stats.read_latency[i];
+        mWriteLatency[i] = stats.write_latency[i];
+    }
+}
+
+qint64 QHidDeviceStats::percentile(const QVector<quint64> &histogram, double percent) {
+    quint64 total = 0;
+    foreach (quint64 count, histogram) {
+        total += count;
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    double wanted = total * qBound(0.0, percent, 100.0) / 100.0;
+    quint64 seen = 0;
+    for (int i = 0; i < histogram.size(); i++) {
+        seen += histogram.at(i);
+        if (seen > 0 && seen >= wanted) {
+            return bucketUpperBound(i);
+        }
+    }
+
+    return bucketUpperBound(histogram.size() - 1);
+}
@@ -0,0 +1,70 @@
+#ifndef QHIDDEVICESTATS_H
+#define QHIDDEVICESTATS_H
+/*
+Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include <QVector>
+
+#include "qhidapi_global.h"
+
+struct hid_device_stats;
+
+class QHIDAPISHARED_EXPORT QHidDeviceStats {
+public:
+    QHidDeviceStats();
+
+    bool isValid() const;
+    qint64 timestamp() const;
+
+    quint64 reportsRead() const;
+    quint64 bytesRead() const;
+    quint64 reportsWritten() const;
+    quint64 bytesWritten() const;
+    quint64 reportsDropped() const;
+    quint64 readTimeouts() const;
+    quint64 readErrors() const;
+    quint64 writeErrors() const;
+    quint64 queueHighWater() const;
+    quint64 reportsSuppressed() const;
+
+    double readRate(const QHidDeviceStats &earlier) const;
+    double writeRate(const QHidDeviceStats &earlier) const;
+
+    QVector<quint64> readLatencyHistogram() const;
+    QVector<quint64> writeLatencyHistogram() const;
+    qint64 readLatencyPercentile(double percent) const;
+    qint64 writeLatencyPercentile(double percent) const;
+    static qint64 bucketUpperBound(int bucket);
+
+private:
+    void setStats(const hid_device_stats &stats);
+    static qint64 percentile(const QVector<quint64> &histogram, double percent);
+
+    bool mValid;
+    /*
+     * QElapsedTimer::msecsSinceReference() when the snapshot was taken, for the rates.
+     */
+    qint64 mTimestamp;
+    quint64 mReportsRead;
+    quint64 mBytesRead;
+    quint64 mReportsWritten;
+    quint64 mBytesWritten;
+    quint64 mReportsDropped;
+    quint64 mReadTimeouts;
+    quint64 mReadErrors;
+    quint64 mWriteErrors;
+    quint64 mQueueHighWater;
+    quint64 mReportsSuppressed;
+    QVector<quint64> mReadLatency;
+    QVector<quint64> mWriteLatency;
+
+    friend class QHidApiPrivate;
+    friend class QHidDevicePrivate;
+};
+
+#endif // QHIDDEVICESTATS_H
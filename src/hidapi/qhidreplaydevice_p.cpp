@@ -0,0 +1,375 @@
+#include "qhidreplaydevice_p.h"
+
+#include <QThread>
+#include <QUrl>
+#include <QUrlQuery>
+
+#include <string.h>
+
+#include "hidapi_capture.h"
+#include "hidapi_stats.h"
+#include "qhidcapturereader.h"
+/*
+Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+static const char REPLAY_SCHEME[] = "replay://";
+
+/*
+ * The shortest pass of a loop, in ns, for recordings whose reports all share one timestamp.
+ */
+static const qint64 MIN_LOOP_PERIOD = 1000000;
+
+QHidReplayDevice::QHidReplayDevice() :
+    mSpeed(1.0),
+    mValidate(false),
+    mLoop(false),
+    mBlocking(true),
+    mNext(0),
+    mNextOutput(0),
+    mNextFeatureSet(0),
+    mStart(0) {
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+bool QHidReplayDevice::isReplayPath(const QString &path) {
+    return path.startsWith(QLatin1String(REPLAY_SCHEME));
+}
+
+/*
+ * Loads the capture named by a replay:// path and starts its clock.
+ * returns NULL if the path is malformed or the capture holds no such device.
+ */
+QHidReplayDevice *QHidReplayDevice::open(const QString &path) {
+    if (!isReplayPath(path)) {
+        return NULL;
+    }
+
+    QString location = path.mid(int(sizeof(REPLAY_SCHEME)) - 1);
+    QString query;
+    int separator = location.indexOf(QLatin1Char('?'));
+    if (separator >= 0) {
+        query = location.mid(separator + 1);
+        location.truncate(separator);
+    }
+    QString fileName = QUrl::fromPercentEncoding(location.toUtf8());
+    if (fileName.isEmpty()) {
+        return NULL;
+    }
+
+    QHidReplayDevice *device = new QHidReplayDevice();
+    QUrlQuery options(query);
+    bool ok = true;
+    int tag = -1;
+
+    if (options.hasQueryItem("speed")) {
+        device->mSpeed = options.queryItemValue("speed").toDouble(&ok);
+        ok = ok && device->mSpeed >= 0;
+    }
+    if (ok && options.hasQueryItem("device")) {
+        tag = options.queryItemValue("device").toInt(&ok);
+        ok = ok && tag >= 0;
+    }
+    device->mValidate = options.queryItemValue("writes") == QLatin1String("validate");
+    device->mLoop = options.queryItemValue("loop") == QLatin1String("1");
+
+    if (!ok || !device->load(fileName, tag)) {
+        delete device;
+        return NULL;
+    }
+
+    device->mTimer.start();
+    device->mStart = device->mTimer.msecsSinceReference() * 1000000;
+
+    return device;
+}
+
+/*
+ * Reads the records of one device out of the capture. tag -1 picks the first device
+ * recorded.
+ */
+bool QHidReplayDevice::load(const QString &fileName, int tag) {
+    QHidCaptureReader reader;
+    if (!reader.open(fileName) || reader.devices().isEmpty()) {
+        return false;
+    }
+
+    if (tag < 0) {
+        tag = reader.devices().first();
+    } else if (!reader.devices().contains(tag)) {
+        return false;
+    }
+
+    mDescriptor = reader.reportDescriptor(tag).data();
+    mDevicePath = reader.devicePath(tag);
+
+    QHidCaptureReader::Position position = { 0, 0 };
+    QHidCaptureReader::Record record;
+    qint64 first = 0;
+    while (reader.next(position, record)) {
+        if (record.tag != tag) {
+            continue;
+        }
+
+        // the data points into the capture, which is closed with the reader.
+        QByteArray payload(record.data.constData(), record.data.size());
+
+        switch (record.type) {
+        case HID_CAPTURE_INPUT:
+            if (mInputs.isEmpty()) {
+                first = record.timestamp;
+            }
+            mInputs.append(payload);
+            mOffsets.append(record.timestamp - first);
+            break;
+        case HID_CAPTURE_OUTPUT:
+            mOutputs.append(payload);
+            break;
+        case HID_CAPTURE_FEATURE_SET:
+            mFeatureSets.append(payload);
+            break;
+        case HID_CAPTURE_FEATURE_GET:
+            if (!payload.isEmpty()) {
+                mFeatureGets[uchar(payload.at(0))].append(payload);
+            }
+            break;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * When Input report index becomes readable, in ns since the device was opened. Each pass
+ * of a loop lasts as long as the recording plus the mean gap between its reports, and at
+ * least MIN_LOOP_PERIOD, so a recording without duration does not loop flat out.
+ */
+qint64 QHidReplayDevice::due(qint64 index) const {
+    if (mSpeed <= 0) {
+        return 0;
+    }
+
+    int count = mInputs.size();
+    qint64 duration = mOffsets.last();
+    qint64 period = qMax(duration + (count > 1 ? duration / (count - 1) : 0), MIN_LOOP_PERIOD);
+
+    return qint64(double(index / count * period + mOffsets.at(int(index % count))) / mSpeed);
+}
+
+bool QHidReplayDevice::atEnd() const {
+    return mInputs.isEmpty() || (!mLoop && mNext >= mInputs.size());
+}
+
+/*
+ * Moves the next Input report into report if it is due.
+ */
+bool QHidReplayDevice::takeReport(QByteArray &report, qint64 &timestamp) {
+    if (atEnd()) {
+        return false;
+    }
+
+    qint64 now = mTimer.nsecsElapsed();
+    qint64 at = due(mNext);
+    if (at > now) {
+        return false;
+    }
+
+    report = mInputs.at(int(mNext % mInputs.size()));
+    timestamp = mStart + (mSpeed <= 0 ? now : at);
+    mNext++;
+
+    mStats.reports_read++;
+    mStats.bytes_read += quint64(report.size());
+    // how late the report was taken, the replay's equivalent of the queueing delay.
+    if (mSpeed > 0) {
+        hid_stats_latency(mStats.read_latency, quint64(at), quint64(now));
+    }
+
+    return true;
+}
+
+/*
+ * Returns the next Input report, waiting up to timeout milliseconds for it to become due,
+ * or for ever if timeout is -1. Returns an empty QByteArray on timeout or once every
+ * report has been played.
+ */
+QByteArray QHidReplayDevice::read(int timeout, qint64 *timestamp) {
+    QByteArray report;
+    qint64 received = 0;
+    qint64 deadline = mTimer.nsecsElapsed() + qint64(timeout) * 1000000;
+
+    while (!takeReport(report, received)) {
+        if (atEnd()) {
+            return QByteArray();
+        }
+
+        qint64 now = mTimer.nsecsElapsed();
+        qint64 wait = due(mNext) - now;
+        if (timeout >= 0) {
+            if (now >= deadline) {
+                if (timeout != 0) {
+                    mStats.read_timeouts++;
+                }
+                return QByteArray();
+            }
+            wait = qMin(wait, deadline - now);
+        }
+        QThread::usleep(ulong((wait + 999) / 1000));
+    }
+
+    if (timestamp != NULL) {
+        *timestamp = received;
+    }
+
+    return report;
+}
+
+/*
+ * hid_read_timeout() style read. returns the number of bytes copied into data, 0 on
+ * timeout and -1 once every report has been played, as if the device was unplugged.
+ */
+int QHidReplayDevice::read(uchar *data, int length, int timeout, qint64 *timestamp) {
+    QByteArray report = read(timeout, timestamp);
+
+    if (report.isEmpty()) {
+        return (atEnd() ? -1 : 0);
+    }
+
+    int size = qMin(length, report.size());
+    memcpy(data, report.constData(), size);
+
+    return size;
+}
+
+/*
+ * Returns true if a read() would not wait, because a report is due or the replay has ended.
+ */
+bool QHidReplayDevice::hasReport() const {
+    return atEnd() || due(mNext) <= mTimer.nsecsElapsed();
+}
+
+/*
+ * Returns how long, in ns, until hasReport() becomes true, 0 if it already is.
+ */
+qint64 QHidReplayDevice::nsecsToReport() const {
+    if (atEnd()) {
+        return 0;
+    }
+
+    return qMax(qint64(0), due(mNext) - mTimer.nsecsElapsed());
+}
+
+/*
+ * Takes every report which is due, up to maxReports, in one go.
+ */
+QHidReportBatch QHidReplayDevice::drain(int maxReports) {
+    QHidReportBatch batch;
+    QByteArray report;
+    qint64 timestamp;
+
+    for (int i = 0; i < maxReports && takeReport(report, timestamp); i++) {
+        batch.append(report, timestamp);
+    }
+
+    return batch;
+}
+
+/*
+ * Only used by read() without a timeout, as for a hid_device.
+ */
+bool QHidReplayDevice::isBlocking() const {
+    return mBlocking;
+}
+
+void QHidReplayDevice::setBlocking(bool blocking) {
+    mBlocking = blocking;
+}
+
+/*
+ * Accepts data in place of the next recorded report in expected, comparing the two if
+ * validating. returns length, or -1 if they differ or nothing more was recorded.
+ */
+int QHidReplayDevice::compare(const QVector<QByteArray> &expected, int &next, const uchar *data, int length, const char *kind) {
+    if (!mValidate) {
+        return length;
+    }
+
+    if (next >= expected.size()) {
+        mError = QStringLiteral("unexpected %1 report, the capture has %2").arg(QLatin1String(kind)).arg(expected.size());
+        return -1;
+    }
+
+    if (QByteArray(reinterpret_cast<const char*>(data), length) != expected.at(next)) {
+        mError = QStringLiteral("%1 report %2 does not match the capture, expected %3")
+                .arg(QLatin1String(kind)).arg(next).arg(QString::fromLatin1(expected.at(next).toHex()));
+        return -1;
+    }
+
+    next++;
+    return length;
+}
+
+int QHidReplayDevice::write(const uchar *data, int length) {
+    int res = compare(mOutputs, mNextOutput, data, length, "output");
+
+    if (res < 0) {
+        mStats.write_errors++;
+    } else {
+        mStats.reports_written++;
+        mStats.bytes_written += quint64(length);
+    }
+
+    return res;
+}
+
+int QHidReplayDevice::sendFeatureReport(const uchar *data, int length) {
+    return compare(mFeatureSets, mNextFeatureSet, data, length, "feature");
+}
+
+/*
+ * Returns the recorded Feature reports with the report id in data[0] in turn, the last
+ * one again once they run out.
+ */
+int QHidReplayDevice::featureReport(uchar *data, int length) {
+    QHash<int, QVector<QByteArray> >::const_iterator it = mFeatureGets.constFind(data[0]);
+    if (it == mFeatureGets.constEnd()) {
+        mError = QStringLiteral("feature report %1 is not in the capture").arg(int(data[0]));
+        return -1;
+    }
+
+    int &next = mNextFeatureGet[data[0]];
+    const QByteArray &report = it->at(qMin(next, it->size() - 1));
+    next++;
+
+    int size = qMin(length, report.size());
+    memcpy(data, report.constData(), size);
+
+    return size;
+}
+
+QByteArray QHidReplayDevice::reportDescriptor() const {
+    return mDescriptor;
+}
+
+/*
+ * The path of the device when it was recorded.
+ */
+QString QHidReplayDevice::devicePath() const {
+    return mDevicePath;
+}
+
+QString QHidReplayDevice::error() const {
+    return mError;
+}
+
+void QHidReplayDevice::stats(hid_device_stats *stats) const {
+    *stats = mStats;
+}
+
+void QHidReplayDevice::resetStats() {
+    memset(&mStats, 0, sizeof(mStats));
+}
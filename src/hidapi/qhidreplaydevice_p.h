@@ -0,0 +1,103 @@
+#ifndef QHIDREPLAYDEVICE_P_H
+#define QHIDREPLAYDEVICE_P_H
+/*
+Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+#include "hidapi.h"
+#include "qhidreportbatch.h"
+
+/*
+ * A device which plays back the Input reports of one device in a capture written by
+ * hid_capture_open(), opened with a path of the form
+ *
+ *   replay://<capture path>[?speed=<factor>][&device=<tag>][&writes=validate][&loop=1]
+ *
+ * The capture path is the one given to hid_capture_open(), without the segment suffix.
+ * Reports become readable at their recorded offset from the first one, divided by speed,
+ * counted from when the device was opened. speed=0 makes every report readable at once.
+ * device selects the tag of the recorded device, by default the first one. Writes and
+ * feature reports sent are accepted unchecked, or with writes=validate compared with the
+ * ones recorded, in order. loop=1 starts again from the first report after the last.
+ *
+ * Like a hid_device, an instance is used by one thread at a time.
+ */
+class QHidReplayDevice {
+public:
+    static bool isReplayPath(const QString &path);
+    static QHidReplayDevice *open(const QString &path);
+
+    int read(uchar *data, int length, int timeout, qint64 *timestamp=NULL);
+    QByteArray read(int timeout, qint64 *timestamp=NULL);
+    bool hasReport() const;
+    qint64 nsecsToReport() const;
+    QHidReportBatch drain(int maxReports);
+    bool isBlocking() const;
+    void setBlocking(bool blocking);
+    int write(const uchar *data, int length);
+    int featureReport(uchar *data, int length);
+    int sendFeatureReport(const uchar *data, int length);
+    QByteArray reportDescriptor() const;
+    QString devicePath() const;
+    QString error() const;
+    void stats(hid_device_stats *stats) const;
+    void resetStats();
+
+private:
+    QHidReplayDevice();
+
+    bool load(const QString &fileName, int tag);
+    qint64 due(qint64 index) const;
+    bool takeReport(QByteArray &report, qint64 &timestamp);
+    bool atEnd() const;
+    int compare(const QVector<QByteArray> &expected, int &next, const uchar *data, int length, const char *kind);
+
+    double mSpeed;
+    bool mValidate;
+    bool mLoop;
+    bool mBlocking;
+
+    QByteArray mDescriptor;
+    QString mDevicePath;
+    /*
+     * the recorded Input reports, and their offset in ns from the first one.
+     */
+    QVector<QByteArray> mInputs;
+    QVector<qint64> mOffsets;
+    /*
+     * the recorded Output and Feature reports, compared in order when validating.
+     */
+    QVector<QByteArray> mOutputs;
+    QVector<QByteArray> mFeatureSets;
+    /*
+     * the reports returned by hid_get_feature_report(), by report id.
+     */
+    QHash<int, QVector<QByteArray> > mFeatureGets;
+    QHash<int, int> mNextFeatureGet;
+
+    /*
+     * the next Input report to return, counted over every pass of a loop.
+     */
+    qint64 mNext;
+    int mNextOutput;
+    int mNextFeatureSet;
+    QElapsedTimer mTimer;
+    /*
+     * CLOCK_MONOTONIC in ns when mTimer was started, the base of the timestamps.
+     */
+    qint64 mStart;
+    QString mError;
+    hid_device_stats mStats;
+};
+
+#endif // QHIDREPLAYDEVICE_P_H
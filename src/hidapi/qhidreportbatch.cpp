@@ -0,0 +1,95 @@
+#include "qhidreportbatch.h"
+/*
+Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/*!
+ * \class QHidReportBatch
+ * \brief \c QHidReportBatch holds the Input reports returned by a single QHidApi::drain() or QHidDevice::drain().
+ *
+ * The reports are stored back to back in one buffer, in the order they were received, so a consumer
+ * which has fallen behind can catch up without one allocation per report.
+ *
+ * \code
+ *     QHidReportBatch batch = api->drain(id);
+ *     for (int i = 0; i < batch.count(); i++) {
+ *         handleReport(batch.reportData(i), batch.reportSize(i));
+ *     }
+ * \endcode
+ */
+
+/*!
+ * \brief Constructs an empty batch.
+ */
+QHidReportBatch::QHidReportBatch() :
+    mOffsets(1, 0) {
+}
+
+/*!
+ * \brief Returns the number of reports in the batch.
+ */
+int QHidReportBatch::count() const {
+    return mOffsets.size() - 1;
+}
+
+/*!
+ * \brief Returns true if the batch holds no reports.
+ */
+bool QHidReportBatch::isEmpty() const {
+    return count() == 0;
+}
+
+/*!
+ * \brief Returns a copy of the report at index.
+ */
+QByteArray QHidReportBatch::report(int index) const {
+    return mData.mid(mOffsets.at(index), reportSize(index));
+}
+
+/*!
+ * \brief Returns a pointer to the report at index, which stays valid as long as the batch.
+ */
+const uchar *QHidReportBatch::reportData(int index) const {
+    return reinterpret_cast<const uchar*>(mData.constData()) + mOffsets.at(index);
+}
+
+/*!
+ * \brief Returns the length in bytes of the report at index.
+ */
+int QHidReportBatch::reportSize(int index) const {
+    return mOffsets.at(index + 1) - mOffsets.at(index);
+}
+
+/*!
+ * \brief Returns the time at which the report at index arrived.
+ *
+ * The time is in nanoseconds of the monotonic clock, the clock used by QElapsedTimer on Linux. See
+ * QHidDevice::lastReportTimestamp() for how close it is to the arrival of the report.
+ */
+qint64 QHidReportBatch::timestamp(int index) const {
+    return mTimestamps.at(index);
+}
+
+/*!
+ * \brief Returns the reports, back to back.
+ */
+QByteArray QHidReportBatch::data() const {
+    return mData;
+}
+
+/*!
+ * \brief Returns the offsets of the reports in data(), followed by the size of data().
+ */
+QVector<int> QHidReportBatch::offsets() const {
+    return mOffsets;
+}
+
+void QHidReportBatch::append(const QByteArray &report, qint64 timestamp) {
+    mData.append(report);
+    mOffsets.append(mData.size());
+    mTimestamps.append(timestamp);
+}
@@ -0,0 +1,49 @@
+#ifndef QHIDREPORTBATCH_H
+#define QHIDREPORTBATCH_H
+/*
+Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include <QByteArray>
+#include <QVector>
+
+#include "qhidapi_global.h"
+
+class QHIDAPISHARED_EXPORT QHidReportBatch {
+public:
+    QHidReportBatch();
+
+    int count() const;
+    bool isEmpty() const;
+
+    QByteArray report(int index) const;
+    const uchar *reportData(int index) const;
+    int reportSize(int index) const;
+    qint64 timestamp(int index) const;
+
+    QByteArray data() const;
+    QVector<int> offsets() const;
+
+private:
+    void append(const QByteArray &report, qint64 timestamp);
+
+    QByteArray mData;
+    /*
+     * report i occupies mData[mOffsets[i], mOffsets[i + 1]), so there is one more offset than reports.
+     */
+    QVector<int> mOffsets;
+    /*
+     * arrival time of each report, see timestamp().
+     */
+    QVector<qint64> mTimestamps;
+
+    friend class QHidDevicePrivate;
+    friend class QHidSharedDevice;
+    friend class QHidReplayDevice;
+};
+
+#endif // QHIDREPORTBATCH_H
@@ -0,0 +1,313 @@
+#include "qhidreportdescriptor.h"
+
+#include <QVector>
+/*
+Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/*!
+ * \class QHidReportDescriptor
+ * \brief \c QHidReportDescriptor holds a HID report descriptor and the report layout parsed out of it.
+ *
+ * Only the items needed to work out the layout of each report are interpreted, that is the Usage Page,
+ * Logical Minimum, Logical Maximum, Report Size, Report Count and Report ID global items, Push and Pop,
+ * the Usage and Usage Minimum local items, and the Input, Output and Feature main items.
+ * See the HID specification, version 1.11, section 6.2.2.
+ */
+
+/*
+ * Short item tags, with the size bits masked off.
+ */
+static const uchar TAG_INPUT = 0x80;
+static const uchar TAG_OUTPUT = 0x90;
+static const uchar TAG_FEATURE = 0xB0;
+static const uchar TAG_COLLECTION = 0xA0;
+static const uchar TAG_END_COLLECTION = 0xC0;
+static const uchar TAG_USAGE_PAGE = 0x04;
+static const uchar TAG_LOGICAL_MINIMUM = 0x14;
+static const uchar TAG_LOGICAL_MAXIMUM = 0x24;
+static const uchar TAG_USAGE = 0x08;
+static const uchar TAG_USAGE_MINIMUM = 0x18;
+static const uchar TAG_REPORT_SIZE = 0x74;
+static const uchar TAG_REPORT_ID = 0x84;
+static const uchar TAG_REPORT_COUNT = 0x94;
+static const uchar TAG_PUSH = 0xA4;
+static const uchar TAG_POP = 0xB4;
+static const uchar TAG_LONG_ITEM = 0xFE;
+
+/*!
+ * \brief Constructs an empty, invalid report descriptor.
+ */
+QHidReportDescriptor::QHidReportDescriptor() :
+    mNumberedReports(false) {
+}
+
+/*!
+ * \brief Constructs a report descriptor from the raw descriptor bytes and parses it.
+ *
+ * \param descriptor the raw report descriptor, as returned by hid_get_report_descriptor().
+ */
+QHidReportDescriptor::QHidReportDescriptor(const QByteArray &descriptor) :
+    mData(descriptor),
+    mNumberedReports(false) {
+    parse();
+}
+
+/*!
+ * \brief Returns true if the descriptor is not empty.
+ */
+bool QHidReportDescriptor::isValid() const {
+    return !mData.isEmpty();
+}
+
+/*!
+ * \brief Returns the raw report descriptor bytes.
+ */
+QByteArray QHidReportDescriptor::data() const {
+    return mData;
+}
+
+/*!
+ * \brief Returns true if the device prefixes its reports with a report id.
+ */
+bool QHidReportDescriptor::usesNumberedReports() const {
+    return mNumberedReports;
+}
+
+/*!
+ * \brief Returns the report ids declared for the given report type.
+ *
+ * Devices which do not use numbered reports have a single report with an id of 0.
+ */
+QList<quint8> QHidReportDescriptor::reportIds(ReportType type) const {
+    return mReportBits[type].keys();
+}
+
+/*!
+ * \brief Returns the length in bytes of a report, excluding the report id byte.
+ *
+ * \param type the report type.
+ * \param reportId the report id, or 0 for devices which do not use numbered reports.
+ * \return the report length, or 0 if the report is not declared.
+ */
+int QHidReportDescriptor::reportSize(ReportType type, quint8 reportId) const {
+    return (mReportBits[type].value(reportId, 0) + 7) / 8;
+}
+
+/*!
+ * \brief Returns the length in bytes of the longest report of the given type, excluding the report id byte.
+ */
+int QHidReportDescriptor::maxReportSize(ReportType type) const {
+    int size = 0;
+
+    QMapIterator<quint8, int> it(mReportBits[type]);
+    while (it.hasNext()) {
+        it.next();
+        size = qMax(size, (it.value() + 7) / 8);
+    }
+
+    return size;
+}
+
+/*!
+ * \brief Returns the fields of a report, in the order they appear in it.
+ *
+ * Each field is one Input, Output or Feature main item. usage is the first Usage or the Usage
+ * Minimum declared for it, with element i of a variable field having the usage after that. bitOffset
+ * counts from the start of the report, excluding the report id byte, and flags holds the data of
+ * the main item, bit 0 set for constant padding and bit 1 for variable rather than array fields.
+ *
+ * \param type the report type.
+ * \param reportId the report id, or 0 for devices which do not use numbered reports.
+ */
+QList<QHidReportDescriptor::Field> QHidReportDescriptor::fields(ReportType type, quint8 reportId) const {
+    return mFields[type].value(reportId);
+}
+
+/*!
+ * \brief Returns a byte mask with the bits of some fields of a report set, for QHidApi::setChangeFilter().
+ *
+ * The mask is laid out like the report as read, with a clear report id byte first for devices which
+ * use numbered reports, so passing the fields that matter makes changes to any other field go
+ * unnoticed.
+ *
+ * \param type the report type.
+ * \param reportId the report id, or 0 for devices which do not use numbered reports.
+ * \param fields fields of the report, as returned by fields().
+ */
+QByteArray QHidReportDescriptor::fieldMask(ReportType type, quint8 reportId, const QList<Field> &fields) const {
+    int first = (mNumberedReports ? 8 : 0);
+    QByteArray mask(first / 8 + reportSize(type, reportId), '\0');
+
+    foreach (const Field &field, fields) {
+        int start = first + field.bitOffset;
+        int end = qMin(start + field.bitSize * field.count, mask.size() * 8);
+        for (int bit = start; bit < end; bit++) {
+            mask[bit / 8] = char(uchar(mask.at(bit / 8)) | (1 << (bit % 8)));
+        }
+    }
+
+    return mask;
+}
+
+/*!
+ * \brief Returns the value of element index of a field in a report.
+ *
+ * The value is sign extended if the field has a negative logical minimum. Elements which lie past
+ * the end of the report read as 0, and only the low 56 bits of longer elements are returned.
+ *
+ * \param field a field returned by fields().
+ * \param index the element, from 0 to field.count - 1.
+ * \param data the report, excluding the report id byte.
+ * \param length the length of data.
+ */
+qint64 QHidReportDescriptor::fieldValue(const Field &field, int index, const uchar *data, int length) {
+    int bits = qMin(field.bitSize, 56);
+    int start = field.bitOffset + index * field.bitSize;
+    if (bits <= 0 || index < 0 || index >= field.count || (start + bits + 7) / 8 > length) {
+        return 0;
+    }
+
+    // at most 8 bytes hold 56 bits starting anywhere in a byte.
+    quint64 raw = 0;
+    int first = start / 8;
+    int last = (start + bits - 1) / 8;
+    for (int i = last; i >= first; i--) {
+        raw = (raw << 8) | data[i];
+    }
+    raw = (raw >> (start % 8)) & ((quint64(1) << bits) - 1);
+
+    if (field.logicalMinimum < 0 && (raw >> (bits - 1)) != 0) {
+        return qint64(raw) - (qint64(1) << bits);
+    }
+
+    return qint64(raw);
+}
+
+void QHidReportDescriptor::parse() {
+    struct GlobalState {
+        quint32 reportSize;
+        quint32 reportCount;
+        quint8 reportId;
+        quint16 usagePage;
+        qint32 logicalMinimum;
+        qint32 logicalMaximum;
+    };
+
+    const uchar *data = reinterpret_cast<const uchar*>(mData.constData());
+    const int size = mData.size();
+
+    GlobalState state = { 0, 0, 0, 0, 0, 0 };
+    QVector<GlobalState> stack;
+    // the first usage of the next main item, with its page if it was given in full.
+    quint32 usage = 0;
+    bool hasUsage = false;
+    int i = 0;
+
+    while (i < size) {
+        uchar key = data[i];
+
+        if (key == TAG_LONG_ITEM) {
+            // Long items carry no report layout, skip the header and the data.
+            int dataLength = (i + 1 < size) ? data[i + 1] : 0;
+            i += 3 + dataLength;
+            continue;
+        }
+
+        int dataLength = key & 0x3;
+        if (dataLength == 3) {
+            dataLength = 4;
+        }
+
+        if (i + dataLength >= size) {
+            // Truncated item, stop here.
+            break;
+        }
+
+        quint32 value = 0;
+        for (int b = 0; b < dataLength; b++) {
+            value |= quint32(data[i + 1 + b]) << (8 * b);
+        }
+        // the logical limits are signed, in as many bytes as the item has.
+        qint32 signedValue = qint32(value);
+        if (dataLength > 0 && dataLength < 4 && (value >> (8 * dataLength - 1)) != 0) {
+            signedValue = qint32(value | (0xFFFFFFFFu << (8 * dataLength)));
+        }
+
+        int mainType = -1;
+
+        switch (key & 0xFC) {
+        case TAG_REPORT_SIZE:
+            state.reportSize = value;
+            break;
+        case TAG_REPORT_COUNT:
+            state.reportCount = value;
+            break;
+        case TAG_REPORT_ID:
+            state.reportId = quint8(value);
+            mNumberedReports = true;
+            break;
+        case TAG_PUSH:
+            stack.append(state);
+            break;
+        case TAG_POP:
+            if (!stack.isEmpty()) {
+                state = stack.takeLast();
+            }
+            break;
+        case TAG_USAGE_PAGE:
+            state.usagePage = quint16(value);
+            break;
+        case TAG_LOGICAL_MINIMUM:
+            state.logicalMinimum = signedValue;
+            break;
+        case TAG_LOGICAL_MAXIMUM:
+            state.logicalMaximum = signedValue;
+            break;
+        case TAG_USAGE:
+        case TAG_USAGE_MINIMUM:
+            if (!hasUsage) {
+                usage = (dataLength == 4 ? value : (quint32(state.usagePage) << 16) | (value & 0xFFFF));
+                hasUsage = true;
+            }
+            break;
+        case TAG_INPUT:
+            mainType = Input;
+            break;
+        case TAG_OUTPUT:
+            mainType = Output;
+            break;
+        case TAG_FEATURE:
+            mainType = Feature;
+            break;
+        case TAG_COLLECTION:
+        case TAG_END_COLLECTION:
+            hasUsage = false;
+            break;
+        default:
+            break;
+        }
+
+        if (mainType >= 0) {
+            Field field;
+            field.usagePage = quint16(hasUsage ? usage >> 16 : state.usagePage);
+            field.usage = quint16(hasUsage ? usage & 0xFFFF : 0);
+            field.bitOffset = mReportBits[mainType].value(state.reportId, 0);
+            field.bitSize = int(state.reportSize);
+            field.count = int(state.reportCount);
+            field.logicalMinimum = state.logicalMinimum;
+            field.logicalMaximum = state.logicalMaximum;
+            field.flags = value;
+            mFields[mainType][state.reportId].append(field);
+
+            mReportBits[mainType][state.reportId] += state.reportSize * state.reportCount;
+            hasUsage = false;
+        }
+
+        i += 1 + dataLength;
+    }
+}
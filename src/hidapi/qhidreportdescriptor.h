@@ -0,0 +1,71 @@
+#ifndef QHIDREPORTDESCRIPTOR_H
+#define QHIDREPORTDESCRIPTOR_H
+/*
+Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include <QByteArray>
+#include <QList>
+#include <QMap>
+
+#include "qhidapi_global.h"
+
+class QHIDAPISHARED_EXPORT QHidReportDescriptor {
+public:
+    enum ReportType {
+        Input,
+        Output,
+        Feature
+    };
+
+    QHidReportDescriptor();
+    explicit QHidReportDescriptor(const QByteArray &descriptor);
+
+    bool isValid() const;
+    QByteArray data() const;
+    bool usesNumberedReports() const;
+
+    QList<quint8> reportIds(ReportType type) const;
+    int reportSize(ReportType type, quint8 reportId) const;
+    int maxReportSize(ReportType type) const;
+
+    /*
+     * one Input, Output or Feature main item of a report, count elements of bitSize bits each.
+     */
+    struct Field {
+        quint16 usagePage;
+        quint16 usage;
+        int bitOffset;
+        int bitSize;
+        int count;
+        qint32 logicalMinimum;
+        qint32 logicalMaximum;
+        quint32 flags;
+    };
+
+    QList<Field> fields(ReportType type, quint8 reportId) const;
+    QByteArray fieldMask(ReportType type, quint8 reportId, const QList<Field> &fields) const;
+    static qint64 fieldValue(const Field &field, int index, const uchar *data, int length);
+
+    static const int ReportTypeCount = 3;
+
+private:
+    void parse();
+
+    QByteArray mData;
+    bool mNumberedReports;
+    /*
+     * map of report id -> report length in bits, per ReportType.
+     */
+    QMap<quint8, int> mReportBits[ReportTypeCount];
+    /*
+     * map of report id -> the fields of the report in order, per ReportType.
+     */
+    QMap<quint8, QList<Field> > mFields[ReportTypeCount];
+};
+
+#endif // QHIDREPORTDESCRIPTOR_H
@@ -0,0 +1,256 @@
+#include "qhidscanner_p.h"
+#include "qhidapi_p.h"
+#include "qhiddevice_p.h"
+/*
+Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/*
+ * Upper bound on the number of devices worked on at once.
+ */
+static const int DEFAULT_MAX_THREADS = 8;
+
+QHidScanTask::QHidScanTask(Operation operation, const QHidDeviceInfo &info, hid_context *context, int deadline) :
+    mOperation(operation),
+    mInfo(info),
+    mContext(context),
+    mDevice(nullptr),
+    mDeadline(deadline),
+    mState(Pending),
+    mStartedAt(-1) {
+    setAutoDelete(false);
+    mClock.start();
+}
+
+QHidScanTask::~QHidScanTask() {
+    if (mDevice != nullptr) {
+        hid_close(mDevice);
+    }
+}
+
+/*
+ * Runs on a pool thread. The result is only stored if the task has not been
+ * abandoned in the meantime, as the scanner may already have reported it.
+ */
+void QHidScanTask::run() {
+    mStartedAt.storeRelease(int(mClock.elapsed()));
+
+    if (mState.testAndSetOrdered(Pending, Running)) {
+        QHidDeviceInfo info = mInfo;
+        hid_device *device = nullptr;
+
+        if (mOperation == FetchStrings) {
+            QHidApiPrivate::readStrings(info, mContext);
+        } else {
+            device = hid_open_path_context(mContext, info.path.toLocal8Bit().constData());
+            if (device != nullptr) {
+                hid_device_info *devInfo = hid_get_device_info(device);
+                if (devInfo != nullptr) {
+                    info = QHidDevicePrivate::fromHidDeviceInfo(devInfo);
+                }
+            }
+        }
+
+        if (mState.testAndSetOrdered(Running, Done)) {
+            mInfo = info;
+            mDevice = device;
+        } else if (device != nullptr) {
+            // too late, the scanner has given up on this device.
+            hid_close(device);
+        }
+    }
+
+    emit finished(this);
+}
+
+QHidScanTask::Operation QHidScanTask::operation() const {
+    return mOperation;
+}
+
+QHidScanTask::State QHidScanTask::state() const {
+    return State(mState.loadAcquire());
+}
+
+QHidDeviceInfo QHidScanTask::info() const {
+    return mInfo;
+}
+
+/*
+ * Hands the opened device over to the caller.
+ */
+hid_device *QHidScanTask::takeDevice() {
+    hid_device *device = mDevice;
+    mDevice = nullptr;
+    return device;
+}
+
+/*
+ * Returns true if the task has been running for longer than its deadline, or has been
+ * waiting for a thread for longer than that, as the pool threads may all be stuck in
+ * devices which do not answer.
+ */
+bool QHidScanTask::hasExpired() const {
+    State state = State(mState.loadAcquire());
+    if (state == Pending) {
+        // mClock was started when the task was submitted.
+        return mClock.elapsed() > mDeadline;
+    }
+    if (state != Running) {
+        return false;
+    }
+    int startedAt = mStartedAt.loadAcquire();
+    return startedAt >= 0 && mClock.elapsed() - startedAt > mDeadline;
+}
+
+/*
+ * Marks a pending or running task as abandoned, returns false if it has already completed.
+ */
+bool QHidScanTask::abandon() {
+    return mState.testAndSetOrdered(Pending, Abandoned) ||
+           mState.testAndSetOrdered(Running, Abandoned);
+}
+
+QHidScanner::QHidScanner(QHidApiPrivate *d, QObject *parent) :
+    QObject(parent),
+    d(d),
+    mPendingEnumerate(0),
+    mPendingOpen(0) {
+    qRegisterMetaType<QHidDeviceInfo>("QHidDeviceInfo");
+
+    mPool.setMaxThreadCount(DEFAULT_MAX_THREADS);
+    connect(&mDeadlineTimer, SIGNAL(timeout()), this, SLOT(checkDeadlines()));
+}
+
+QHidScanner::~QHidScanner() {
+    mDeadlineTimer.stop();
+    // wait for the wedged devices, the pool threads can't be interrupted.
+    mPool.waitForDone();
+    qDeleteAll(mAllTasks);
+}
+
+/*
+ * Enumerates without opening any device, then reads the strings of each
+ * device on the pool. deviceFound() is emitted for each device as its
+ * strings arrive, or without strings if its deadline passes first.
+ */
+void QHidScanner::enumerate(ushort vendorId, ushort productId, int deadline) {
+    QList<QHidDeviceInfo> devices = d->enumerate(vendorId, productId, QHidApi::QuickEnumeration);
+
+    mPendingEnumerate += devices.size();
+    if (devices.isEmpty() && mPendingEnumerate == 0) {
+        emit enumerationFinished();
+        return;
+    }
+
+    submit(QHidScanTask::FetchStrings, devices, deadline);
+}
+
+/*
+ * Opens every matching device on the pool. Devices which are already open
+ * are reported straight away with their existing id.
+ */
+void QHidScanner::openAll(ushort vendorId, ushort productId, int deadline) {
+    QList<QHidDeviceInfo> devices = d->enumerate(vendorId, productId, QHidApi::QuickEnumeration);
+    QList<QHidDeviceInfo> closed;
+
+    foreach (QHidDeviceInfo info, devices) {
+        if (d->mPathMap.contains(info.path)) {
+            emit deviceOpened(d->mPathMap.value(info.path), info);
+        } else {
+            closed.append(info);
+        }
+    }
+
+    mPendingOpen += closed.size();
+    if (closed.isEmpty() && mPendingOpen == 0) {
+        emit openAllFinished();
+        return;
+    }
+
+    submit(QHidScanTask::Open, closed, deadline);
+}
+
+int QHidScanner::maxThreadCount() const {
+    return mPool.maxThreadCount();
+}
+
+void QHidScanner::setMaxThreadCount(int count) {
+    mPool.setMaxThreadCount(qMax(1, count));
+}
+
+void QHidScanner::submit(QHidScanTask::Operation operation, const QList<QHidDeviceInfo> &devices, int deadline) {
+    foreach (QHidDeviceInfo info, devices) {
+        QHidScanTask *task = new QHidScanTask(operation, info, d->mContext, deadline);
+        // queued, as finished() is emitted from the pool thread.
+        connect(task, SIGNAL(finished(QHidScanTask*)), this, SLOT(taskFinished(QHidScanTask*)), Qt::QueuedConnection);
+        mActiveTasks.append(task);
+        mAllTasks.append(task);
+        mPool.start(task);
+    }
+
+    // check a few times per deadline, but not too often.
+    int interval = qBound(10, deadline / 4, 100);
+    if (!mDeadlineTimer.isActive() || mDeadlineTimer.interval() > interval) {
+        mDeadlineTimer.start(interval);
+    }
+}
+
+void QHidScanner::taskFinished(QHidScanTask *task) {
+    mAllTasks.removeOne(task);
+
+    if (mActiveTasks.removeOne(task)) {
+        report(task, task->state() != QHidScanTask::Done);
+    }
+
+    task->deleteLater();
+}
+
+void QHidScanner::checkDeadlines() {
+    foreach (QHidScanTask *task, mActiveTasks) {
+        if (task->hasExpired() && task->abandon()) {
+            mActiveTasks.removeOne(task);
+            report(task, true);
+        }
+    }
+
+    if (mActiveTasks.isEmpty()) {
+        mDeadlineTimer.stop();
+    }
+}
+
+void QHidScanner::report(QHidScanTask *task, bool timedOut) {
+    QHidDeviceInfo info = task->info();
+
+    if (task->operation() == QHidScanTask::FetchStrings) {
+        if (!timedOut) {
+            d->updateDeviceInfo(info);
+        }
+        emit deviceFound(info);
+    } else {
+        hid_device *device = (timedOut ? nullptr : task->takeDevice());
+        if (device != nullptr) {
+            quint32 id = d->registerDevice(info.path, device);
+            emit deviceOpened(id, info);
+        } else {
+            emit deviceOpenFailed(info);
+        }
+    }
+
+    decrementPending(task->operation());
+}
+
+void QHidScanner::decrementPending(QHidScanTask::Operation operation) {
+    if (operation == QHidScanTask::FetchStrings) {
+        if (--mPendingEnumerate == 0) {
+            emit enumerationFinished();
+        }
+    } else {
+        if (--mPendingOpen == 0) {
+            emit openAllFinished();
+        }
+    }
+}
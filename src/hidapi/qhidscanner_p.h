@@ -0,0 +1,119 @@
+#ifndef QHIDSCANNER_P_H
+#define QHIDSCANNER_P_H
+/*
+Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include <QObject>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QAtomicInt>
+#include <QList>
+
+#include "qhiddeviceinfo.h"
+#include "hidapi.h"
+
+class QHidApiPrivate;
+
+/*
+ * A single piece of per-device work run on the scanner's thread pool.
+ */
+class QHidScanTask : public QObject, public QRunnable {
+    Q_OBJECT
+public:
+    enum Operation {
+        FetchStrings,
+        Open
+    };
+
+    enum State {
+        Pending,
+        Running,
+        Done,
+        Abandoned
+    };
+
+    QHidScanTask(Operation operation, const QHidDeviceInfo &info, hid_context *context, int deadline);
+    ~QHidScanTask();
+
+    void run();
+
+    Operation operation() const;
+    State state() const;
+    QHidDeviceInfo info() const;
+    hid_device *takeDevice();
+
+    bool hasExpired() const;
+    bool abandon();
+
+signals:
+    void finished(QHidScanTask *task);
+
+private:
+    Operation mOperation;
+    QHidDeviceInfo mInfo;
+    hid_context *mContext;
+    hid_device *mDevice;
+    int mDeadline;
+    QAtomicInt mState;
+    /*
+     * time in ms, measured by mClock, at which run() started, or -1.
+     */
+    QAtomicInt mStartedAt;
+    QElapsedTimer mClock;
+};
+
+/*
+ * Fans enumeration and open work for each device out over a bounded thread pool,
+ * reporting each device as it completes or when its deadline passes.
+ */
+class QHidScanner : public QObject {
+    Q_OBJECT
+public:
+    QHidScanner(QHidApiPrivate *d, QObject *parent = nullptr);
+    ~QHidScanner();
+
+    void enumerate(ushort vendorId, ushort productId, int deadline);
+    void openAll(ushort vendorId, ushort productId, int deadline);
+
+    int maxThreadCount() const;
+    void setMaxThreadCount(int count);
+
+signals:
+    void deviceFound(const QHidDeviceInfo &info);
+    void enumerationFinished();
+    void deviceOpened(quint32 id, const QHidDeviceInfo &info);
+    void deviceOpenFailed(const QHidDeviceInfo &info);
+    void openAllFinished();
+
+protected slots:
+    void taskFinished(QHidScanTask *task);
+    void checkDeadlines();
+
+protected:
+    void submit(QHidScanTask::Operation operation, const QList<QHidDeviceInfo> &devices, int deadline);
+    void report(QHidScanTask *task, bool timedOut);
+    void decrementPending(QHidScanTask::Operation operation);
+
+    QHidApiPrivate *d;
+    QThreadPool mPool;
+    QTimer mDeadlineTimer;
+    int mPendingEnumerate;
+    int mPendingOpen;
+    /*
+     * tasks which have not been reported yet.
+     */
+    QList<QHidScanTask*> mActiveTasks;
+    /*
+     * every task not yet deleted, including those abandoned but still running.
+     */
+    QList<QHidScanTask*> mAllTasks;
+};
+
+#endif // QHIDSCANNER_P_H
@@ -0,0 +1,427 @@
+#include "qhidshareddevice_p.h"
+
+#include <QMutexLocker>
+#include <QElapsedTimer>
+
+#include <string.h>
+#include <time.h>
+
+#include "hidapi_stats.h"
+#include "qhidreportdescriptor.h"
+#include "qhidtrace_p.h"
+/*
+Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/*
+ * The largest report the reader accepts, the hidraw buffer size.
+ */
+static const int MAX_REPORT_SIZE = 4096;
+
+/*
+ * How often, in milliseconds, the reader checks whether it has been asked to stop.
+ */
+static const int READER_POLL_INTERVAL = 100;
+
+/*
+ * CLOCK_MONOTONIC in nanoseconds, the clock of the report timestamps.
+ */
+static qint64 monotonicNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+struct SharedDeviceRegistry {
+    QMutex mutex;
+    QHash<QString, QHidSharedDevice*> devices;
+};
+Q_GLOBAL_STATIC(SharedDeviceRegistry, registry)
+
+QHidSharedDevice::QHidSharedDevice(const QString &path, hid_device *device) :
+    mPath(path),
+    mDevice(device),
+    mRefCount(1),
+    mStop(0),
+    mRing(RING_SIZE),
+    mTimestamps(RING_SIZE),
+    mWritten(0),
+    mFailed(false),
+    mNextSubscriber(1) {
+}
+
+QHidSharedDevice::~QHidSharedDevice() {
+    delete mStateRegister.loadAcquire();
+    hid_close(mDevice);
+    hid_exit();
+}
+
+/*
+ * Returns the shared device for path, opening it and starting its reader if no one
+ * in the process has it open yet. Each successful call must be balanced by release().
+ * returns NULL if the device can not be opened.
+ *
+ * A device whose reader has failed, usually because it was unplugged, is left to the
+ * subscribers still holding it and a fresh one is opened, as the path may have been
+ * plugged in again.
+ */
+QHidSharedDevice *QHidSharedDevice::acquire(const QString &path) {
+    QMutexLocker locker(&registry()->mutex);
+
+    QHidSharedDevice *shared = registry()->devices.value(path);
+    if (shared != NULL) {
+        QMutexLocker sharedLocker(&shared->mMutex);
+        if (!shared->mFailed) {
+            shared->mRefCount++;
+            return shared;
+        }
+        registry()->devices.remove(path);
+    }
+
+    if (hid_init() < 0) {
+        return NULL;
+    }
+
+    hid_device *device = hid_open_path(path.toLocal8Bit().constData());
+    if (device == NULL) {
+        hid_exit();
+        return NULL;
+    }
+
+    shared = new QHidSharedDevice(path, device);
+    registry()->devices.insert(path, shared);
+    shared->start();
+
+    return shared;
+}
+
+/*
+ * Drops a reference taken by acquire(). The last one stops the reader and closes the device.
+ */
+void QHidSharedDevice::release() {
+    {
+        QMutexLocker locker(&registry()->mutex);
+        if (--mRefCount > 0) {
+            return;
+        }
+        // a failed device may have been replaced by a fresh one for the same path.
+        if (registry()->devices.value(mPath) == this) {
+            registry()->devices.remove(mPath);
+        }
+    }
+
+    mStop.storeRelease(1);
+    wait();
+    delete this;
+}
+
+QString QHidSharedDevice::path() const {
+    return mPath;
+}
+
+/*
+ * The underlying device, used for feature reports. Reads must go through read() and
+ * writes through write(), which count them for the subscriber.
+ */
+hid_device *QHidSharedDevice::device() const {
+    return mDevice;
+}
+
+/*
+ * Adds a subscriber, which sees every report received from now on.
+ * returns the subscriber id to pass to read().
+ */
+int QHidSharedDevice::subscribe() {
+    QMutexLocker locker(&mMutex);
+
+    Cursor cursor;
+    cursor.next = mWritten;
+    memset(&cursor.stats, 0, sizeof(cursor.stats));
+
+    int subscriber = mNextSubscriber++;
+    mCursors.insert(subscriber, cursor);
+
+    return subscriber;
+}
+
+/*
+ * Removes a subscriber. A read() blocked on its behalf returns at once.
+ */
+void QHidSharedDevice::unsubscribe(int subscriber) {
+    QMutexLocker locker(&mMutex);
+    mCursors.remove(subscriber);
+    mReportReady.wakeAll();
+}
+
+/*
+ * Moves the next report for subscriber into report. Must be called with mMutex held.
+ * A subscriber which has fallen more than RING_SIZE reports behind skips to the
+ * oldest report still kept, the skipped ones are counted as dropped in its stats().
+ */
+bool QHidSharedDevice::takeReport(int subscriber, QByteArray &report, qint64 &timestamp) {
+    QHash<int, Cursor>::iterator it = mCursors.find(subscriber);
+    if (it == mCursors.end() || it->next == mWritten) {
+        return false;
+    }
+
+    if (mWritten - it->next > quint64(RING_SIZE)) {
+        quint64 oldest = mWritten - RING_SIZE;
+        it->stats.reports_dropped += oldest - it->next;
+        it->next = oldest;
+    }
+    // the subscriber's queue is the part of the ring it has not read yet.
+    hid_stats_max(&it->stats.queue_high_water, mWritten - it->next);
+
+    report = mRing.at(int(it->next % RING_SIZE));
+    timestamp = mTimestamps.at(int(it->next % RING_SIZE));
+    it->next++;
+
+    it->stats.reports_read++;
+    it->stats.bytes_read += quint64(report.size());
+    hid_stats_latency(it->stats.read_latency, quint64(timestamp), quint64(monotonicNs()));
+
+    return true;
+}
+
+/*
+ * Returns the next report for subscriber, waiting up to timeout milliseconds for one,
+ * or for ever if timeout is -1. Returns an empty QByteArray on timeout or error.
+ * timestamp, if given, is set to the time the reader received the report.
+ */
+QByteArray QHidSharedDevice::read(int subscriber, int timeout, qint64 *timestamp) {
+    HID_TRACE_BEGIN("mutex_wait");
+    QMutexLocker locker(&mMutex);
+    HID_TRACE_END("mutex_wait", 0);
+    QByteArray report;
+    qint64 received = 0;
+    QElapsedTimer timer;
+
+    timer.start();
+    while (!takeReport(subscriber, report, received)) {
+        QHash<int, Cursor>::iterator it = mCursors.find(subscriber);
+        if (it == mCursors.end()) {
+            return QByteArray();
+        }
+        if (mFailed) {
+            it->stats.read_errors++;
+            return QByteArray();
+        }
+
+        if (timeout < 0) {
+            mReportReady.wait(&mMutex);
+        } else {
+            qint64 remaining = timeout - timer.elapsed();
+            if (remaining <= 0) {
+                if (timeout != 0) {
+                    it->stats.read_timeouts++;
+                }
+                return QByteArray();
+            }
+            mReportReady.wait(&mMutex, ulong(remaining));
+        }
+    }
+
+    if (timestamp != NULL) {
+        *timestamp = received;
+    }
+
+    return report;
+}
+
+/*
+ * hid_read_timeout() style read. returns the number of bytes copied into data, 0 on
+ * timeout and -1 once the device has failed, for example because it was unplugged.
+ */
+int QHidSharedDevice::read(int subscriber, uchar *data, int length, int timeout, qint64 *timestamp) {
+    QByteArray report = read(subscriber, timeout, timestamp);
+
+    if (report.isEmpty()) {
+        QMutexLocker locker(&mMutex);
+        return (mFailed ? -1 : 0);
+    }
+
+    int size = qMin(length, report.size());
+    memcpy(data, report.constData(), size);
+
+    return size;
+}
+
+/*
+ * Takes every report waiting for subscriber, up to maxReports, in one go.
+ */
+QHidReportBatch QHidSharedDevice::drain(int subscriber, int maxReports) {
+    QList<QByteArray> reports;
+    QVector<qint64> timestamps;
+    QByteArray report;
+    qint64 timestamp;
+
+    {
+        QMutexLocker locker(&mMutex);
+        while (reports.size() < maxReports && takeReport(subscriber, report, timestamp)) {
+            reports.append(report);
+            timestamps.append(timestamp);
+        }
+    }
+
+    QHidReportBatch batch;
+    for (int i = 0; i < reports.size(); i++) {
+        batch.append(reports.at(i), timestamps.at(i));
+    }
+
+    return batch;
+}
+
+/*
+ * Returns true if a read() by subscriber would not wait, because a report is
+ * waiting for it or the device has failed.
+ */
+bool QHidSharedDevice::hasReport(int subscriber) const {
+    QMutexLocker locker(&mMutex);
+
+    QHash<int, Cursor>::const_iterator it = mCursors.constFind(subscriber);
+    return mFailed || (it != mCursors.constEnd() && it->next != mWritten);
+}
+
+/*
+ * hid_write() on behalf of subscriber, counted in its stats().
+ */
+int QHidSharedDevice::write(int subscriber, const uchar *data, int length) {
+    qint64 start = monotonicNs();
+    int res = hid_write(mDevice, data, size_t(length));
+    qint64 end = monotonicNs();
+
+    QMutexLocker locker(&mMutex);
+    QHash<int, Cursor>::iterator it = mCursors.find(subscriber);
+    if (it != mCursors.end()) {
+        if (res < 0) {
+            it->stats.write_errors++;
+        } else {
+            it->stats.reports_written++;
+            it->stats.bytes_written += quint64(res);
+        }
+        hid_stats_latency(it->stats.write_latency, quint64(start), quint64(end));
+    }
+
+    return res;
+}
+
+/*
+ * The counters of subscriber: the reports it was handed and missed, its timeouts, its
+ * writes, and the time from the arrival of a report to its delivery. Reports suppressed
+ * by the change filter are those of the device, as the filter is shared.
+ */
+void QHidSharedDevice::stats(int subscriber, hid_device_stats *stats) const {
+    hid_device_stats device;
+    if (hid_get_device_stats(mDevice, &device) < 0) {
+        memset(&device, 0, sizeof(device));
+    }
+
+    QMutexLocker locker(&mMutex);
+    QHash<int, Cursor>::const_iterator it = mCursors.constFind(subscriber);
+    if (it == mCursors.constEnd()) {
+        memset(stats, 0, sizeof(*stats));
+    } else {
+        *stats = it->stats;
+    }
+    stats->reports_suppressed = device.reports_suppressed;
+}
+
+/*
+ * Resets the counters of subscriber only, every other subscriber keeps its own.
+ */
+void QHidSharedDevice::resetStats(int subscriber) {
+    QMutexLocker locker(&mMutex);
+
+    QHash<int, Cursor>::iterator it = mCursors.find(subscriber);
+    if (it != mCursors.end()) {
+        memset(&it->stats, 0, sizeof(it->stats));
+    }
+}
+
+/*
+ * Returns the latest-report register of the device, starting it if needed. Reports
+ * which arrived before the first call are not in it. The register lives as long as
+ * the shared device.
+ */
+QHidStateRegister *QHidSharedDevice::stateRegister() {
+    QMutexLocker locker(&mMutex);
+
+    QHidStateRegister *state = mStateRegister.loadAcquire();
+    if (state == NULL) {
+        unsigned char descriptor[HID_API_MAX_REPORT_DESCRIPTOR_SIZE];
+        int size = hid_get_report_descriptor(mDevice, descriptor, sizeof(descriptor));
+        bool numbered = size > 0 &&
+                QHidReportDescriptor(QByteArray(reinterpret_cast<char*>(descriptor), size)).usesNumberedReports();
+
+        state = new QHidStateRegister(numbered);
+        mStateRegister.storeRelease(state);
+    }
+
+    return state;
+}
+
+/*
+ * Signals event, as well as mReportReady, whenever a report arrives or the device
+ * fails, until removeWakeEvent(). The event may be added more than once.
+ */
+void QHidSharedDevice::addWakeEvent(hid_wake_event *event) {
+    QMutexLocker locker(&mMutex);
+    mWakeEvents.append(event);
+}
+
+void QHidSharedDevice::removeWakeEvent(hid_wake_event *event) {
+    QMutexLocker locker(&mMutex);
+    mWakeEvents.removeOne(event);
+}
+
+/*
+ * Wakes everyone waiting for a report. Must be called with mMutex held.
+ */
+void QHidSharedDevice::notify() {
+    mReportReady.wakeAll();
+    foreach (hid_wake_event *event, mWakeEvents) {
+        hid_wake_event_signal(event);
+    }
+}
+
+/*
+ * The reader. It is the only caller of hid_read_timeout() on the device.
+ */
+void QHidSharedDevice::run() {
+    unsigned char buf[MAX_REPORT_SIZE];
+    unsigned long long timestamp = 0;
+
+    while (!mStop.loadAcquire()) {
+        int res = hid_read_timeout_timestamped(mDevice, buf, sizeof(buf), READER_POLL_INTERVAL, &timestamp);
+
+        if (res == 0) {
+            continue;
+        }
+
+        QHID_TRACE_SCOPE("QHidSharedDevice::publish");
+
+        // published before taking the lock, the register is read without it.
+        QHidStateRegister *state = mStateRegister.loadAcquire();
+        if (state != NULL && res > 0) {
+            state->publish(buf, res, qint64(timestamp));
+        }
+
+        HID_TRACE_BEGIN("mutex_wait");
+        QMutexLocker locker(&mMutex);
+        HID_TRACE_END("mutex_wait", 0);
+        if (res < 0) {
+            mFailed = true;
+            notify();
+            break;
+        }
+
+        mRing[int(mWritten % RING_SIZE)] = QByteArray(reinterpret_cast<char*>(buf), res);
+        mTimestamps[int(mWritten % RING_SIZE)] = qint64(timestamp);
+        mWritten++;
+        notify();
+    }
+}
@@ -0,0 +1,111 @@
+#ifndef QHIDSHAREDDEVICE_P_H
+#define QHIDSHAREDDEVICE_P_H
+/*
+Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QByteArray>
+#include <QVector>
+#include <QHash>
+#include <QList>
+#include <QString>
+
+#include "hidapi.h"
+#include "qhidreportbatch.h"
+#include "qhidstateregister_p.h"
+
+/*
+ * One hid_device shared by every user of a path in the process. A single reader
+ * thread owns the reads and copies each report into a ring, and every subscriber
+ * reads the ring through its own cursor, so no subscriber steals reports from another.
+ *
+ * Instances are only created and destroyed through acquire() and release().
+ */
+class QHidSharedDevice : public QThread {
+public:
+    static QHidSharedDevice *acquire(const QString &path);
+    void release();
+
+    QString path() const;
+    hid_device *device() const;
+
+    int subscribe();
+    void unsubscribe(int subscriber);
+    int read(int subscriber, uchar *data, int length, int timeout, qint64 *timestamp=NULL);
+    QByteArray read(int subscriber, int timeout, qint64 *timestamp=NULL);
+    bool hasReport(int subscriber) const;
+    QHidReportBatch drain(int subscriber, int maxReports);
+    int write(int subscriber, const uchar *data, int length);
+    void stats(int subscriber, hid_device_stats *stats) const;
+    void resetStats(int subscriber);
+    QHidStateRegister *stateRegister();
+    void addWakeEvent(hid_wake_event *event);
+    void removeWakeEvent(hid_wake_event *event);
+
+    /*
+     * number of reports kept for subscribers which fall behind.
+     */
+    static const int RING_SIZE = 256;
+
+protected:
+    void run();
+
+private:
+    QHidSharedDevice(const QString &path, hid_device *device);
+    ~QHidSharedDevice();
+
+    bool takeReport(int subscriber, QByteArray &report, qint64 &timestamp);
+    void notify();
+
+    /*
+     * stats holds the counters of the subscriber alone, the device's own are those of
+     * the reader thread.
+     */
+    struct Cursor {
+        quint64 next;
+        hid_device_stats stats;
+    };
+
+    QString mPath;
+    hid_device *mDevice;
+    /*
+     * references held through acquire(), guarded by the registry lock.
+     */
+    int mRefCount;
+    QAtomicInt mStop;
+    /*
+     * the latest report per report id, only kept once someone asks for it.
+     */
+    QAtomicPointer<QHidStateRegister> mStateRegister;
+
+    mutable QMutex mMutex;
+    QWaitCondition mReportReady;
+    /*
+     * report n is kept in mRing[n % RING_SIZE] until it is overwritten. QByteArray is
+     * implicitly shared, so handing a report to a subscriber does not copy it.
+     */
+    QVector<QByteArray> mRing;
+    /*
+     * arrival time of the report in the same slot of mRing.
+     */
+    QVector<qint64> mTimestamps;
+    quint64 mWritten;
+    bool mFailed;
+    QHash<int, Cursor> mCursors;
+    int mNextSubscriber;
+    /*
+     * signalled with mReportReady, for QHidApi::readReady() calls waiting in hidapi.
+     */
+    QList<hid_wake_event*> mWakeEvents;
+};
+
+#endif // QHIDSHAREDDEVICE_P_H
@@ -0,0 +1,89 @@
+#include "qhidstateregister_p.h"
+
+#include <atomic>
+#include <string.h>
+/*
+Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+QHidStateRegister::QHidStateRegister(bool numberedReports) :
+    mNumberedReports(numberedReports) {
+}
+
+QHidStateRegister::~QHidStateRegister() {
+    for (int i = 0; i < 256; i++) {
+        delete mSlots[i].loadAcquire();
+    }
+}
+
+/*
+ * Stores report as the latest for its report id. Only ever called from one thread.
+ * Devices which do not use numbered reports keep everything in the slot for id 0.
+ */
+void QHidStateRegister::publish(const uchar *report, int length, qint64 timestamp) {
+    if (length <= 0) {
+        return;
+    }
+
+    quint8 reportId = (mNumberedReports ? report[0] : 0);
+    Slot *slot = mSlots[reportId].loadAcquire();
+    if (slot == nullptr) {
+        slot = new Slot;
+        slot->sequence.store(0);
+        slot->length = 0;
+        slot->timestamp = 0;
+        mSlots[reportId].storeRelease(slot);
+    }
+
+    int size = qMin(length, int(MAX_REPORT_SIZE));
+
+    // odd while the slot is being written. The ordered increment keeps the stores
+    // below from being seen before it.
+    slot->sequence.fetchAndAddOrdered(1);
+    memcpy(slot->data, report, size);
+    slot->length = size;
+    slot->timestamp = timestamp;
+    slot->sequence.fetchAndAddRelease(1);
+}
+
+/*
+ * Copies the latest report with reportId into data, including the report id byte for
+ * numbered reports. timestamp, if given, is set to the time the report arrived, which
+ * also tells a poller whether the state has changed since its last read.
+ * returns the number of bytes copied, or 0 if no such report has arrived yet.
+ */
+int QHidStateRegister::read(quint8 reportId, uchar *data, int length, qint64 *timestamp) const {
+    const Slot *slot = mSlots[reportId].loadAcquire();
+    if (slot == nullptr) {
+        return 0;
+    }
+
+    int size = 0;
+    qint64 received = 0;
+    int before, after = 0;
+
+    do {
+        before = slot->sequence.loadAcquire();
+        if (before & 1) {
+            continue;
+        }
+
+        size = qMin(length, slot->length);
+        memcpy(data, slot->data, size);
+        received = slot->timestamp;
+
+        // the copy must complete before the sequence is checked again.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = slot->sequence.load();
+    } while ((before & 1) || before != after);
+
+    if (timestamp != nullptr) {
+        *timestamp = received;
+    }
+
+    return size;
+}
@@ -0,0 +1,57 @@
+#ifndef QHIDSTATEREGISTER_P_H
+#define QHIDSTATEREGISTER_P_H
+/*
+Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include <QAtomicInt>
+#include <QAtomicPointer>
+
+/*
+ * The latest report of each report id of a device, for consumers which only care about
+ * the current state. One writer, the reader thread of a QHidSharedDevice, publishes every
+ * report into the slot for its id and any number of readers copy a slot out without
+ * taking a lock. Each slot is a seqlock: the writer makes the sequence odd while it
+ * copies the report in, and a reader retries if it saw an odd sequence or the sequence
+ * changed under it.
+ *
+ * Only QHidSharedDevice publishes. The libusb backend has a read thread of its own, but it
+ * lives in the C library below hidapi's report queue and knows nothing of the register, so
+ * devices opened with open() are not tracked whatever the backend.
+ */
+class QHidStateRegister {
+public:
+    explicit QHidStateRegister(bool numberedReports);
+    ~QHidStateRegister();
+
+    void publish(const uchar *report, int length, qint64 timestamp);
+    int read(quint8 reportId, uchar *data, int length, qint64 *timestamp) const;
+
+    /*
+     * the longest report kept, longer ones are truncated. The hidraw buffer size.
+     */
+    static const int MAX_REPORT_SIZE = 4096;
+
+private:
+    struct Slot {
+        QAtomicInt sequence;
+        int length;
+        qint64 timestamp;
+        uchar data[MAX_REPORT_SIZE];
+    };
+
+    bool mNumberedReports;
+    /*
+     * one slot per report id, created by the writer the first time it sees the id and
+     * only freed with the register, so readers never see a slot go away.
+     */
+    QAtomicPointer<Slot> mSlots[256];
+
+    Q_DISABLE_COPY(QHidStateRegister)
+};
+
+#endif // QHIDSTATEREGISTER_P_H
@@ -0,0 +1,45 @@
+#ifndef QHIDTRACE_P_H
+#define QHIDTRACE_P_H
+/*
+Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include <QtGlobal>
+
+#include "hidapi_trace.h"
+
+#ifdef HIDAPI_TRACE
+
+/*
+ * Records a begin event when constructed and the matching end event when it goes out
+ * of scope, so every return path of a traced function is covered.
+ */
+class QHidTraceScope {
+public:
+    explicit QHidTraceScope(const char *name) :
+        mName(name) {
+        hid_trace_record(mName, 'B', 0);
+    }
+
+    ~QHidTraceScope() {
+        hid_trace_record(mName, 'E', 0);
+    }
+
+private:
+    const char *mName;
+    Q_DISABLE_COPY(QHidTraceScope)
+};
+
+#define QHID_TRACE_SCOPE(name) QHidTraceScope qhidTraceScope(name)
+
+#else
+
+#define QHID_TRACE_SCOPE(name)
+
+#endif
+
+#endif // QHIDTRACE_P_H
@@ -0,0 +1,1290 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ Virtual Version
+
+ An in-process backend with scripted devices, for testing
+ and benchmarking without hardware. The devices are set up
+ through hidapi_virtual.h.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        http://github.com/signal11/hidapi .
+********************************************************/
+
+/* C */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <wchar.h>
+
+/* Unix */
+#include <pthread.h>
+#include <time.h>
+#include <fnmatch.h>
+
+#include "hidapi.h"
+#include "hidapi_stats.h"
+#include "hidapi_trace.h"
+#include "hidapi_capture.h"
+#include "hidapi_change.h"
+#include "hidapi_virtual.h"
+
+#define DEFAULT_REPORT_SIZE 64
+#define DEFAULT_QUEUE_LIMIT 30
+
+struct input_report {
+	unsigned char *data;
+	size_t len;
+	unsigned long long timestamp; /* CLOCK_MONOTONIC, in ns */
+	struct input_report *next;
+};
+
+/* A scripted device. It is kept alive by the registry while it is
+   plugged in, by each open handle and by its generator thread. */
+struct virtual_device {
+	int id;
+	char path[32];
+	struct hid_virtual_device_config config;
+	int refs;
+	int unplugged;
+	unsigned long long delivered;
+
+	/* Copies of the strings and descriptor of config. */
+	wchar_t *serial_number;
+	wchar_t *manufacturer_string;
+	wchar_t *product_string;
+	unsigned char *report_descriptor;
+
+	unsigned char *output_report;
+	size_t output_len;
+	unsigned char *feature_reports[256];
+	size_t feature_lens[256];
+
+	/* Open handles, each with its own queue. */
+	hid_device *handles;
+
+	/* Generator thread, when config.report_rate is set. */
+	int stop_generator;
+	pthread_cond_t generator_condition;
+
+	struct virtual_device *next;
+};
+
+struct hid_device_ {
+	struct virtual_device *vdev;
+	int blocking;
+
+	struct input_report *input_reports;
+	struct input_report *last_report;
+	size_t num_queued;
+	pthread_cond_t condition;
+
+	struct hid_device_info *device_info;
+	const wchar_t *last_error;
+	struct hid_device_stats stats;
+
+	/* Set by hid_capture_attach(), only used with the mutex locked. */
+	struct hid_capture *capture;
+	int capture_tag;
+
+	/* Set by hid_set_change_filter(), only used with the mutex locked. */
+	struct hid_change_filter *changes;
+
+	hid_device *next;
+};
+
+struct hid_context_ {
+	int unused;
+};
+
+/* One lock for the whole backend, devices, handles and queues. */
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct virtual_device *devices = NULL;
+static int next_device_id = 1;
+static int init_refs = 0;
+
+/* hid_wait_any() callers sleep on this, see deliver_report(). */
+static pthread_cond_t wait_any_condition;
+static int wait_any_waiters = 0;
+static pthread_once_t wait_any_once = PTHREAD_ONCE_INIT;
+
+/* Signalled on the same condition, guarded by mutex. */
+struct hid_wake_event_ {
+	int signalled;
+};
+
+/* CLOCK_MONOTONIC in nanoseconds, the clock of the timestamps and of
+   every condition variable of this backend. */
+static unsigned long long monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct timespec ns_to_timespec(unsigned long long ns)
+{
+	struct timespec ts;
+	ts.tv_sec = (time_t) (ns / 1000000000ULL);
+	ts.tv_nsec = (long) (ns % 1000000000ULL);
+	return ts;
+}
+
+static void init_condition(pthread_cond_t *condition)
+{
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(condition, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+static void init_wait_any(void)
+{
+	init_condition(&wait_any_condition);
+}
+
+static wchar_t *dup_wcs(const wchar_t *s)
+{
+	wchar_t *copy;
+
+	if (!s)
+		return NULL;
+	copy = malloc((wcslen(s) + 1) * sizeof(wchar_t));
+	if (copy)
+		wcscpy(copy, s);
+	return copy;
+}
+
+/* Encodes s as UTF-8, for matching against the serial number pattern. */
+static char *wcs_to_utf8(const wchar_t *s)
+{
+	size_t len = wcslen(s);
+	char *out = malloc(len * 4 + 1);
+	char *p = out;
+	size_t i;
+
+	if (!out)
+		return NULL;
+
+	for (i = 0; i < len; i++) {
+		unsigned long c = (unsigned long) s[i];
+		if (c < 0x80) {
+			*p++ = (char) c;
+		}
+		else if (c < 0x800) {
+			*p++ = (char) (0xC0 | (c >> 6));
+			*p++ = (char) (0x80 | (c & 0x3F));
+		}
+		else if (c < 0x10000) {
+			*p++ = (char) (0xE0 | (c >> 12));
+			*p++ = (char) (0x80 | ((c >> 6) & 0x3F));
+			*p++ = (char) (0x80 | (c & 0x3F));
+		}
+		else {
+			*p++ = (char) (0xF0 | (c >> 18));
+			*p++ = (char) (0x80 | ((c >> 12) & 0x3F));
+			*p++ = (char) (0x80 | ((c >> 6) & 0x3F));
+			*p++ = (char) (0x80 | (c & 0x3F));
+		}
+	}
+	*p = '\0';
+
+	return out;
+}
+
+/* Must be called with mutex locked. */
+static struct virtual_device *find_device(int id)
+{
+	struct virtual_device *vdev;
+
+	for (vdev = devices; vdev; vdev = vdev->next) {
+		if (vdev->id == id)
+			return vdev;
+	}
+	return NULL;
+}
+
+/* Must be called with mutex locked. */
+static void release_device(struct virtual_device *vdev)
+{
+	int i;
+
+	if (--vdev->refs > 0)
+		return;
+
+	pthread_cond_destroy(&vdev->generator_condition);
+	free(vdev->serial_number);
+	free(vdev->manufacturer_string);
+	free(vdev->product_string);
+	free(vdev->report_descriptor);
+	free(vdev->output_report);
+	for (i = 0; i < 256; i++)
+		free(vdev->feature_reports[i]);
+	free(vdev);
+}
+
+/* Takes the device out of the registry and wakes every reader, which
+   then sees it unplugged. Must be called with mutex locked. */
+static void unplug_device(struct virtual_device *vdev)
+{
+	struct virtual_device **link;
+	hid_device *dev;
+
+	if (vdev->unplugged)
+		return;
+
+	for (link = &devices; *link; link = &(*link)->next) {
+		if (*link == vdev) {
+			*link = vdev->next;
+			break;
+		}
+	}
+
+	vdev->unplugged = 1;
+	vdev->stop_generator = 1;
+	pthread_cond_signal(&vdev->generator_condition);
+
+	for (dev = vdev->handles; dev; dev = dev->next)
+		pthread_cond_broadcast(&dev->condition);
+	if (wait_any_waiters > 0)
+		pthread_cond_broadcast(&wait_any_condition);
+
+	release_device(vdev);
+}
+
+/* Queues a copy of the report on every open handle of the device.
+   Must be called with mutex locked. */
+static void deliver_report(struct virtual_device *vdev, const unsigned char *data, size_t length, unsigned long long timestamp)
+{
+	hid_device *dev;
+
+	HID_TRACE_BEGIN("deliver_report");
+	for (dev = vdev->handles; dev; dev = dev->next) {
+		struct input_report *rpt;
+
+		if (dev->capture)
+			hid_capture_record(dev->capture, dev->capture_tag, HID_CAPTURE_INPUT, timestamp, data, length);
+
+		if (hid_change_suppress(dev->changes, data, length)) {
+			hid_stats_add(&dev->stats.reports_suppressed, 1);
+			continue;
+		}
+
+		rpt = malloc(sizeof(*rpt));
+		if (!rpt)
+			continue;
+		rpt->data = malloc(length);
+		if (!rpt->data) {
+			free(rpt);
+			continue;
+		}
+		memcpy(rpt->data, data, length);
+		rpt->len = length;
+		rpt->timestamp = timestamp;
+		rpt->next = NULL;
+
+		if (dev->last_report)
+			dev->last_report->next = rpt;
+		else
+			dev->input_reports = rpt;
+		dev->last_report = rpt;
+		dev->num_queued++;
+		hid_stats_max(&dev->stats.queue_high_water, dev->num_queued);
+
+		/* Drop the oldest report once the queue is full, as the
+		   libusb backend does. */
+		if (dev->num_queued > vdev->config.queue_limit) {
+			struct input_report *oldest = dev->input_reports;
+			dev->input_reports = oldest->next;
+			dev->num_queued--;
+			free(oldest->data);
+			free(oldest);
+			hid_stats_add(&dev->stats.reports_dropped, 1);
+		}
+
+		pthread_cond_signal(&dev->condition);
+	}
+
+	vdev->delivered++;
+	if (wait_any_waiters > 0)
+		pthread_cond_broadcast(&wait_any_condition);
+	HID_TRACE_END("deliver_report", length);
+}
+
+/* Writes report number n of the device into buf. */
+static void fill_report(const struct virtual_device *vdev, unsigned char *buf, unsigned long long n)
+{
+	size_t size = vdev->config.report_size;
+	size_t i = 0;
+	int b;
+
+	if (vdev->config.report_id)
+		buf[i++] = vdev->config.report_id;
+	for (b = 0; b < 8 && i < size; b++)
+		buf[i++] = (unsigned char) (n >> (8 * b));
+	while (i < size)
+		buf[i++] = (unsigned char) n;
+}
+
+/* Delivers report n at start + n / rate + latency. A generator which
+   falls behind catches up in a burst, so the number of reports only
+   depends on the time elapsed. */
+static void *generator_thread(void *param)
+{
+	struct virtual_device *vdev = param;
+	unsigned long long interval = 1000000000ULL / vdev->config.report_rate;
+	unsigned long long latency = vdev->config.latency_us * 1000ULL;
+	unsigned long long start = monotonic_ns();
+	unsigned long long n = 0;
+	unsigned char *buf = malloc(vdev->config.report_size);
+
+	pthread_mutex_lock(&mutex);
+	while (buf && !vdev->stop_generator) {
+		unsigned long long due = start + n * interval + latency;
+
+		if (monotonic_ns() < due) {
+			struct timespec ts = ns_to_timespec(due);
+			pthread_cond_timedwait(&vdev->generator_condition, &mutex, &ts);
+			continue;
+		}
+
+		fill_report(vdev, buf, n);
+		deliver_report(vdev, buf, vdev->config.report_size, monotonic_ns());
+		n++;
+
+		if (vdev->config.disconnect_after && n >= vdev->config.disconnect_after)
+			unplug_device(vdev);
+	}
+	release_device(vdev);
+	pthread_mutex_unlock(&mutex);
+
+	free(buf);
+	return NULL;
+}
+
+int HID_API_EXPORT hid_virtual_add_device(const struct hid_virtual_device_config *config)
+{
+	struct virtual_device *vdev;
+	struct virtual_device **link;
+	pthread_t thread;
+	int id;
+
+	if (!config)
+		return -1;
+
+	pthread_once(&wait_any_once, init_wait_any);
+
+	vdev = calloc(1, sizeof(*vdev));
+	if (!vdev)
+		return -1;
+
+	vdev->config = *config;
+	if (vdev->config.report_size == 0)
+		vdev->config.report_size = DEFAULT_REPORT_SIZE;
+	if (vdev->config.queue_limit == 0)
+		vdev->config.queue_limit = DEFAULT_QUEUE_LIMIT;
+	if (vdev->config.bus_type == HID_BUS_ANY)
+		vdev->config.bus_type = HID_BUS_USB;
+
+	vdev->serial_number = dup_wcs(config->serial_number);
+	vdev->manufacturer_string = dup_wcs(config->manufacturer_string);
+	vdev->product_string = dup_wcs(config->product_string);
+	if (config->report_descriptor && config->report_descriptor_size > 0) {
+		vdev->report_descriptor = malloc(config->report_descriptor_size);
+		if (vdev->report_descriptor)
+			memcpy(vdev->report_descriptor, config->report_descriptor, config->report_descriptor_size);
+		else
+			vdev->config.report_descriptor_size = 0;
+	}
+	else {
+		vdev->config.report_descriptor_size = 0;
+	}
+	/* Only the copies are used from here on. */
+	vdev->config.serial_number = NULL;
+	vdev->config.manufacturer_string = NULL;
+	vdev->config.product_string = NULL;
+	vdev->config.report_descriptor = NULL;
+
+	init_condition(&vdev->generator_condition);
+	vdev->refs = 1;
+
+	pthread_mutex_lock(&mutex);
+	id = next_device_id++;
+	vdev->id = id;
+	snprintf(vdev->path, sizeof(vdev->path), HID_VIRTUAL_PATH_PREFIX "%d", id);
+
+	/* Keep the devices in the order they were added. */
+	for (link = &devices; *link; link = &(*link)->next)
+		;
+	*link = vdev;
+
+	if (vdev->config.report_rate > 0) {
+		vdev->refs++;
+		if (pthread_create(&thread, NULL, generator_thread, vdev) == 0)
+			pthread_detach(thread);
+		else
+			vdev->refs--;
+	}
+	pthread_mutex_unlock(&mutex);
+
+	return id;
+}
+
+int HID_API_EXPORT hid_virtual_remove_device(int id)
+{
+	struct virtual_device *vdev;
+
+	pthread_mutex_lock(&mutex);
+	vdev = find_device(id);
+	if (vdev)
+		unplug_device(vdev);
+	pthread_mutex_unlock(&mutex);
+
+	return vdev? 0: -1;
+}
+
+void HID_API_EXPORT hid_virtual_remove_all(void)
+{
+	pthread_mutex_lock(&mutex);
+	while (devices)
+		unplug_device(devices);
+	pthread_mutex_unlock(&mutex);
+}
+
+int HID_API_EXPORT hid_virtual_push_report(int id, const unsigned char *data, size_t length)
+{
+	struct virtual_device *vdev;
+
+	if (!data || length == 0)
+		return -1;
+
+	pthread_mutex_lock(&mutex);
+	vdev = find_device(id);
+	if (vdev)
+		deliver_report(vdev, data, length, monotonic_ns());
+	pthread_mutex_unlock(&mutex);
+
+	return vdev? 0: -1;
+}
+
+int HID_API_EXPORT hid_virtual_get_output_report(int id, unsigned char *data, size_t length)
+{
+	struct virtual_device *vdev;
+	int res = -1;
+
+	pthread_mutex_lock(&mutex);
+	vdev = find_device(id);
+	if (vdev) {
+		size_t len = (length < vdev->output_len)? length: vdev->output_len;
+		if (len > 0)
+			memcpy(data, vdev->output_report, len);
+		res = (int) len;
+	}
+	pthread_mutex_unlock(&mutex);
+
+	return res;
+}
+
+unsigned long long HID_API_EXPORT hid_virtual_reports_delivered(int id)
+{
+	struct virtual_device *vdev;
+	unsigned long long delivered = 0;
+
+	pthread_mutex_lock(&mutex);
+	vdev = find_device(id);
+	if (vdev)
+		delivered = vdev->delivered;
+	pthread_mutex_unlock(&mutex);
+
+	return delivered;
+}
+
+int HID_API_EXPORT hid_init(void)
+{
+	pthread_once(&wait_any_once, init_wait_any);
+
+	pthread_mutex_lock(&mutex);
+	init_refs++;
+	pthread_mutex_unlock(&mutex);
+
+	return 0;
+}
+
+int HID_API_EXPORT hid_exit(void)
+{
+	/* The devices belong to the script, only the reference is dropped. */
+	pthread_mutex_lock(&mutex);
+	if (init_refs > 0)
+		init_refs--;
+	pthread_mutex_unlock(&mutex);
+
+	return 0;
+}
+
+hid_context HID_API_EXPORT *hid_context_new(void)
+{
+	return calloc(1, sizeof(hid_context));
+}
+
+void HID_API_EXPORT hid_context_free(hid_context *ctx)
+{
+	free(ctx);
+}
+
+/* Must be called with mutex locked. */
+static struct hid_device_info *create_device_info(const struct virtual_device *vdev, int with_strings)
+{
+	struct hid_device_info *info = calloc(1, sizeof(struct hid_device_info));
+
+	if (!info)
+		return NULL;
+
+	info->path = strdup(vdev->path);
+	info->vendor_id = vdev->config.vendor_id;
+	info->product_id = vdev->config.product_id;
+	info->release_number = vdev->config.release_number;
+	info->interface_number = vdev->config.interface_number;
+	if (with_strings) {
+		info->serial_number = dup_wcs(vdev->serial_number);
+		info->manufacturer_string = dup_wcs(vdev->manufacturer_string);
+		info->product_string = dup_wcs(vdev->product_string);
+		info->usage_page = vdev->config.usage_page;
+		info->usage = vdev->config.usage;
+	}
+	info->next = NULL;
+
+	return info;
+}
+
+static int match_filter(const struct virtual_device *vdev, const struct hid_enumeration_filter *filter)
+{
+	if (filter->vendor_id && filter->vendor_id != vdev->config.vendor_id)
+		return 0;
+	if (filter->product_id && filter->product_id != vdev->config.product_id)
+		return 0;
+	if (filter->interface_number != -1 && filter->interface_number != vdev->config.interface_number)
+		return 0;
+	if (filter->bus_type != HID_BUS_ANY && filter->bus_type != vdev->config.bus_type)
+		return 0;
+	if (filter->usage_page && filter->usage_page != vdev->config.usage_page)
+		return 0;
+	if (filter->usage && filter->usage != vdev->config.usage)
+		return 0;
+
+	if (filter->serial_number) {
+		char *serial;
+		int matched;
+
+		if (!vdev->serial_number)
+			return 0;
+		serial = wcs_to_utf8(vdev->serial_number);
+		matched = serial && fnmatch(filter->serial_number, serial, 0) == 0;
+		free(serial);
+		if (!matched)
+			return 0;
+	}
+
+	return 1;
+}
+
+struct hid_device_info HID_API_EXPORT *hid_enumerate_filter(const struct hid_enumeration_filter *filter)
+{
+	struct hid_device_info *root = NULL;
+	struct hid_device_info *cur = NULL;
+	struct virtual_device *vdev;
+
+	if (!filter)
+		return NULL;
+
+	pthread_mutex_lock(&mutex);
+	for (vdev = devices; vdev; vdev = vdev->next) {
+		struct hid_device_info *info;
+
+		if (!match_filter(vdev, filter))
+			continue;
+
+		info = create_device_info(vdev, !(filter->flags & HID_ENUMERATE_NO_STRINGS));
+		if (!info)
+			continue;
+		if (cur)
+			cur->next = info;
+		else
+			root = info;
+		cur = info;
+	}
+	pthread_mutex_unlock(&mutex);
+
+	return root;
+}
+
+struct hid_device_info HID_API_EXPORT *hid_enumerate_ex(unsigned short vendor_id, unsigned short product_id, unsigned int flags)
+{
+	struct hid_enumeration_filter filter;
+
+	memset(&filter, 0, sizeof(filter));
+	filter.vendor_id = vendor_id;
+	filter.product_id = product_id;
+	filter.interface_number = -1;
+	filter.flags = flags;
+
+	return hid_enumerate_filter(&filter);
+}
+
+struct hid_device_info HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+{
+	return hid_enumerate_ex(vendor_id, product_id, 0);
+}
+
+void HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
+{
+	struct hid_device_info *d = devs;
+	while (d) {
+		struct hid_device_info *next = d->next;
+		free(d->path);
+		free(d->serial_number);
+		free(d->manufacturer_string);
+		free(d->product_string);
+		free(d);
+		d = next;
+	}
+}
+
+/* Must be called with mutex locked. */
+static struct virtual_device *find_device_by_path(const char *path)
+{
+	struct virtual_device *vdev;
+
+	for (vdev = devices; vdev; vdev = vdev->next) {
+		if (strcmp(vdev->path, path) == 0)
+			return vdev;
+	}
+	return NULL;
+}
+
+int HID_API_EXPORT hid_enumerate_fill_strings(struct hid_device_info *info)
+{
+	struct virtual_device *vdev;
+
+	if (!info || !info->path)
+		return -1;
+
+	pthread_mutex_lock(&mutex);
+	vdev = find_device_by_path(info->path);
+	if (vdev) {
+		if (!info->serial_number)
+			info->serial_number = dup_wcs(vdev->serial_number);
+		if (!info->manufacturer_string)
+			info->manufacturer_string = dup_wcs(vdev->manufacturer_string);
+		if (!info->product_string)
+			info->product_string = dup_wcs(vdev->product_string);
+		if (!info->usage_page)
+			info->usage_page = vdev->config.usage_page;
+		if (!info->usage)
+			info->usage = vdev->config.usage;
+	}
+	pthread_mutex_unlock(&mutex);
+
+	return vdev? 0: -1;
+}
+
+struct hid_device_info HID_API_EXPORT *hid_enumerate_context(hid_context *ctx, const struct hid_enumeration_filter *filter)
+{
+	(void) ctx;
+	return hid_enumerate_filter(filter);
+}
+
+int HID_API_EXPORT hid_enumerate_fill_strings_context(hid_context *ctx, struct hid_device_info *info)
+{
+	(void) ctx;
+	return hid_enumerate_fill_strings(info);
+}
+
+int HID_API_EXPORT hid_get_location(const char *path, char *buf, size_t buf_size)
+{
+	int len;
+
+	if (!path || !buf || buf_size == 0)
+		return -1;
+
+	/* A virtual device never moves, its path is its location. */
+	len = snprintf(buf, buf_size, "%s", path);
+	if (len < 0 || (size_t) len >= buf_size)
+		return -1;
+
+	return len;
+}
+
+hid_device * HID_API_EXPORT hid_open_path(const char *path)
+{
+	struct virtual_device *vdev;
+	hid_device *dev = NULL;
+
+	if (!path)
+		return NULL;
+
+	pthread_mutex_lock(&mutex);
+	vdev = find_device_by_path(path);
+	if (vdev) {
+		dev = calloc(1, sizeof(hid_device));
+		if (dev) {
+			dev->vdev = vdev;
+			dev->blocking = 1;
+			init_condition(&dev->condition);
+			dev->next = vdev->handles;
+			vdev->handles = dev;
+			vdev->refs++;
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+
+	return dev;
+}
+
+hid_device * HID_API_EXPORT hid_open(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number)
+{
+	struct virtual_device *vdev;
+	char path[sizeof(vdev->path)];
+	int found = 0;
+
+	pthread_mutex_lock(&mutex);
+	for (vdev = devices; vdev; vdev = vdev->next) {
+		if (vdev->config.vendor_id != vendor_id || vdev->config.product_id != product_id)
+			continue;
+		if (serial_number && (!vdev->serial_number || wcscmp(serial_number, vdev->serial_number) != 0))
+			continue;
+		strcpy(path, vdev->path);
+		found = 1;
+		break;
+	}
+	pthread_mutex_unlock(&mutex);
+
+	return found? hid_open_path(path): NULL;
+}
+
+hid_device HID_API_EXPORT *hid_open_context(hid_context *ctx, unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number)
+{
+	(void) ctx;
+	return hid_open(vendor_id, product_id, serial_number);
+}
+
+hid_device HID_API_EXPORT *hid_open_path_context(hid_context *ctx, const char *path)
+{
+	(void) ctx;
+	return hid_open_path(path);
+}
+
+int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t length)
+{
+	unsigned char *copy;
+	int res = -1;
+	unsigned long long start = monotonic_ns();
+
+	if (!data || length == 0)
+		return -1;
+
+	pthread_mutex_lock(&mutex);
+	if (dev->vdev->unplugged) {
+		dev->last_error = L"Device unplugged";
+	}
+	else if ((copy = malloc(length)) != NULL) {
+		HID_TRACE_INSTANT("hid_write", length);
+		memcpy(copy, data, length);
+		free(dev->vdev->output_report);
+		dev->vdev->output_report = copy;
+		dev->vdev->output_len = length;
+		res = (int) length;
+		if (dev->capture)
+			hid_capture_record(dev->capture, dev->capture_tag, HID_CAPTURE_OUTPUT, start, data, length);
+	}
+	pthread_mutex_unlock(&mutex);
+
+	if (res < 0) {
+		hid_stats_add(&dev->stats.write_errors, 1);
+	}
+	else {
+		hid_stats_add(&dev->stats.reports_written, 1);
+		hid_stats_add(&dev->stats.bytes_written, res);
+		hid_stats_latency(dev->stats.write_latency, start, monotonic_ns());
+	}
+
+	return res;
+}
+
+/* Helper function, to simplify hid_read().
+   This should be called with mutex locked. Reports handed to
+   the caller, that is with data set, are counted in the statistics. */
+static int return_data(hid_device *dev, unsigned char *data, size_t length, unsigned long long *timestamp)
+{
+	struct input_report *rpt = dev->input_reports;
+	size_t len = (length < rpt->len)? length: rpt->len;
+
+	if (len > 0)
+		memcpy(data, rpt->data, len);
+	if (timestamp)
+		*timestamp = rpt->timestamp;
+	if (data) {
+		hid_stats_add(&dev->stats.reports_read, 1);
+		hid_stats_add(&dev->stats.bytes_read, len);
+		hid_stats_latency(dev->stats.read_latency, rpt->timestamp, monotonic_ns());
+	}
+	dev->input_reports = rpt->next;
+	if (!dev->input_reports)
+		dev->last_report = NULL;
+	dev->num_queued--;
+	free(rpt->data);
+	free(rpt);
+
+	return (int) len;
+}
+
+int HID_API_EXPORT hid_read_timeout_timestamped(hid_device *dev, unsigned char *data, size_t length, int milliseconds, unsigned long long *timestamp)
+{
+	struct timespec ts;
+	int bytes_read;
+
+	if (milliseconds > 0)
+		ts = ns_to_timespec(monotonic_ns() + milliseconds * 1000000ULL);
+
+	HID_TRACE_BEGIN("hid_read");
+	pthread_mutex_lock(&mutex);
+	for (;;) {
+		if (dev->input_reports) {
+			bytes_read = return_data(dev, data, length, timestamp);
+			break;
+		}
+		if (dev->vdev->unplugged) {
+			dev->last_error = L"Device unplugged";
+			bytes_read = -1;
+			break;
+		}
+		if (milliseconds == 0) {
+			bytes_read = 0;
+			break;
+		}
+
+		if (milliseconds < 0) {
+			pthread_cond_wait(&dev->condition, &mutex);
+		}
+		else if (pthread_cond_timedwait(&dev->condition, &mutex, &ts) == ETIMEDOUT) {
+			bytes_read = dev->input_reports? return_data(dev, data, length, timestamp): 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+
+	if (bytes_read < 0)
+		hid_stats_add(&dev->stats.read_errors, 1);
+	else if (bytes_read == 0 && milliseconds != 0)
+		hid_stats_add(&dev->stats.read_timeouts, 1);
+
+	HID_TRACE_END("hid_read", bytes_read);
+	return bytes_read;
+}
+
+int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+{
+	return hid_read_timeout_timestamped(dev, data, length, milliseconds, NULL);
+}
+
+int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length)
+{
+	return hid_read_timeout(dev, data, length, dev->blocking? -1: 0);
+}
+
+int HID_API_EXPORT hid_read_timestamped(hid_device *dev, unsigned char *data, size_t length, unsigned long long *timestamp)
+{
+	return hid_read_timeout_timestamped(dev, data, length, dev->blocking? -1: 0, timestamp);
+}
+
+/* Must be called with mutex locked. */
+static int mark_ready_devices(hid_device **devs, size_t num_devs, int *ready)
+{
+	size_t i;
+	int num_ready = 0;
+
+	for (i = 0; i < num_devs; i++) {
+		ready[i] = devs[i]->input_reports != NULL || devs[i]->vdev->unplugged;
+		num_ready += ready[i];
+	}
+
+	return num_ready;
+}
+
+hid_wake_event HID_API_EXPORT *hid_wake_event_new(void)
+{
+	pthread_once(&wait_any_once, init_wait_any);
+	return calloc(1, sizeof(hid_wake_event));
+}
+
+void HID_API_EXPORT hid_wake_event_free(hid_wake_event *event)
+{
+	free(event);
+}
+
+void HID_API_EXPORT hid_wake_event_signal(hid_wake_event *event)
+{
+	pthread_mutex_lock(&mutex);
+	event->signalled = 1;
+	if (wait_any_waiters > 0)
+		pthread_cond_broadcast(&wait_any_condition);
+	pthread_mutex_unlock(&mutex);
+}
+
+int HID_API_EXPORT hid_wait_any(hid_device **devs, size_t num_devs, int *ready, int milliseconds)
+{
+	return hid_wait_any_event(devs, num_devs, ready, milliseconds, NULL);
+}
+
+int HID_API_EXPORT hid_wait_any_event(hid_device **devs, size_t num_devs, int *ready, int milliseconds, hid_wake_event *event)
+{
+	struct timespec ts;
+	int num_ready;
+	int woken = 0;
+	int res = 0;
+
+	if ((num_devs > 0 && (!devs || !ready)) || (num_devs == 0 && !event))
+		return -1;
+
+	if (milliseconds > 0)
+		ts = ns_to_timespec(monotonic_ns() + milliseconds * 1000000ULL);
+
+	pthread_mutex_lock(&mutex);
+	for (;;) {
+		num_ready = mark_ready_devices(devs, num_devs, ready);
+		if (event && event->signalled) {
+			event->signalled = 0;
+			woken = 1;
+		}
+		if (num_ready > 0 || woken || milliseconds == 0 || res == ETIMEDOUT)
+			break;
+
+		wait_any_waiters++;
+		if (milliseconds < 0)
+			res = pthread_cond_wait(&wait_any_condition, &mutex);
+		else
+			res = pthread_cond_timedwait(&wait_any_condition, &mutex, &ts);
+		wait_any_waiters--;
+
+		if (res != 0 && res != ETIMEDOUT) {
+			num_ready = -1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+
+	return num_ready;
+}
+
+int HID_API_EXPORT hid_read_all(hid_device *dev, unsigned char *data, size_t length, size_t *offsets, unsigned long long *timestamps, size_t max_reports)
+{
+	struct input_report *taken, *last = NULL, *rpt;
+	size_t needed = 0;
+	size_t num_reports = 0;
+	int unplugged;
+	unsigned long long now;
+
+	if (!data || !offsets)
+		return -1;
+
+	/* Detach as many reports as fit in one go, the copies and frees are
+	   done after the generator has been let go again. */
+	pthread_mutex_lock(&mutex);
+	taken = dev->input_reports;
+	for (rpt = taken; rpt != NULL && num_reports < max_reports; rpt = rpt->next) {
+		if (needed + rpt->len > length) {
+			/* A report longer than the whole buffer would stay at
+			   the head of the queue for ever, so it is taken
+			   truncated, as hid_read() would. */
+			if (num_reports == 0 && length > 0) {
+				num_reports = 1;
+				last = rpt;
+			}
+			break;
+		}
+		needed += rpt->len;
+		num_reports++;
+		last = rpt;
+	}
+	if (last) {
+		dev->input_reports = last->next;
+		if (!dev->input_reports)
+			dev->last_report = NULL;
+		dev->num_queued -= num_reports;
+		last->next = NULL;
+	}
+	else {
+		taken = NULL;
+	}
+	unplugged = dev->vdev->unplugged;
+	pthread_mutex_unlock(&mutex);
+
+	if (num_reports == 0) {
+		if (unplugged)
+			hid_stats_add(&dev->stats.read_errors, 1);
+		return unplugged? -1: 0;
+	}
+
+	now = monotonic_ns();
+	offsets[0] = 0;
+	num_reports = 0;
+	while (taken) {
+		size_t len;
+
+		rpt = taken;
+		taken = rpt->next;
+
+		len = (length - offsets[num_reports] < rpt->len)? length - offsets[num_reports]: rpt->len;
+		memcpy(data + offsets[num_reports], rpt->data, len);
+		offsets[num_reports + 1] = offsets[num_reports] + len;
+		if (timestamps)
+			timestamps[num_reports] = rpt->timestamp;
+		hid_stats_latency(dev->stats.read_latency, rpt->timestamp, now);
+		num_reports++;
+
+		free(rpt->data);
+		free(rpt);
+	}
+
+	hid_stats_add(&dev->stats.reports_read, num_reports);
+	hid_stats_add(&dev->stats.bytes_read, offsets[num_reports]);
+
+	return (int) num_reports;
+}
+
+int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
+{
+	dev->blocking = !nonblock;
+	return 0;
+}
+
+int HID_API_EXPORT hid_send_feature_report(hid_device *dev, const unsigned char *data, size_t length)
+{
+	unsigned char *copy;
+	int res = -1;
+
+	if (!data || length == 0)
+		return -1;
+
+	pthread_mutex_lock(&mutex);
+	if (dev->vdev->unplugged) {
+		dev->last_error = L"Device unplugged";
+	}
+	else if ((copy = malloc(length)) != NULL) {
+		/* Kept per report ID, and handed back by hid_get_feature_report(). */
+		memcpy(copy, data, length);
+		free(dev->vdev->feature_reports[data[0]]);
+		dev->vdev->feature_reports[data[0]] = copy;
+		dev->vdev->feature_lens[data[0]] = length;
+		res = (int) length;
+		if (dev->capture)
+			hid_capture_record(dev->capture, dev->capture_tag, HID_CAPTURE_FEATURE_SET, monotonic_ns(), data, length);
+	}
+	pthread_mutex_unlock(&mutex);
+
+	return res;
+}
+
+int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data, size_t length)
+{
+	int res = -1;
+
+	if (!data || length == 0)
+		return -1;
+
+	pthread_mutex_lock(&mutex);
+	if (dev->vdev->unplugged) {
+		dev->last_error = L"Device unplugged";
+	}
+	else if (dev->vdev->feature_reports[data[0]]) {
+		size_t stored = dev->vdev->feature_lens[data[0]];
+		size_t len = (length < stored)? length: stored;
+		memcpy(data, dev->vdev->feature_reports[data[0]], len);
+		res = (int) len;
+		if (dev->capture)
+			hid_capture_record(dev->capture, dev->capture_tag, HID_CAPTURE_FEATURE_GET, monotonic_ns(), data, len);
+	}
+	else {
+		dev->last_error = L"No such feature report";
+	}
+	pthread_mutex_unlock(&mutex);
+
+	return res;
+}
+
+void HID_API_EXPORT hid_close(hid_device *dev)
+{
+	hid_device **link;
+
+	if (!dev)
+		return;
+
+	pthread_mutex_lock(&mutex);
+	for (link = &dev->vdev->handles; *link; link = &(*link)->next) {
+		if (*link == dev) {
+			*link = dev->next;
+			break;
+		}
+	}
+	while (dev->input_reports) {
+		return_data(dev, NULL, 0, NULL);
+	}
+	hid_change_free(dev->changes);
+	release_device(dev->vdev);
+	pthread_mutex_unlock(&mutex);
+
+	pthread_cond_destroy(&dev->condition);
+	hid_free_enumeration(dev->device_info);
+	free(dev);
+}
+
+/* Copies one of the strings of the device. Must be called with mutex locked. */
+static int get_string(const wchar_t *value, wchar_t *string, size_t maxlen)
+{
+	if (!string || maxlen == 0)
+		return -1;
+
+	if (!value) {
+		string[0] = L'\0';
+		return 0;
+	}
+
+	wcsncpy(string, value, maxlen);
+	string[maxlen - 1] = L'\0';
+	return 0;
+}
+
+int HID_API_EXPORT_CALL hid_get_manufacturer_string(hid_device *dev, wchar_t *string, size_t maxlen)
+{
+	int res;
+
+	pthread_mutex_lock(&mutex);
+	res = get_string(dev->vdev->manufacturer_string, string, maxlen);
+	pthread_mutex_unlock(&mutex);
+
+	return res;
+}
+
+int HID_API_EXPORT_CALL hid_get_product_string(hid_device *dev, wchar_t *string, size_t maxlen)
+{
+	int res;
+
+	pthread_mutex_lock(&mutex);
+	res = get_string(dev->vdev->product_string, string, maxlen);
+	pthread_mutex_unlock(&mutex);
+
+	return res;
+}
+
+int HID_API_EXPORT_CALL hid_get_serial_number_string(hid_device *dev, wchar_t *string, size_t maxlen)
+{
+	int res;
+
+	pthread_mutex_lock(&mutex);
+	res = get_string(dev->vdev->serial_number, string, maxlen);
+	pthread_mutex_unlock(&mutex);
+
+	return res;
+}
+
+int HID_API_EXPORT_CALL hid_get_indexed_string(hid_device *dev, int string_index, wchar_t *string, size_t maxlen)
+{
+	(void) string_index;
+	(void) string;
+	(void) maxlen;
+
+	dev->last_error = L"Indexed strings are not supported by virtual devices";
+	return -1;
+}
+
+struct hid_device_info HID_API_EXPORT *hid_get_device_info(hid_device *dev)
+{
+	pthread_mutex_lock(&mutex);
+	if (!dev->device_info)
+		dev->device_info = create_device_info(dev->vdev, 1);
+	pthread_mutex_unlock(&mutex);
+
+	return dev->device_info;
+}
+
+int HID_API_EXPORT_CALL hid_get_report_descriptor(hid_device *dev, unsigned char *buf, size_t buf_size)
+{
+	size_t len;
+
+	if (!buf)
+		return -1;
+
+	pthread_mutex_lock(&mutex);
+	len = dev->vdev->config.report_descriptor_size;
+	if (len > buf_size)
+		len = buf_size;
+	if (len > 0)
+		memcpy(buf, dev->vdev->report_descriptor, len);
+	pthread_mutex_unlock(&mutex);
+
+	return (int) len;
+}
+
+void HID_API_EXPORT hid_set_capture(hid_device *dev, struct hid_capture *capture, int tag)
+{
+	pthread_mutex_lock(&mutex);
+	dev->capture = capture;
+	dev->capture_tag = tag;
+	pthread_mutex_unlock(&mutex);
+}
+
+int HID_API_EXPORT_CALL hid_get_device_stats(hid_device *dev, struct hid_device_stats *stats)
+{
+	if (!dev || !stats)
+		return -1;
+
+	hid_stats_copy(stats, &dev->stats);
+
+	return 0;
+}
+
+void HID_API_EXPORT_CALL hid_reset_device_stats(hid_device *dev)
+{
+	if (dev)
+		hid_stats_reset(&dev->stats);
+}
+
+int HID_API_EXPORT_CALL hid_set_change_filter(hid_device *dev, int report_id, const unsigned char *mask, size_t mask_length)
+{
+	int res;
+
+	if (!dev)
+		return -1;
+
+	pthread_mutex_lock(&mutex);
+	res = hid_change_set(&dev->changes,
+		hid_change_uses_numbered_reports(dev->vdev->report_descriptor, dev->vdev->config.report_descriptor_size),
+		report_id, mask, mask_length);
+	pthread_mutex_unlock(&mutex);
+
+	return res;
+}
+
+void HID_API_EXPORT_CALL hid_clear_change_filter(hid_device *dev, int report_id)
+{
+	if (!dev)
+		return;
+
+	pthread_mutex_lock(&mutex);
+	hid_change_clear(&dev->changes, report_id);
+	pthread_mutex_unlock(&mutex);
+}
+
+HID_API_EXPORT const wchar_t * HID_API_CALL hid_error(hid_device *dev)
+{
+	return dev? dev->last_error: NULL;
+}
@@ -1,5 +1,8 @@
-CONFIG += testcase
-TARGET = tst_qzip
+CONFIG += testcase hidapi_virtual
+TARGET = tst_qhidapi
 
-SOURCES += 
+# The library sources are built in, against the virtual backend.
+include(../../../../src/hidapi/hidapi.pri)
+QT += testlib
 
+SOURCES += tst_qhidapi.cpp
@@ -0,0 +1,652 @@
+/*
+Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include <QtTest/QtTest>
+
+#include "qhidapi.h"
+#include "qhiddevice.h"
+#include "qhidcapturereader.h"
+#include "hidapi_virtual.h"
+#include "hidapi_capture.h"
+
+/*
+ * Runs the Qt layer against scripted devices from the virtual hidapi backend.
+ */
+class tst_QHidApi : public QObject {
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+
+    void enumerate();
+    void enumerateFilter();
+    void quickEnumeration();
+    void readWrite();
+    void readTimestamp();
+    void featureReport();
+    void drain();
+    void readAny();
+    void sharedFanOut();
+    void latestReport();
+    void deviceStats();
+    void sharedDeviceStats();
+    void changeFilter();
+    void capture();
+    void replay();
+    void captureReader();
+    void deltaCapture();
+    void generatedReports();
+    void disconnect();
+
+private:
+    static int addDevice(const wchar_t *serial, uint rate=0, quint64 disconnectAfter=0);
+    static QByteArray report(char id, const QByteArray &payload);
+};
+
+static const ushort VENDOR_ID = 0x1209;
+static const ushort PRODUCT_ID = 0x0001;
+
+/*
+ * Report 1 has two bytes, report 2 has four.
+ */
+static const unsigned char DESCRIPTOR[] = {
+    0x05, 0x01, 0x09, 0x04, 0xA1, 0x01,
+    0x85, 0x01, 0x75, 0x08, 0x95, 0x02, 0x81, 0x02,
+    0x85, 0x02, 0x95, 0x04, 0x81, 0x02,
+    0xC0
+};
+
+int tst_QHidApi::addDevice(const wchar_t *serial, uint rate, quint64 disconnectAfter) {
+    hid_virtual_device_config config;
+    memset(&config, 0, sizeof(config));
+    config.vendor_id = VENDOR_ID;
+    config.product_id = PRODUCT_ID;
+    config.serial_number = serial;
+    config.manufacturer_string = L"Virtual";
+    config.product_string = L"Test Device";
+    config.report_descriptor = DESCRIPTOR;
+    config.report_descriptor_size = sizeof(DESCRIPTOR);
+    config.report_id = 1;
+    config.report_size = 3;
+    config.report_rate = rate;
+    config.disconnect_after = disconnectAfter;
+    config.queue_limit = 1000;
+    return hid_virtual_add_device(&config);
+}
+
+QByteArray tst_QHidApi::report(char id, const QByteArray &payload) {
+    return QByteArray(1, id) + payload;
+}
+
+static QString pathOf(int id) {
+    return QString(HID_VIRTUAL_PATH_PREFIX "%1").arg(id);
+}
+
+static void push(int id, const QByteArray &report) {
+    QCOMPARE(hid_virtual_push_report(id, reinterpret_cast<const uchar*>(report.constData()), size_t(report.size())), 0);
+}
+
+void tst_QHidApi::init() {
+    hid_virtual_remove_all();
+}
+
+void tst_QHidApi::cleanup() {
+    hid_virtual_remove_all();
+}
+
+void tst_QHidApi::enumerate() {
+    addDevice(L"A1");
+    addDevice(L"B2");
+
+    QHidApi api;
+    QList<QHidDeviceInfo> devices = api.enumerate(VENDOR_ID, PRODUCT_ID);
+
+    QCOMPARE(devices.size(), 2);
+    QCOMPARE(devices.at(0).serialNumber, QString("A1"));
+    QCOMPARE(devices.at(0).productString, QString("Test Device"));
+    QCOMPARE(devices.at(1).serialNumber, QString("B2"));
+    QVERIFY(api.enumerate(VENDOR_ID, PRODUCT_ID + 1).isEmpty());
+}
+
+void tst_QHidApi::enumerateFilter() {
+    addDevice(L"A1");
+    addDevice(L"B2");
+
+    QHidApi api;
+    QHidDeviceFilter filter(VENDOR_ID);
+    filter.setSerialNumberPattern("B*");
+    QList<QHidDeviceInfo> devices = api.enumerate(filter);
+
+    QCOMPARE(devices.size(), 1);
+    QCOMPARE(devices.at(0).serialNumber, QString("B2"));
+}
+
+void tst_QHidApi::quickEnumeration() {
+    addDevice(L"A1");
+
+    QHidApi api;
+    QList<QHidDeviceInfo> devices = api.enumerate(VENDOR_ID, PRODUCT_ID, QHidApi::QuickEnumeration);
+
+    QCOMPARE(devices.size(), 1);
+    QHidDeviceInfo info = devices.at(0);
+    QVERIFY(info.serialNumber.isEmpty());
+    QVERIFY(api.fetchStrings(info));
+    QCOMPARE(info.serialNumber, QString("A1"));
+}
+
+void tst_QHidApi::readWrite() {
+    int device = addDevice(L"A1");
+
+    QHidApi api;
+    quint32 id = api.open(pathOf(device));
+    QVERIFY(id != 0);
+
+    QVERIFY(api.read(id, 0).isEmpty());
+    push(device, report(1, "ab"));
+    QCOMPARE(api.read(id, 100), report(1, "ab"));
+
+    QCOMPARE(api.write(id, QByteArray("xyz"), 3), 4);
+    uchar output[8];
+    QCOMPARE(hid_virtual_get_output_report(device, output, sizeof(output)), 4);
+    QCOMPARE(QByteArray(reinterpret_cast<char*>(output), 4), report(3, "xyz"));
+
+    api.close(id);
+}
+
+void tst_QHidApi::readTimestamp() {
+    int device = addDevice(L"A1");
+
+    QHidDevice hid;
+    QVERIFY(hid.open(pathOf(device)));
+
+    QElapsedTimer timer;
+    timer.start();
+    push(device, report(1, "ab"));
+
+    char buf[8];
+    QCOMPARE(hid.read(buf, sizeof(buf), 100), qint64(3));
+    QVERIFY(hid.lastReportTimestamp() > 0);
+    if (QElapsedTimer::clockType() == QElapsedTimer::MonotonicClock) {
+        QVERIFY(hid.lastReportTimestamp() / 1000000 >= timer.msecsSinceReference());
+    }
+}
+
+void tst_QHidApi::featureReport() {
+    int device = addDevice(L"A1");
+
+    QHidApi api;
+    quint32 id = api.open(pathOf(device));
+
+    QCOMPARE(api.sendFeatureReport(id, 5, QByteArray("\x01\x02")), 3);
+    QCOMPARE(api.featureReport(id, 5), report(5, "\x01\x02"));
+    QVERIFY(api.featureReport(id, 6).isEmpty());
+}
+
+void tst_QHidApi::drain() {
+    int device = addDevice(L"A1");
+
+    QHidApi api;
+    quint32 id = api.open(pathOf(device));
+
+    for (char i = 0; i < 10; i++) {
+        push(device, report(1, QByteArray(2, i)));
+    }
+
+    QHidReportBatch batch = api.drain(id);
+    QCOMPARE(batch.count(), 10);
+    for (int i = 0; i < batch.count(); i++) {
+        QCOMPARE(batch.report(i), report(1, QByteArray(2, char(i))));
+        QVERIFY(batch.timestamp(i) > 0);
+    }
+    QVERIFY(api.drain(id).isEmpty());
+}
+
+void tst_QHidApi::readAny() {
+    int first = addDevice(L"A1");
+    int second = addDevice(L"B2");
+
+    QHidApi api;
+    quint32 firstId = api.open(pathOf(first));
+    quint32 secondId = api.open(pathOf(second));
+    QList<quint32> ids;
+    ids << firstId << secondId;
+
+    QByteArray data;
+    QCOMPARE(api.readAny(ids, data, 0), quint32(0));
+
+    push(second, report(1, "cd"));
+    QCOMPARE(api.readReady(ids, 100), QList<quint32>() << secondId);
+    QCOMPARE(api.readAny(ids, data, 100), secondId);
+    QCOMPARE(data, report(1, "cd"));
+}
+
+/*
+ * Every subscriber of a shared device sees every report.
+ */
+void tst_QHidApi::sharedFanOut() {
+    int device = addDevice(L"A1");
+
+    QHidApi first, second;
+    quint32 firstId = first.openShared(pathOf(device));
+    quint32 secondId = second.openShared(pathOf(device));
+    QVERIFY(firstId != 0);
+    QVERIFY(secondId != 0);
+
+    push(device, report(1, "ab"));
+    push(device, report(1, "cd"));
+
+    QCOMPARE(first.read(firstId, 1000), report(1, "ab"));
+    QCOMPARE(first.read(firstId, 1000), report(1, "cd"));
+    QCOMPARE(second.read(secondId, 1000), report(1, "ab"));
+    QCOMPARE(second.read(secondId, 1000), report(1, "cd"));
+}
+
+void tst_QHidApi::latestReport() {
+    int device = addDevice(L"A1");
+
+    QHidApi api;
+    quint32 id = api.openShared(pathOf(device));
+    QVERIFY(!api.trackLatestReports(api.open(pathOf(addDevice(L"B2")))));
+    QVERIFY(api.trackLatestReports(id));
+    QVERIFY(api.latestReport(id, 1).isEmpty());
+
+    push(device, report(1, "ab"));
+    push(device, report(2, "wxyz"));
+    push(device, report(1, "cd"));
+
+    QTRY_COMPARE(api.latestReport(id, 1), report(1, "cd"));
+    QTRY_COMPARE(api.latestReport(id, 2), report(2, "wxyz"));
+}
+
+void tst_QHidApi::deviceStats() {
+    int device = addDevice(L"A1");
+
+    QHidApi api;
+    QVERIFY(!api.deviceStats(1234).isValid());
+    quint32 id = api.open(pathOf(device));
+
+    push(device, report(1, "ab"));
+    push(device, report(1, "cd"));
+    QVERIFY(!api.read(id, 100).isEmpty());
+    QVERIFY(!api.read(id, 100).isEmpty());
+    QVERIFY(api.read(id, 1).isEmpty());
+    QCOMPARE(api.write(id, QByteArray("xyz"), 3), 4);
+
+    QHidDeviceStats stats = api.deviceStats(id);
+    QVERIFY(stats.isValid());
+    QCOMPARE(stats.reportsRead(), quint64(2));
+    QCOMPARE(stats.bytesRead(), quint64(6));
+    QCOMPARE(stats.reportsWritten(), quint64(1));
+    QCOMPARE(stats.bytesWritten(), quint64(4));
+    QCOMPARE(stats.readTimeouts(), quint64(1));
+    QCOMPARE(stats.queueHighWater(), quint64(2));
+
+    quint64 latencies = 0;
+    foreach (quint64 count, stats.readLatencyHistogram()) {
+        latencies += count;
+    }
+    QCOMPARE(latencies, quint64(2));
+    QVERIFY(stats.readLatencyPercentile(50) > 0);
+
+    api.resetDeviceStats(id);
+    QCOMPARE(api.deviceStats(id).reportsRead(), quint64(0));
+}
+
+/*
+ * Each id of a shared device has its own counters, which neither the polls of the reader
+ * thread nor a reset by another id touch.
+ */
+void tst_QHidApi::sharedDeviceStats() {
+    int device = addDevice(L"A1");
+
+    QHidApi first, second;
+    quint32 firstId = first.openShared(pathOf(device));
+    quint32 secondId = second.openShared(pathOf(device));
+
+    push(device, report(1, "ab"));
+    QCOMPARE(first.read(firstId, 1000), report(1, "ab"));
+    QVERIFY(first.read(firstId, 1).isEmpty());
+    QCOMPARE(first.write(firstId, QByteArray("xyz"), 3), 4);
+    QCOMPARE(second.read(secondId, 1000), report(1, "ab"));
+    // long enough for the reader to time out a few times.
+    QTest::qWait(350);
+
+    QHidDeviceStats stats = first.deviceStats(firstId);
+    QCOMPARE(stats.reportsRead(), quint64(1));
+    QCOMPARE(stats.bytesRead(), quint64(3));
+    QCOMPARE(stats.reportsWritten(), quint64(1));
+    QCOMPARE(stats.readTimeouts(), quint64(1));
+
+    stats = second.deviceStats(secondId);
+    QCOMPARE(stats.reportsRead(), quint64(1));
+    QCOMPARE(stats.reportsWritten(), quint64(0));
+    QCOMPARE(stats.readTimeouts(), quint64(0));
+
+    first.resetDeviceStats(firstId);
+    QCOMPARE(first.deviceStats(firstId).reportsRead(), quint64(0));
+    QCOMPARE(second.deviceStats(secondId).reportsRead(), quint64(1));
+}
+
+void tst_QHidApi::changeFilter() {
+    int device = addDevice(L"A1");
+
+    QHidApi api;
+    QVERIFY(!api.setChangeFilter(1234));
+    quint32 id = api.open(pathOf(device));
+    QVERIFY(api.setChangeFilter(id));
+
+    push(device, report(1, "ab"));
+    push(device, report(1, "ab"));
+    push(device, report(2, "abcd"));
+    push(device, report(1, "ab"));
+    push(device, report(1, "ac"));
+    QCOMPARE(api.read(id, 100), report(1, "ab"));
+    QCOMPARE(api.read(id, 100), report(2, "abcd"));
+    QCOMPARE(api.read(id, 100), report(1, "ac"));
+    QVERIFY(api.read(id, 1).isEmpty());
+    QCOMPARE(api.deviceStats(id).reportsSuppressed(), quint64(2));
+
+    // only compare the first two of the four elements of report 2.
+    QHidReportDescriptor descriptor = api.reportDescriptor(id);
+    QList<QHidReportDescriptor::Field> fields = descriptor.fields(QHidReportDescriptor::Input, 2);
+    QCOMPARE(fields.size(), 1);
+    fields[0].count = 2;
+    QByteArray mask = descriptor.fieldMask(QHidReportDescriptor::Input, 2, fields);
+    QCOMPARE(mask, QByteArray("\x00\xff\xff\x00\x00", 5));
+    QVERIFY(api.setChangeFilter(id, 2, mask));
+
+    push(device, report(2, "abcd"));
+    push(device, report(2, "abxy"));
+    push(device, report(2, "azxy"));
+    QCOMPARE(api.read(id, 100), report(2, "abcd"));
+    QCOMPARE(api.read(id, 100), report(2, "azxy"));
+
+    api.clearChangeFilter(id);
+    push(device, report(1, "ac"));
+    push(device, report(1, "ac"));
+    QCOMPARE(api.read(id, 100), report(1, "ac"));
+    QCOMPARE(api.read(id, 100), report(1, "ac"));
+    QCOMPARE(api.deviceStats(id).reportsSuppressed(), quint64(3));
+}
+
+/*
+ * Walks the records of the first segment of the capture.
+ */
+void tst_QHidApi::capture() {
+    int device = addDevice(L"A1");
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString fileName = dir.path() + "/capture";
+
+    QHidApi api;
+    quint32 id = api.open(pathOf(device));
+    QVERIFY(!api.startCapture(1234, fileName));
+    QVERIFY(api.startCapture(id, fileName));
+    QVERIFY(!api.startCapture(id, fileName));
+
+    push(device, report(1, "ab"));
+    QCOMPARE(api.read(id, 100), report(1, "ab"));
+    QCOMPARE(api.write(id, QByteArray("xyz"), 3), 4);
+    api.stopCapture(id);
+
+    QFile file(fileName + QString::asprintf(HID_CAPTURE_SEGMENT_SUFFIX, 0ULL));
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QByteArray data = file.readAll();
+
+    const hid_capture_segment_header *header = reinterpret_cast<const hid_capture_segment_header*>(data.constData());
+    QVERIFY(data.size() >= int(sizeof(*header)));
+    QCOMPARE(QByteArray(header->magic, 8), QByteArray(HID_CAPTURE_MAGIC));
+    QCOMPARE(header->version, uint32_t(HID_CAPTURE_VERSION));
+
+    QList<int> types;
+    QList<QByteArray> payloads;
+    int offset = header->header_size;
+    while (offset + int(sizeof(hid_capture_record)) <= data.size()) {
+        const hid_capture_record *record = reinterpret_cast<const hid_capture_record*>(data.constData() + offset);
+        if (record->type == 0) {
+            break;
+        }
+        types.append(record->type);
+        payloads.append(data.mid(offset + int(sizeof(*record)), record->length));
+        offset += (int(sizeof(*record)) + record->length + HID_CAPTURE_ALIGNMENT - 1) & ~(HID_CAPTURE_ALIGNMENT - 1);
+    }
+
+    QCOMPARE(types, QList<int>() << HID_CAPTURE_DEVICE << HID_CAPTURE_INPUT << HID_CAPTURE_OUTPUT);
+    QCOMPARE(payloads.at(1), report(1, "ab"));
+    QCOMPARE(payloads.at(2), report(3, "xyz"));
+}
+
+void tst_QHidApi::replay() {
+    int device = addDevice(L"A1");
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString fileName = dir.path() + "/capture";
+
+    {
+        QHidApi api;
+        quint32 id = api.open(pathOf(device));
+        QVERIFY(api.startCapture(id, fileName));
+        for (char i = 0; i < 3; i++) {
+            if (i > 0) {
+                QThread::msleep(50);
+            }
+            push(device, report(1, QByteArray(2, 'a' + i)));
+            QCOMPARE(api.read(id, 100), report(1, QByteArray(2, 'a' + i)));
+        }
+        QCOMPARE(api.write(id, QByteArray("xyz"), 3), 4);
+    }
+
+    QHidApi api;
+    QCOMPARE(api.open("replay://" + dir.path() + "/missing"), quint32(0));
+
+    quint32 id = api.open("replay://" + fileName + "?speed=0&writes=validate");
+    QVERIFY(id != 0);
+    QCOMPARE(api.reportDescriptor(id).data(), QByteArray(reinterpret_cast<const char*>(DESCRIPTOR), sizeof(DESCRIPTOR)));
+    QCOMPARE(api.drain(id).count(), 3);
+    QVERIFY(api.read(id, 0).isEmpty());
+    QCOMPARE(api.write(id, QByteArray("xyw"), 3), -1);
+    QVERIFY(!api.error(id).isEmpty());
+    QCOMPARE(api.write(id, QByteArray("xyz"), 3), 4);
+    QCOMPARE(api.write(id, QByteArray("xyz"), 3), -1);
+    api.close(id);
+
+    // 100ms recorded, played twice as fast.
+    QElapsedTimer timer;
+    timer.start();
+    id = api.open("replay://" + fileName + "?speed=2");
+    QVERIFY(id != 0);
+    qint64 first = 0, last = 0;
+    QCOMPARE(api.read(id, 1000, &first), report(1, "aa"));
+    QCOMPARE(api.read(id, 1000), report(1, "bb"));
+    QCOMPARE(api.read(id, 1000, &last), report(1, "cc"));
+    QVERIFY(timer.elapsed() >= 45);
+    QVERIFY(last - first >= 45000000);
+    QVERIFY(api.read(id, 1000).isEmpty());
+    QCOMPARE(api.deviceStats(id).reportsRead(), quint64(3));
+}
+
+/*
+ * 256 KiB segments, so the reports span two segments of several index chunks. Report 2 is
+ * only sent at the start and the end, leaving the chunks in between without it for
+ * records() to skip.
+ */
+void tst_QHidApi::captureReader() {
+    int device = addDevice(L"A1");
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString fileName = dir.path() + "/capture";
+
+    const int count = 20000;
+    QList<QByteArray> sent2;
+    QVector<int> sent1;
+    {
+        QHidApi api;
+        quint32 id = api.open(pathOf(device));
+        QVERIFY(api.startCapture(id, fileName, 256 * 1024));
+        for (int i = 0; i < count; i++) {
+            bool second = (i % 4 == 3 && (i < 4000 || i >= 16000));
+            QByteArray r = (second ? report(2, QByteArray("wx") + char(i) + char(i >> 8))
+                                   : report(1, QByteArray(1, char(i)) + char(i >> 8)));
+            push(device, r);
+            QCOMPARE(api.read(id, 100), r);
+            if (second) {
+                sent2.append(r);
+            } else {
+                sent1.append(i);
+            }
+        }
+    }
+
+    // the index of the segments must hold chunks with and without report 2.
+    int segments = 0;
+    int chunks = 0;
+    int chunksWithout2 = 0;
+    for (;; segments++) {
+        QFile file(fileName + QString::asprintf(HID_CAPTURE_SEGMENT_SUFFIX, qulonglong(segments)));
+        if (!file.open(QIODevice::ReadOnly)) {
+            break;
+        }
+        QByteArray data = file.readAll();
+        const hid_capture_segment_header *header = reinterpret_cast<const hid_capture_segment_header*>(data.constData());
+        const hid_capture_index *index = reinterpret_cast<const hid_capture_index*>(data.constData() + header->index_offset);
+        const hid_capture_index_entry *entries = reinterpret_cast<const hid_capture_index_entry*>(index + 1);
+        for (uint32_t i = 0; i < index->count; i++) {
+            chunks++;
+            if (!(entries[i].report_ids[0] & (1 << 2))) {
+                chunksWithout2++;
+            }
+        }
+    }
+    QCOMPARE(segments, 2);
+    QVERIFY(chunks > 4);
+    QVERIFY(chunksWithout2 > 0);
+
+    QHidCaptureReader reader;
+    QVERIFY(!reader.open(dir.path() + "/missing"));
+    QVERIFY(reader.open(fileName));
+    QCOMPARE(reader.devices(), QList<int>() << 0);
+    QCOMPARE(reader.reportDescriptor(0).data(), QByteArray(reinterpret_cast<const char*>(DESCRIPTOR), sizeof(DESCRIPTOR)));
+    QCOMPARE(reader.devicePath(0), pathOf(device));
+
+    QList<QHidCaptureReader::Record> records = reader.records(reader.startTime(), reader.endTime());
+    QCOMPARE(records.size(), count);
+    QCOMPARE(records.last().timestamp, reader.endTime());
+
+    QList<QHidCaptureReader::Record> second = reader.records(reader.startTime(), reader.endTime(), 0, 2);
+    QCOMPARE(second.size(), sent2.size());
+    for (int i = 0; i < second.size(); i++) {
+        QCOMPARE(second.at(i).data, sent2.at(i));
+    }
+
+    QHidCaptureReader::Position position = reader.seek(records.at(600).timestamp);
+    QHidCaptureReader::Record record;
+    QVERIFY(reader.next(position, record));
+    QCOMPARE(record.timestamp, records.at(600).timestamp);
+
+    QVector<QHidCaptureReader::DecodedReport> reports = reader.decode(reader.startTime(), reader.endTime(), 0, 1, 4);
+    QCOMPARE(reports.size(), sent1.size());
+    for (int i = 0; i < reports.size(); i++) {
+        int n = sent1.at(i);
+        QCOMPARE(reports.at(i).reportId, quint8(1));
+        QCOMPARE(reports.at(i).values, QVector<qint64>() << (n & 0xFF) << ((n >> 8) & 0xFF));
+    }
+}
+
+/*
+ * The same reports captured raw and delta encoded read back the same, in a quarter of the space.
+ */
+void tst_QHidApi::deltaCapture() {
+    int device = addDevice(L"A1");
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QList<QByteArray> sent;
+    qint64 sizes[2];
+
+    for (int encoding = QHidApi::RawCapture; encoding <= QHidApi::DeltaCapture; encoding++) {
+        QString fileName = dir.path() + QString("/capture%1").arg(encoding);
+        {
+            QHidApi api;
+            quint32 id = api.open(pathOf(device));
+            QVERIFY(api.startCapture(id, fileName, 65536, 0, QHidApi::CaptureEncoding(encoding)));
+            for (int i = 0; i < 3000; i++) {
+                // runs of equal reports, and reports differing in a byte.
+                QByteArray r = (i % 5 == 4 ? report(2, "wxyz") : report(1, QByteArray(1, char(i / 10)) + char(i / 1000)));
+                push(device, r);
+                QCOMPARE(api.read(id, 100), r);
+                if (encoding == QHidApi::RawCapture) {
+                    sent.append(r);
+                }
+            }
+        }
+
+        sizes[encoding] = 0;
+        foreach (const QFileInfo &info, QDir(dir.path()).entryInfoList(QStringList() << QString("capture%1.*").arg(encoding))) {
+            sizes[encoding] += info.size();
+        }
+
+        QHidCaptureReader reader;
+        QVERIFY(reader.open(fileName));
+        QCOMPARE(reader.devicePath(0), pathOf(device));
+        QList<QHidCaptureReader::Record> records = reader.records(reader.startTime(), reader.endTime());
+        QCOMPARE(records.size(), sent.size());
+        for (int i = 0; i < records.size(); i++) {
+            QCOMPARE(records.at(i).data, sent.at(i));
+        }
+
+        QHidCaptureReader::Position position = reader.seek(records.at(2500).timestamp);
+        QHidCaptureReader::Record record;
+        QVERIFY(reader.next(position, record));
+        QCOMPARE(record.timestamp, records.at(2500).timestamp);
+        QCOMPARE(record.data, sent.at(2500));
+        QCOMPARE(reader.decode(reader.startTime(), reader.endTime(), 0, 2).size(), 600);
+    }
+
+    QVERIFY(sizes[QHidApi::DeltaCapture] * 4 < sizes[QHidApi::RawCapture]);
+}
+
+/*
+ * Generated reports carry their number after the report id.
+ */
+void tst_QHidApi::generatedReports() {
+    int device = addDevice(L"A1", 1000);
+
+    QHidDevice hid;
+    QVERIFY(hid.open(pathOf(device)));
+
+    char buf[8];
+    QCOMPARE(hid.read(buf, sizeof(buf), 1000), qint64(3));
+    QCOMPARE(buf[0], char(1));
+    uchar previous = uchar(buf[1]);
+
+    QCOMPARE(hid.read(buf, sizeof(buf), 1000), qint64(3));
+    QCOMPARE(uchar(buf[1]), uchar(previous + 1));
+}
+
+void tst_QHidApi::disconnect() {
+    int device = addDevice(L"A1", 1000, 5);
+
+    QHidDevice hid;
+    QVERIFY(hid.open(pathOf(device)));
+
+    char buf[8];
+    qint64 res;
+    int reports = 0;
+    while ((res = hid.read(buf, sizeof(buf), 1000)) > 0) {
+        reports++;
+    }
+
+    QCOMPARE(res, qint64(-1));
+    QVERIFY(reports <= 5);
+
+    QHidApi api;
+    QVERIFY(api.enumerate(VENDOR_ID, PRODUCT_ID).isEmpty());
+}
+
+QTEST_GUILESS_MAIN(tst_QHidApi)
+#include "tst_qhidapi.moc"
@@ -0,0 +1,9 @@
+CONFIG += testcase hidapi_virtual hidapi_trace
+TARGET = tst_qhidapitrace
+
+# The library sources are built in, against the virtual backend, with the tracepoints
+# compiled in.
+include(../../../../src/hidapi/hidapi.pri)
+QT += testlib
+
+SOURCES += tst_qhidapitrace.cpp
@@ -0,0 +1,124 @@
+/*
+Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include <QtTest/QtTest>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include "qhidapi.h"
+#include "hidapi_virtual.h"
+#include "hidapi_trace.h"
+
+/*
+ * Runs a read through the tracepoints, built with CONFIG += hidapi_trace, and checks the
+ * Chrome trace-event export.
+ */
+class tst_QHidApiTrace : public QObject {
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+
+    void exportChrome();
+};
+
+/*
+ * Report 1 has two bytes.
+ */
+static const unsigned char DESCRIPTOR[] = {
+    0x05, 0x01, 0x09, 0x04, 0xA1, 0x01,
+    0x85, 0x01, 0x75, 0x08, 0x95, 0x02, 0x81, 0x02,
+    0xC0
+};
+
+void tst_QHidApiTrace::init() {
+    hid_virtual_remove_all();
+    hid_trace_clear();
+}
+
+void tst_QHidApiTrace::cleanup() {
+    hid_trace_stop();
+    hid_trace_clear();
+    hid_virtual_remove_all();
+}
+
+void tst_QHidApiTrace::exportChrome() {
+    hid_virtual_device_config config;
+    memset(&config, 0, sizeof(config));
+    config.vendor_id = 0x1209;
+    config.product_id = 0x0001;
+    config.serial_number = L"T1";
+    config.manufacturer_string = L"Virtual";
+    config.product_string = L"Test Device";
+    config.report_descriptor = DESCRIPTOR;
+    config.report_descriptor_size = sizeof(DESCRIPTOR);
+    config.report_id = 1;
+    config.report_size = 3;
+    config.queue_limit = 16;
+    int device = hid_virtual_add_device(&config);
+    QVERIFY(device > 0);
+
+    QHidApi api;
+    quint32 id = api.open(QString(HID_VIRTUAL_PATH_PREFIX "%1").arg(device));
+    QVERIFY(id != 0);
+
+    QCOMPARE(hid_trace_start(), 0);
+
+    const uchar report[] = { 1, 'a', 'b' };
+    QCOMPARE(hid_virtual_push_report(device, report, sizeof(report)), 0);
+    QCOMPARE(api.read(id, 100), QByteArray("\x01" "ab"));
+
+    hid_trace_stop();
+    api.close(id);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString fileName = dir.path() + "/trace.json";
+    int written = hid_trace_export_chrome(QFile::encodeName(fileName).constData());
+    QVERIFY(written > 0);
+    QCOMPARE(hid_trace_dropped(), 0ULL);
+
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QJsonParseError error;
+    QJsonDocument document = QJsonDocument::fromJson(file.readAll(), &error);
+    QCOMPARE(error.error, QJsonParseError::NoError);
+
+    QJsonArray events = document.object().value("traceEvents").toArray();
+    QCOMPARE(events.size(), written);
+
+    // the begin and end events of hid_read must pair up, in order on each thread.
+    QHash<int, int> open;
+    int reads = 0;
+    for (const QJsonValue &value : events) {
+        QJsonObject event = value.toObject();
+        if (event.value("name").toString() != "hid_read") {
+            continue;
+        }
+
+        int tid = event.value("tid").toInt();
+        QString phase = event.value("ph").toString();
+        if (phase == "B") {
+            open[tid]++;
+        } else if (phase == "E") {
+            QVERIFY2(open.value(tid) > 0, "hid_read ended before it began");
+            open[tid]--;
+            reads++;
+        }
+    }
+
+    QVERIFY(reads > 0);
+    for (int depth : open) {
+        QCOMPARE(depth, 0);
+    }
+}
+
+QTEST_GUILESS_MAIN(tst_QHidApiTrace)
+#include "tst_qhidapitrace.moc"
@@ -1,2 +1,2 @@
 TEMPLATE = subdirs
-SUBDIRS += qhidapi
+SUBDIRS += qhidapi qhidapitrace
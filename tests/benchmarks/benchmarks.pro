@@ -0,0 +1,3 @@
+TEMPLATE = subdirs
+linux: SUBDIRS += enumerate uhid
+unix: SUBDIRS += qhidapi
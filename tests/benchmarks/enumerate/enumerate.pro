@@ -0,0 +1,15 @@
+CONFIG += benchmark
+QT = core testlib
+TARGET = tst_bench_enumerate
+
+# Built against the hidraw backend directly, whichever backend the library uses.
+HIDAPI_DIR = $$PWD/../../../src/hidapi
+INCLUDEPATH += $$HIDAPI_DIR
+
+SOURCES += \
+    tst_bench_enumerate.cpp \
+    $$HIDAPI_DIR/linux/hid.c \
+    $$HIDAPI_DIR/hidapi_capture.c \
+    $$HIDAPI_DIR/hidapi_change.c
+
+LIBS += -ludev
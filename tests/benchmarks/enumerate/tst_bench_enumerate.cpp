@@ -0,0 +1,78 @@
+/*
+Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include <QtTest/QtTest>
+
+#include "hidapi.h"
+
+/*
+ * Compares the libudev and the sysfs enumeration paths of the hidraw backend.
+ */
+class tst_bench_enumerate : public QObject {
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void enumerate_data();
+    void enumerate();
+    void sameDevices();
+
+private:
+    static int count(hid_device_info *devs);
+};
+
+void tst_bench_enumerate::initTestCase() {
+    QCOMPARE(hid_init(), 0);
+}
+
+void tst_bench_enumerate::cleanupTestCase() {
+    hid_exit();
+}
+
+void tst_bench_enumerate::enumerate_data() {
+    QTest::addColumn<uint>("flags");
+
+    QTest::newRow("udev") << uint(0);
+    QTest::newRow("udev, no strings") << uint(HID_ENUMERATE_NO_STRINGS);
+    QTest::newRow("sysfs") << uint(HID_ENUMERATE_SYSFS);
+    QTest::newRow("sysfs, no strings") << uint(HID_ENUMERATE_SYSFS | HID_ENUMERATE_NO_STRINGS);
+}
+
+void tst_bench_enumerate::enumerate() {
+    QFETCH(uint, flags);
+
+    QBENCHMARK {
+        hid_device_info *devs = hid_enumerate_ex(0x0, 0x0, flags);
+        hid_free_enumeration(devs);
+    }
+}
+
+/*
+ * Both paths must describe the same devices, or the comparison is meaningless.
+ */
+void tst_bench_enumerate::sameDevices() {
+    hid_device_info *udevDevs = hid_enumerate_ex(0x0, 0x0, 0);
+    hid_device_info *sysfsDevs = hid_enumerate_ex(0x0, 0x0, HID_ENUMERATE_SYSFS);
+
+    QCOMPARE(count(sysfsDevs), count(udevDevs));
+
+    hid_free_enumeration(udevDevs);
+    hid_free_enumeration(sysfsDevs);
+}
+
+int tst_bench_enumerate::count(hid_device_info *devs) {
+    int n = 0;
+    for (hid_device_info *info = devs; info != nullptr; info = info->next) {
+        n++;
+    }
+    return n;
+}
+
+QTEST_MAIN(tst_bench_enumerate)
+#include "tst_bench_enumerate.moc"
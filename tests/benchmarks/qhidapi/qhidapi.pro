@@ -0,0 +1,9 @@
+CONFIG += benchmark hidapi_virtual
+TARGET = tst_bench_qhidapi
+
+# The library sources are built in, against the virtual backend, so the numbers
+# only measure the Qt layer and do not depend on the hardware of the machine.
+include(../../../src/hidapi/hidapi.pri)
+QT += testlib
+
+SOURCES += tst_bench_qhidapi.cpp
@@ -0,0 +1,271 @@
+/*
+Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include <QtTest/QtTest>
+
+#include "qhidapi.h"
+#include "qhiddevice.h"
+#include "qhiddeviceinfomodel.h"
+#include "hidapi_virtual.h"
+
+/*
+ * The per-report and per-call costs of the Qt layer, against scripted devices from the
+ * virtual hidapi backend. Run with -callgrind for instruction counts which are stable
+ * across machines, and to see the allocations made per call.
+ */
+class tst_bench_qhidapi : public QObject {
+    Q_OBJECT
+
+private slots:
+    void cleanup();
+
+    void read_data();
+    void read();
+    void write_data();
+    void write();
+    void featureReport();
+    void findId_data();
+    void findId();
+    void enumerate_data();
+    void enumerate();
+    void modelUpdate_data();
+    void modelUpdate();
+    void readData_data();
+    void readData();
+    void writeData();
+
+private:
+    static int addDevices(int count, int reportSize=64);
+};
+
+static const ushort VENDOR_ID = 0x1209;
+static const ushort PRODUCT_ID = 0x0001;
+
+/*
+ * Adds count push-only devices and returns the id of the first, the others follow it.
+ */
+int tst_bench_qhidapi::addDevices(int count, int reportSize) {
+    int first = -1;
+
+    for (int i = 0; i < count; i++) {
+        QString serial = QString("SN%1").arg(i, 4, 10, QChar('0'));
+        std::wstring wserial = serial.toStdWString();
+
+        hid_virtual_device_config config;
+        memset(&config, 0, sizeof(config));
+        config.vendor_id = VENDOR_ID;
+        config.product_id = PRODUCT_ID;
+        config.serial_number = wserial.c_str();
+        config.manufacturer_string = L"Virtual";
+        config.product_string = L"Benchmark Device";
+        config.report_size = size_t(reportSize);
+
+        int id = hid_virtual_add_device(&config);
+        if (first < 0) {
+            first = id;
+        }
+    }
+
+    return first;
+}
+
+static QString pathOf(int id) {
+    return QString(HID_VIRTUAL_PATH_PREFIX "%1").arg(id);
+}
+
+void tst_bench_qhidapi::cleanup() {
+    hid_virtual_remove_all();
+}
+
+void tst_bench_qhidapi::read_data() {
+    QTest::addColumn<int>("reportSize");
+
+    QTest::newRow("8 bytes") << 8;
+    QTest::newRow("64 bytes") << 64;
+}
+
+/*
+ * One report delivered by the backend and read back through QHidApi::read().
+ */
+void tst_bench_qhidapi::read() {
+    QFETCH(int, reportSize);
+
+    int device = addDevices(1, reportSize);
+    QHidApi api;
+    quint32 id = api.open(pathOf(device));
+    QVERIFY(id != 0);
+
+    QByteArray report(reportSize, 0x55);
+    const uchar *data = reinterpret_cast<const uchar*>(report.constData());
+
+    QBENCHMARK {
+        hid_virtual_push_report(device, data, size_t(reportSize));
+        QByteArray result = api.read(id, 0);
+        Q_UNUSED(result);
+    }
+}
+
+void tst_bench_qhidapi::write_data() {
+    QTest::addColumn<int>("reportSize");
+
+    QTest::newRow("8 bytes") << 8;
+    QTest::newRow("64 bytes") << 64;
+}
+
+void tst_bench_qhidapi::write() {
+    QFETCH(int, reportSize);
+
+    int device = addDevices(1);
+    QHidApi api;
+    quint32 id = api.open(pathOf(device));
+    QByteArray report(reportSize, 0x55);
+
+    QBENCHMARK {
+        api.write(id, report, 0);
+    }
+}
+
+void tst_bench_qhidapi::featureReport() {
+    int device = addDevices(1);
+    QHidApi api;
+    quint32 id = api.open(pathOf(device));
+    QCOMPARE(api.sendFeatureReport(id, 1, QByteArray(32, 0x55)), 33);
+
+    QBENCHMARK {
+        QByteArray result = api.featureReport(id, 1);
+        Q_UNUSED(result);
+    }
+}
+
+void tst_bench_qhidapi::findId_data() {
+    QTest::addColumn<int>("openDevices");
+
+    QTest::newRow("1 device") << 1;
+    QTest::newRow("16 devices") << 16;
+    QTest::newRow("256 devices") << 256;
+}
+
+/*
+ * A read from an empty queue, which is little more than the id lookup.
+ */
+void tst_bench_qhidapi::findId() {
+    QFETCH(int, openDevices);
+
+    int first = addDevices(openDevices);
+    QHidApi api;
+    quint32 id = 0;
+    for (int i = 0; i < openDevices; i++) {
+        id = api.open(pathOf(first + i));
+        QVERIFY(id != 0);
+    }
+
+    QBENCHMARK {
+        QByteArray result = api.read(id, 0);
+        Q_UNUSED(result);
+    }
+}
+
+void tst_bench_qhidapi::enumerate_data() {
+    QTest::addColumn<int>("devices");
+    QTest::addColumn<int>("mode");
+
+    QTest::newRow("16 devices") << 16 << int(QHidApi::FullEnumeration);
+    QTest::newRow("16 devices, quick") << 16 << int(QHidApi::QuickEnumeration);
+    QTest::newRow("256 devices") << 256 << int(QHidApi::FullEnumeration);
+    QTest::newRow("256 devices, quick") << 256 << int(QHidApi::QuickEnumeration);
+}
+
+/*
+ * The backend enumeration is a walk of an in-memory list, so this is mostly the
+ * conversion of each record into a QHidDeviceInfo.
+ */
+void tst_bench_qhidapi::enumerate() {
+    QFETCH(int, devices);
+    QFETCH(int, mode);
+
+    addDevices(devices);
+    QHidApi api;
+
+    QBENCHMARK {
+        QList<QHidDeviceInfo> result = api.enumerate(VENDOR_ID, PRODUCT_ID, QHidApi::EnumerationMode(mode));
+        Q_UNUSED(result);
+    }
+}
+
+void tst_bench_qhidapi::modelUpdate_data() {
+    QTest::addColumn<int>("devices");
+
+    QTest::newRow("16 devices") << 16;
+    QTest::newRow("256 devices") << 256;
+}
+
+/*
+ * A new device list set on the model and every cell read back, as a view would.
+ */
+void tst_bench_qhidapi::modelUpdate() {
+    QFETCH(int, devices);
+
+    addDevices(devices);
+    QHidApi api;
+    QList<QHidDeviceInfo> list = api.enumerate(VENDOR_ID, PRODUCT_ID);
+    QHidDeviceInfoModel model;
+
+    QBENCHMARK {
+        model.setDataSet(list);
+        for (int row = 0; row < model.rowCount(); row++) {
+            for (int column = 0; column < model.columnCount(); column++) {
+                QVariant value = model.data(model.index(row, column));
+                Q_UNUSED(value);
+            }
+        }
+    }
+}
+
+void tst_bench_qhidapi::readData_data() {
+    QTest::addColumn<int>("reportSize");
+
+    QTest::newRow("8 bytes") << 8;
+    QTest::newRow("64 bytes") << 64;
+}
+
+/*
+ * One report read through QIODevice::read() and so QHidDevice::readData().
+ */
+void tst_bench_qhidapi::readData() {
+    QFETCH(int, reportSize);
+
+    int device = addDevices(1, reportSize);
+    QHidDevice hid;
+    QVERIFY(hid.open(pathOf(device)));
+    QVERIFY(hid.setNonBlocking());
+
+    QByteArray report(reportSize, 0x55);
+    const uchar *data = reinterpret_cast<const uchar*>(report.constData());
+    QIODevice *io = &hid;
+    char buf[64];
+
+    QBENCHMARK {
+        hid_virtual_push_report(device, data, size_t(reportSize));
+        io->read(buf, sizeof(buf));
+    }
+}
+
+void tst_bench_qhidapi::writeData() {
+    int device = addDevices(1);
+    QHidDevice hid;
+    QVERIFY(hid.open(pathOf(device)));
+    QByteArray report(65, 0x55);
+    report[0] = 0;
+
+    QBENCHMARK {
+        hid.write(report);
+    }
+}
+
+QTEST_GUILESS_MAIN(tst_bench_qhidapi)
+#include "tst_bench_qhidapi.moc"
@@ -0,0 +1,279 @@
+/*
+Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include <QtTest/QtTest>
+#include <QVector>
+
+#include <algorithm>
+#include <sys/resource.h>
+
+#include "qhidapi.h"
+#include "qhiddevice.h"
+#include "uhiddevice.h"
+
+/*
+ * End to end numbers for the hidraw backend, against devices emulated by the kernel through
+ * /dev/uhid, so the poll, read, write and feature report ioctl paths are the real ones. Needs
+ * read and write access to /dev/uhid, usually root, and is skipped otherwise.
+ */
+class tst_bench_uhid : public QObject {
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+
+    void stream_data();
+    void stream();
+    void write();
+    void featureReport();
+
+private:
+    enum Metric {
+        Throughput,
+        LatencyP50,
+        LatencyP99,
+        CpuPerReport,
+        Dropped
+    };
+
+    static qint64 percentile(const QVector<qint64> &sorted, int percent);
+
+    UhidDevice *mDevice;
+    QString mPath;
+};
+
+static const ushort VENDOR_ID = 0x1209;
+static const ushort PRODUCT_ID = 0x7701;
+
+static const quint8 INPUT_REPORT_ID = 1;
+static const quint8 OUTPUT_REPORT_ID = 2;
+static const quint8 FEATURE_REPORT_ID = 3;
+
+/*
+ * 64 byte reports including the report id: Input 1, Output 2 and Feature 3.
+ */
+static const uchar DESCRIPTOR[] = {
+    0x06, 0x00, 0xFF, 0x09, 0x01, 0xA1, 0x01,
+    0x15, 0x00, 0x26, 0xFF, 0x00, 0x75, 0x08, 0x95, 0x3F,
+    0x85, INPUT_REPORT_ID, 0x09, 0x01, 0x81, 0x02,
+    0x85, OUTPUT_REPORT_ID, 0x09, 0x01, 0x91, 0x02,
+    0x85, FEATURE_REPORT_ID, 0x09, 0x01, 0xB1, 0x02,
+    0xC0
+};
+
+static const int REPORT_SIZE = 64;
+
+/*
+ * How long, in milliseconds, to wait for the hidraw node of a new device to show up.
+ */
+static const int CREATE_TIMEOUT = 2000;
+
+/*
+ * How long, in milliseconds, stream() waits for a report while the device is still sending
+ * before giving up on the stream as stalled.
+ */
+static const int STALL_TIMEOUT = 1000;
+
+/*
+ * How long, in milliseconds, each read in stream() waits before checking whether the device
+ * has finished sending.
+ */
+static const int READ_TIMEOUT = 100;
+
+void tst_bench_uhid::init() {
+    mDevice = new UhidDevice(VENDOR_ID, PRODUCT_ID,
+                             QByteArray(reinterpret_cast<const char*>(DESCRIPTOR), sizeof(DESCRIPTOR)));
+
+    QByteArray feature(REPORT_SIZE, 0x33);
+    feature[0] = char(FEATURE_REPORT_ID);
+    mDevice->setFeatureReport(feature);
+
+    if (!mDevice->create()) {
+        delete mDevice;
+        mDevice = nullptr;
+        QSKIP("/dev/uhid is not accessible");
+    }
+
+    QHidApi api;
+    QElapsedTimer timer;
+    timer.start();
+    mPath.clear();
+    while (mPath.isEmpty() && timer.elapsed() < CREATE_TIMEOUT) {
+        QList<QHidDeviceInfo> devices = api.enumerate(VENDOR_ID, PRODUCT_ID, QHidApi::QuickEnumeration);
+        if (devices.isEmpty()) {
+            QTest::qWait(10);
+        } else {
+            mPath = devices.first().path;
+        }
+    }
+    QVERIFY2(!mPath.isEmpty(), "the hidraw node of the uhid device did not show up");
+}
+
+void tst_bench_uhid::cleanup() {
+    delete mDevice;
+    mDevice = nullptr;
+}
+
+qint64 tst_bench_uhid::percentile(const QVector<qint64> &sorted, int percent) {
+    int index = qMin(sorted.size() - 1, sorted.size() * percent / 100);
+    return sorted.at(index);
+}
+
+void tst_bench_uhid::stream_data() {
+    QTest::addColumn<int>("rate");
+    QTest::addColumn<int>("count");
+    QTest::addColumn<int>("metric");
+
+    struct {
+        const char *name;
+        int rate;
+        int count;
+    } streams[] = {
+        { "125 Hz", 125, 500 },
+        { "1 kHz", 1000, 4000 },
+        { "8 kHz", 8000, 20000 },
+        { "flat out", 0, 50000 }
+    };
+
+    struct {
+        const char *name;
+        Metric metric;
+    } metrics[] = {
+        { "throughput", Throughput },
+        { "latency p50", LatencyP50 },
+        { "latency p99", LatencyP99 },
+        { "cpu per report", CpuPerReport },
+        { "dropped", Dropped }
+    };
+
+    for (const auto &stream : streams) {
+        for (const auto &metric : metrics) {
+            QByteArray name = QByteArray(stream.name) + ' ' + metric.name;
+            QTest::newRow(name.constData()) << stream.rate << stream.count << int(metric.metric);
+        }
+    }
+}
+
+/*
+ * Reads a stream of Input reports through QHidDevice until the device has sent them all,
+ * and reports one metric of it per row:
+ *
+ * throughput, the reports read per second, after the first one.
+ * latency p50 and p99, in nanoseconds from the device sending a report to it being read.
+ * cpu per report, the CPU time of the reading thread per report read, in nanoseconds.
+ * dropped, the reports sent which were never read. hidraw keeps at most 64 reports for each
+ * open file and drops the oldest beyond that, so the faster streams lose some by design.
+ */
+void tst_bench_uhid::stream() {
+    QFETCH(int, rate);
+    QFETCH(int, count);
+    QFETCH(int, metric);
+
+    QHidDevice hid;
+    QVERIFY(hid.open(mPath));
+
+    QVector<qint64> latencies;
+    latencies.reserve(count);
+    uchar buf[REPORT_SIZE];
+
+    struct rusage before, after;
+    getrusage(RUSAGE_THREAD, &before);
+    QElapsedTimer timer;
+    QElapsedTimer stall;
+    qint64 elapsed = 0;
+
+    mDevice->startInput(INPUT_REPORT_ID, REPORT_SIZE, rate, count);
+    stall.start();
+
+    forever {
+        // once the device has finished, every report it sent is already queued, so drain
+        // them without waiting and stop at the first empty read.
+        bool finished = mDevice->inputFinished();
+        qint64 res = hid.read(reinterpret_cast<char*>(buf), sizeof(buf), finished ? 0 : READ_TIMEOUT);
+        if (res <= 0) {
+            if (finished) {
+                break;
+            }
+            QVERIFY2(stall.elapsed() < STALL_TIMEOUT, "the stream stalled");
+            continue;
+        }
+
+        if (latencies.isEmpty()) {
+            timer.start();
+        }
+        elapsed = timer.nsecsElapsed();
+        stall.restart();
+
+        quint64 sent = 0;
+        for (int b = 0; b < 8; b++) {
+            sent |= quint64(buf[1 + b]) << (8 * b);
+        }
+        latencies.append(hid.lastReportTimestamp() - qint64(sent));
+    }
+
+    getrusage(RUSAGE_THREAD, &after);
+    QVERIFY2(latencies.size() > 1, "too few reports were read");
+
+    qint64 cpu = (after.ru_utime.tv_sec - before.ru_utime.tv_sec + after.ru_stime.tv_sec - before.ru_stime.tv_sec) * 1000000LL
+            + (after.ru_utime.tv_usec - before.ru_utime.tv_usec) + (after.ru_stime.tv_usec - before.ru_stime.tv_usec);
+
+    std::sort(latencies.begin(), latencies.end());
+
+    switch (metric) {
+    case Throughput:
+        QTest::setBenchmarkResult((latencies.size() - 1) * 1e9 / qMax<qint64>(elapsed, 1), QTest::FramesPerSecond);
+        break;
+    case LatencyP50:
+        QTest::setBenchmarkResult(percentile(latencies, 50), QTest::WalltimeNanoseconds);
+        break;
+    case LatencyP99:
+        QTest::setBenchmarkResult(percentile(latencies, 99), QTest::WalltimeNanoseconds);
+        break;
+    case CpuPerReport:
+        // QTest has no CPU time metric, so the nanoseconds go out as wall time.
+        QTest::setBenchmarkResult(cpu * 1000.0 / latencies.size(), QTest::WalltimeNanoseconds);
+        break;
+    case Dropped:
+        QTest::setBenchmarkResult(mDevice->inputReports() - latencies.size(), QTest::Events);
+        break;
+    }
+}
+
+void tst_bench_uhid::write() {
+    QHidDevice hid;
+    QVERIFY(hid.open(mPath));
+
+    QByteArray report(REPORT_SIZE, 0x55);
+    report[0] = char(OUTPUT_REPORT_ID);
+
+    QBENCHMARK {
+        hid.write(report);
+    }
+
+    QVERIFY(mDevice->outputReports() > 0);
+}
+
+/*
+ * HIDIOCGFEATURE, answered by the uhid device thread.
+ */
+void tst_bench_uhid::featureReport() {
+    QHidApi api;
+    quint32 id = api.open(mPath);
+    QVERIFY(id != 0);
+
+    QCOMPARE(api.featureReport(id, FEATURE_REPORT_ID).size(), REPORT_SIZE);
+
+    QBENCHMARK {
+        QByteArray report = api.featureReport(id, FEATURE_REPORT_ID);
+        Q_UNUSED(report);
+    }
+}
+
+QTEST_GUILESS_MAIN(tst_bench_uhid)
+#include "tst_bench_uhid.moc"
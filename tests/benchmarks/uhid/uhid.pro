@@ -0,0 +1,13 @@
+CONFIG += benchmark
+TARGET = tst_bench_uhid
+
+# The library sources are built in, against the hidraw backend, which is what is measured.
+include(../../../src/hidapi/hidapi.pri)
+QT += testlib
+LIBS += -ludev
+
+HEADERS += uhiddevice.h
+
+SOURCES += \
+    tst_bench_uhid.cpp \
+    uhiddevice.cpp
@@ -0,0 +1,244 @@
+#include "uhiddevice.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/input.h>
+#include <linux/uhid.h>
+/*
+Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/*
+ * How often, in milliseconds, an idle device thread checks whether it has been asked to stop.
+ */
+static const int POLL_INTERVAL = 100;
+
+static quint64 monotonicNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return quint64(ts.tv_sec) * 1000000000ULL + quint64(ts.tv_nsec);
+}
+
+UhidDevice::UhidDevice(ushort vendorId, ushort productId, const QByteArray &descriptor) :
+    mVendorId(vendorId),
+    mProductId(productId),
+    mDescriptor(descriptor),
+    mFd(-1),
+    mReportId(0),
+    mReportSize(0),
+    mRate(0),
+    mCount(0),
+    mStop(0),
+    mStreaming(0),
+    mInputFinished(0),
+    mOutputReports(0),
+    mInputReports(0) {
+}
+
+UhidDevice::~UhidDevice() {
+    destroy();
+}
+
+/*
+ * Registers the device with the kernel. returns false if /dev/uhid can not be opened,
+ * usually because the process lacks the permission.
+ */
+bool UhidDevice::create() {
+    mFd = ::open("/dev/uhid", O_RDWR | O_CLOEXEC);
+    if (mFd < 0) {
+        return false;
+    }
+
+    struct uhid_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.type = UHID_CREATE2;
+    strcpy(reinterpret_cast<char*>(ev.u.create2.name), "qhidapi uhid benchmark");
+    ev.u.create2.rd_size = quint16(mDescriptor.size());
+    ev.u.create2.bus = BUS_USB;
+    ev.u.create2.vendor = mVendorId;
+    ev.u.create2.product = mProductId;
+    memcpy(ev.u.create2.rd_data, mDescriptor.constData(), size_t(mDescriptor.size()));
+
+    if (!writeEvent(&ev, sizeof(ev))) {
+        ::close(mFd);
+        mFd = -1;
+        return false;
+    }
+
+    mStop.storeRelease(0);
+    mStreaming.storeRelease(0);
+    mInputFinished.storeRelease(0);
+    start();
+    return true;
+}
+
+/*
+ * Stops the device thread and removes the device, which the kernel reports as unplugged.
+ */
+void UhidDevice::destroy() {
+    if (mFd < 0) {
+        return;
+    }
+
+    mStop.storeRelease(1);
+    wait();
+
+    struct uhid_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.type = UHID_DESTROY;
+    writeEvent(&ev, sizeof(ev));
+
+    ::close(mFd);
+    mFd = -1;
+}
+
+/*
+ * Starts sending count Input reports of reportSize bytes, including the report id, at rate
+ * reports per second, or as fast as the kernel takes them if rate is 0. The kernel drops
+ * reports no one has the hidraw node open for, so open it before calling this.
+ */
+void UhidDevice::startInput(quint8 reportId, int reportSize, int rate, int count) {
+    mReportId = reportId;
+    mReportSize = qBound(9, reportSize, int(UHID_DATA_MAX));
+    mRate = rate;
+    mCount = count;
+    mInputFinished.storeRelease(0);
+    mStreaming.storeRelease(1);
+}
+
+void UhidDevice::stop() {
+    mStop.storeRelease(1);
+}
+
+/*
+ * The report returned for every Get Feature Report request, including the report id. The
+ * device thread reads it without locking, so set it before create().
+ */
+void UhidDevice::setFeatureReport(const QByteArray &report) {
+    mFeatureReport = report;
+}
+
+int UhidDevice::outputReports() const {
+    return mOutputReports.loadAcquire();
+}
+
+int UhidDevice::inputReports() const {
+    return mInputReports.loadAcquire();
+}
+
+/*
+ * Whether all the Input reports asked for by startInput() have been handed to the kernel,
+ * which passes them on to the open hidraw nodes before the write returns.
+ */
+bool UhidDevice::inputFinished() const {
+    return mInputFinished.loadAcquire();
+}
+
+bool UhidDevice::writeEvent(const void *event, size_t size) {
+    return ::write(mFd, event, size) == ssize_t(size);
+}
+
+void UhidDevice::handleEvent() {
+    struct uhid_event ev;
+    memset(&ev, 0, sizeof(ev));
+    if (::read(mFd, &ev, sizeof(ev)) <= 0) {
+        return;
+    }
+
+    struct uhid_event reply;
+    memset(&reply, 0, sizeof(reply));
+
+    switch (ev.type) {
+    case UHID_OUTPUT:
+        mOutputReports.fetchAndAddRelaxed(1);
+        break;
+    case UHID_GET_REPORT:
+        reply.type = UHID_GET_REPORT_REPLY;
+        reply.u.get_report_reply.id = ev.u.get_report.id;
+        reply.u.get_report_reply.err = 0;
+        reply.u.get_report_reply.size = quint16(mFeatureReport.size());
+        memcpy(reply.u.get_report_reply.data, mFeatureReport.constData(), size_t(mFeatureReport.size()));
+        writeEvent(&reply, sizeof(reply));
+        break;
+    case UHID_SET_REPORT:
+        reply.type = UHID_SET_REPORT_REPLY;
+        reply.u.set_report_reply.id = ev.u.set_report.id;
+        reply.u.set_report_reply.err = 0;
+        writeEvent(&reply, sizeof(reply));
+        break;
+    default:
+        break;
+    }
+}
+
+void UhidDevice::sendInput() {
+    struct uhid_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.type = UHID_INPUT2;
+    ev.u.input2.size = quint16(mReportSize);
+    ev.u.input2.data[0] = mReportId;
+
+    quint64 now = monotonicNs();
+    for (int b = 0; b < 8; b++) {
+        ev.u.input2.data[1 + b] = quint8(now >> (8 * b));
+    }
+
+    if (writeEvent(&ev, sizeof(ev))) {
+        mInputReports.fetchAndAddRelaxed(1);
+    }
+}
+
+/*
+ * Serves the kernel requests and sends the Input reports when they are due.
+ */
+void UhidDevice::run() {
+    bool streaming = false;
+    quint64 interval = 0;
+    quint64 start = 0;
+    int sent = 0;
+
+    while (!mStop.loadAcquire()) {
+        int timeout = POLL_INTERVAL;
+        bool due = false;
+
+        if (!streaming && mStreaming.loadAcquire()) {
+            streaming = true;
+            interval = (mRate > 0 ? 1000000000ULL / quint64(mRate) : 0);
+            start = monotonicNs();
+        }
+
+        if (streaming && sent < mCount) {
+            quint64 next = start + quint64(sent) * interval;
+            quint64 now = monotonicNs();
+            if (now >= next) {
+                due = true;
+                timeout = 0;
+            } else {
+                timeout = int(qMin<quint64>((next - now) / 1000000, POLL_INTERVAL));
+            }
+        }
+
+        struct pollfd pfd;
+        pfd.fd = mFd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, timeout) > 0 && (pfd.revents & POLLIN)) {
+            handleEvent();
+        }
+
+        if (due) {
+            sendInput();
+            sent++;
+            if (sent == mCount) {
+                mInputFinished.storeRelease(1);
+            }
+        }
+    }
+}
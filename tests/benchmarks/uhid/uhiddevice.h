@@ -0,0 +1,71 @@
+#ifndef UHIDDEVICE_H
+#define UHIDDEVICE_H
+/*
+Copyright (C) [year] by Simon Meaden <[simonmeaden@virginmedia.com]>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include <QThread>
+#include <QByteArray>
+#include <QAtomicInt>
+
+/*
+ * A HID device emulated by the kernel through /dev/uhid, which shows up as a real hidraw node.
+ *
+ * Once started, the device thread answers the Get/Set Report requests of the kernel, counts the
+ * Output reports and sends Input reports at the configured rate. Every Input report carries the
+ * CLOCK_MONOTONIC time, in nanoseconds, at which it was handed to the kernel, little endian in the
+ * 8 bytes after the report id, so the reader can work out the latency of each report.
+ */
+class UhidDevice : public QThread {
+public:
+    UhidDevice(ushort vendorId, ushort productId, const QByteArray &descriptor);
+    ~UhidDevice();
+
+    bool create();
+    void destroy();
+
+    void startInput(quint8 reportId, int reportSize, int rate, int count);
+    void stop();
+
+    void setFeatureReport(const QByteArray &report);
+    int outputReports() const;
+    int inputReports() const;
+    bool inputFinished() const;
+
+protected:
+    void run();
+
+private:
+    bool writeEvent(const void *event, size_t size);
+    void handleEvent();
+    void sendInput();
+
+    ushort mVendorId;
+    ushort mProductId;
+    QByteArray mDescriptor;
+    int mFd;
+
+    quint8 mReportId;
+    int mReportSize;
+    int mRate;
+    int mCount;
+    QByteArray mFeatureReport;
+
+    QAtomicInt mStop;
+    /*
+     * set by startInput() once the report parameters above are in place.
+     */
+    QAtomicInt mStreaming;
+    /*
+     * set by the device thread once it has sent all the reports asked for.
+     */
+    QAtomicInt mInputFinished;
+    QAtomicInt mOutputReports;
+    QAtomicInt mInputReports;
+};
+
+#endif // UHIDDEVICE_H
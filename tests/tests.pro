@@ -1,2 +1,2 @@
 TEMPLATE = subdirs
-SUBDIRS += auto
\ No newline at end of file
+SUBDIRS += auto benchmarks